@@ -586,6 +586,8 @@ class read_callback : public multigroup_callback<read_result_entry>
 				write_ctl.id = kid.id();
 				write_ctl.io = *io;
 
+				io_buffer buffer(read_result.file());
+
 				write_ctl.data = read_result.file().data();
 				write_ctl.io.size = read_result.file().size();
 
@@ -593,7 +595,7 @@ class read_callback : public multigroup_callback<read_result_entry>
 				write_ctl.cmd = DNET_CMD_WRITE;
 				write_ctl.cflags = ctl.cflags;
 
-				new_sess.write_data(write_ctl);
+				new_sess.write_data(write_ctl, buffer.get());
 			}
 
 			cb.complete(error);
@@ -885,9 +887,14 @@ class write_callback
 	public:
 		typedef std::shared_ptr<write_callback> ptr;
 
-		write_callback(const session &sess, const async_write_result &result, const dnet_io_control &ctl):
-		sess(sess), cb(sess, result), ctl(ctl)
+		write_callback(const session &sess, const async_write_result &result, const dnet_io_control &ctl, dnet_io_buf *buf):
+		sess(sess), cb(sess, result), ctl(ctl), buf(buf ? dnet_io_buf_get(buf) : NULL)
+		{
+		}
+
+		~write_callback()
 		{
+			dnet_io_buf_put(buf);
 		}
 
 		bool start(error_info *error, complete_func func, void *priv)
@@ -909,7 +916,7 @@ class write_callback
 
 			cb.set_count(unlimited);
 
-			int err = dnet_write_object(sess.get_native(), &ctl);
+			int err = dnet_write_object_buf(sess.get_native(), &ctl, buf);
 			if (err < 0) {
 				*error = create_error(err, "Failed to write data");
 				return true;
@@ -931,6 +938,7 @@ class write_callback
 		session sess;
 		default_callback<write_result_entry> cb;
 		dnet_io_control ctl;
+		dnet_io_buf *buf;
 };
 
 class remove_callback
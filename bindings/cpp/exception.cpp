@@ -58,6 +58,11 @@ no_such_address_error::no_such_address_error(const std::string &message) throw()
 {
 }
 
+busy_error::busy_error(const std::string &message) throw()
+	: error(-EBUSY, message)
+{
+}
+
 void error_info::throw_error() const
 {
 	switch (m_code) {
@@ -73,6 +78,9 @@ void error_info::throw_error() const
 		case -ENXIO:
 			throw no_such_address_error(m_message);
 			break;
+		case -EBUSY:
+			throw busy_error(m_message);
+			break;
 		case 0:
 			// Do nothing, it's not an error
 			break;
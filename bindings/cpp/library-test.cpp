@@ -0,0 +1,1110 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Tests of library internals, they use library-private structures and functions.
+ * Client API is tested by test.cpp.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "test_base.hpp"
+#include "../../library/elliptics.h"
+
+using namespace ioremap::elliptics;
+using namespace boost::unit_test;
+
+namespace tests {
+
+struct conn_read_result {
+	std::atomic<dnet_net_state *> st;
+	std::atomic<bool> done;
+};
+
+static int conn_read_complete(dnet_net_state *st, dnet_cmd *cmd, void *priv)
+{
+	conn_read_result *res = reinterpret_cast<conn_read_result *>(priv);
+
+	if (st)
+		res->st = st;
+	if (is_trans_destroyed(st, cmd))
+		res->done = true;
+
+	return 0;
+}
+
+/*
+ * Connection READ is sent over is selected by the size in its io attribute, which follows route version prefix
+ * of versioned command: small read goes over route table connection, whole object read over additional one
+ */
+static void test_conn_select(int conn_num)
+{
+	logger log(NULL);
+	dnet_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 1;
+	cfg.net_conns = conn_num;
+
+	node client(log, cfg);
+	client.add_remote("localhost", 1025);
+
+	dnet_node *n = client.get_native();
+	dnet_set_net_conns_policy(n, DNET_NET_CONNS_POLICY_SIZE, 0);
+	dnet_id id;
+	memset(&id, 0, sizeof(id));
+	id.group_id = 1;
+
+	dnet_net_state *st = dnet_state_get_first(n, &id);
+	BOOST_REQUIRE(st != NULL);
+
+	/* additional connections are opened by reconnection thread */
+	for (int i = 0; i < 500 && st->conn_num < conn_num - 1; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	BOOST_REQUIRE_EQUAL(st->conn_num, conn_num - 1);
+	BOOST_REQUIRE_NE(st->route_version, 0U);
+
+	auto read = [&] (uint64_t size) -> dnet_net_state * {
+		conn_read_result res;
+		res.st = NULL;
+		res.done = false;
+
+		dnet_io_attr io;
+		memset(&io, 0, sizeof(io));
+		memcpy(io.id, id.id, DNET_ID_SIZE);
+		memcpy(io.parent, id.id, DNET_ID_SIZE);
+		io.size = size;
+
+		dnet_trans_control ctl;
+		memset(&ctl, 0, sizeof(ctl));
+		memcpy(&ctl.id, &id, sizeof(id));
+		ctl.cmd = DNET_CMD_READ;
+		ctl.cflags = DNET_FLAGS_NEED_ACK;
+		ctl.data = &io;
+		ctl.size = sizeof(io);
+		ctl.complete = conn_read_complete;
+		ctl.priv = &res;
+
+		BOOST_REQUIRE_EQUAL(dnet_trans_alloc_send_state(NULL, st, &ctl), 0);
+
+		for (int i = 0; i < 1000 && !res.done; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		BOOST_REQUIRE(res.done);
+
+		return res.st;
+	};
+
+	for (int i = 0; i < 10; ++i) {
+		BOOST_REQUIRE(read(100) == st);
+
+		dnet_net_state *conn = read(0);
+		BOOST_REQUIRE(std::find(st->conns, st->conns + st->conn_num, conn) != st->conns + st->conn_num);
+	}
+
+	/* reset additional connection is replaced by reconnection thread */
+	dnet_net_state *reset = st->conns[0];
+	dnet_state_reset(reset, -ECONNRESET);
+
+	for (int i = 0; i < 500 && __atomic_load_n(&st->conns[0], __ATOMIC_ACQUIRE) == reset; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	BOOST_REQUIRE(__atomic_load_n(&st->conns[0], __ATOMIC_ACQUIRE) != reset);
+
+	for (int i = 0; i < 10; ++i) {
+		dnet_net_state *conn = read(0);
+		BOOST_REQUIRE(std::find(st->conns, st->conns + st->conn_num, conn) != st->conns + st->conn_num);
+	}
+
+	dnet_state_put(st);
+}
+
+static bool route_read_all(int s, void *buf, size_t size)
+{
+	for (size_t off = 0; off < size; ) {
+		ssize_t err = read(s, (char *)buf + off, size - off);
+		if (err <= 0)
+			return false;
+		off += err;
+	}
+
+	return true;
+}
+
+/* fake node which acknowledges every command and counts those which are not route list requests */
+static void route_owner_process(int s, std::shared_ptr<std::atomic<int> > requests)
+{
+	std::vector<char> data;
+	dnet_cmd cmd;
+
+	while (route_read_all(s, &cmd, sizeof(cmd))) {
+		dnet_convert_cmd(&cmd);
+
+		data.resize(cmd.size);
+		if (cmd.size && !route_read_all(s, &data[0], cmd.size))
+			break;
+
+		if (cmd.trans & DNET_TRANS_REPLY)
+			continue;
+		if (cmd.cmd != DNET_CMD_ROUTE_LIST)
+			++*requests;
+
+		cmd.trans |= DNET_TRANS_REPLY;
+		cmd.flags = 0;
+		cmd.status = 0;
+		cmd.size = 0;
+		dnet_convert_cmd(&cmd);
+
+		if (write(s, &cmd, sizeof(cmd)) != sizeof(cmd))
+			break;
+	}
+
+	close(s);
+}
+
+static int route_redirect_handler(void *state, void *priv, dnet_cmd *cmd, void *data)
+{
+	(void) state;
+	(void) cmd;
+	(void) data;
+
+	++*reinterpret_cast<std::atomic<int> *>(priv);
+	return 0;
+}
+
+struct route_lookup_result {
+	std::atomic<int> done;
+	std::atomic<int> failed;
+};
+
+static int route_lookup_complete(dnet_net_state *st, dnet_cmd *cmd, void *priv)
+{
+	route_lookup_result *res = reinterpret_cast<route_lookup_result *>(priv);
+
+	if (is_trans_destroyed(st, cmd)) {
+		if (cmd && cmd->status)
+			++res->failed;
+		++res->done;
+	}
+
+	return 0;
+}
+
+/*
+ * Node, whose route table has changed since client received route list from it, replies to commands
+ * for keys it does not own with redirect carrying the changes, client applies them and resends commands
+ * to the owners itself. Node here is a bare node with a command handler, owners are fake nodes.
+ */
+static void test_route_redirect(int count)
+{
+	std::shared_ptr<std::atomic<int> > owner_requests = std::make_shared<std::atomic<int> >(0);
+	std::atomic<int> local_requests(0);
+	unsigned int seed = 1;
+	int err;
+
+	auto random_id = [&seed] (uint8_t *id) {
+		for (int k = 0; k < DNET_ID_SIZE; ++k)
+			id[k] = rand_r(&seed);
+	};
+
+	auto listen_socket = [] (uint32_t ip, sockaddr_in &sa) -> int {
+		socklen_t salen = sizeof(sa);
+		int s = socket(AF_INET, SOCK_STREAM, 0);
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(ip);
+
+		BOOST_REQUIRE(s >= 0);
+		BOOST_REQUIRE(!bind(s, (sockaddr *)&sa, sizeof(sa)) && !listen(s, 64) && !getsockname(s, (sockaddr *)&sa, &salen));
+		return s;
+	};
+
+	sockaddr_in owner_sa;
+	int owner_ls = listen_socket(INADDR_ANY, owner_sa);
+
+	std::thread acceptor([owner_ls, owner_requests] () {
+		for (int s; (s = accept(owner_ls, NULL, NULL)) >= 0; )
+			std::thread(route_owner_process, s, owner_requests).detach();
+	});
+
+	logger log(NULL);
+
+	dnet_backend_callbacks cb;
+	memset(&cb, 0, sizeof(cb));
+	cb.command_handler = route_redirect_handler;
+	cb.command_private = &local_requests;
+
+	dnet_config cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = log.get_native();
+	cfg.cb = &cb;
+	cfg.wait_timeout = 60;
+	cfg.check_timeout = 1000;
+
+	dnet_node *server = dnet_node_create(&cfg);
+	BOOST_REQUIRE(server != NULL);
+	BOOST_REQUIRE_EQUAL(dnet_locks_init(server, 1024), 0);
+	server->notify_hash_size = 16;
+	BOOST_REQUIRE_EQUAL(dnet_notify_init(server), 0);
+
+	/* entries of the route list carry addresses of the node */
+	server->addr_num = 1;
+	server->addrs = (dnet_addr *)calloc(1, sizeof(dnet_addr));
+
+	int owners = 0;
+	auto add_owner = [&] () {
+		sockaddr_in sa = owner_sa;
+		sa.sin_addr.s_addr = htonl(0x7f010000 | ++owners);
+
+		dnet_addr addr;
+		memset(&addr, 0, sizeof(addr));
+		memcpy(addr.addr, &sa, sizeof(sa));
+		addr.addr_len = sizeof(sa);
+		addr.family = AF_INET;
+
+		std::vector<dnet_raw_id> ids(100);
+		for (auto it = ids.begin(); it != ids.end(); ++it)
+			random_id(it->id);
+
+		int s = dnet_socket_create_addr(server, &addr, 0);
+		BOOST_REQUIRE(s >= 0);
+
+		dnet_net_state *st = dnet_state_create(server, 1, &ids[0], ids.size(), &addr, s, &err, 0, 0, dnet_state_net_process);
+		BOOST_REQUIRE(st != NULL);
+		dnet_copy_addrs(st, &addr, 1);
+	};
+
+	add_owner();
+
+	/* client connects to the node over loopback, node's own state has the ids client knows it by */
+	sockaddr_in server_sa;
+	int server_ls = listen_socket(INADDR_LOOPBACK, server_sa);
+
+	dnet_addr server_addr;
+	memset(&server_addr, 0, sizeof(server_addr));
+	memcpy(server_addr.addr, &server_sa, sizeof(server_sa));
+	server_addr.addr_len = sizeof(server_sa);
+	server_addr.family = AF_INET;
+
+	int cs = socket(AF_INET, SOCK_STREAM, 0);
+	BOOST_REQUIRE(!connect(cs, (sockaddr *)&server_sa, sizeof(server_sa)));
+	int ss = accept(server_ls, NULL, NULL);
+	BOOST_REQUIRE(ss >= 0);
+	close(server_ls);
+
+	dnet_set_sockopt(cs);
+	dnet_set_sockopt(ss);
+
+	BOOST_REQUIRE(dnet_state_create(server, 0, NULL, 0, &server_addr, ss, &err, 0, -1, dnet_state_net_process) != NULL);
+
+	std::vector<dnet_raw_id> server_ids(300);
+	for (auto it = server_ids.begin(); it != server_ids.end(); ++it)
+		random_id(it->id);
+
+	sockaddr_in self_sa = owner_sa;
+	self_sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int self_s = socket(AF_INET, SOCK_STREAM, 0);
+	BOOST_REQUIRE(!connect(self_s, (sockaddr *)&self_sa, sizeof(self_sa)));
+	dnet_set_sockopt(self_s);
+
+	server->st = dnet_state_create(server, 1, &server_ids[0], server_ids.size(), &server_addr, self_s, &err,
+			0, 0, dnet_state_net_process);
+	BOOST_REQUIRE(server->st != NULL);
+
+	dnet_node *client = dnet_node_create(&cfg);
+	BOOST_REQUIRE(client != NULL);
+
+	dnet_net_state *cst = dnet_state_create(client, 1, &server_ids[0], server_ids.size(), &server_addr, cs, &err,
+			0, 0, dnet_state_net_process);
+	BOOST_REQUIRE(cst != NULL);
+
+	BOOST_REQUIRE_EQUAL(dnet_recv_route_list(cst), 0);
+	BOOST_REQUIRE_EQUAL(cst->route_version, server->route_version);
+
+	/* client does not know about these owners */
+	for (int i = 0; i < 5; ++i)
+		add_owner();
+	BOOST_REQUIRE_LT(cst->route_version, server->route_version);
+
+	dnet_session *sess = dnet_session_create(client);
+	int group_id = 1;
+	dnet_session_set_groups(sess, &group_id, 1);
+
+	route_lookup_result res;
+	res.done = 0;
+	res.failed = 0;
+
+	int to_server = 0;
+	for (int i = 0; i < count; ++i) {
+		dnet_id id;
+		memset(&id, 0, sizeof(id));
+		random_id(id.id);
+		id.group_id = group_id;
+
+		dnet_net_state *st = dnet_state_get_first(client, &id);
+		if (st == cst)
+			++to_server;
+		dnet_state_put(st);
+
+		dnet_lookup_object(sess, &id, route_lookup_complete, &res);
+
+		for (int j = 0; j < 10000 && res.done <= i; ++j)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		BOOST_REQUIRE_EQUAL(res.done, i + 1);
+	}
+
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	memset(counters, 0, sizeof(counters));
+	dnet_node_get_counters(client, counters);
+
+	/* keys node does not own anymore are redirected, all others are sent to their owners right away */
+	BOOST_REQUIRE_EQUAL(res.failed, 0);
+	BOOST_REQUIRE_EQUAL(cst->route_version, server->route_version);
+	BOOST_REQUIRE_GE(counters[DNET_CNTR_NET_REDIRECTED].count, 1U);
+	BOOST_REQUIRE_EQUAL(local_requests + *owner_requests, count);
+	BOOST_REQUIRE_LT(local_requests, to_server);
+
+	dnet_session_destroy(sess);
+	dnet_node_destroy(client);
+	dnet_server_node_destroy(server);
+
+	shutdown(owner_ls, SHUT_RDWR);
+	close(owner_ls);
+	acceptor.join();
+}
+
+/*
+ * Shared oplocks of one key are held at once, exclusive one waits for all of them,
+ * and shared lockers which come while exclusive one waits queue behind it
+ */
+static void test_oplock_shared()
+{
+	logger log(NULL);
+	dnet_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.wait_timeout = 60;
+
+	node client(log, cfg);
+	dnet_node *n = client.get_native();
+	BOOST_REQUIRE_EQUAL(dnet_locks_init(n, 16), 0);
+
+	dnet_id id;
+	memset(&id, 0, sizeof(id));
+	memset(id.id, 0x5a, DNET_ID_SIZE);
+
+	auto wait_for = [] (std::atomic<int> &value, int expected) {
+		for (int i = 0; i < 5000 && value != expected; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		BOOST_REQUIRE_EQUAL(value, expected);
+	};
+
+	/* shared locker does not block other shared lockers, but keeps exclusive ones out */
+	dnet_oplock_shared(n, &id);
+
+	std::atomic<int> shared(0);
+	std::thread reader([n, &id, &shared] () {
+		dnet_oplock_shared(n, &id);
+		++shared;
+		dnet_opunlock(n, &id);
+	});
+	wait_for(shared, 1);
+	reader.join();
+
+	BOOST_REQUIRE_EQUAL(dnet_optrylock(n, &id), -EBUSY);
+
+	std::atomic<int> order(0), writer_pos(0), reader_pos(0);
+
+	std::thread writer([n, &id, &order, &writer_pos] () {
+		dnet_oplock(n, &id);
+		writer_pos = ++order;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		dnet_opunlock(n, &id);
+	});
+
+	/* writer is waiting for the shared lock to be released */
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	for (int i = 0; i < 5000; ++i) {
+		memset(counters, 0, sizeof(counters));
+		dnet_locks_stat_fill(n, counters);
+		if (counters[DNET_CNTR_OPLOCK_WAITERS].count)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	BOOST_REQUIRE_EQUAL(counters[DNET_CNTR_OPLOCK_WAITERS].count, 1U);
+	BOOST_REQUIRE_EQUAL(writer_pos, 0);
+
+	std::thread late_reader([n, &id, &order, &reader_pos] () {
+		dnet_oplock_shared(n, &id);
+		reader_pos = ++order;
+		dnet_opunlock(n, &id);
+	});
+
+	/* late reader queues behind the writer instead of joining the held shared lock */
+	for (int i = 0; i < 5000; ++i) {
+		memset(counters, 0, sizeof(counters));
+		dnet_locks_stat_fill(n, counters);
+		if (counters[DNET_CNTR_OPLOCK_WAITERS].count == 2)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	BOOST_REQUIRE_EQUAL(counters[DNET_CNTR_OPLOCK_WAITERS].count, 2U);
+	BOOST_REQUIRE_EQUAL(reader_pos, 0);
+
+	dnet_opunlock(n, &id);
+
+	writer.join();
+	late_reader.join();
+
+	BOOST_REQUIRE_EQUAL(writer_pos, 1);
+	BOOST_REQUIRE_EQUAL(reader_pos, 2);
+
+	/* nobody holds the key anymore */
+	BOOST_REQUIRE_EQUAL(dnet_optrylock(n, &id), 0);
+	dnet_opunlock(n, &id);
+
+	memset(counters, 0, sizeof(counters));
+	dnet_locks_stat_fill(n, counters);
+	BOOST_REQUIRE_EQUAL(counters[DNET_CNTR_OPLOCK_WAITERS].count, 0U);
+	BOOST_REQUIRE_GE(counters[DNET_CNTR_OPLOCK_WAITS].count, 2U);
+
+	dnet_locks_destroy(n);
+}
+
+/* words of objects in cache tests are key and generation of the write which has stored the object */
+static void cache_key_id(dnet_id *id, uint32_t key)
+{
+	memset(id, 0, sizeof(dnet_id));
+	for (size_t i = 0; i < DNET_ID_SIZE; i += sizeof(key))
+		memcpy(id->id + i, &key, sizeof(key));
+}
+
+static int cache_io(dnet_net_state *st, int command, uint32_t key, uint32_t gen, std::vector<uint64_t> &data,
+		uint64_t cflags = 0)
+{
+	dnet_cmd cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cache_key_id(&cmd.id, key);
+	cmd.cmd = command;
+	cmd.flags = cflags;
+
+	dnet_io_attr io;
+	memset(&io, 0, sizeof(io));
+	memcpy(io.id, cmd.id.id, DNET_ID_SIZE);
+	io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+
+	if (command == DNET_CMD_WRITE) {
+		for (size_t i = 0; i < data.size(); ++i)
+			data[i] = ((uint64_t)key << 32) | gen;
+		io.size = data.size() * sizeof(uint64_t);
+	}
+
+	/* readers hold shared oplock and writers exclusive one, like command processing does */
+	const bool lock = !(cflags & DNET_FLAGS_NOLOCK);
+	if (lock && command == DNET_CMD_WRITE)
+		dnet_oplock(st->n, &cmd.id);
+	else if (lock)
+		dnet_oplock_shared(st->n, &cmd.id);
+
+	int err = dnet_cmd_cache_io(st, &cmd, &io, command == DNET_CMD_WRITE ? (char *)&data[0] : NULL);
+	if (lock)
+		dnet_opunlock(st->n, &cmd.id);
+
+	return err;
+}
+
+/* client end of connection to the node, checks that every read reply carries whole object */
+struct cache_client {
+	cache_client(uint32_t keys, size_t size) : s(-1), size(size), received(0), corrupted(0), last(keys) {
+	}
+
+	int s;
+	size_t size;
+	std::atomic<int> received;
+	std::atomic<int> corrupted;
+	std::vector<std::atomic<uint32_t> > last;
+};
+
+static void cache_client_process(cache_client *c)
+{
+	std::vector<char> data;
+	dnet_cmd cmd;
+
+	while (route_read_all(c->s, &cmd, sizeof(cmd))) {
+		dnet_convert_cmd(&cmd);
+
+		data.resize(cmd.size);
+		if (cmd.size && !route_read_all(c->s, &data[0], cmd.size))
+			break;
+
+		if (cmd.cmd != DNET_CMD_READ)
+			continue;
+
+		dnet_io_attr *io = reinterpret_cast<dnet_io_attr *>(&data[0]);
+		const uint64_t *words = reinterpret_cast<const uint64_t *>(io + 1);
+		bool whole = cmd.size == sizeof(dnet_io_attr) + c->size;
+
+		uint32_t key = 0;
+		if (whole) {
+			dnet_convert_io_attr(io);
+			memcpy(&key, io->id, sizeof(key));
+			whole = key < c->last.size() && (words[0] >> 32) == key;
+		}
+
+		for (size_t i = 1; whole && i < c->size / sizeof(uint64_t); ++i)
+			whole = words[i] == words[0];
+
+		if (whole)
+			c->last[key] = (uint32_t)words[0];
+		else
+			++c->corrupted;
+
+		++c->received;
+	}
+}
+
+/* node gets connection over loopback, client end is returned in @client_socket */
+static dnet_net_state *cache_state_create(dnet_node *n, int *client_socket)
+{
+	sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int ls = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	BOOST_REQUIRE(ls >= 0);
+	BOOST_REQUIRE(!bind(ls, (sockaddr *)&sa, sizeof(sa)) && !listen(ls, 1) && !getsockname(ls, (sockaddr *)&sa, &salen));
+
+	*client_socket = socket(AF_INET, SOCK_STREAM, 0);
+	BOOST_REQUIRE(*client_socket >= 0);
+	BOOST_REQUIRE(!connect(*client_socket, (sockaddr *)&sa, sizeof(sa)));
+
+	int s = accept(ls, NULL, NULL);
+	close(ls);
+	BOOST_REQUIRE(s >= 0);
+
+	dnet_addr addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.family = AF_INET;
+
+	int err;
+	dnet_set_sockopt(s);
+	dnet_net_state *st = dnet_state_create(n, 0, NULL, 0, &addr, s, &err, 0, -1, dnet_state_net_process);
+	BOOST_REQUIRE(st != NULL);
+
+	return st;
+}
+
+/* node which serves cache commands on its own */
+static dnet_node *cache_node_init(node &client)
+{
+	dnet_node *n = client.get_native();
+
+	/* write replies carry address of the node */
+	n->addr_num = 1;
+	n->addrs = (dnet_addr *)calloc(1, sizeof(dnet_addr));
+	BOOST_REQUIRE(n->addrs != NULL);
+
+	BOOST_REQUIRE_EQUAL(dnet_locks_init(n, 1024), 0);
+	BOOST_REQUIRE_EQUAL(dnet_cache_init(n), 0);
+
+	return n;
+}
+
+static void cache_node_cleanup(dnet_node *n, cache_client &c, std::thread &client_thread)
+{
+	shutdown(c.s, SHUT_RDWR);
+	client_thread.join();
+	close(c.s);
+
+	dnet_cache_cleanup(n);
+	n->cache = NULL;
+	dnet_locks_destroy(n);
+
+	free(n->addrs);
+	n->addrs = NULL;
+	n->addr_num = 0;
+}
+
+/*
+ * Readers hit cache while writer overwrites objects and adds new ones which push old objects
+ * out of cache, half of readers do not take oplock. Readers must always get whole objects
+ * and see the last write of every object once writer is done.
+ */
+static void test_cache_concurrent(int thread_num, int count)
+{
+	const uint32_t keys = 1000;
+	const size_t size = 256;
+
+	logger log(NULL);
+	dnet_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.wait_timeout = 60;
+	cfg.cache_size = keys * size * 2;
+	cfg.cache_shards = 4;
+
+	node client(log, cfg);
+	dnet_node *n = cache_node_init(client);
+
+	cache_client c(keys, size);
+	dnet_net_state *st = cache_state_create(n, &c.s);
+	std::thread client_thread(cache_client_process, &c);
+
+	std::vector<uint64_t> data(size / sizeof(uint64_t));
+	std::vector<uint32_t> gens(keys, 1);
+
+	for (uint32_t key = 0; key < keys; ++key)
+		BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_WRITE, key, 1, data), 0);
+
+	std::atomic<int> sent(0), misses(0), errors(0), readers_done(0);
+
+	auto wait_received = [&c, &sent] () {
+		for (int i = 0; i < 10000 && c.received != sent; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		BOOST_REQUIRE_EQUAL(c.received, sent);
+	};
+
+	std::vector<std::thread> readers;
+	for (int t = 0; t < thread_num; ++t) {
+		readers.emplace_back([&, t] () {
+			const uint64_t cflags = (t & 1) ? DNET_FLAGS_NOLOCK : 0;
+			std::vector<uint64_t> unused;
+			unsigned int seed = t + 1;
+
+			for (int i = 0; i < count; ++i) {
+				while (sent - c.received > 256)
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+				if (cache_io(st, DNET_CMD_READ, rand_r(&seed) % keys, 0, unused, cflags))
+					++misses;
+				else
+					++sent;
+			}
+
+			++readers_done;
+		});
+	}
+
+	/* writer runs until readers are done, and writes at least as many new objects as cache holds */
+	uint32_t cold = keys;
+	std::thread writer([&] () {
+		std::vector<uint64_t> wdata(size / sizeof(uint64_t));
+		unsigned int seed = 77;
+
+		while (readers_done != thread_num || cold < keys * 3) {
+			uint32_t key = rand_r(&seed) % keys;
+
+			if (cache_io(st, DNET_CMD_WRITE, key, ++gens[key], wdata))
+				++errors;
+			if (cache_io(st, DNET_CMD_WRITE, cold++, 1, wdata))
+				++errors;
+		}
+	});
+
+	for (auto it = readers.begin(); it != readers.end(); ++it)
+		it->join();
+	writer.join();
+
+	wait_received();
+
+	BOOST_REQUIRE_EQUAL(errors, 0);
+	BOOST_REQUIRE_EQUAL(c.corrupted, 0);
+	BOOST_REQUIRE_GT(sent, 0);
+	BOOST_REQUIRE_EQUAL(sent + misses, thread_num * count);
+
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	memset(counters, 0, sizeof(counters));
+	dnet_cache_stat_fill(n, counters);
+	BOOST_REQUIRE_LE(counters[DNET_CNTR_CACHE_OBJECTS].count, 2ULL * keys);
+
+	/* objects which have just been written must be in cache, the rest may have been evicted */
+	for (uint32_t key = 0; key < 100; ++key)
+		BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_WRITE, key, ++gens[key], data), 0);
+
+	std::vector<bool> hits(keys);
+	for (uint32_t key = 0; key < keys; ++key) {
+		hits[key] = !cache_io(st, DNET_CMD_READ, key, 0, data);
+		if (hits[key])
+			++sent;
+	}
+
+	wait_received();
+	BOOST_REQUIRE_EQUAL(c.corrupted, 0);
+
+	for (uint32_t key = 0; key < keys; ++key) {
+		BOOST_REQUIRE(hits[key] || key >= 100);
+		if (hits[key])
+			BOOST_REQUIRE_EQUAL(c.last[key], gens[key]);
+	}
+
+	cache_node_cleanup(n, c, client_thread);
+}
+
+/*
+ * Cache hits are sent from cached payload itself, so writer which overwrites the object while replies
+ * are still in send queue must copy it instead of modifying payload in place. Client does not read
+ * replies until the object is overwritten, they must carry the object as it was read.
+ */
+static void test_cache_zero_copy(size_t size, int count)
+{
+	logger log(NULL);
+	dnet_config cfg;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.wait_timeout = 60;
+	cfg.cache_size = size * 4;
+	cfg.cache_shards = 1;
+
+	node client(log, cfg);
+	dnet_node *n = cache_node_init(client);
+
+	cache_client c(1, size);
+	dnet_net_state *st = cache_state_create(n, &c.s);
+
+	std::vector<uint64_t> data(size / sizeof(uint64_t));
+	BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_WRITE, 0, 1, data), 0);
+
+	/* replies do not fit into socket buffers and stay in send queue */
+	for (int i = 0; i < count; ++i)
+		BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_READ, 0, 0, data), 0);
+
+	BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_WRITE, 0, 2, data), 0);
+
+	std::thread client_thread(cache_client_process, &c);
+
+	auto wait_received = [&c] (int expected) {
+		for (int i = 0; i < 10000 && c.received != expected; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		BOOST_REQUIRE_EQUAL(c.received, expected);
+	};
+
+	wait_received(count);
+	BOOST_REQUIRE_EQUAL(c.corrupted, 0);
+	BOOST_REQUIRE_EQUAL(c.last[0], 1U);
+
+	/* once replies are sent, the next read gets the new object */
+	BOOST_REQUIRE_EQUAL(cache_io(st, DNET_CMD_READ, 0, 0, data), 0);
+
+	wait_received(count + 1);
+	BOOST_REQUIRE_EQUAL(c.corrupted, 0);
+	BOOST_REQUIRE_EQUAL(c.last[0], 2U);
+
+	cache_node_cleanup(n, c, client_thread);
+}
+
+/*
+ * Objects of the object cache must not be handed out twice, must keep their contents on realloc
+ * and may be freed by another thread than the one which has allocated them
+ */
+static void test_slab_alloc(int thread_num, int count)
+{
+	const size_t sizes[] = { 1, 100, 128, 129, 600, 4096, 8192, 8193, 100000 };
+	struct dnet_stat_count before[__DNET_CNTR_MAX], after[__DNET_CNTR_MAX];
+
+	memset(before, 0, sizeof(before));
+	dnet_slab_stat_fill(before);
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		std::vector<unsigned char *> ptrs;
+
+		for (int j = 0; j < count; ++j) {
+			unsigned char *ptr = (unsigned char *)dnet_slab_alloc(sizes[i]);
+			BOOST_REQUIRE(ptr != NULL);
+			memset(ptr, j, sizes[i]);
+			ptrs.push_back(ptr);
+		}
+
+		for (int j = 0; j < count; ++j) {
+			BOOST_REQUIRE_EQUAL(ptrs[j][0], (unsigned char)j);
+			BOOST_REQUIRE_EQUAL(ptrs[j][sizes[i] - 1], (unsigned char)j);
+			dnet_slab_free(ptrs[j]);
+		}
+	}
+
+	char *ptr = (char *)dnet_slab_alloc(100);
+	BOOST_REQUIRE(ptr != NULL);
+	strcpy(ptr, "slab-realloc");
+
+	ptr = (char *)dnet_slab_realloc(ptr, 5000);
+	BOOST_REQUIRE(ptr != NULL);
+	BOOST_REQUIRE_EQUAL(std::string(ptr), "slab-realloc");
+
+	ptr = (char *)dnet_slab_realloc(ptr, 100000);
+	BOOST_REQUIRE(ptr != NULL);
+	BOOST_REQUIRE_EQUAL(std::string(ptr), "slab-realloc");
+
+	ptr = (char *)dnet_slab_realloc(ptr, 200000);
+	BOOST_REQUIRE(ptr != NULL);
+	BOOST_REQUIRE_EQUAL(std::string(ptr), "slab-realloc");
+	dnet_slab_free(ptr);
+
+	/* every thread allocates objects which are freed by the main thread */
+	std::vector<std::vector<void *> > allocated(thread_num);
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < thread_num; ++i) {
+		threads.emplace_back([&allocated, count, i] () {
+			for (int j = 0; j < count; ++j) {
+				void *ptr = dnet_slab_alloc(256);
+				if (ptr)
+					memset(ptr, i, 256);
+				allocated[i].push_back(ptr);
+			}
+		});
+	}
+
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	std::set<void *> unique;
+	for (int i = 0; i < thread_num; ++i) {
+		for (auto it = allocated[i].begin(); it != allocated[i].end(); ++it) {
+			BOOST_REQUIRE(*it != NULL);
+			BOOST_REQUIRE_EQUAL(*(unsigned char *)*it, (unsigned char)i);
+			BOOST_REQUIRE(unique.insert(*it).second);
+			dnet_slab_free(*it);
+		}
+	}
+
+	memset(after, 0, sizeof(after));
+	dnet_slab_stat_fill(after);
+
+	BOOST_REQUIRE_GE(after[DNET_CNTR_SLAB_ALLOCS].count - before[DNET_CNTR_SLAB_ALLOCS].count,
+			(uint64_t)(sizeof(sizes) / sizeof(sizes[0]) + thread_num) * count);
+	BOOST_REQUIRE_GT(after[DNET_CNTR_SLAB_HITS].count, before[DNET_CNTR_SLAB_HITS].count);
+	BOOST_REQUIRE_GE(after[DNET_CNTR_SLAB_LARGE].count - before[DNET_CNTR_SLAB_LARGE].count, (uint64_t)2 * count);
+}
+
+/*
+ * Transactions must stay reachable in state's table after any sequence of removals,
+ * which shift the rest of probe runs back instead of leaving tombstones
+ */
+static void test_trans_table(int count)
+{
+	struct dnet_trans_table table;
+	std::vector<dnet_trans> trans(count);
+	std::vector<bool> inserted(count, false);
+	std::vector<int> order(count);
+
+	memset(&table, 0, sizeof(table));
+
+	auto check = [&] () {
+		for (int i = 0; i < count; ++i) {
+			dnet_trans *t = dnet_trans_search(&table, trans[i].trans);
+
+			if (!inserted[i]) {
+				BOOST_REQUIRE(t == NULL);
+				continue;
+			}
+
+			BOOST_REQUIRE(t == &trans[i]);
+			BOOST_REQUIRE_EQUAL(atomic_read(&t->refcnt), 2);
+			atomic_dec(&t->refcnt);
+		}
+	};
+
+	for (int i = 0; i < count; ++i) {
+		memset(&trans[i], 0, sizeof(dnet_trans));
+		INIT_LIST_HEAD(&trans[i].trans_list_entry);
+		atomic_init(&trans[i].refcnt, 1);
+
+		/* sequential numbers as well as numbers of other clients far away from them */
+		trans[i].trans = (i & 1) ? i : (uint64_t)i << 40 | rand();
+		order[i] = i;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		BOOST_REQUIRE_EQUAL(dnet_trans_insert_nolock(&table, &trans[i]), 0);
+		inserted[i] = true;
+	}
+
+	BOOST_REQUIRE_EQUAL(table.num, (unsigned int)count);
+	BOOST_REQUIRE_LE(table.num * 2, table.size);
+	BOOST_REQUIRE_EQUAL(dnet_trans_insert_nolock(&table, &trans[0]), -EEXIST);
+	check();
+
+	std::random_shuffle(order.begin(), order.end());
+
+	for (int i = 0; i < count - 1; ++i) {
+		dnet_trans_remove_nolock(&table, &trans[order[i]]);
+		inserted[order[i]] = false;
+		BOOST_REQUIRE(!trans[order[i]].trans_hashed);
+
+		if (i % 16 == 0 || count - i < 64)
+			check();
+	}
+
+	BOOST_REQUIRE_EQUAL(table.num, 1U);
+	check();
+
+	for (int i = 0; i < count / 2; ++i) {
+		BOOST_REQUIRE_EQUAL(dnet_trans_insert_nolock(&table, &trans[order[i]]), 0);
+		inserted[order[i]] = true;
+	}
+	check();
+
+	struct list_head head;
+	INIT_LIST_HEAD(&head);
+
+	BOOST_REQUIRE_EQUAL(dnet_trans_table_move_nolock(&table, &head), count / 2 + 1);
+	BOOST_REQUIRE_EQUAL(table.num, 0U);
+
+	int moved = 0;
+	for (struct list_head *pos = head.next; pos != &head; pos = pos->next) {
+		dnet_trans *t = (dnet_trans *)((char *)pos - offsetof(dnet_trans, trans_list_entry));
+		BOOST_REQUIRE(!t->trans_hashed);
+		++moved;
+	}
+	BOOST_REQUIRE_EQUAL(moved, count / 2 + 1);
+
+	std::fill(inserted.begin(), inserted.end(), false);
+	check();
+
+	dnet_trans_table_free(&table);
+}
+
+/*
+ * Timers must expire exactly at their ticks and cancelled ones must never expire,
+ * while the next tick when anything happens in the wheel only lands on occupied slots
+ */
+static void test_timer_wheel()
+{
+	const uint64_t offsets[] = { 0, 1, 63, 64, 65, 100, 1000, 4095, 4096, 5000, 300000, 20000000 };
+	const size_t num = sizeof(offsets) / sizeof(offsets[0]);
+
+	struct dnet_timer_waiter waiter;
+	struct dnet_timer_wheel wheel;
+
+	BOOST_REQUIRE_EQUAL(dnet_timer_waiter_init(&waiter), 0);
+	BOOST_REQUIRE_EQUAL(dnet_timer_wheel_init(&wheel, &waiter), 0);
+
+	const uint64_t base = wheel.now;
+
+	/* the first half of timers is armed, the second half is cancelled, the last one is re-armed */
+	std::vector<dnet_timer> timers(num * 2 + 1);
+	std::vector<uint64_t> expired(timers.size(), 0);
+
+	for (size_t i = 0; i < timers.size(); ++i) {
+		INIT_LIST_HEAD(&timers[i].entry);
+		timers[i].wheel = NULL;
+		dnet_timer_add(&wheel, &timers[i], base + offsets[i % num]);
+	}
+
+	for (size_t i = num; i < num * 2; ++i)
+		dnet_timer_del(&timers[i]);
+
+	dnet_timer_add(&wheel, &timers[num * 2], base + 2000);
+	BOOST_REQUIRE_EQUAL(wheel.num, (int)num + 1);
+
+	int steps = 0;
+	for (uint64_t next = dnet_timer_next(&wheel); next != (uint64_t)-1; next = dnet_timer_next(&wheel)) {
+		BOOST_REQUIRE_LT(++steps, 200);
+
+		pthread_mutex_lock(&wheel.lock);
+		for (struct dnet_timer *t; (t = dnet_timer_expire_nolock(&wheel, next)); ) {
+			BOOST_REQUIRE_EQUAL(expired[t - &timers[0]], 0U);
+			expired[t - &timers[0]] = next;
+		}
+		pthread_mutex_unlock(&wheel.lock);
+	}
+
+	for (size_t i = 0; i < num; ++i)
+		BOOST_REQUIRE_EQUAL(expired[i], base + offsets[i]);
+	for (size_t i = num; i < num * 2; ++i)
+		BOOST_REQUIRE_EQUAL(expired[i], 0U);
+	BOOST_REQUIRE_EQUAL(expired[num * 2], base + 2000);
+	BOOST_REQUIRE_EQUAL(wheel.num, 0);
+
+	/* wheel has been driven hours ahead, waiter needs one which follows real time */
+	dnet_timer_wheel_destroy(&wheel);
+	BOOST_REQUIRE_EQUAL(dnet_timer_wheel_init(&wheel, &waiter), 0);
+
+	/* waiter sleeps until the only timer expires, and wakes up when earlier timer is added */
+	dnet_timer far_timer, near_timer;
+	INIT_LIST_HEAD(&far_timer.entry);
+	far_timer.wheel = NULL;
+	INIT_LIST_HEAD(&near_timer.entry);
+	near_timer.wheel = NULL;
+
+	uint64_t start = dnet_timer_now();
+	dnet_timer_add(&wheel, &far_timer, start + 300);
+	dnet_timer_wait(&waiter, start + 10000);
+	BOOST_REQUIRE_GE(dnet_timer_now() - start, 250U);
+	BOOST_REQUIRE_LT(dnet_timer_now() - start, 2000U);
+
+	dnet_timer_del(&far_timer);
+	dnet_timer_add(&wheel, &far_timer, dnet_timer_now() + 60000);
+
+	std::thread adder([&wheel, &near_timer] () {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		dnet_timer_add(&wheel, &near_timer, dnet_timer_now());
+	});
+
+	start = dnet_timer_now();
+	dnet_timer_wait(&waiter, start + 10000);
+	adder.join();
+	BOOST_REQUIRE_LT(dnet_timer_now() - start, 2000U);
+
+	dnet_timer_del(&far_timer);
+	dnet_timer_del(&near_timer);
+
+	dnet_timer_wheel_destroy(&wheel);
+	dnet_timer_waiter_destroy(&waiter);
+}
+
+bool register_tests()
+{
+	srand(time(0));
+	/* additional connections are opened to these nodes */
+	configure_server_nodes();
+
+	ELLIPTICS_TEST_CASE(test_conn_select, 3);
+	ELLIPTICS_TEST_CASE(test_route_redirect, 500);
+	ELLIPTICS_TEST_CASE(test_slab_alloc, 8, 10000);
+	ELLIPTICS_TEST_CASE(test_trans_table, 5000);
+	ELLIPTICS_TEST_CASE(test_timer_wheel);
+	ELLIPTICS_TEST_CASE(test_oplock_shared);
+	ELLIPTICS_TEST_CASE(test_cache_concurrent, 8, 10000);
+	ELLIPTICS_TEST_CASE(test_cache_zero_copy, 8 * 1024 * 1024, 4);
+
+	return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	int result = unit_test_main(tests::register_tests, argc, argv);
+	tests::global_data.reset();
+	return result;
+}
@@ -586,6 +586,17 @@ long session::get_timeout(void) const
 	return tm->tv_sec;
 }
 
+void session::set_timeout_ms(unsigned int timeout)
+{
+	dnet_session_set_timeout_ms(m_data->session_ptr, timeout);
+}
+
+long session::get_timeout_ms(void) const
+{
+	struct timespec *tm = dnet_session_get_timeout(m_data->session_ptr);
+	return tm->tv_sec * 1000 + tm->tv_nsec / 1000000;
+}
+
 void session::set_trace_id(uint32_t trace_id)
 {
 	m_data->trace_id = trace_id;
@@ -839,9 +850,14 @@ async_read_result session::read_latest(const key &id, uint64_t offset, uint64_t
 }
 
 async_write_result session::write_data(const dnet_io_control &ctl)
+{
+	return write_data(ctl, NULL);
+}
+
+async_write_result session::write_data(const dnet_io_control &ctl, dnet_io_buf *buf)
 {
 	async_write_result result(*this);
-	auto cb = createCallback<write_callback>(*this, result, ctl);
+	auto cb = createCallback<write_callback>(*this, result, ctl, buf);
 
 	cb->ctl.cmd = DNET_CMD_WRITE;
 	cb->ctl.cflags |= DNET_FLAGS_NEED_ACK;
@@ -855,6 +871,7 @@ async_write_result session::write_data(const dnet_io_control &ctl)
 async_write_result session::write_data(const dnet_io_attr &io, const data_pointer &file)
 {
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
 
@@ -871,7 +888,7 @@ async_write_result session::write_data(const dnet_io_attr &io, const data_pointe
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 
@@ -881,6 +898,7 @@ async_write_result session::write_data(const key &id, const data_pointer &file,
 	dnet_id raw = id.id();
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -897,7 +915,7 @@ async_write_result session::write_data(const key &id, const data_pointer &file,
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 struct chunk_handler : public std::enable_shared_from_this<chunk_handler> {
@@ -1166,6 +1184,7 @@ async_write_result session::write_cas(const key &id, const data_pointer &file, c
 	dnet_id raw = id.id();
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -1184,7 +1203,7 @@ async_write_result session::write_cas(const key &id, const data_pointer &file, c
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 async_write_result session::write_prepare(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t psize)
@@ -1192,6 +1211,7 @@ async_write_result session::write_prepare(const key &id, const data_pointer &fil
 	transform(id);
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -1209,7 +1229,7 @@ async_write_result session::write_prepare(const key &id, const data_pointer &fil
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 async_write_result session::write_plain(const key &id, const data_pointer &file, uint64_t remote_offset)
@@ -1217,6 +1237,7 @@ async_write_result session::write_plain(const key &id, const data_pointer &file,
 	transform(id);
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -1235,7 +1256,7 @@ async_write_result session::write_plain(const key &id, const data_pointer &file,
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 async_write_result session::write_commit(const key &id, const data_pointer &file, uint64_t remote_offset, uint64_t csize)
@@ -1243,6 +1264,7 @@ async_write_result session::write_commit(const key &id, const data_pointer &file
 	transform(id);
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -1259,7 +1281,7 @@ async_write_result session::write_commit(const key &id, const data_pointer &file
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 async_write_result session::write_cache(const key &id, const data_pointer &file, long timeout)
@@ -1268,6 +1290,7 @@ async_write_result session::write_cache(const key &id, const data_pointer &file,
 	dnet_id raw = id.id();
 
 	struct dnet_io_control ctl;
+	io_buffer buffer(file);
 
 	memset(&ctl, 0, sizeof(ctl));
 	dnet_empty_time(&ctl.io.timestamp);
@@ -1284,7 +1307,7 @@ async_write_result session::write_cache(const key &id, const data_pointer &file,
 
 	ctl.fd = -1;
 
-	return write_data(ctl);
+	return write_data(ctl, buffer.get());
 }
 
 std::string session::lookup_address(const key &id, int group_id)
@@ -25,14 +25,10 @@
 #include <fstream>
 #include <set>
 #include <iostream>
+#include <thread>
+#include <atomic>
 
-#include <boost/filesystem.hpp>
-
-#define BOOST_TEST_DYN_LINK
-#include <boost/test/included/unit_test.hpp>
-
-#include "../../include/elliptics/cppdef.h"
-#include "../../example/common.h"
+#include "test_base.hpp"
 
 #include <algorithm>
 
@@ -41,380 +37,71 @@ using namespace boost::unit_test;
 
 namespace tests {
 
-#define ELLIPTICS_CHECK_IMPL(R, C, CMD) auto R = (C); \
-	R.wait(); \
-	{ \
-		auto base_message = BOOST_TEST_STRINGIZE(C); \
-		std::string message(base_message.begin(), base_message.end()); \
-		message += ", err: \""; \
-		message += R.error().message(); \
-		message += "\""; \
-		CMD(!R.error(), message); \
-	}
-
-#define ELLIPTICS_CHECK_ERROR_IMPL(R, C, E, CMD) auto R = (C); \
-	R.wait(); \
-	if (R.error().code() != (E)) { \
-		auto base_message = BOOST_TEST_STRINGIZE(C); \
-		std::stringstream out; \
-		out << std::string(base_message.begin(), base_message.end()) \
-			<< ", expected error: " << (E) << ", received: \"" << R.error().message() << "\""; \
-		CMD(false, out.str()); \
-	}
-
-#define ELLIPTICS_WARN(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_WARN_MESSAGE)
-#define ELLIPTICS_CHECK(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_CHECK_MESSAGE)
-#define ELLIPTICS_REQUIRE(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_REQUIRE_MESSAGE)
-
-#define ELLIPTICS_WARN_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_WARN_MESSAGE)
-#define ELLIPTICS_CHECK_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_CHECK_MESSAGE)
-#define ELLIPTICS_REQUIRE_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_REQUIRE_MESSAGE)
-
-#define ELLIPTICS_TEST_CASE(M, C...) do { framework::master_test_suite().add(BOOST_TEST_CASE(std::bind( M, ##C ))); } while (false)
-
-session create_session(node n, std::initializer_list<int> groups, uint64_t cflags, uint32_t ioflags)
+static void test_write(session &sess, const std::string &id, const std::string &data)
 {
-	session sess(n);
-
-	sess.set_groups(std::vector<int>(groups));
-	sess.set_cflags(cflags);
-	sess.set_ioflags(ioflags);
-
-	sess.set_exceptions_policy(session::no_exceptions);
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(id, data, 0));
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(id, 0, 0));
+	read_result_entry result = read_result.get_one();
 
-	return sess;
+	BOOST_REQUIRE_EQUAL(result.file().to_string(), data);
 }
 
-class directory_handler
+/*
+ * Data owned by data_pointer is referenced by send queue until it is sent, so caller may drop
+ * its pointer right after write_data() returns, borrowed data is copied and may be reused
+ */
+static void test_write_buffers(session &sess, const std::string &id, size_t size)
 {
-public:
-	directory_handler()
-	{
-	}
+	const std::string owned(size, 'a');
 
-	directory_handler(const std::string &path) : m_path(path)
-	{
-	}
+	ELLIPTICS_REQUIRE(owned_write_result, sess.write_data(id, data_pointer::copy(owned), 0));
+	ELLIPTICS_REQUIRE(owned_read_result, sess.read_data(id, 0, 0));
+	BOOST_REQUIRE(owned_read_result.get_one().file().to_string() == owned);
 
-	directory_handler(directory_handler &&other) : m_path(other.m_path)
-	{
-		other.m_path.clear();
-	}
-
-	directory_handler &operator= (directory_handler &&other)
-	{
-		std::swap(m_path, other.m_path);
-
-		return *this;
-	}
-
-	~directory_handler()
-	{
-		if (!m_path.empty())
-			boost::filesystem::remove_all(m_path);
-	}
-
-	directory_handler(const directory_handler &) = delete;
-	directory_handler &operator =(const directory_handler &) = delete;
+	std::string borrowed(size, 'b');
 
-private:
-	std::string m_path;
-};
+	async_write_result borrowed_write_result = sess.write_data(id, data_pointer::from_raw(borrowed), 0);
+	std::fill(borrowed.begin(), borrowed.end(), 'c');
+	borrowed_write_result.wait();
+	BOOST_REQUIRE_MESSAGE(!borrowed_write_result.error(), borrowed_write_result.error().message());
 
-void create_directory(const std::string &path)
-{
-	// Boost throws exception on fail
-	boost::filesystem::create_directory(path);
+	ELLIPTICS_REQUIRE(borrowed_read_result, sess.read_data(id, 0, 0));
+	BOOST_REQUIRE(borrowed_read_result.get_one().file().to_string() == std::string(size, 'b'));
 }
 
-enum dummy_value_type { DUMMY_VALUE };
-
-class config_data
-{
-public:
-	config_data()
-	{
-	}
-
-	config_data &operator() (const std::string &name, const std::string &value)
-	{
-		for (auto it = m_data.begin(); it != m_data.end(); ++it) {
-			if (it->first == name) {
-				it->second = value;
-				return *this;
-			}
-		}
-
-		m_data.emplace_back(name, value);
-
-		return *this;
-	}
-
-	config_data &operator() (const std::string &name, int value)
-	{
-		return (*this)(name, boost::lexical_cast<std::string>(value));
-	}
-
-	config_data &operator() (const std::string &name, dummy_value_type)
-	{
-		return (*this)(name, "dummy-value");
-	}
-
-protected:
-	std::vector<std::pair<std::string, std::string> >  m_data;
-};
-
-class config_data_writer : public config_data
+/*
+ * Servers send replies larger than net_slice_size in slices, small replies sent meanwhile
+ * must not be mixed into the large one, which is reassembled intact
+ */
+static void test_read_slices(session &sess, const std::string &id, size_t size, int small_count)
 {
-public:
-	config_data_writer() = delete;
-	config_data_writer &operator =(const config_data_writer &other) = delete;
+	std::string data(size, '\0');
+	for (size_t i = 0; i < size; ++i)
+		data[i] = i * 7 + 3;
 
-	config_data_writer(const config_data_writer &other)
-		: config_data(other), m_path(other.m_path)
-	{
-	}
-	config_data_writer(const config_data &other, const std::string &path)
-		: config_data(other), m_path(path)
-	{
-	}
-
-	~config_data_writer()
-	{
-		write();
-	}
+	const std::string small_id = id + "-small";
+	const std::string small_data = "small-data";
 
-	template <typename T>
-	config_data_writer &operator() (const std::string &name, const T &value)
-	{
-		config_data::operator ()(name, value);
-
-		return *this;
-	}
-
-	dnet_node *run()
-	{
-		dnet_node *node = dnet_parse_config(m_path.c_str(), 0);
-		if (!node)
-			throw std::runtime_error("Can not start server with config file: \"" + m_path + "\"");
-
-		return node;
-	}
-
-	void write()
-	{
-		std::ofstream out;
-		out.open(m_path.c_str());
+	ELLIPTICS_REQUIRE(write_result, sess.write_data(id, data, 0));
+	ELLIPTICS_REQUIRE(small_write_result, sess.write_data(small_id, small_data, 0));
 
-		if (!out) {
-			throw std::runtime_error("Can not open file \"" + m_path + "\" for writing");
-		}
+	for (int iteration = 0; iteration < 10; ++iteration) {
+		async_read_result read_result = sess.read_data(id, 0, 0);
 
-		for (auto it = m_data.begin(); it != m_data.end(); ++it) {
-			if (it->second == "dummy-value")
-				throw std::runtime_error("Unset value for key \"" + it->first + "\", file: \"" + m_path + "\"");
+		std::vector<async_read_result> small_results;
+		for (int i = 0; i < small_count; ++i)
+			small_results.emplace_back(sess.read_data(small_id, 0, 0));
 
-			out << it->first << " = " << it->second << std::endl;
+		for (auto it = small_results.begin(); it != small_results.end(); ++it) {
+			it->wait();
+			BOOST_REQUIRE_MESSAGE(!it->error(), it->error().message());
+			BOOST_REQUIRE_EQUAL(it->get_one().file().to_string(), small_data);
 		}
 
-		out.flush();
-		out.close();
-	}
-private:
-
-	std::string m_path;
-};
-
-class server_node
-{
-public:
-	server_node() : m_node(NULL)
-	{
-	}
-
-	server_node(const std::string &path) : m_node(NULL), m_path(path)
-	{
-	}
-
-	server_node(server_node &&other) : m_node(other.m_node), m_path(other.m_path)
-	{
-		other.m_node = NULL;
-		other.m_path.clear();
-	}
-
-	server_node &operator =(server_node &&other)
-	{
-		std::swap(m_node, other.m_node);
-		std::swap(m_path, other.m_path);
-
-		return *this;
-	}
-
-	server_node(const server_node &other) = delete;
-	server_node &operator =(const server_node &other) = delete;
-
-	~server_node()
-	{
-		if (m_node)
-			stop();
-	}
-
-	void start()
-	{
-		if (m_node)
-			throw std::runtime_error("Server node \"" + m_path + "\" is already started");
-
-		m_node = dnet_parse_config(m_path.c_str(), 0);
-		if (!m_node)
-			throw std::runtime_error("Can not start server with config file: \"" + m_path + "\"");
-	}
-
-	void stop()
-	{
-		if (!m_node)
-			throw std::runtime_error("Server node \"" + m_path + "\" is already stoped");
-
-		dnet_set_need_exit(m_node);
-		while (!dnet_need_exit(m_node))
-			sleep(1);
-
-		dnet_server_node_destroy(m_node);
-		m_node = NULL;
-	}
-
-private:
-	dnet_node *m_node;
-	std::string m_path;
-};
-
-struct tests_data
-{
-	~tests_data()
-	{
-		nodes.clear();
+		read_result.wait();
+		BOOST_REQUIRE_MESSAGE(!read_result.error(), read_result.error().message());
+		BOOST_REQUIRE(read_result.get_one().file().to_string() == data);
 	}
-
-	std::vector<server_node> nodes;
-	directory_handler directory;
-};
-
-static std::shared_ptr<tests_data> global_data;
-
-static config_data_writer create_config(config_data base_config, const std::string &path)
-{
-	return config_data_writer(base_config, path);
-}
-
-static void configure_server_nodes()
-{
-	std::string base_path;
-	std::string auth_cookie;
-
-	{
-		char buffer[1024];
-
-		snprintf(buffer, sizeof(buffer), "/tmp/elliptics-test-%04x/", rand());
-		buffer[sizeof(buffer) - 1] = 0;
-		base_path = buffer;
-
-		snprintf(buffer, sizeof(buffer), "%04x%04x", rand(), rand());
-		buffer[sizeof(buffer) - 1] = 0;
-		auth_cookie = buffer;
-	}
-
-	create_directory(base_path);
-
-	directory_handler guard(base_path);
-
-	results_reporter::get_stream() << "Set base directory: \"" << base_path << "\"" << std::endl;
-	results_reporter::get_stream() << "Starting up servers" << std::endl;
-
-	const std::string first_server_path = base_path + "/server-1";
-	const std::string second_server_path = base_path + "/server-2";
-
-	create_directory(first_server_path);
-	create_directory(first_server_path + "/blob");
-	create_directory(first_server_path + "/history");
-	create_directory(second_server_path);
-	create_directory(second_server_path + "/blob");
-	create_directory(second_server_path + "/history");
-
-	config_data ioserv_config;
-
-	ioserv_config("log", "/dev/stderr")
-			("log_level", DNET_LOG_INFO)
-			("join", 1)
-			("flags", 4)
-			("group", DUMMY_VALUE)
-			("addr", DUMMY_VALUE)
-			("remote", DUMMY_VALUE)
-			("wait_timeout", 60)
-			("check_timeout", 60)
-			("io_thread_num", 50)
-			("nonblocking_io_thread_num", 16)
-			("net_thread_num", 16)
-			("history", DUMMY_VALUE)
-			("daemon", 0)
-			("auth_cookie", auth_cookie)
-			("bg_ionice_class", 3)
-			("bg_ionice_prio", 0)
-			("server_net_prio", 1)
-			("client_net_prio", 6)
-			("cache_size", 1024 * 1024 * 256)
-			("backend", "blob")
-			("sync", 5)
-			("data", DUMMY_VALUE)
-			("data_block_size", 1024)
-			("blob_flags", 6)
-			("iterate_thread_num", 1)
-			("blob_size", "10M")
-			("records_in_blob", 10000000)
-			("defrag_timeout", 3600)
-			("defrag_percentage", 25)
-			;
-
-	create_config(ioserv_config, first_server_path + "/ioserv.conf")
-			("log", first_server_path + "/log.log")
-			("group", 1)
-			("addr", "localhost:1025:2")
-			("remote", "localhost:1026:2")
-			("history", first_server_path + "/history")
-			("data", first_server_path + "/blob/data")
-			;
-
-	server_node first_server(first_server_path + "/ioserv.conf");
-
-	first_server.start();
-	results_reporter::get_stream() << "First server started" << std::endl;
-
-	create_config(ioserv_config, second_server_path + "/ioserv.conf")
-			("log", second_server_path + "/log.log")
-			("group", 2)
-			("addr", "localhost:1026:2")
-			("remote", "localhost:1025:2")
-			("history", second_server_path + "/history")
-			("data", second_server_path + "/blob/data")
-			;
-
-	server_node second_server(second_server_path + "/ioserv.conf");
-
-	second_server.start();
-	results_reporter::get_stream() << "Second server started" << std::endl;
-
-	global_data = std::make_shared<tests_data>();
-
-	global_data->directory = std::move(guard);
-	global_data->nodes.emplace_back(std::move(first_server));
-	global_data->nodes.emplace_back(std::move(second_server));
-}
-
-static void test_write(session &sess, const std::string &id, const std::string &data)
-{
-	ELLIPTICS_REQUIRE(write_result, sess.write_data(id, data, 0));
-	ELLIPTICS_REQUIRE(read_result, sess.read_data(id, 0, 0));
-	read_result_entry result = read_result.get_one();
-
-	BOOST_REQUIRE_EQUAL(result.file().to_string(), data);
 }
 
 static void test_recovery(session &sess, const std::string &id, const std::string &data)
@@ -1112,6 +799,119 @@ static void test_prepare_latest(session &sess, const std::string &id)
 	BOOST_REQUIRE_EQUAL(lookup_result.size(), 2);
 }
 
+/*
+ * Route lookups from many threads, they must all succeed while reading route table without locks
+ */
+static void test_lookup_address(session &sess, int thread_num, int count)
+{
+	const int group_id = sess.get_groups().front();
+	std::vector<std::thread> threads;
+	std::atomic<int> failed(0);
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+
+	for (int i = 0; i < thread_num; ++i) {
+		threads.emplace_back([&sess, &failed, group_id, count, i] () {
+			session thread_sess = sess.clone();
+			unsigned int seed = i;
+			dnet_id id;
+
+			memset(&id, 0, sizeof(id));
+
+			for (int j = 0; j < count; ++j) {
+				for (int k = 0; k < DNET_ID_SIZE; ++k)
+					id.id[k] = rand_r(&seed);
+
+				try {
+					thread_sess.lookup_address(id, group_id);
+				} catch (std::exception &) {
+					++failed;
+				}
+			}
+		});
+	}
+
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	gettimeofday(&end, NULL);
+
+	BOOST_REQUIRE_EQUAL(failed, 0);
+
+	long diff = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+	BOOST_TEST_MESSAGE("lookup_address: threads: " << thread_num << ", lookups: " << thread_num * count
+			<< ", " << (diff ? thread_num * count * 1000000LL / diff : 0) << " lookups/s");
+}
+
+/*
+ * Route lookups must find the same node as plain search over sorted route ids does,
+ * both for random keys and for keys right next to route ids
+ */
+static void test_lookup_routes(session &sess, int count)
+{
+	typedef std::pair<dnet_raw_id, std::string> route_entry;
+
+	const int group_id = sess.get_groups().front();
+	std::vector<std::pair<dnet_id, dnet_addr> > all_routes = sess.get_routes();
+	std::vector<route_entry> routes;
+
+	for (auto it = all_routes.begin(); it != all_routes.end(); ++it) {
+		if (it->first.group_id != (uint32_t)group_id)
+			continue;
+
+		dnet_raw_id raw;
+		memcpy(raw.id, it->first.id, DNET_ID_SIZE);
+		routes.push_back(route_entry(raw, dnet_server_convert_dnet_addr(&it->second)));
+	}
+
+	BOOST_REQUIRE(!routes.empty());
+
+	auto compare = [] (const route_entry &e1, const route_entry &e2) {
+		return dnet_id_cmp_str(e1.first.id, e2.first.id) < 0;
+	};
+	std::sort(routes.begin(), routes.end(), compare);
+
+	auto check = [&] (dnet_raw_id &raw) {
+		/* the last route id which is not greater than the key, or the last one if all of them are */
+		auto it = std::upper_bound(routes.begin(), routes.end(), route_entry(raw, std::string()), compare);
+		if (it == routes.begin())
+			it = routes.end();
+		--it;
+
+		dnet_id id;
+		dnet_setup_id(&id, group_id, raw.id);
+		BOOST_REQUIRE_EQUAL(sess.lookup_address(id, group_id), it->second);
+	};
+
+	dnet_raw_id raw;
+
+	memset(raw.id, 0, DNET_ID_SIZE);
+	check(raw);
+	memset(raw.id, 0xff, DNET_ID_SIZE);
+	check(raw);
+
+	for (int i = 0; i < count; ++i) {
+		for (int k = 0; k < DNET_ID_SIZE; ++k)
+			raw.id[k] = rand();
+		check(raw);
+	}
+
+	for (auto it = routes.begin(); it != routes.end(); ++it) {
+		raw = it->first;
+		check(raw);
+
+		for (int k = DNET_ID_SIZE - 1; k >= 0 && raw.id[k]-- == 0; --k)
+			;
+		check(raw);
+
+		raw = it->first;
+		for (int k = DNET_ID_SIZE - 1; k >= 0 && ++raw.id[k] == 0; --k)
+			;
+		check(raw);
+	}
+}
+
 bool register_tests()
 {
 	srand(time(0));
@@ -1133,6 +933,10 @@ bool register_tests()
 	ELLIPTICS_TEST_CASE(test_write, create_session(n, {1, 2}, 0, 0), "new-id-real", "short");
 	ELLIPTICS_TEST_CASE(test_remove, create_session(n, {1, 2}, 0, 0), "new-id-real");
 	ELLIPTICS_TEST_CASE(test_recovery, create_session(n, {1, 2}, 0, 0), "recovery-id", "recovered-data");
+	ELLIPTICS_TEST_CASE(test_write_buffers, create_session(n, {1, 2}, 0, 0), "write-buffers-id", 100);
+	ELLIPTICS_TEST_CASE(test_write_buffers, create_session(n, {1, 2}, 0, 0), "write-buffers-id", 4 * 1024 * 1024);
+	ELLIPTICS_TEST_CASE(test_read_slices, create_session(n, {1, 2}, 0, 0), "read-slices-id", 4 * 1024 * 1024, 100);
+	ELLIPTICS_TEST_CASE(test_read_slices, create_session(n, {1, 2}, 0, DNET_IO_FLAGS_CACHE), "read-slices-cache-id", 4 * 1024 * 1024, 100);
 	ELLIPTICS_TEST_CASE(test_indexes, create_session(n, {1, 2}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_error, create_session(n, {99}, 0, 0), "non-existen-key", -ENXIO);
 	ELLIPTICS_TEST_CASE(test_cache_write, create_session(n, { 1, 2 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY), 1000);
@@ -1159,6 +963,10 @@ bool register_tests()
 	ELLIPTICS_TEST_CASE(test_partial_bulk_read, create_session(n, {1, 2, 3}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_indexes_update, create_session(n, {2}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_prepare_latest, create_session(n, {1, 2}, 0, 0), "prepare-latest-key");
+	ELLIPTICS_TEST_CASE(test_lookup_routes, create_session(n, {1, 2}, 0, 0), 10000);
+	ELLIPTICS_TEST_CASE(test_lookup_routes, create_session(n, {2}, 0, 0), 10000);
+	ELLIPTICS_TEST_CASE(test_lookup_address, create_session(n, {1, 2}, 0, 0), 1, 100000);
+	ELLIPTICS_TEST_CASE(test_lookup_address, create_session(n, {1, 2}, 0, 0), 8, 100000);
 
 	return true;
 }
@@ -0,0 +1,414 @@
+/*
+ * 2008+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Test harness shared by client and library tests: result check macros
+ * and a pair of server nodes the tests talk to
+ */
+
+#ifndef __CPP_TEST_BASE_HPP
+#define __CPP_TEST_BASE_HPP
+
+#include <cerrno>
+#include <cstring>
+
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/included/unit_test.hpp>
+
+#include "../../include/elliptics/cppdef.h"
+#include "../../example/common.h"
+
+namespace tests {
+
+using namespace ioremap::elliptics;
+using namespace boost::unit_test;
+
+#define ELLIPTICS_CHECK_IMPL(R, C, CMD) auto R = (C); \
+	R.wait(); \
+	{ \
+		auto base_message = BOOST_TEST_STRINGIZE(C); \
+		std::string message(base_message.begin(), base_message.end()); \
+		message += ", err: \""; \
+		message += R.error().message(); \
+		message += "\""; \
+		CMD(!R.error(), message); \
+	}
+
+#define ELLIPTICS_CHECK_ERROR_IMPL(R, C, E, CMD) auto R = (C); \
+	R.wait(); \
+	if (R.error().code() != (E)) { \
+		auto base_message = BOOST_TEST_STRINGIZE(C); \
+		std::stringstream out; \
+		out << std::string(base_message.begin(), base_message.end()) \
+			<< ", expected error: " << (E) << ", received: \"" << R.error().message() << "\""; \
+		CMD(false, out.str()); \
+	}
+
+#define ELLIPTICS_WARN(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_WARN_MESSAGE)
+#define ELLIPTICS_CHECK(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_CHECK_MESSAGE)
+#define ELLIPTICS_REQUIRE(R, C) ELLIPTICS_CHECK_IMPL(R, (C), BOOST_REQUIRE_MESSAGE)
+
+#define ELLIPTICS_WARN_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_WARN_MESSAGE)
+#define ELLIPTICS_CHECK_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_CHECK_MESSAGE)
+#define ELLIPTICS_REQUIRE_ERROR(R, C, E) ELLIPTICS_CHECK_ERROR_IMPL(R, (C), (E), BOOST_REQUIRE_MESSAGE)
+
+#define ELLIPTICS_TEST_CASE(M, C...) do { framework::master_test_suite().add(BOOST_TEST_CASE(std::bind( M, ##C ))); } while (false)
+
+static session create_session(node n, std::initializer_list<int> groups, uint64_t cflags, uint32_t ioflags)
+{
+	session sess(n);
+
+	sess.set_groups(std::vector<int>(groups));
+	sess.set_cflags(cflags);
+	sess.set_ioflags(ioflags);
+
+	sess.set_exceptions_policy(session::no_exceptions);
+
+	return sess;
+}
+
+class directory_handler
+{
+public:
+	directory_handler()
+	{
+	}
+
+	directory_handler(const std::string &path) : m_path(path)
+	{
+	}
+
+	directory_handler(directory_handler &&other) : m_path(other.m_path)
+	{
+		other.m_path.clear();
+	}
+
+	directory_handler &operator= (directory_handler &&other)
+	{
+		std::swap(m_path, other.m_path);
+
+		return *this;
+	}
+
+	~directory_handler()
+	{
+		if (!m_path.empty())
+			boost::filesystem::remove_all(m_path);
+	}
+
+	directory_handler(const directory_handler &) = delete;
+	directory_handler &operator =(const directory_handler &) = delete;
+
+private:
+	std::string m_path;
+};
+
+static void create_directory(const std::string &path)
+{
+	// Boost throws exception on fail
+	boost::filesystem::create_directory(path);
+}
+
+enum dummy_value_type { DUMMY_VALUE };
+
+class config_data
+{
+public:
+	config_data()
+	{
+	}
+
+	config_data &operator() (const std::string &name, const std::string &value)
+	{
+		for (auto it = m_data.begin(); it != m_data.end(); ++it) {
+			if (it->first == name) {
+				it->second = value;
+				return *this;
+			}
+		}
+
+		m_data.emplace_back(name, value);
+
+		return *this;
+	}
+
+	config_data &operator() (const std::string &name, int value)
+	{
+		return (*this)(name, boost::lexical_cast<std::string>(value));
+	}
+
+	config_data &operator() (const std::string &name, dummy_value_type)
+	{
+		return (*this)(name, "dummy-value");
+	}
+
+protected:
+	std::vector<std::pair<std::string, std::string> >  m_data;
+};
+
+class config_data_writer : public config_data
+{
+public:
+	config_data_writer() = delete;
+	config_data_writer &operator =(const config_data_writer &other) = delete;
+
+	config_data_writer(const config_data_writer &other)
+		: config_data(other), m_path(other.m_path)
+	{
+	}
+	config_data_writer(const config_data &other, const std::string &path)
+		: config_data(other), m_path(path)
+	{
+	}
+
+	~config_data_writer()
+	{
+		write();
+	}
+
+	template <typename T>
+	config_data_writer &operator() (const std::string &name, const T &value)
+	{
+		config_data::operator ()(name, value);
+
+		return *this;
+	}
+
+	dnet_node *run()
+	{
+		dnet_node *node = dnet_parse_config(m_path.c_str(), 0);
+		if (!node)
+			throw std::runtime_error("Can not start server with config file: \"" + m_path + "\"");
+
+		return node;
+	}
+
+	void write()
+	{
+		std::ofstream out;
+		out.open(m_path.c_str());
+
+		if (!out) {
+			throw std::runtime_error("Can not open file \"" + m_path + "\" for writing");
+		}
+
+		for (auto it = m_data.begin(); it != m_data.end(); ++it) {
+			if (it->second == "dummy-value")
+				throw std::runtime_error("Unset value for key \"" + it->first + "\", file: \"" + m_path + "\"");
+
+			out << it->first << " = " << it->second << std::endl;
+		}
+
+		out.flush();
+		out.close();
+	}
+private:
+
+	std::string m_path;
+};
+
+class server_node
+{
+public:
+	server_node() : m_node(NULL)
+	{
+	}
+
+	server_node(const std::string &path) : m_node(NULL), m_path(path)
+	{
+	}
+
+	server_node(server_node &&other) : m_node(other.m_node), m_path(other.m_path)
+	{
+		other.m_node = NULL;
+		other.m_path.clear();
+	}
+
+	server_node &operator =(server_node &&other)
+	{
+		std::swap(m_node, other.m_node);
+		std::swap(m_path, other.m_path);
+
+		return *this;
+	}
+
+	server_node(const server_node &other) = delete;
+	server_node &operator =(const server_node &other) = delete;
+
+	~server_node()
+	{
+		if (m_node)
+			stop();
+	}
+
+	void start()
+	{
+		if (m_node)
+			throw std::runtime_error("Server node \"" + m_path + "\" is already started");
+
+		m_node = dnet_parse_config(m_path.c_str(), 0);
+		if (!m_node)
+			throw std::runtime_error("Can not start server with config file: \"" + m_path + "\"");
+	}
+
+	void stop()
+	{
+		if (!m_node)
+			throw std::runtime_error("Server node \"" + m_path + "\" is already stoped");
+
+		dnet_set_need_exit(m_node);
+		while (!dnet_need_exit(m_node))
+			sleep(1);
+
+		dnet_server_node_destroy(m_node);
+		m_node = NULL;
+	}
+
+private:
+	dnet_node *m_node;
+	std::string m_path;
+};
+
+struct tests_data
+{
+	~tests_data()
+	{
+		nodes.clear();
+	}
+
+	std::vector<server_node> nodes;
+	directory_handler directory;
+};
+
+static std::shared_ptr<tests_data> global_data;
+
+static config_data_writer create_config(config_data base_config, const std::string &path)
+{
+	return config_data_writer(base_config, path);
+}
+
+static void configure_server_nodes()
+{
+	std::string base_path;
+	std::string auth_cookie;
+
+	{
+		char buffer[1024];
+
+		snprintf(buffer, sizeof(buffer), "/tmp/elliptics-test-%04x/", rand());
+		buffer[sizeof(buffer) - 1] = 0;
+		base_path = buffer;
+
+		snprintf(buffer, sizeof(buffer), "%04x%04x", rand(), rand());
+		buffer[sizeof(buffer) - 1] = 0;
+		auth_cookie = buffer;
+	}
+
+	create_directory(base_path);
+
+	directory_handler guard(base_path);
+
+	results_reporter::get_stream() << "Set base directory: \"" << base_path << "\"" << std::endl;
+	results_reporter::get_stream() << "Starting up servers" << std::endl;
+
+	const std::string first_server_path = base_path + "/server-1";
+	const std::string second_server_path = base_path + "/server-2";
+
+	create_directory(first_server_path);
+	create_directory(first_server_path + "/blob");
+	create_directory(first_server_path + "/history");
+	create_directory(second_server_path);
+	create_directory(second_server_path + "/blob");
+	create_directory(second_server_path + "/history");
+
+	config_data ioserv_config;
+
+	ioserv_config("log", "/dev/stderr")
+			("log_level", DNET_LOG_INFO)
+			("join", 1)
+			("flags", 4)
+			("group", DUMMY_VALUE)
+			("addr", DUMMY_VALUE)
+			("remote", DUMMY_VALUE)
+			("wait_timeout", 60)
+			("check_timeout", 60)
+			("io_thread_num", 50)
+			("nonblocking_io_thread_num", 16)
+			("net_thread_num", 16)
+			("net_slice_size", 64 * 1024)
+			("history", DUMMY_VALUE)
+			("daemon", 0)
+			("auth_cookie", auth_cookie)
+			("bg_ionice_class", 3)
+			("bg_ionice_prio", 0)
+			("server_net_prio", 1)
+			("client_net_prio", 6)
+			("cache_size", 1024 * 1024 * 256)
+			("backend", "blob")
+			("sync", 5)
+			("data", DUMMY_VALUE)
+			("data_block_size", 1024)
+			("blob_flags", 6)
+			("iterate_thread_num", 1)
+			("blob_size", "10M")
+			("records_in_blob", 10000000)
+			("defrag_timeout", 3600)
+			("defrag_percentage", 25)
+			;
+
+	create_config(ioserv_config, first_server_path + "/ioserv.conf")
+			("log", first_server_path + "/log.log")
+			("group", 1)
+			("addr", "localhost:1025:2")
+			("remote", "localhost:1026:2")
+			("history", first_server_path + "/history")
+			("data", first_server_path + "/blob/data")
+			;
+
+	server_node first_server(first_server_path + "/ioserv.conf");
+
+	first_server.start();
+	results_reporter::get_stream() << "First server started" << std::endl;
+
+	create_config(ioserv_config, second_server_path + "/ioserv.conf")
+			("log", second_server_path + "/log.log")
+			("group", 2)
+			("addr", "localhost:1026:2")
+			("remote", "localhost:1025:2")
+			("history", second_server_path + "/history")
+			("data", second_server_path + "/blob/data")
+			;
+
+	server_node second_server(second_server_path + "/ioserv.conf");
+
+	second_server.start();
+	results_reporter::get_stream() << "Second server started" << std::endl;
+
+	global_data = std::make_shared<tests_data>();
+
+	global_data->directory = std::move(guard);
+	global_data->nodes.emplace_back(std::move(first_server));
+	global_data->nodes.emplace_back(std::move(second_server));
+}
+
+} // namespace tests
+
+#endif /* __CPP_TEST_BASE_HPP */
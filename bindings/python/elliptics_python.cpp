@@ -54,6 +54,8 @@ enum elliptics_cflags {
 	cflags_default = 0,
 	cflags_direct = DNET_FLAGS_DIRECT,
 	cflags_nolock = DNET_FLAGS_NOLOCK,
+	cflags_background = DNET_FLAGS_BACKGROUND,
+	cflags_deadline = DNET_FLAGS_DEADLINE,
 };
 
 enum elliptics_ioflags {
@@ -334,7 +336,15 @@ BOOST_PYTHON_MODULE(core)
 		.def_readwrite("check_timeout", &dnet_config::check_timeout)
 		.def_readwrite("io_thread_num", &dnet_config::io_thread_num)
 		.def_readwrite("nonblocking_io_thread_num", &dnet_config::nonblocking_io_thread_num)
+		.def_readwrite("io_thread_num_max", &dnet_config::io_thread_num_max)
+		.def_readwrite("nonblocking_io_thread_num_max", &dnet_config::nonblocking_io_thread_num_max)
 		.def_readwrite("net_thread_num", &dnet_config::net_thread_num)
+		.def_readwrite("io_queue_limit", &dnet_config::io_queue_limit)
+		.def_readwrite("io_queue_kb_limit", &dnet_config::io_queue_kb_limit)
+		.def_readwrite("net_engine", &dnet_config::net_engine)
+		.def_readwrite("net_conns", &dnet_config::net_conns)
+		.def_readwrite("net_slice_size", &dnet_config::net_slice_size)
+		.def_readwrite("oplock_shared", &dnet_config::oplock_shared)
 		.def_readwrite("client_prio", &dnet_config::client_prio)
 	;
 
@@ -369,6 +379,8 @@ BOOST_PYTHON_MODULE(core)
 		.value("default", cflags_default)
 		.value("direct", cflags_direct)
 		.value("nolock", cflags_nolock)
+		.value("background", cflags_background)
+		.value("deadline", cflags_deadline)
 	;
 
 	bp::enum_<elliptics_ioflags>("io_flags")
@@ -571,6 +571,12 @@ void init_elliptcs_session() {
 		.def("set_timeout", &elliptics_session::set_timeout)
 		.def("get_timeout", &elliptics_session::get_timeout)
 
+		.add_property("timeout_ms",
+		              &elliptics_session::get_timeout_ms,
+		              &elliptics_session::set_timeout_ms)
+		.def("set_timeout_ms", &elliptics_session::set_timeout_ms)
+		.def("get_timeout_ms", &elliptics_session::get_timeout_ms)
+
 		.def("read_file", &elliptics_session::read_file,
 		     (bp::arg("key"), bp::arg("filename"),
 		      bp::arg("offset") = 0, bp::arg("size") = 0))
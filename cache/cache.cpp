@@ -13,6 +13,7 @@
  * GNU General Public License for more details.
  */
 
+#include <atomic>
 #include <iostream>
 #include <deque>
 #include <vector>
@@ -23,6 +24,7 @@
 #include <boost/unordered_map.hpp>
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/set.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 #include "../library/elliptics.h"
 #include "../indexes/local_session.h"
@@ -32,94 +34,221 @@
 
 namespace ioremap { namespace cache {
 
+/*
+ * Object payload, header and data are allocated in a single block.
+ * Payload is referenced by cached object and by readers which send it, send queue keeps
+ * the reference until data is sent. Payload is modified in place only while it is large enough
+ * and nobody else references it, otherwise object gets new payload (copy-on-write).
+ */
 class raw_data_t {
 	public:
-		raw_data_t(const char *data, size_t size) {
-			m_data.reserve(size);
-			m_data.insert(m_data.begin(), data, data + size);
+		static raw_data_t *create(const char *data, size_t size, size_t capacity) {
+			if (capacity < size)
+				capacity = size;
+
+			void *ptr = malloc(sizeof(raw_data_t) + capacity);
+			if (!ptr)
+				throw std::bad_alloc();
+
+			raw_data_t *raw = new (ptr) raw_data_t(capacity);
+			if (size) {
+				memcpy(raw->data(), data, size);
+				raw->m_size = size;
+			}
+
+			return raw;
 		}
 
-		std::vector<char> &data(void) {
-			return m_data;
+		char *data(void) {
+			return reinterpret_cast<char *>(this + 1);
+		}
+
+		size_t size(void) const {
+			return m_size;
 		}
 
-		size_t size(void) {
-			return m_data.size();
+		size_t capacity(void) const {
+			return m_capacity;
+		}
+
+		void set_size(size_t size) {
+			m_size = size;
+		}
+
+		/*
+		 * Referenced by somebody else than cached object: reply is being sent or object is being synced
+		 */
+		bool shared(void) const {
+			return m_refcnt.load(std::memory_order_acquire) > 1;
+		}
+
+		/*
+		 * Buffer which references payload while it is queued into send queue, NULL if it can not be allocated
+		 */
+		struct dnet_io_buf *io_buf(void) {
+			intrusive_ptr_add_ref(this);
+
+			struct dnet_io_buf *buf = dnet_io_buf_create(data(), size(), &raw_data_t::put_io_buf, this);
+			if (!buf)
+				intrusive_ptr_release(this);
+
+			return buf;
+		}
+
+		friend void intrusive_ptr_add_ref(raw_data_t *raw) {
+			raw->m_refcnt.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		friend void intrusive_ptr_release(raw_data_t *raw) {
+			if (raw->m_refcnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				raw->~raw_data_t();
+				free(raw);
+			}
 		}
 
 	private:
-		std::vector<char> m_data;
+		std::atomic<int> m_refcnt;
+		size_t m_size;
+		size_t m_capacity;
+
+		raw_data_t(size_t capacity) : m_refcnt(0), m_size(0), m_capacity(capacity) {
+		}
+
+		raw_data_t(const raw_data_t &) = delete;
+
+		static void put_io_buf(void *priv) {
+			intrusive_ptr_release(reinterpret_cast<raw_data_t *>(priv));
+		}
 };
 
+typedef boost::intrusive_ptr<raw_data_t> raw_data_ptr_t;
+
 struct data_lru_tag_t;
 typedef boost::intrusive::list_base_hook<boost::intrusive::tag<data_lru_tag_t>,
 					 boost::intrusive::link_mode<boost::intrusive::safe_link>
 					> lru_list_base_hook_t;
-struct data_set_tag_t;
-typedef boost::intrusive::set_base_hook<boost::intrusive::tag<data_set_tag_t>,
-					 boost::intrusive::link_mode<boost::intrusive::safe_link>
-					> set_base_hook_t;
-
 struct time_set_tag_t;
 typedef boost::intrusive::set_base_hook<boost::intrusive::tag<time_set_tag_t>,
-					 boost::intrusive::link_mode<boost::intrusive::safe_link>
+					 boost::intrusive::link_mode<boost::intrusive::safe_link>,
+					 boost::intrusive::optimize_size<true>
 					> time_set_base_hook_t;
 
 struct sync_set_tag_t;
 typedef boost::intrusive::set_base_hook<boost::intrusive::tag<sync_set_tag_t>,
-					 boost::intrusive::link_mode<boost::intrusive::safe_link>
+					 boost::intrusive::link_mode<boost::intrusive::safe_link>,
+					 boost::intrusive::optimize_size<true>
 					> sync_set_base_hook_t;
 
-class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_set_base_hook_t, public sync_set_base_hook_t {
+class data_t;
+
+/*
+ * Lifetime and sync time of cached object. Most objects have neither of them,
+ * so timer is allocated only while object is in lifetime or sync set, see cache_t::set_lifetime()
+ */
+class data_timer_t : public time_set_base_hook_t, public sync_set_base_hook_t {
 	public:
-		data_t(const unsigned char *id) {
-			memcpy(m_id.id, id, DNET_ID_SIZE);
+		data_timer_t(data_t *obj) : m_obj(obj), m_lifetime(0), m_synctime(0) {
+		}
+
+		data_t *obj(void) const {
+			return m_obj;
+		}
+
+		size_t lifetime(void) const {
+			return m_lifetime;
+		}
+
+		void set_lifetime(size_t lifetime) {
+			m_lifetime = lifetime;
+		}
+
+		size_t synctime() const {
+			return m_synctime;
+		}
+
+		void set_synctime(size_t synctime) {
+			m_synctime = synctime;
 		}
 
-		data_t(const unsigned char *id, size_t lifetime, const char *data, size_t size, bool remove_from_disk) :
-			m_lifetime(0), m_synctime(0), m_user_flags(0),
-			m_remove_from_disk(remove_from_disk), m_remove_from_cache(false), m_only_append(false) {
+	private:
+		data_t *m_obj;
+		size_t m_lifetime;
+		size_t m_synctime;
+
+		data_timer_t(const data_timer_t &) = delete;
+};
+
+class data_t : public lru_list_base_hook_t {
+	public:
+		data_t(const unsigned char *id, const char *data, size_t size, size_t capacity, bool remove_from_disk) :
+			m_hash_next(NULL), m_timer(NULL), m_data(NULL), m_user_flags(0),
+			m_remove_from_disk(remove_from_disk), m_only_append(false),
+			m_remove_from_cache(false) {
 			memcpy(m_id.id, id, DNET_ID_SIZE);
 			dnet_empty_time(&m_timestamp);
 
-			if (lifetime)
-				m_lifetime = lifetime + time(NULL);
-
-			m_data.reset(new raw_data_t(data, size));
+			m_data = raw_data_t::create(data, size, capacity);
+			intrusive_ptr_add_ref(m_data);
 		}
 
 		data_t(const data_t &other) = delete;
 		data_t &operator =(const data_t &other) = delete;
 
 		~data_t() {
+			delete m_timer;
+			intrusive_ptr_release(m_data);
 		}
 
 		const struct dnet_raw_id &id(void) const {
 			return m_id;
 		}
 
-		std::shared_ptr<raw_data_t> data(void) const {
+		/*
+		 * Reference to the current payload, it is kept after object is modified or removed
+		 */
+		raw_data_ptr_t data(void) const {
+			return raw_data_ptr_t(m_data);
+		}
+
+		/*
+		 * Payload which may be modified in place
+		 */
+		raw_data_t *raw(void) const {
 			return m_data;
 		}
 
-		size_t lifetime(void) const {
-			return m_lifetime;
+		/*
+		 * Makes payload which can be modified in place and is large enough for @size bytes,
+		 * first @keep bytes are preserved, payload more than twice as large as needed is shrunk.
+		 * Payload which is being sent is never modified, it is released by the last reader instead.
+		 */
+		raw_data_t *reserve(size_t size, size_t keep, size_t capacity) {
+			raw_data_t *old = m_data;
+
+			if (old->capacity() >= size && old->capacity() <= 2 * std::max(size, capacity) && !old->shared())
+				return old;
+
+			m_data = raw_data_t::create(old->data(), std::min(keep, old->size()), std::max(size, capacity));
+			intrusive_ptr_add_ref(m_data);
+			intrusive_ptr_release(old);
+
+			return m_data;
 		}
 
-		void set_lifetime(size_t lifetime) {
-			m_lifetime = lifetime;
+		data_timer_t *timer(void) const {
+			return m_timer;
 		}
 
-		size_t synctime() const {
-			return m_synctime;
+		void set_timer(data_timer_t *timer) {
+			m_timer = timer;
 		}
 
-		void set_synctime(size_t synctime) {
-			m_synctime = synctime;
+		size_t lifetime(void) const {
+			return m_timer ? m_timer->lifetime() : 0;
 		}
 
-		void clear_synctime() {
-			m_synctime = 0;
+		size_t synctime() const {
+			return m_timer ? m_timer->synctime() : 0;
 		}
 
 		const dnet_time &timestamp() const {
@@ -150,6 +279,10 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 			m_remove_from_cache = remove_from_cache;
 		}
 
+		data_t *&hash_next() {
+			return m_hash_next;
+		}
+
 		bool only_append() const {
 			return m_only_append;
 		}
@@ -159,67 +292,220 @@ class data_t : public lru_list_base_hook_t, public set_base_hook_t, public time_
 		}
 
 		size_t size(void) const {
-			return m_data->size();
-		}
-
-		friend bool operator< (const data_t &a, const data_t &b) {
-			return dnet_id_cmp_str(a.id().id, b.id().id) < 0;
-		}
-
-		friend bool operator> (const data_t &a, const data_t &b) {
-			return dnet_id_cmp_str(a.id().id, b.id().id) > 0;
+			return raw()->size();
 		}
 
-		friend bool operator== (const data_t &a, const data_t &b) {
-			return dnet_id_cmp_str(a.id().id, b.id().id) == 0;
+		/*
+		 * Memory held by payload, cache budget accounts it instead of size
+		 */
+		size_t capacity(void) const {
+			return raw()->capacity();
 		}
 
 	private:
-		size_t m_lifetime;
-		size_t m_synctime;
+		data_t *m_hash_next;
+		data_timer_t *m_timer;
+		raw_data_t *m_data;
 		dnet_time m_timestamp;
 		uint64_t m_user_flags;
 		bool m_remove_from_disk;
-		bool m_remove_from_cache;
 		bool m_only_append;
+		bool m_remove_from_cache;
 		struct dnet_raw_id m_id;
-		std::shared_ptr<raw_data_t> m_data;
 };
 
 typedef boost::intrusive::list<data_t, boost::intrusive::base_hook<lru_list_base_hook_t> > lru_list_t;
-typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<set_base_hook_t>,
-					  boost::intrusive::compare<std::less<data_t> >
-			     > iset_t;
+
+/*
+ * Hash index of cached objects, it is modified and searched under cache lock
+ */
+class hash_index_t {
+	public:
+		hash_index_t() : m_num(0) {
+			m_table = alloc_table(10);
+		}
+
+		~hash_index_t() {
+			free_table(m_table);
+		}
+
+		data_t *find(const unsigned char *id) const {
+			data_t *obj = m_table->buckets[bucket(m_table, id)];
+
+			for (; obj; obj = obj->hash_next()) {
+				if (!memcmp(obj->id().id, id, DNET_ID_SIZE))
+					return obj;
+			}
+
+			return NULL;
+		}
+
+		void insert(data_t *obj) {
+			if (m_num >= m_table->mask + 1)
+				grow();
+
+			link(m_table, obj);
+			m_num++;
+		}
+
+		void erase(data_t *obj) {
+			data_t **prev = &m_table->buckets[bucket(m_table, obj->id().id)];
+
+			for (; *prev; prev = &(*prev)->hash_next()) {
+				if (*prev == obj) {
+					*prev = obj->hash_next();
+					m_num--;
+					return;
+				}
+			}
+		}
+
+		size_t size() const {
+			return m_num;
+		}
+
+	private:
+		struct table_t {
+			int bits;
+			size_t mask;
+			data_t **buckets;
+		};
+
+		table_t *m_table;
+		size_t m_num;
+
+		hash_index_t(const hash_index_t &) = delete;
+
+		static size_t bucket(const table_t *table, const unsigned char *id) {
+			uint64_t h;
+
+			// the first bytes select cache shard
+			memcpy(&h, id + sizeof(uint64_t), sizeof(h));
+			return (h * 0x9e3779b97f4a7c15ULL) >> (64 - table->bits);
+		}
+
+		static table_t *alloc_table(int bits) {
+			table_t *table = new table_t;
+			table->bits = bits;
+			table->mask = (1ULL << bits) - 1;
+			table->buckets = new data_t *[table->mask + 1]();
+
+			return table;
+		}
+
+		static void free_table(table_t *table) {
+			delete [] table->buckets;
+			delete table;
+		}
+
+		static void link(table_t *table, data_t *obj) {
+			data_t *&head = table->buckets[bucket(table, obj->id().id)];
+
+			obj->hash_next() = head;
+			head = obj;
+		}
+
+		void grow() {
+			table_t *old = m_table;
+			data_t *obj, *next;
+
+			m_table = alloc_table(old->bits + 1);
+
+			for (size_t i = 0; i <= old->mask; ++i) {
+				for (obj = old->buckets[i]; obj; obj = next) {
+					next = obj->hash_next();
+					link(m_table, obj);
+				}
+			}
+
+			free_table(old);
+		}
+};
 
 struct lifetime_less {
-	bool operator() (const data_t &x, const data_t &y) const {
+	bool operator() (const data_timer_t &x, const data_timer_t &y) const {
 		return x.lifetime() < y.lifetime()
 			|| (x.lifetime() == y.lifetime() && ((&x) < (&y)));
 	}
 };
 
-typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<time_set_base_hook_t>,
+typedef boost::intrusive::set<data_timer_t, boost::intrusive::base_hook<time_set_base_hook_t>,
 					  boost::intrusive::compare<lifetime_less>
 			     > life_set_t;
 
 struct synctime_less {
-	bool operator() (const data_t &x, const data_t &y) const {
+	bool operator() (const data_timer_t &x, const data_timer_t &y) const {
 		return x.synctime() < y.synctime()
 			|| (x.synctime() == y.synctime() && ((&x) < (&y)));
 	}
 };
 
-typedef boost::intrusive::set<data_t, boost::intrusive::base_hook<sync_set_base_hook_t>,
+typedef boost::intrusive::set<data_timer_t, boost::intrusive::base_hook<sync_set_base_hook_t>,
 					  boost::intrusive::compare<synctime_less>
 			     > sync_set_t;
 
+/*
+ * Memory shared by cache shards. Shard may use memory which other shards do not use,
+ * but when cache is full, only shards which use more than their equal share evict objects,
+ * so that shard which has been idle for a while is not starved by busy ones.
+ * Shard which grows up to its share may push cache over its size, shards which have borrowed
+ * memory return it right after that (see cache_manager::reclaim()).
+ */
+class cache_budget_t {
+	public:
+		cache_budget_t(size_t max_size, size_t shards) :
+		m_max_size(max_size),
+		m_share(max_size / shards),
+		m_used(0) {
+		}
+
+		size_t share() const {
+			return m_share;
+		}
+
+		void add(size_t size) {
+			m_used.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void sub(size_t size) {
+			m_used.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		/*
+		 * Maximum size of the shard which uses @size bytes now
+		 */
+		size_t limit(size_t size) const {
+			size_t used = m_used.load(std::memory_order_relaxed);
+			size_t others = used > size ? used - size : 0;
+			size_t free = m_max_size > others ? m_max_size - others : 0;
+
+			return std::max(free, m_share);
+		}
+
+		bool over() const {
+			return m_used.load(std::memory_order_relaxed) > m_max_size;
+		}
+
+	private:
+		size_t m_max_size, m_share;
+		std::atomic<size_t> m_used;
+};
+
+struct cache_stat_t {
+	size_t size;
+	size_t objects;
+	uint64_t lock_contended;
+};
+
 class cache_t {
 	public:
-		cache_t(struct dnet_node *n, size_t max_size) :
+		cache_t(struct dnet_node *n, cache_budget_t &budget) :
 		m_need_exit(false),
+		m_clear(false),
 		m_node(n),
 		m_cache_size(0),
-		m_max_cache_size(max_size) {
+		m_budget(budget),
+		m_lock_contended(0) {
 			m_lifecheck = std::thread(std::bind(&cache_t::life_check, this));
 		}
 
@@ -227,17 +513,19 @@ class cache_t {
 			stop();
 			m_lifecheck.join();
 
-			m_max_cache_size = 0; //sets max_size to 0 for erasing lru set
-			resize(0);
+			{
+				shard_guard_t guard(this);
 
-			std::lock_guard<std::mutex> guard(m_lock);
+				m_clear = true; //sets max_size to 0 for erasing lru set
+				resize(0);
 
-			while(!m_syncset.empty()) { //removes datas from syncset
-				erase_element(&*m_syncset.begin());
-			}
+				while(!m_syncset.empty()) { //removes datas from syncset
+					erase_element(m_syncset.begin()->obj());
+				}
 
-			while(!m_lifeset.empty()) { //removes datas from lifeset
-				erase_element(&*m_lifeset.begin());
+				while(!m_lifeset.empty()) { //removes datas from lifeset
+					erase_element(m_lifeset.begin()->obj());
+				}
 			}
 		}
 
@@ -254,50 +542,52 @@ class cache_t {
 			const bool append = (io->flags & DNET_IO_FLAGS_APPEND);
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: before guard\n", dnet_dump_id_str(id));
-			std::unique_lock<std::mutex> guard(m_lock);
+			shard_guard_t guard(this);
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: after guard\n", dnet_dump_id_str(id));
 
-			iset_t::iterator it = m_set.find(id);
+			data_t *it = m_index.find(id);
 
-			if (it == m_set.end() && !cache) {
+			if (it == NULL && !cache) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: not a cache call\n", dnet_dump_id_str(id));
 				return -ENOTSUP;
 			}
 
 			// Optimization for append-only commands
 			if (!cache_only) {
-				if (append && (it == m_set.end() || it->only_append())) {
-					if (it == m_set.end()) {
-						it = create_data(id, 0, 0, false);
+				if (append && (it == NULL || it->only_append())) {
+					if (it == NULL) {
+						it = create_data(id, 0, 0, io->size, io->timestamp, io->user_flags, false);
 						it->set_only_append(true);
-						it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
-						m_syncset.insert(*it);
+						set_synctime(it, time(NULL) + m_node->cache_sync_timeout);
 					}
 
-					auto &raw = it->data()->data();
+					raw_data_t *raw = it->raw();
+					const size_t old_size = raw->size();
 
-					m_cache_size -= raw.size();
+					sub_size(raw->capacity());
 					m_lru.erase(m_lru.iterator_to(*it));
 
-					const size_t new_size = raw.size() + io->size;
+					const size_t new_size = old_size + io->size;
 
-					if (m_cache_size + new_size > m_max_cache_size) {
+					if (m_cache_size + new_size > max_size()) {
 						dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called\n", dnet_dump_id_str(id));
 						resize(new_size * 2);
 						dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished\n", dnet_dump_id_str(id));
 					}
 
 					m_lru.push_back(*it);
-					m_cache_size += new_size;
 
-					raw.insert(raw.end(), data, data + io->size);
+					raw = it->reserve(new_size, old_size, raw->capacity() * 2);
+					add_size(raw->capacity());
+					memcpy(raw->data() + old_size, data, io->size);
+					raw->set_size(new_size);
 
 					it->set_timestamp(io->timestamp);
 					it->set_user_flags(io->user_flags);
 
 					cmd->flags &= ~DNET_FLAGS_NEED_ACK;
 					return dnet_send_file_info_ts_without_fd(st, cmd, data, io->size, &io->timestamp);
-				} else if (it != m_set.end() && it->only_append()) {
+				} else if (it != NULL && it->only_append()) {
 					sync_after_append(guard, false, &*it);
 
 					local_session sess(m_node);
@@ -314,7 +604,7 @@ class cache_t {
 				}
 			}
 
-			if (it == m_set.end()) {
+			if (it == NULL) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: not exist\n", dnet_dump_id_str(id));
 				// If file not found and CACHE flag is not set - fallback to backend request
 				if (!cache_only && io->offset != 0) {
@@ -326,21 +616,22 @@ class cache_t {
 				}
 
 				// Create empty data for code simplifing
-				if (it == m_set.end())
-					it = create_data(id, 0, 0, remove_from_disk);
+				if (it == NULL)
+					it = create_data(id, 0, 0, append ? size : io->offset + size,
+							io->timestamp, io->user_flags, remove_from_disk);
 			} else {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: exists\n", dnet_dump_id_str(id));
 			}
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data ensured\n", dnet_dump_id_str(id));
 
-			raw_data_t &raw = *it->data();
+			raw_data_t *raw = it->raw();
 
 			if (io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) {
 				// Data is already in memory, so it's free to use it
 				// raw.size() is zero only if there is no such file on the server
-				if (raw.size() != 0) {
+				if (raw->size() != 0) {
 					struct dnet_raw_id csum;
-					dnet_transform_node(m_node, raw.data().data(), raw.size(), csum.id, sizeof(csum.id));
+					dnet_transform_node(m_node, raw->data(), raw->size(), csum.id, sizeof(csum.id));
 
 					if (memcmp(csum.id, io->parent, DNET_ID_SIZE)) {
 						dnet_log(m_node, DNET_LOG_ERROR, "%s: cas: cache checksum mismatch\n", dnet_dump_id(&cmd->id));
@@ -351,19 +642,20 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: CAS checked\n", dnet_dump_id_str(id));
 
+			const size_t old_size = raw->size();
 			size_t new_size = 0;
 
 			if (append) {
-				new_size = raw.size() + size;
+				new_size = old_size + size;
 			} else {
 				new_size = io->offset + io->size;
 			}
 
 			// Recalc used space, free enough space for new data, move object to the end of the queue
-			m_cache_size -= raw.size();
+			sub_size(raw->capacity());
 			m_lru.erase(m_lru.iterator_to(*it));
 
-			if (m_cache_size + new_size > m_max_cache_size) {
+			if (m_cache_size + new_size > max_size()) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called\n", dnet_dump_id_str(id));
 				resize(new_size * 2);
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished\n", dnet_dump_id_str(id));
@@ -371,30 +663,27 @@ class cache_t {
 
 			m_lru.push_back(*it);
 			it->set_remove_from_cache(false);
-			m_cache_size += new_size;
 
 			if (append) {
-				raw.data().insert(raw.data().end(), data, data + size);
+				raw = it->reserve(new_size, old_size, raw->capacity() * 2);
+				memcpy(raw->data() + old_size, data, size);
 			} else {
-				raw.data().resize(new_size);
-				memcpy(raw.data().data() + io->offset, data, size);
+				raw = it->reserve(new_size, io->offset, 0);
+				if (io->offset > old_size)
+					memset(raw->data() + old_size, 0, io->offset - old_size);
+				memcpy(raw->data() + io->offset, data, size);
 			}
+			raw->set_size(new_size);
+			add_size(raw->capacity());
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: data modified\n", dnet_dump_id_str(id));
 
 			// Mark data as dirty one, so it will be synced to the disk
 			if (!it->synctime() && !(io->flags & DNET_IO_FLAGS_CACHE_ONLY)) {
-				it->set_synctime(time(NULL) + m_node->cache_sync_timeout);
-				m_syncset.insert(*it);
+				set_synctime(it, time(NULL) + m_node->cache_sync_timeout);
 			}
 
-			if (it->lifetime())
-				m_lifeset.erase(m_lifeset.iterator_to(*it));
-
-			if (lifetime) {
-				it->set_lifetime(lifetime + time(NULL));
-				m_lifeset.insert(*it);
-			}
+			set_lifetime(it, lifetime ? lifetime + time(NULL) : 0);
 
 			it->set_timestamp(io->timestamp);
 			it->set_user_flags(io->user_flags);
@@ -402,27 +691,27 @@ class cache_t {
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: finished write\n", dnet_dump_id_str(id));
 
 			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-			return dnet_send_file_info_ts_without_fd(st, cmd, raw.data().data() + io->offset, io->size, &io->timestamp);
+			return dnet_send_file_info_ts_without_fd(st, cmd, raw->data() + io->offset, io->size, &io->timestamp);
 		}
 
-		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+		raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
 			const bool cache = (io->flags & DNET_IO_FLAGS_CACHE);
 			const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 			(void) cmd;
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: before guard\n", dnet_dump_id_str(id));
-			std::unique_lock<std::mutex> guard(m_lock);
+			shard_guard_t guard(this);
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: after guard\n", dnet_dump_id_str(id));
 
-			iset_t::iterator it = m_set.find(id);
-			if (it != m_set.end() && it->only_append()) {
+			data_t *it = m_index.find(id);
+			if (it != NULL && it->only_append()) {
 				sync_after_append(guard, true, &*it);
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: synced append-only data\n", dnet_dump_id_str(id));
 
-				it = m_set.end();
+				it = NULL;
 			}
 
-			if (it == m_set.end() && cache && !cache_only) {
+			if (it == NULL && cache && !cache_only) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: not exist\n", dnet_dump_id_str(id));
 				int err = 0;
 				it = populate_from_disk(guard, id, false, &err);
@@ -432,7 +721,7 @@ class cache_t {
 
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE READ: data ensured\n", dnet_dump_id_str(id));
 
-			if (it != m_set.end()) {
+			if (it != NULL) {
 				m_lru.erase(m_lru.iterator_to(*it));
 				it->set_remove_from_cache(false);
 				m_lru.push_back(*it);
@@ -443,7 +732,7 @@ class cache_t {
 				return it->data();
 			}
 
-			return std::shared_ptr<raw_data_t>();
+			return raw_data_ptr_t();
 		}
 
 		int remove(const unsigned char *id, dnet_io_attr *io) {
@@ -451,15 +740,14 @@ class cache_t {
 			bool remove_from_disk = !cache_only;
 			int err = -ENOENT;
 
-			std::unique_lock<std::mutex> guard(m_lock);
-			iset_t::iterator it = m_set.find(id);
-			if (it != m_set.end()) {
+			shard_guard_t guard(this);
+			data_t *it = m_index.find(id);
+			if (it != NULL) {
 				// If cache_only is not set the data also should be remove from the disk
 				// If data is marked and cache_only is not set - data must be synced to the disk
 				remove_from_disk |= it->remove_from_disk();
 				if (it->synctime() && !cache_only) {
-					m_syncset.erase(m_syncset.iterator_to(*it));
-					it->clear_synctime();
+					set_synctime(it, 0);
 				}
 				erase_element(&(*it));
 				err = 0;
@@ -484,9 +772,9 @@ class cache_t {
 		int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd) {
 			int err = 0;
 
-			std::unique_lock<std::mutex> guard(m_lock);
-			iset_t::iterator it = m_set.find(id);
-			if (it == m_set.end()) {
+			shard_guard_t guard(this);
+			data_t *it = m_index.find(id);
+			if (it == NULL) {
 				return -ENOTSUP;
 			}
 
@@ -511,15 +799,39 @@ class cache_t {
 			info->mtime = timestamp;
 
 			cmd->flags &= (DNET_FLAGS_MORE | DNET_FLAGS_NEED_ACK);
-			return dnet_send_reply(st, cmd, data.data(), data.size(), 0);
+			ioremap::elliptics::io_buffer io_data(data);
+			return dnet_send_reply_buf(st, cmd, io_data.get(), data.data(), data.size(), 0);
+		}
+
+		/*
+		 * Evicts objects if shard uses more memory than it may keep now
+		 */
+		void reclaim() {
+			shard_guard_t guard(this);
+
+			if (m_cache_size > max_size())
+				resize(0);
+		}
+
+		cache_stat_t stat() {
+			std::lock_guard<std::mutex> guard(m_lock);
+			cache_stat_t st;
+
+			st.size = m_cache_size;
+			st.objects = m_index.size();
+			st.lock_contended = m_lock_contended.load(std::memory_order_relaxed);
+			return st;
 		}
 
 	private:
 		bool m_need_exit;
+		bool m_clear;
 		struct dnet_node *m_node;
-		size_t m_cache_size, m_max_cache_size;
+		size_t m_cache_size;
+		cache_budget_t &m_budget;
 		std::mutex m_lock;
-		iset_t m_set;
+		std::atomic<uint64_t> m_lock_contended;
+		hash_index_t m_index;
 		lru_list_t m_lru;
 		life_set_t m_lifeset;
 		sync_set_t m_syncset;
@@ -527,22 +839,134 @@ class cache_t {
 
 		cache_t(const cache_t &) = delete;
 
-		iset_t::iterator create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk) {
-			if (m_cache_size + size > m_max_cache_size) {
+		/*
+		 * Shard lock which counts how many times it has been found already locked
+		 */
+		class shard_guard_t {
+			public:
+				shard_guard_t(cache_t *cache) : m_cache(cache), m_guard(cache->m_lock, std::defer_lock) {
+					lock();
+				}
+
+				~shard_guard_t() {
+					if (owns_lock())
+						unlock();
+				}
+
+				void lock() {
+					if (!m_guard.try_lock()) {
+						m_cache->m_lock_contended.fetch_add(1, std::memory_order_relaxed);
+						m_guard.lock();
+					}
+				}
+
+				void unlock() {
+					m_guard.unlock();
+				}
+
+				bool owns_lock() const {
+					return m_guard.owns_lock();
+				}
+
+			private:
+				cache_t *m_cache;
+				std::unique_lock<std::mutex> m_guard;
+
+				shard_guard_t(const shard_guard_t &) = delete;
+		};
+
+		size_t max_size() const {
+			return m_clear ? 0 : m_budget.limit(m_cache_size);
+		}
+
+		void add_size(size_t size) {
+			m_cache_size += size;
+			m_budget.add(size);
+		}
+
+		void sub_size(size_t size) {
+			m_cache_size -= size;
+			m_budget.sub(size);
+		}
+
+		data_timer_t *get_timer(data_t *obj) {
+			data_timer_t *timer = obj->timer();
+
+			if (!timer) {
+				timer = new data_timer_t(obj);
+				obj->set_timer(timer);
+			}
+
+			return timer;
+		}
+
+		void put_timer(data_t *obj) {
+			data_timer_t *timer = obj->timer();
+
+			if (timer && !timer->lifetime() && !timer->synctime()) {
+				obj->set_timer(NULL);
+				delete timer;
+			}
+		}
+
+		/*
+		 * Zero @lifetime removes object from lifetime set
+		 */
+		void set_lifetime(data_t *obj, size_t lifetime) {
+			if (obj->lifetime())
+				m_lifeset.erase(m_lifeset.iterator_to(*obj->timer()));
+
+			if (lifetime) {
+				data_timer_t *timer = get_timer(obj);
+
+				timer->set_lifetime(lifetime);
+				m_lifeset.insert(*timer);
+			} else if (obj->timer()) {
+				obj->timer()->set_lifetime(0);
+				put_timer(obj);
+			}
+		}
+
+		/*
+		 * Zero @synctime removes object from sync set
+		 */
+		void set_synctime(data_t *obj, size_t synctime) {
+			if (obj->synctime())
+				m_syncset.erase(m_syncset.iterator_to(*obj->timer()));
+
+			if (synctime) {
+				data_timer_t *timer = get_timer(obj);
+
+				timer->set_synctime(synctime);
+				m_syncset.insert(*timer);
+			} else if (obj->timer()) {
+				obj->timer()->set_synctime(0);
+				put_timer(obj);
+			}
+		}
+
+		data_t *create_data(const unsigned char *id, const char *data, size_t size, size_t capacity,
+				const dnet_time &timestamp, uint64_t user_flags, bool remove_from_disk) {
+			capacity = std::max(size, capacity);
+
+			if (m_cache_size + capacity > max_size()) {
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize called from create_data\n", dnet_dump_id_str(id));
-				resize(size);
+				resize(capacity);
 				dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: resize finished from create_data\n", dnet_dump_id_str(id));
 			}
 
-			data_t *raw = new data_t(id, 0, data, size, remove_from_disk);
+			data_t *raw = new data_t(id, data, size, capacity, remove_from_disk);
+			raw->set_timestamp(timestamp);
+			raw->set_user_flags(user_flags);
 
-			m_cache_size += size;
+			add_size(raw->capacity());
 
 			m_lru.push_back(*raw);
-			return m_set.insert(*raw).first;
+			m_index.insert(raw);
+			return raw;
 		}
 
-		iset_t::iterator populate_from_disk(std::unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err) {
+		data_t *populate_from_disk(shard_guard_t &guard, const unsigned char *id, bool remove_from_disk, int *err) {
 			if (guard.owns_lock()) {
 				guard.unlock();
 			}
@@ -566,21 +990,27 @@ class cache_t {
 
 			guard.lock();
 
-			if (*err == 0) {
-				auto it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
-				it->set_user_flags(user_flags);
-				it->set_timestamp(timestamp);
+			// object could have been added while cache was unlocked
+			data_t *it = m_index.find(id);
+			if (it != NULL) {
+				*err = 0;
 				return it;
 			}
 
-			return m_set.end();
+			if (*err == 0) {
+				return create_data(id, reinterpret_cast<char *>(data.data()), data.size(), 0,
+						timestamp, user_flags, remove_from_disk);
+			}
+
+			return NULL;
 		}
 
 		void resize(size_t reserve) {
+			const size_t max_size = this->max_size();
 			size_t removed_size = 0;
 
 			for (auto it = m_lru.begin(); it != m_lru.end();) {
-				if (m_max_cache_size > m_cache_size + reserve + removed_size)
+				if (max_size > m_cache_size + reserve + removed_size)
 					break;
 
 				data_t *raw = &*it;
@@ -589,12 +1019,9 @@ class cache_t {
 				if (raw->synctime() || raw->remove_from_cache()) {
 					if (!raw->remove_from_cache()) {
 						raw->set_remove_from_cache(true);
-
-						m_syncset.erase(m_syncset.iterator_to(*raw));
-						raw->set_synctime(1);
-						m_syncset.insert(*raw);
+						set_synctime(raw, 1);
 					}
-					removed_size += raw->size();
+					removed_size += raw->capacity();
 				} else {
 					erase_element(raw);
 				}
@@ -603,27 +1030,24 @@ class cache_t {
 
 		void erase_element(data_t *obj) {
 			m_lru.erase(m_lru.iterator_to(*obj));
-			m_set.erase(m_set.iterator_to(*obj));
-			if (obj->lifetime())
-				m_lifeset.erase(m_lifeset.iterator_to(*obj));
+			m_index.erase(obj);
+			set_lifetime(obj, 0);
 
 			if (obj->synctime()) {
 				sync_element(obj);
-
-				m_syncset.erase(m_syncset.iterator_to(*obj));
-				obj->clear_synctime();
+				set_synctime(obj, 0);
 			}
 
-			m_cache_size -= obj->size();
+			sub_size(obj->capacity());
 
 			delete obj;
 		}
 
-		void sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp) {
+		void sync_element(const dnet_id &raw, bool after_append, const char *data, size_t size, uint64_t user_flags, const dnet_time &timestamp) {
 			local_session sess(m_node);
 			sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | (after_append ? DNET_IO_FLAGS_APPEND : 0));
 
-			int err = sess.write(raw, data.data(), data.size(), user_flags, timestamp);
+			int err = sess.write(raw, data, size, user_flags, timestamp);
 			if (err) {
 				dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: forced to sync to disk, err: %d\n", dnet_dump_id_str(raw.id), err);
 			} else {
@@ -636,15 +1060,14 @@ class cache_t {
 			memset(&raw, 0, sizeof(struct dnet_id));
 			memcpy(raw.id, obj->id().id, DNET_ID_SIZE);
 
-			auto &data = obj->data()->data();
+			raw_data_t *data = obj->raw();
 
-			sync_element(raw, obj->only_append(), data, obj->user_flags(), obj->timestamp());
+			sync_element(raw, obj->only_append(), data->data(), data->size(), obj->user_flags(), obj->timestamp());
 		}
 
-		void sync_after_append(std::unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj) {
-			std::shared_ptr<raw_data_t> raw_data = obj->data();
-			m_syncset.erase(m_syncset.iterator_to(*obj));
-			obj->set_synctime(0);
+		void sync_after_append(shard_guard_t &guard, bool lock_guard, data_t *obj) {
+			raw_data_ptr_t raw_data = obj->data();
+			set_synctime(obj, 0);
 
 			dnet_id id;
 			memset(&id, 0, sizeof(id));
@@ -660,9 +1083,7 @@ class cache_t {
 			local_session sess(m_node);
 			sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | DNET_IO_FLAGS_APPEND);
 
-			auto &raw = raw_data->data();
-
-			int err = sess.write(id, raw.data(), raw.size(), user_flags, timestamp);
+			int err = sess.write(id, raw_data->data(), raw_data->size(), user_flags, timestamp);
 			dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: sync after append, err: %d", dnet_dump_id_str(id.id), err);
 
 			if (lock_guard)
@@ -676,29 +1097,29 @@ class cache_t {
 				while (!m_need_exit && !m_lifeset.empty()) {
 					size_t time = ::time(NULL);
 
-					std::lock_guard<std::mutex> guard(m_lock);
+					shard_guard_t guard(this);
 
 					if (m_lifeset.empty())
 						break;
 
-					life_set_t::iterator it = m_lifeset.begin();
-					if (it->lifetime() > time)
+					data_t *obj = m_lifeset.begin()->obj();
+					if (obj->lifetime() > time)
 						break;
 
-					if (it->remove_from_disk()) {
+					if (obj->remove_from_disk()) {
 						struct dnet_id id;
 						memset(&id, 0, sizeof(struct dnet_id));
 
-						dnet_setup_id(&id, 0, (unsigned char *)it->id().id);
+						dnet_setup_id(&id, 0, (unsigned char *)obj->id().id);
 
 						remove.push_back(id);
 					}
 
-					erase_element(&(*it));
+					erase_element(obj);
 				}
 
 				dnet_id id;
-				std::vector<char> data;
+				raw_data_ptr_t data;
 				uint64_t user_flags;
 				dnet_time timestamp;
 
@@ -707,14 +1128,12 @@ class cache_t {
 				while (!m_need_exit && !m_syncset.empty()) {
 					size_t time = ::time(NULL);
 
-					std::unique_lock<std::mutex> guard(m_lock);
+					shard_guard_t guard(this);
 
 					if (m_syncset.empty())
 						break;
 
-					sync_set_t::iterator it = m_syncset.begin();
-
-					data_t *obj = &*it;
+					data_t *obj = m_syncset.begin()->obj();
 					if (obj->synctime() > time)
 						break;
 
@@ -724,24 +1143,24 @@ class cache_t {
 					}
 
 					memcpy(id.id, obj->id().id, DNET_ID_SIZE);
-					data = it->data()->data();
+					data = obj->data();
 					user_flags = obj->user_flags();
 					timestamp = obj->timestamp();
 
-					m_syncset.erase(it);
-					obj->clear_synctime();
+					set_synctime(obj, 0);
 
 					guard.unlock();
 					dnet_oplock(m_node, &id);
 
 					// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
-					sync_element(id, false, data, user_flags, timestamp);
+					sync_element(id, false, data->data(), data->size(), user_flags, timestamp);
+					data.reset();
 
 					dnet_opunlock(m_node, &id);
 					guard.lock();
 
-					auto jt = m_set.find(id.id);
-					if (jt != m_set.end()) {
+					data_t *jt = m_index.find(id.id);
+					if (jt != NULL) {
 						if (jt->remove_from_cache()) {
 							erase_element(&*jt);
 						}
@@ -752,6 +1171,10 @@ class cache_t {
 					dnet_remove_local(m_node, &(*it));
 				}
 
+				// objects which were synced above may be evicted now
+				if (!m_need_exit)
+					reclaim();
+
 				sleep(1);
 			}
 		}
@@ -759,9 +1182,10 @@ class cache_t {
 
 class cache_manager {
 	public:
-		cache_manager(struct dnet_node *n, int num = 16) {
-			for (int i  = 0; i < num; ++i) {
-				m_caches.emplace_back(std::make_shared<cache_t>(n, n->cache_size / num));
+		cache_manager(struct dnet_node *n) :
+		m_budget(n->cache_size, n->cache_shards) {
+			for (int i  = 0; i < n->cache_shards; ++i) {
+				m_caches.emplace_back(std::make_shared<cache_t>(n, std::ref(m_budget)));
 			}
 		}
 
@@ -773,11 +1197,15 @@ class cache_manager {
 		}
 
 		int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data) {
-			return m_caches[idx(id)]->write(id, st, cmd, io, data);
+			int err = m_caches[idx(id)]->write(id, st, cmd, io, data);
+			reclaim();
+			return err;
 		}
 
-		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
-			return m_caches[idx(id)]->read(id, cmd, io);
+		raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+			raw_data_ptr_t data = m_caches[idx(id)]->read(id, cmd, io);
+			reclaim();
+			return data;
 		}
 
 		int remove(const unsigned char *id, dnet_io_attr *io) {
@@ -785,7 +1213,9 @@ class cache_manager {
 		}
 
 		int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd) {
-			return m_caches[idx(id)]->lookup(id, st, cmd);
+			int err = m_caches[idx(id)]->lookup(id, st, cmd);
+			reclaim();
+			return err;
 		}
 
 		int indexes_find(dnet_cmd *cmd, dnet_indexes_request *request) {
@@ -806,12 +1236,55 @@ class cache_manager {
 			return -ENOTSUP;
 		}
 
+		void stat_fill(struct dnet_node *n, struct dnet_stat_count *counters) {
+			counters[DNET_CNTR_CACHE_SHARD_MAX_SIZE].count = m_budget.share();
+
+			for (size_t i = 0; i < m_caches.size(); ++i) {
+				cache_stat_t st = m_caches[i]->stat();
+
+				counters[DNET_CNTR_CACHE_SIZE].count += st.size;
+				counters[DNET_CNTR_CACHE_OBJECTS].count += st.objects;
+				counters[DNET_CNTR_CACHE_LOCK_CONTENDED].count += st.lock_contended;
+
+				if (i == 0 || st.size > counters[DNET_CNTR_CACHE_LARGEST_SHARD_SIZE].count) {
+					counters[DNET_CNTR_CACHE_LARGEST_SHARD_SIZE].count = st.size;
+					counters[DNET_CNTR_CACHE_LARGEST_SHARD_LOCK_CONTENDED].count = st.lock_contended;
+				}
+
+				dnet_log_raw(n, DNET_LOG_DEBUG, "cache: shard: %zd, size: %zd, objects: %zd, lock-contended: %llu\n",
+						i, st.size, st.objects, (unsigned long long)st.lock_contended);
+			}
+		}
+
 	private:
+		cache_budget_t m_budget;
 		std::vector<std::shared_ptr<cache_t>> m_caches;
 
+		/*
+		 * Shard which has grown up to its share may have pushed cache over its size,
+		 * shards which have borrowed that memory return it before the next command.
+		 * This is called without shard locks held, so shards never wait for each other.
+		 */
+		void reclaim() {
+			if (!m_budget.over())
+				return;
+
+			for (auto it(m_caches.begin()), end(m_caches.end()); it != end; ++it) {
+				(*it)->reclaim();
+			}
+		}
+
+		/*
+		 * Keys are frequently generated with common prefixes, mix words from different parts of the id.
+		 * Bytes 8..15 are used by shard hash index and are not used here.
+		 */
 		size_t idx(const unsigned char *id) {
-			unsigned i = *(unsigned *)id;
-			return i % m_caches.size();
+			uint64_t a, b;
+
+			memcpy(&a, id, sizeof(a));
+			memcpy(&b, id + 16, sizeof(b));
+
+			return (((a ^ b) * 0x9e3779b97f4a7c15ULL) >> 32) % m_caches.size();
 		}
 };
 
@@ -830,7 +1303,8 @@ int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dn
 	}
 
 	cache_manager *cache = (cache_manager *)n->cache;
-	std::shared_ptr<raw_data_t> d;
+	raw_data_ptr_t d;
+	struct dnet_io_buf *buf;
 
 	try {
 		switch (cmd->cmd) {
@@ -862,7 +1336,15 @@ int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dn
 					io->size = d->size() - io->offset;
 
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+
+				// send queue references payload instead of copying it, writers copy payload meanwhile
+				buf = d->io_buf();
+				if (buf) {
+					err = dnet_send_read_data_buf(st, cmd, io, buf, d->data() + io->offset);
+					dnet_io_buf_put(buf);
+				} else {
+					err = dnet_send_read_data(st, cmd, io, d->data() + io->offset, -1, io->offset, 0);
+				}
 				break;
 			case DNET_CMD_DEL:
 				err = cache->remove(cmd->id.id, io);
@@ -939,7 +1421,7 @@ int dnet_cache_init(struct dnet_node *n)
 		return 0;
 
 	try {
-		n->cache = (void *)(new cache_manager(n, 16));
+		n->cache = (void *)(new cache_manager(n));
 	} catch (const std::exception &e) {
 		dnet_log_raw(n, DNET_LOG_ERROR, "Could not create cache: %s\n", e.what());
 		return -ENOMEM;
@@ -953,3 +1435,9 @@ void dnet_cache_cleanup(struct dnet_node *n)
 	if (n->cache)
 		delete (cache_manager *)n->cache;
 }
+
+void dnet_cache_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters)
+{
+	if (n->cache)
+		((cache_manager *)n->cache)->stat_fill(n, counters);
+}
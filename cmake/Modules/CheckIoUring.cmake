@@ -0,0 +1,22 @@
+# Check whether kernel headers provide io_uring interface used by network engine
+# Sets variables:
+#  HAVE_IO_URING_SUPPORT - whether io_uring network engine can be built
+
+include(CheckCSourceCompiles)
+
+check_c_source_compiles("#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main()
+{
+    struct io_uring_params p;
+    long nr = __NR_io_uring_setup + __NR_io_uring_enter + __NR_io_uring_register;
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+    p.features = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    return IORING_OP_RECV + IORING_OP_SENDMSG + IORING_OP_SPLICE + IORING_OP_READ_FIXED +
+        IORING_ASYNC_CANCEL_ANY + (int)nr + (int)p.flags + (int)p.features;
+}" HAVE_IO_URING_SUPPORT)
+if (HAVE_IO_URING_SUPPORT)
+    add_definitions(-DHAVE_IO_URING_SUPPORT=1)
+endif()
+
+message(STATUS "io_uring support: ${HAVE_IO_URING_SUPPORT}")
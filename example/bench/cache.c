@@ -0,0 +1,467 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Cache hit (dnet_cmd_cache_io()) throughput benchmark.
+ *
+ * Cache-only objects are read by reader threads which hold shared oplock like command
+ * processing does, every reader sends replies over its own connection to a client
+ * which checks that every object is whole. Optional writer overwrites objects and
+ * adds new ones, so that cache evicts objects while readers run.
+ * Reports memory used per cached object, hits per second, misses and corrupted replies.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_WINDOW		64
+
+struct bench_conn {
+	struct dnet_net_state		*st;
+	int				s;
+	volatile unsigned long long	sent, received;
+	unsigned long long		corrupted;
+};
+
+static struct dnet_node *bench_node;
+static struct dnet_addr bench_addr;
+static struct bench_conn bench_conns[BENCH_MAX_THREADS + 1];
+static int bench_keys = 10000, bench_size = 512;
+static volatile int bench_stop;
+static unsigned long long bench_misses, bench_written;
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static int bench_read(int s, void *buf, size_t size)
+{
+	ssize_t err;
+	size_t off = 0;
+
+	while (off < size) {
+		err = read(s, buf + off, size - off);
+		if (err <= 0)
+			return -EPIPE;
+
+		off += err;
+	}
+
+	return 0;
+}
+
+static void bench_key_id(struct dnet_id *id, uint32_t key)
+{
+	int i;
+
+	memset(id, 0, sizeof(struct dnet_id));
+	for (i = 0; i < DNET_ID_SIZE; i += sizeof(key))
+		memcpy(id->id + i, &key, sizeof(key));
+}
+
+/* every word of the object is key and generation of the write which has stored it */
+static void bench_fill(uint64_t *data, uint32_t key, uint32_t gen)
+{
+	int i;
+
+	for (i = 0; i < bench_size / (int)sizeof(uint64_t); ++i)
+		data[i] = ((uint64_t)key << 32) | gen;
+}
+
+static int bench_check(struct dnet_io_attr *io, uint64_t *data, uint64_t size)
+{
+	uint32_t key;
+	uint64_t i;
+
+	memcpy(&key, io->id, sizeof(key));
+
+	if (size != (uint64_t)bench_size || (data[0] >> 32) != key)
+		return -EINVAL;
+
+	for (i = 1; i < size / sizeof(uint64_t); ++i) {
+		if (data[i] != data[0])
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void *bench_client(void *data)
+{
+	struct bench_conn *c = data;
+	struct dnet_io_attr *io;
+	struct dnet_cmd cmd;
+	/* write replies carry file info */
+	size_t size = sizeof(struct dnet_io_attr) + bench_size + 4096;
+	void *buf;
+
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+
+	io = buf;
+
+	while (!bench_read(c->s, &cmd, sizeof(struct dnet_cmd))) {
+		if (cmd.size > size)
+			break;
+		if (bench_read(c->s, buf, cmd.size))
+			break;
+
+		if (cmd.cmd != DNET_CMD_READ)
+			continue;
+
+		if (cmd.size < sizeof(struct dnet_io_attr) ||
+				bench_check(io, (uint64_t *)(io + 1), cmd.size - sizeof(struct dnet_io_attr)))
+			c->corrupted++;
+
+		c->received++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int bench_connect(int ls, struct sockaddr_in *sa, struct bench_conn *c)
+{
+	struct dnet_addr addr;
+	int ss, one = 1, err;
+
+	c->s = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->s < 0)
+		return -errno;
+
+	if (connect(c->s, (struct sockaddr *)sa, sizeof(struct sockaddr_in)) < 0) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	setsockopt(c->s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	ss = accept(ls, NULL, NULL);
+	if (ss < 0) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	dnet_set_sockopt(ss);
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	addr.family = AF_INET;
+
+	c->st = dnet_state_create(bench_node, 0, NULL, 0, &addr, ss, &err, 0, -1, dnet_state_net_process);
+	if (!c->st)
+		goto err_out_close;
+
+	return 0;
+
+err_out_close:
+	close(c->s);
+	return err;
+}
+
+static int bench_write_key(struct dnet_net_state *st, uint32_t key, uint32_t gen, uint64_t *data)
+{
+	struct dnet_io_attr io;
+	struct dnet_cmd cmd;
+	int err;
+
+	memset(&cmd, 0, sizeof(struct dnet_cmd));
+	bench_key_id(&cmd.id, key);
+	cmd.cmd = DNET_CMD_WRITE;
+
+	memset(&io, 0, sizeof(struct dnet_io_attr));
+	memcpy(io.id, cmd.id.id, DNET_ID_SIZE);
+	io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+	io.size = bench_size;
+
+	bench_fill(data, key, gen);
+
+	dnet_oplock(bench_node, &cmd.id);
+	err = dnet_cmd_cache_io(st, &cmd, &io, (char *)data);
+	dnet_opunlock(bench_node, &cmd.id);
+
+	return err;
+}
+
+static void *bench_reader(void *data)
+{
+	struct bench_conn *c = data;
+	unsigned int seed = (c - bench_conns) * 7919 + 1;
+	unsigned long long misses = 0;
+	struct dnet_io_attr io;
+	struct dnet_cmd cmd;
+	int err;
+
+	memset(&cmd, 0, sizeof(struct dnet_cmd));
+	cmd.cmd = DNET_CMD_READ;
+
+	while (!bench_stop) {
+		while (c->sent - c->received > BENCH_WINDOW && !bench_stop)
+			usleep(50);
+
+		bench_key_id(&cmd.id, rand_r(&seed) % bench_keys);
+		cmd.trans = c->sent;
+		cmd.flags = 0;
+
+		memset(&io, 0, sizeof(struct dnet_io_attr));
+		memcpy(io.id, cmd.id.id, DNET_ID_SIZE);
+		io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+
+		dnet_oplock_shared(bench_node, &cmd.id);
+		err = dnet_cmd_cache_io(c->st, &cmd, &io, NULL);
+		dnet_opunlock(bench_node, &cmd.id);
+
+		if (err) {
+			misses++;
+			continue;
+		}
+
+		c->sent++;
+	}
+
+	__sync_add_and_fetch(&bench_misses, misses);
+	return NULL;
+}
+
+/* overwrites hot objects with new generation and adds cold ones which push objects out of cache */
+static void *bench_writer(void *data)
+{
+	struct bench_conn *c = data;
+	unsigned int seed = 13;
+	uint32_t gen = 1, cold = bench_keys;
+	uint64_t *buf;
+
+	buf = malloc(bench_size);
+	if (!buf)
+		return NULL;
+
+	while (!bench_stop) {
+		if (bench_write_key(c->st, rand_r(&seed) % bench_keys, ++gen, buf))
+			break;
+		if (bench_write_key(c->st, cold++, 0, buf))
+			break;
+
+		bench_written += 2;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* resident memory of the process in bytes, it is grown by cached objects only while cache is filled */
+static long bench_rss(void)
+{
+	long pages, resident = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+
+	fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	pthread_t tids[BENCH_MAX_THREADS], clients[BENCH_MAX_THREADS + 1], tid;
+	unsigned long long hits = 0, corrupted = 0;
+	struct bench_conn *wc = &bench_conns[BENCH_MAX_THREADS];
+	struct dnet_log log;
+	struct dnet_config cfg;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int threads, writer = 0, seconds = 3;
+	double start, time, mem;
+	uint64_t *buf;
+	long rss;
+	int ls, i, err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <reader threads> [writer: 0 - off, 1 - on] [keys: %d] [size: %d] [seconds: %d]\n",
+				argv[0], bench_keys, bench_size, seconds);
+		return -EINVAL;
+	}
+
+	threads = atoi(argv[1]);
+	if (argc > 2)
+		writer = atoi(argv[2]);
+	if (argc > 3)
+		bench_keys = atoi(argv[3]);
+	if (argc > 4)
+		bench_size = atoi(argv[4]);
+	if (argc > 5)
+		seconds = atoi(argv[5]);
+
+	if (threads <= 0 || threads > BENCH_MAX_THREADS || bench_keys <= 0 ||
+			bench_size <= 0 || bench_size % sizeof(uint64_t)) {
+		fprintf(stderr, "Number of reader threads must be in [1, %d] range, number of keys positive "
+				"and object size a multiple of %zu\n", BENCH_MAX_THREADS, sizeof(uint64_t));
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+	/* all objects fit into cache twice, so only writer makes it evict them */
+	cfg.cache_size = 2ULL * bench_keys * bench_size;
+
+	bench_node = dnet_node_create(&cfg);
+	if (!bench_node)
+		return -ENOMEM;
+
+	/* write replies carry address of the node */
+	bench_node->addr_num = 1;
+	bench_node->addrs = &bench_addr;
+
+	err = dnet_locks_init(bench_node, 1024);
+	if (err)
+		return err;
+
+	err = dnet_cache_init(bench_node);
+	if (err)
+		return err;
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || listen(ls, BENCH_MAX_THREADS) ||
+			getsockname(ls, (struct sockaddr *)&sa, &salen)) {
+		err = -errno;
+		fprintf(stderr, "Failed to setup listening socket: %s [%d]\n", strerror(-err), err);
+		return err;
+	}
+
+	for (i = 0; i < threads; ++i) {
+		err = bench_connect(ls, &sa, &bench_conns[i]);
+		if (err) {
+			fprintf(stderr, "Failed to connect: %s [%d]\n", strerror(-err), err);
+			return err;
+		}
+
+		err = pthread_create(&clients[i], NULL, bench_client, &bench_conns[i]);
+		if (err)
+			return -err;
+	}
+
+	err = bench_connect(ls, &sa, wc);
+	if (err)
+		return err;
+
+	err = pthread_create(&clients[threads], NULL, bench_client, wc);
+	if (err)
+		return -err;
+
+	buf = malloc(bench_size);
+	if (!buf)
+		return -ENOMEM;
+
+	rss = bench_rss();
+
+	for (i = 0; i < bench_keys; ++i) {
+		err = bench_write_key(wc->st, i, 1, buf);
+		if (err) {
+			fprintf(stderr, "Failed to write object: %s [%d]\n", strerror(-err), err);
+			return err;
+		}
+	}
+
+	mem = (double)(bench_rss() - rss) / bench_keys;
+	printf("keys: %d, size: %d: %.1f bytes per cached object, overhead: %.1f bytes\n",
+			bench_keys, bench_size, mem, mem - bench_size);
+
+	start = bench_now();
+
+	for (i = 0; i < threads; ++i) {
+		err = pthread_create(&tids[i], NULL, bench_reader, &bench_conns[i]);
+		if (err)
+			return -err;
+	}
+
+	if (writer) {
+		err = pthread_create(&tid, NULL, bench_writer, wc);
+		if (err)
+			return -err;
+	}
+
+	sleep(seconds);
+	bench_stop = 1;
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+	if (writer)
+		pthread_join(tid, NULL);
+
+	time = bench_now() - start;
+
+	/* let clients check replies which are still in flight */
+	for (i = 0; i < threads; ++i) {
+		while (bench_conns[i].received < bench_conns[i].sent && bench_now() - start < time + 5)
+			usleep(1000);
+
+		hits += bench_conns[i].received;
+		corrupted += bench_conns[i].corrupted;
+	}
+
+	memset(counters, 0, sizeof(counters));
+	dnet_cache_stat_fill(bench_node, counters);
+
+	printf("threads: %d, writer: %d, keys: %d, size: %d: %.2f Mhits/s, misses: %llu, corrupted: %llu, "
+			"written: %llu, cached objects: %llu\n",
+			threads, writer, bench_keys, bench_size, hits / time / 1000000.0, bench_misses, corrupted,
+			bench_written, (unsigned long long)counters[DNET_CNTR_CACHE_OBJECTS].count);
+
+	/* node still has states with queued replies, do not wait for them */
+	fflush(stdout);
+	_exit(0);
+}
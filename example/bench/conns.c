@@ -0,0 +1,289 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Head-of-line blocking benchmark of multiple connections per node (net_conns option).
+ *
+ * Node reads from a fake remote node, which replies to every read with requested
+ * number of bytes. Small reads are sent every millisecond, every fifth of them
+ * is accompanied by a large read. Reports average latency of small and large
+ * transactions from DNET_CNTR_NET_{SMALL,LARGE}_TRANS counters.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+#define BENCH_SMALL_SIZE	100
+#define BENCH_REQUESTS		400
+
+static uint64_t bench_large_size = 32 << 20;
+static int bench_inflight;
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static int bench_write(int s, const void *buf, size_t size)
+{
+	ssize_t err;
+	size_t off = 0;
+
+	while (off < size) {
+		err = write(s, buf + off, size - off);
+		if (err <= 0)
+			return -errno;
+
+		off += err;
+	}
+
+	return 0;
+}
+
+static int bench_read(int s, void *buf, size_t size)
+{
+	ssize_t err;
+	size_t off = 0;
+
+	while (off < size) {
+		err = read(s, buf + off, size - off);
+		if (err <= 0)
+			return -EPIPE;
+
+		off += err;
+	}
+
+	return 0;
+}
+
+/* replies to reads with requested number of bytes, to other commands with a few bytes */
+static void *bench_remote_process(void *data)
+{
+	int s = (long)data;
+	struct dnet_io_attr *io;
+	struct dnet_cmd cmd;
+	char buf[4096];
+	uint64_t size;
+	void *reply;
+
+	reply = calloc(1, bench_large_size);
+	if (!reply)
+		goto out;
+
+	while (!bench_read(s, &cmd, sizeof(struct dnet_cmd))) {
+		if (cmd.size > sizeof(buf) || bench_read(s, buf, cmd.size))
+			break;
+
+		size = 16;
+		if (cmd.cmd == DNET_CMD_READ && cmd.size >= sizeof(struct dnet_io_attr)) {
+			io = (struct dnet_io_attr *)buf;
+			size = io->size ? io->size : bench_large_size;
+		}
+
+		cmd.trans |= DNET_TRANS_REPLY;
+		cmd.flags = 0;
+		cmd.status = 0;
+		cmd.size = size;
+
+		if (bench_write(s, &cmd, sizeof(struct dnet_cmd)) || bench_write(s, reply, size))
+			break;
+	}
+
+out:
+	free(reply);
+	close(s);
+	return NULL;
+}
+
+static void *bench_remote_accept(void *data)
+{
+	int ls = (long)data;
+	pthread_t tid;
+	int s;
+
+	while (1) {
+		s = accept(ls, NULL, NULL);
+		if (s < 0)
+			break;
+
+		if (pthread_create(&tid, NULL, bench_remote_process, (void *)(long)s)) {
+			close(s);
+			continue;
+		}
+
+		pthread_detach(tid);
+	}
+
+	return NULL;
+}
+
+static int bench_complete(struct dnet_net_state *st, struct dnet_cmd *cmd, void *priv __unused)
+{
+	if (is_trans_destroyed(st, cmd))
+		__sync_sub_and_fetch(&bench_inflight, 1);
+
+	return 0;
+}
+
+/* zero size reads the whole object, which is large */
+static int bench_send_read(struct dnet_net_state *st, uint64_t size)
+{
+	struct dnet_trans_control ctl;
+	struct dnet_io_attr io;
+	int err;
+
+	memset(&io, 0, sizeof(struct dnet_io_attr));
+	io.size = size;
+
+	memset(&ctl, 0, sizeof(struct dnet_trans_control));
+	ctl.cmd = DNET_CMD_READ;
+	ctl.cflags = DNET_FLAGS_NEED_ACK;
+	ctl.data = &io;
+	ctl.size = sizeof(struct dnet_io_attr);
+	ctl.complete = bench_complete;
+
+	__sync_add_and_fetch(&bench_inflight, 1);
+
+	err = dnet_trans_alloc_send_state(NULL, st, &ctl);
+	if (err)
+		__sync_sub_and_fetch(&bench_inflight, 1);
+
+	return err;
+}
+
+static double bench_avg_ms(struct dnet_stat_count *counters, int num, int time)
+{
+	if (!counters[num].count)
+		return 0;
+
+	return counters[time].count / 1000.0 / counters[num].count;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	struct dnet_net_state *st;
+	struct dnet_raw_id id;
+	struct dnet_addr addr;
+	struct dnet_log log;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	pthread_t tid;
+	int ls, s, i, policy = DNET_NET_CONNS_POLICY_SIZE, err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <connections> [policy: 0 - by size, 1 - round-robin] [large size: %llu]\n",
+				argv[0], (unsigned long long)bench_large_size);
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 2;
+	cfg.nonblocking_io_thread_num = 2;
+	cfg.net_thread_num = 2;
+	cfg.net_conns = atoi(argv[1]);
+	if (argc > 2)
+		policy = atoi(argv[2]);
+	if (argc > 3)
+		bench_large_size = strtoull(argv[3], NULL, 0);
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -ENOMEM;
+
+	dnet_set_net_conns_policy(n, policy, 0);
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || listen(ls, 64) ||
+			getsockname(ls, (struct sockaddr *)&sa, &salen)) {
+		err = -errno;
+		fprintf(stderr, "Failed to setup listening socket: %s [%d]\n", strerror(-err), err);
+		return err;
+	}
+
+	err = pthread_create(&tid, NULL, bench_remote_accept, (void *)(long)ls);
+	if (err)
+		return -err;
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	memcpy(addr.addr, &sa, sizeof(sa));
+	addr.addr_len = sizeof(sa);
+	addr.family = AF_INET;
+
+	s = dnet_socket_create_addr(n, &addr, 0);
+	if (s < 0)
+		return s;
+
+	memset(&id, 0, sizeof(struct dnet_raw_id));
+
+	st = dnet_state_create(n, 1, &id, 1, &addr, s, &err, 0, 0, dnet_state_net_process);
+	if (!st) {
+		fprintf(stderr, "Failed to create state: %s [%d]\n", strerror(-err), err);
+		return err;
+	}
+
+	/* additional connections are opened by reconnection thread */
+	for (i = 0; i < 300 && st->conn_num < cfg.net_conns - 1; ++i)
+		usleep(10000);
+
+	for (i = 0; i < BENCH_REQUESTS; ++i) {
+		if (i % 5 == 0)
+			bench_send_read(st, 0);
+		bench_send_read(st, BENCH_SMALL_SIZE);
+
+		usleep(1000);
+	}
+
+	while (bench_inflight)
+		usleep(1000);
+
+	memset(counters, 0, sizeof(counters));
+	dnet_node_get_counters(n, counters);
+
+	printf("connections: %d, policy: %d: small: %llu, avg: %.2f ms, large: %llu, avg: %.2f ms\n",
+			st->conn_num + 1, policy,
+			(unsigned long long)counters[DNET_CNTR_NET_SMALL_TRANS].count,
+			bench_avg_ms(counters, DNET_CNTR_NET_SMALL_TRANS, DNET_CNTR_NET_SMALL_TRANS_TIME),
+			(unsigned long long)counters[DNET_CNTR_NET_LARGE_TRANS].count,
+			bench_avg_ms(counters, DNET_CNTR_NET_LARGE_TRANS, DNET_CNTR_NET_LARGE_TRANS_TIME));
+
+	fflush(stdout);
+	_exit(0);
+}
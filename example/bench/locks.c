@@ -0,0 +1,160 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Oplock table (dnet_oplock()) scalability benchmark.
+ *
+ * Every thread locks and unlocks random keys out of given number of keys,
+ * every eighth key is also probed with dnet_optrylock(). When there are few keys,
+ * threads check that nobody else holds the key they have locked.
+ * Reports lock/unlock pairs per second and exclusion violations.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+#define BENCH_MAX_THREADS	256
+#define BENCH_CHECKED_KEYS	256
+
+static struct dnet_node *bench_node;
+static int bench_keys = 100000;
+static volatile int bench_stop;
+static unsigned long long bench_total, bench_violations;
+static int bench_inside[BENCH_CHECKED_KEYS];
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static void *bench_locker(void *data)
+{
+	unsigned int seed = (long)data * 7919 + 1;
+	unsigned long long done = 0, violations = 0;
+	struct dnet_id id;
+	unsigned int key;
+	int i;
+
+	memset(&id, 0, sizeof(struct dnet_id));
+
+	while (!bench_stop) {
+		key = rand_r(&seed) % bench_keys;
+		for (i = 0; i < DNET_ID_SIZE; i += sizeof(key))
+			memcpy(id.id + i, &key, sizeof(key));
+
+		dnet_oplock(bench_node, &id);
+		if (bench_keys <= BENCH_CHECKED_KEYS) {
+			if (__sync_add_and_fetch(&bench_inside[key], 1) != 1)
+				violations++;
+			__sync_sub_and_fetch(&bench_inside[key], 1);
+		}
+		dnet_opunlock(bench_node, &id);
+
+		if ((done & 7) == 0 && !dnet_optrylock(bench_node, &id))
+			dnet_opunlock(bench_node, &id);
+
+		done++;
+	}
+
+	__sync_add_and_fetch(&bench_total, done);
+	__sync_add_and_fetch(&bench_violations, violations);
+	return NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t tids[BENCH_MAX_THREADS];
+	struct dnet_log log;
+	struct dnet_config cfg;
+	int threads, seconds = 3;
+	double start, time;
+	int i, err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <threads> [keys: %d] [seconds: %d]\n",
+				argv[0], bench_keys, seconds);
+		return -EINVAL;
+	}
+
+	threads = atoi(argv[1]);
+	if (argc > 2)
+		bench_keys = atoi(argv[2]);
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+
+	if (threads <= 0 || threads > BENCH_MAX_THREADS || bench_keys <= 0) {
+		fprintf(stderr, "Number of threads must be in [1, %d] range and number of keys positive\n",
+				BENCH_MAX_THREADS);
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+
+	bench_node = dnet_node_create(&cfg);
+	if (!bench_node)
+		return -ENOMEM;
+
+	err = dnet_locks_init(bench_node, 1024);
+	if (err)
+		return err;
+
+	start = bench_now();
+
+	for (i = 0; i < threads; ++i) {
+		err = pthread_create(&tids[i], NULL, bench_locker, (void *)(long)i);
+		if (err)
+			return -err;
+	}
+
+	sleep(seconds);
+	bench_stop = 1;
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+
+	time = bench_now() - start;
+
+	printf("threads: %d, keys: %d: %.0f lock/unlock per second, exclusion violations: %llu\n",
+			threads, bench_keys, bench_total / time, bench_violations);
+
+	dnet_locks_destroy(bench_node);
+	dnet_node_destroy(bench_node);
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Loopback network engine benchmark.
+ *
+ * Every client thread keeps a window of commands with payload in flight over its own
+ * connection to the node, node acknowledges them from a trivial command handler.
+ * Reports acknowledged commands per second, send syscalls per command and
+ * network thread wakeups for the selected network engine.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+#define BENCH_MAX_CONNS		64
+#define BENCH_WINDOW		32
+
+static int bench_size = 4096;
+static volatile int bench_stop;
+static unsigned long long bench_total;
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static int bench_handler(void *state __unused, void *priv __unused, struct dnet_cmd *cmd __unused, void *data __unused)
+{
+	return 0;
+}
+
+static int bench_write(int s, const void *buf, size_t size)
+{
+	ssize_t err;
+	size_t off = 0;
+
+	while (off < size) {
+		err = write(s, buf + off, size - off);
+		if (err <= 0)
+			return -errno;
+
+		off += err;
+	}
+
+	return 0;
+}
+
+static int bench_read(int s, void *buf, size_t size)
+{
+	ssize_t err;
+	size_t off = 0;
+
+	while (off < size) {
+		err = read(s, buf + off, size - off);
+		if (err <= 0)
+			return -EPIPE;
+
+		off += err;
+	}
+
+	return 0;
+}
+
+static int bench_read_reply(int s, void *buf, size_t buf_size)
+{
+	struct dnet_cmd cmd;
+	uint64_t size;
+	int err;
+
+	err = bench_read(s, &cmd, sizeof(struct dnet_cmd));
+	if (err)
+		return err;
+
+	while (cmd.size) {
+		size = cmd.size > buf_size ? buf_size : cmd.size;
+
+		err = bench_read(s, buf, size);
+		if (err)
+			return err;
+
+		cmd.size -= size;
+	}
+
+	return 0;
+}
+
+static void *bench_client(void *data)
+{
+	int s = (long)data;
+	unsigned long long done = 0, trans = 0;
+	char reply[65536];
+	struct dnet_cmd *cmd;
+	void *req;
+	int i;
+
+	req = calloc(1, sizeof(struct dnet_cmd) + bench_size);
+	if (!req)
+		return NULL;
+
+	cmd = req;
+	cmd->cmd = DNET_CMD_BULK_READ;
+	cmd->flags = DNET_FLAGS_NEED_ACK;
+	cmd->size = bench_size;
+
+	for (i = 0; i < BENCH_WINDOW; ++i) {
+		cmd->trans = ++trans;
+		if (bench_write(s, req, sizeof(struct dnet_cmd) + bench_size))
+			goto out;
+	}
+
+	while (!bench_stop) {
+		if (bench_read_reply(s, reply, sizeof(reply)))
+			break;
+
+		done++;
+
+		cmd->trans = ++trans;
+		if (bench_write(s, req, sizeof(struct dnet_cmd) + bench_size))
+			break;
+	}
+
+out:
+	__sync_add_and_fetch(&bench_total, done);
+	free(req);
+	return NULL;
+}
+
+static int bench_connect(struct dnet_node *n, int ls, struct sockaddr_in *sa)
+{
+	struct dnet_net_state *st;
+	struct dnet_addr addr;
+	int cs, ss, one = 1, err;
+
+	cs = socket(AF_INET, SOCK_STREAM, 0);
+	if (cs < 0)
+		return -errno;
+
+	if (connect(cs, (struct sockaddr *)sa, sizeof(struct sockaddr_in)) < 0) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	setsockopt(cs, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	ss = accept(ls, NULL, NULL);
+	if (ss < 0) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	dnet_set_sockopt(ss);
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	addr.family = AF_INET;
+
+	st = dnet_state_create(n, 0, NULL, 0, &addr, ss, &err, 0, -1, dnet_state_net_process);
+	if (!st)
+		goto err_out_close;
+
+	return cs;
+
+err_out_close:
+	close(cs);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	struct dnet_backend_callbacks cb;
+	pthread_t tids[BENCH_MAX_CONNS];
+	struct dnet_log log;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int engine, conns = 8, seconds = 5;
+	int ls, s, i, err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <engine: 0 - epoll, 1 - io_uring> [size: %d] [connections: %d] [seconds: %d]\n",
+				argv[0], bench_size, conns, seconds);
+		return -EINVAL;
+	}
+
+	engine = atoi(argv[1]);
+	if (argc > 2)
+		bench_size = atoi(argv[2]);
+	if (argc > 3)
+		conns = atoi(argv[3]);
+	if (argc > 4)
+		seconds = atoi(argv[4]);
+
+	if (conns <= 0 || conns > BENCH_MAX_CONNS) {
+		fprintf(stderr, "Number of connections must be in [1, %d] range\n", BENCH_MAX_CONNS);
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.command_handler = bench_handler;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.cb = &cb;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 4;
+	cfg.nonblocking_io_thread_num = 4;
+	cfg.net_thread_num = 2;
+	cfg.net_engine = engine;
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -ENOMEM;
+
+	err = dnet_locks_init(n, 1024);
+	if (err)
+		return err;
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || listen(ls, BENCH_MAX_CONNS) ||
+			getsockname(ls, (struct sockaddr *)&sa, &salen)) {
+		err = -errno;
+		fprintf(stderr, "Failed to setup listening socket: %s [%d]\n", strerror(-err), err);
+		return err;
+	}
+
+	for (i = 0; i < conns; ++i) {
+		s = bench_connect(n, ls, &sa);
+		if (s < 0) {
+			fprintf(stderr, "Failed to connect: %s [%d]\n", strerror(-s), s);
+			return s;
+		}
+
+		err = pthread_create(&tids[i], NULL, bench_client, (void *)(long)s);
+		if (err)
+			return -err;
+	}
+
+	sleep(seconds);
+	bench_stop = 1;
+
+	for (i = 0; i < conns; ++i)
+		pthread_join(tids[i], NULL);
+
+	memset(counters, 0, sizeof(counters));
+	dnet_io_stat_fill(n, counters);
+
+	printf("engine: %d, size: %d, connections: %d: %.0f ops/s, send calls per op: %.2f, wakeups: %llu\n",
+			n->io->net_engine, bench_size, conns, bench_total / (double)seconds,
+			bench_total ? counters[DNET_CNTR_NET_SEND_CALLS].count / (double)bench_total : 0,
+			(unsigned long long)counters[DNET_CNTR_NET_WAKEUPS].count);
+
+	/* client threads are gone, but node still has states with queued replies, do not wait for them */
+	fflush(stdout);
+	_exit(0);
+}
@@ -0,0 +1,288 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Route lookup (dnet_state_get_first()) scalability benchmark.
+ *
+ * Node is connected to a number of fake remote nodes in two groups, every one of them
+ * owns a set of random IDs. Reader threads look up random IDs, optional churn thread
+ * keeps connecting and resetting additional nodes, so route snapshot is rebuilt
+ * and retired snapshots are reclaimed while readers run. Reports lookups per second.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_STATES		16
+#define BENCH_IDS		64
+
+static struct dnet_node *bench_node;
+static unsigned short bench_port;
+static int bench_addrs;
+static volatile int bench_stop;
+static unsigned long long bench_total, bench_misses, bench_churned;
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static void *bench_remote_process(void *data)
+{
+	int s = (long)data;
+	char buf[4096];
+
+	while (read(s, buf, sizeof(buf)) > 0)
+		;
+
+	close(s);
+	return NULL;
+}
+
+static void *bench_remote_accept(void *data)
+{
+	int ls = (long)data;
+	pthread_t tid;
+	int s;
+
+	while (1) {
+		s = accept(ls, NULL, NULL);
+		if (s < 0)
+			break;
+
+		if (pthread_create(&tid, NULL, bench_remote_process, (void *)(long)s)) {
+			close(s);
+			continue;
+		}
+
+		pthread_detach(tid);
+	}
+
+	return NULL;
+}
+
+static void bench_random_id(uint8_t *id, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < DNET_ID_SIZE; ++i)
+		id[i] = rand_r(seed);
+}
+
+/* every state gets its own loopback address, since route table keeps one state per address */
+static struct dnet_net_state *bench_state_create(int group, unsigned int *seed)
+{
+	struct dnet_raw_id ids[BENCH_IDS];
+	struct dnet_net_state *st;
+	struct sockaddr_in sa;
+	struct dnet_addr addr;
+	int i, k, s, err;
+
+	k = __sync_add_and_fetch(&bench_addrs, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = bench_port;
+	sa.sin_addr.s_addr = htonl(0x7f010000 | (k & 0xffff));
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	memcpy(addr.addr, &sa, sizeof(sa));
+	addr.addr_len = sizeof(sa);
+	addr.family = AF_INET;
+
+	for (i = 0; i < BENCH_IDS; ++i)
+		bench_random_id(ids[i].id, seed);
+
+	s = dnet_socket_create_addr(bench_node, &addr, 0);
+	if (s < 0)
+		return NULL;
+
+	st = dnet_state_create(bench_node, group, ids, BENCH_IDS, &addr, s, &err, 0, 0, dnet_state_net_process);
+	if (!st)
+		fprintf(stderr, "Failed to create state: %s [%d]\n", strerror(-err), err);
+
+	return st;
+}
+
+static void *bench_reader(void *data)
+{
+	unsigned int seed = (long)data;
+	unsigned long long done = 0, misses = 0;
+	struct dnet_net_state *st;
+	struct dnet_id id;
+	int k;
+
+	memset(&id, 0, sizeof(struct dnet_id));
+
+	while (!bench_stop) {
+		for (k = 0; k < 1000; ++k) {
+			bench_random_id(id.id, &seed);
+			id.group_id = 1 + (k & 1);
+
+			st = dnet_state_get_first(bench_node, &id);
+			if (!st) {
+				misses++;
+				continue;
+			}
+
+			dnet_state_put(st);
+		}
+
+		done += 1000;
+	}
+
+	__sync_add_and_fetch(&bench_total, done);
+	__sync_add_and_fetch(&bench_misses, misses);
+	return NULL;
+}
+
+static void *bench_churn(void *data __unused)
+{
+	struct dnet_net_state *st;
+	unsigned int seed = 77;
+
+	while (!bench_stop) {
+		st = bench_state_create(1 + (bench_churned & 1), &seed);
+		if (!st)
+			break;
+
+		usleep(500);
+
+		dnet_state_reset(st, -EUCLEAN);
+		bench_churned++;
+	}
+
+	return NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t tids[BENCH_MAX_THREADS], tid;
+	struct dnet_log log;
+	struct dnet_config cfg;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	unsigned int seed = 1;
+	int threads, churn = 0, seconds = 2;
+	double start, time;
+	int ls, i, err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <reader threads> [churn: 0 - off, 1 - on] [seconds: %d]\n",
+				argv[0], seconds);
+		return -EINVAL;
+	}
+
+	threads = atoi(argv[1]);
+	if (argc > 2)
+		churn = atoi(argv[2]);
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+
+	if (threads <= 0 || threads > BENCH_MAX_THREADS) {
+		fprintf(stderr, "Number of reader threads must be in [1, %d] range\n", BENCH_MAX_THREADS);
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+
+	bench_node = dnet_node_create(&cfg);
+	if (!bench_node)
+		return -ENOMEM;
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || listen(ls, 64) ||
+			getsockname(ls, (struct sockaddr *)&sa, &salen)) {
+		err = -errno;
+		fprintf(stderr, "Failed to setup listening socket: %s [%d]\n", strerror(-err), err);
+		return err;
+	}
+	bench_port = sa.sin_port;
+
+	err = pthread_create(&tid, NULL, bench_remote_accept, (void *)(long)ls);
+	if (err)
+		return -err;
+
+	for (i = 0; i < BENCH_STATES; ++i) {
+		if (!bench_state_create(1 + (i & 1), &seed))
+			return -ENOMEM;
+	}
+
+	start = bench_now();
+
+	for (i = 0; i < threads; ++i) {
+		err = pthread_create(&tids[i], NULL, bench_reader, (void *)(long)(i + 1));
+		if (err)
+			return -err;
+	}
+
+	if (churn) {
+		err = pthread_create(&tid, NULL, bench_churn, NULL);
+		if (err)
+			return -err;
+	}
+
+	sleep(seconds);
+	bench_stop = 1;
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+	if (churn)
+		pthread_join(tid, NULL);
+
+	time = bench_now() - start;
+
+	printf("threads: %d, churn: %d: %.2f Mlookups/s, misses: %llu, churned states: %llu\n",
+			threads, churn, bench_total / time / 1000000.0, bench_misses, bench_churned);
+
+	fflush(stdout);
+	_exit(0);
+}
@@ -0,0 +1,238 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Zero-copy read reply benchmark.
+ *
+ * Node sends read replies with the same payload to a client which drains the socket,
+ * either copying payload into send queue (dnet_send_read_data()) or queueing reference
+ * to it (dnet_send_read_data_buf()), the latter is how cache hits are sent.
+ * Reports replies and bytes per second and peak resident memory.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+static int bench_size = 1024 * 1024, bench_num = 2000;
+static unsigned long long bench_received;
+
+static void bench_log(void *priv __unused, int level __unused, const char *msg __unused)
+{
+}
+
+static void *bench_client(void *data)
+{
+	int s = (long)data;
+	unsigned long long need;
+	char buf[65536];
+	ssize_t err;
+
+	need = (unsigned long long)bench_num * (sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr) + bench_size);
+
+	while (bench_received < need) {
+		err = read(s, buf, sizeof(buf));
+		if (err <= 0)
+			break;
+
+		bench_received += err;
+	}
+
+	return NULL;
+}
+
+static struct dnet_net_state *bench_connect(struct dnet_node *n, int *client_socket)
+{
+	struct dnet_net_state *st = NULL;
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	struct dnet_addr addr;
+	int ls, cs, ss, err;
+
+	ls = socket(AF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		return NULL;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || listen(ls, 1) ||
+			getsockname(ls, (struct sockaddr *)&sa, &salen))
+		goto err_out_close_listen;
+
+	cs = socket(AF_INET, SOCK_STREAM, 0);
+	if (cs < 0)
+		goto err_out_close_listen;
+
+	if (connect(cs, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		goto err_out_close;
+
+	ss = accept(ls, NULL, NULL);
+	if (ss < 0)
+		goto err_out_close;
+
+	dnet_set_sockopt(ss);
+
+	memset(&addr, 0, sizeof(struct dnet_addr));
+	addr.family = AF_INET;
+
+	st = dnet_state_create(n, 0, NULL, 0, &addr, ss, &err, 0, -1, dnet_state_net_process);
+	if (!st)
+		goto err_out_close;
+
+	*client_socket = cs;
+	close(ls);
+	return st;
+
+err_out_close:
+	close(cs);
+err_out_close_listen:
+	close(ls);
+	return NULL;
+}
+
+/* peak resident memory of the process in bytes */
+static long bench_peak_rss(void)
+{
+	char line[128];
+	long peak = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "VmHWM: %ld kB", &peak) == 1)
+			break;
+	}
+
+	fclose(f);
+	return peak * 1024;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_net_state *st;
+	struct dnet_io_attr io;
+	struct dnet_cmd cmd;
+	struct dnet_io_buf *buf;
+	struct dnet_log log;
+	struct dnet_config cfg;
+	struct dnet_node *n;
+	pthread_t tid;
+	int zero_copy, s, i, err;
+	double start, time;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <send: 0 - copy, 1 - reference> [size: %d] [replies: %d]\n",
+				argv[0], bench_size, bench_num);
+		return -EINVAL;
+	}
+
+	zero_copy = atoi(argv[1]);
+	if (argc > 2)
+		bench_size = atoi(argv[2]);
+	if (argc > 3)
+		bench_num = atoi(argv[3]);
+
+	if (bench_size <= 0 || bench_num <= 0) {
+		fprintf(stderr, "Reply size and number of replies must be positive\n");
+		return -EINVAL;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.log_level = DNET_LOG_ERROR;
+	log.log = bench_log;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.log = &log;
+	cfg.wait_timeout = 60;
+	cfg.io_thread_num = 1;
+	cfg.nonblocking_io_thread_num = 1;
+	cfg.net_thread_num = 1;
+
+	n = dnet_node_create(&cfg);
+	if (!n)
+		return -ENOMEM;
+
+	st = bench_connect(n, &s);
+	if (!st) {
+		fprintf(stderr, "Failed to connect\n");
+		return -ECONNREFUSED;
+	}
+
+	buf = dnet_io_buf_alloc(bench_size);
+	if (!buf)
+		return -ENOMEM;
+	memset(dnet_io_buf_data(buf), 'x', bench_size);
+
+	err = pthread_create(&tid, NULL, bench_client, (void *)(long)s);
+	if (err)
+		return -err;
+
+	start = bench_now();
+
+	for (i = 0; i < bench_num; ++i) {
+		memset(&cmd, 0, sizeof(struct dnet_cmd));
+		cmd.cmd = DNET_CMD_READ;
+		cmd.trans = i;
+
+		memset(&io, 0, sizeof(struct dnet_io_attr));
+		io.size = bench_size;
+
+		if (zero_copy)
+			err = dnet_send_read_data_buf(st, &cmd, &io, buf, dnet_io_buf_data(buf));
+		else
+			err = dnet_send_read_data(st, &cmd, &io, dnet_io_buf_data(buf), -1, 0, 0);
+		if (err) {
+			fprintf(stderr, "Failed to send reply: %s [%d]\n", strerror(-err), err);
+			return err;
+		}
+	}
+
+	pthread_join(tid, NULL);
+
+	time = bench_now() - start;
+
+	printf("%s, size: %d: %.0f replies/s, %.2f GB/s, peak resident memory: %.1f MB\n",
+			zero_copy ? "reference" : "copy", bench_size, bench_num / time,
+			bench_received / time / 1000000000.0, bench_peak_rss() / 1000000.0);
+
+	/* node still has the state, do not wait for it */
+	fflush(stdout);
+	_exit(0);
+}
@@ -0,0 +1,187 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Object cache (dnet_slab_alloc()) versus malloc() benchmark.
+ *
+ * Cross-thread pass models IO thread queueing replies which are freed by network thread:
+ * producer allocates batches of objects, consumer frees them. Same-thread pass allocates
+ * and frees objects in one thread. Reports nanoseconds per alloc+free pair and
+ * cache hit counters.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elliptics.h"
+
+#define BENCH_BATCH		64
+
+static int bench_slab;
+static size_t bench_size = 256;
+static long bench_num = 4000000;
+
+static void *bench_batch[2][BENCH_BATCH];
+static int bench_full[2];
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_wait = PTHREAD_COND_INITIALIZER;
+
+static void *bench_alloc(void)
+{
+	void *ptr;
+
+	ptr = bench_slab ? dnet_slab_alloc(bench_size) : malloc(bench_size);
+	if (ptr)
+		memset(ptr, 0, 64);
+
+	return ptr;
+}
+
+static void bench_free(void *ptr)
+{
+	if (bench_slab)
+		dnet_slab_free(ptr);
+	else
+		free(ptr);
+}
+
+static void bench_batch_wait(int idx, int full)
+{
+	pthread_mutex_lock(&bench_lock);
+	while (bench_full[idx] != full)
+		pthread_cond_wait(&bench_wait, &bench_lock);
+	pthread_mutex_unlock(&bench_lock);
+}
+
+static void bench_batch_set(int idx, int full)
+{
+	pthread_mutex_lock(&bench_lock);
+	bench_full[idx] = full;
+	pthread_cond_broadcast(&bench_wait);
+	pthread_mutex_unlock(&bench_lock);
+}
+
+static void *bench_producer(void *data __unused)
+{
+	long i;
+	int k, idx = 0;
+
+	for (i = 0; i < bench_num / BENCH_BATCH; ++i, idx ^= 1) {
+		bench_batch_wait(idx, 0);
+
+		for (k = 0; k < BENCH_BATCH; ++k)
+			bench_batch[idx][k] = bench_alloc();
+
+		bench_batch_set(idx, 1);
+	}
+
+	return NULL;
+}
+
+static void *bench_consumer(void *data __unused)
+{
+	long i;
+	int k, idx = 0;
+
+	for (i = 0; i < bench_num / BENCH_BATCH; ++i, idx ^= 1) {
+		bench_batch_wait(idx, 1);
+
+		for (k = 0; k < BENCH_BATCH; ++k)
+			bench_free(bench_batch[idx][k]);
+
+		bench_batch_set(idx, 0);
+	}
+
+	return NULL;
+}
+
+static void bench_local(void)
+{
+	void *ptrs[32];
+	long i;
+	int k;
+
+	for (i = 0; i < bench_num; i += 32) {
+		for (k = 0; k < 32; ++k)
+			ptrs[k] = bench_alloc();
+		for (k = 0; k < 32; ++k)
+			bench_free(ptrs[k]);
+	}
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
+	pthread_t producer, consumer;
+	double start, cross, local;
+	int err;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <allocator: 0 - malloc, 1 - slab> [size: %zu] [objects: %ld]\n",
+				argv[0], bench_size, bench_num);
+		return -EINVAL;
+	}
+
+	bench_slab = atoi(argv[1]);
+	if (argc > 2)
+		bench_size = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		bench_num = strtol(argv[3], NULL, 0);
+
+	if (bench_size < 64 || bench_num < BENCH_BATCH) {
+		fprintf(stderr, "Object size must be at least 64 bytes and number of objects at least %d\n", BENCH_BATCH);
+		return -EINVAL;
+	}
+
+	start = bench_now();
+
+	err = pthread_create(&producer, NULL, bench_producer, NULL);
+	if (err)
+		return -err;
+
+	err = pthread_create(&consumer, NULL, bench_consumer, NULL);
+	if (err)
+		return -err;
+
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+
+	cross = bench_now();
+	bench_local();
+	local = bench_now();
+
+	memset(counters, 0, sizeof(counters));
+	dnet_slab_stat_fill(counters);
+
+	printf("%s, size: %zu: cross-thread: %.1f ns/op, same thread: %.1f ns/op, allocs: %llu, hits: %llu\n",
+			bench_slab ? "slab" : "malloc", bench_size,
+			(cross - start) * 1000000000.0 / bench_num, (local - cross) * 1000000000.0 / bench_num,
+			(unsigned long long)counters[DNET_CNTR_SLAB_ALLOCS].count,
+			(unsigned long long)counters[DNET_CNTR_SLAB_HITS].count);
+
+	return 0;
+}
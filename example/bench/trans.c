@@ -0,0 +1,176 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * In-flight transaction table versus rb-tree benchmark.
+ *
+ * Replies come back out of order, so every operation looks up random outstanding
+ * transaction, removes it and inserts new one with the next transaction number.
+ * Rb-tree variant is the one state used to keep transactions in.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elliptics.h"
+
+struct bench_rb_trans {
+	struct rb_node		entry;
+	uint64_t		trans;
+};
+
+static struct bench_rb_trans *bench_rb_search(struct rb_root *root, uint64_t trans)
+{
+	struct rb_node *n = root->rb_node;
+	struct bench_rb_trans *t;
+
+	while (n) {
+		t = rb_entry(n, struct bench_rb_trans, entry);
+
+		if (t->trans > trans)
+			n = n->rb_left;
+		else if (t->trans < trans)
+			n = n->rb_right;
+		else
+			return t;
+	}
+
+	return NULL;
+}
+
+static int bench_rb_insert(struct rb_root *root, struct bench_rb_trans *a)
+{
+	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct bench_rb_trans *t;
+
+	while (*n) {
+		parent = *n;
+		t = rb_entry(parent, struct bench_rb_trans, entry);
+
+		if (t->trans > a->trans)
+			n = &parent->rb_left;
+		else if (t->trans < a->trans)
+			n = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(&a->entry, parent, n);
+	rb_insert_color(&a->entry, root);
+	return 0;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dnet_trans_table table;
+	struct rb_root root = RB_ROOT;
+	struct bench_rb_trans *rb_trans, *rt;
+	struct dnet_trans *trans, *t;
+	uint64_t *outstanding, next;
+	double start, rb_time, table_time;
+	long i, ops = 4000000;
+	unsigned int seed;
+	int num, k;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <outstanding transactions> [operations: %ld]\n", argv[0], ops);
+		return -EINVAL;
+	}
+
+	num = atoi(argv[1]);
+	if (argc > 2)
+		ops = strtol(argv[2], NULL, 0);
+
+	if (num <= 0) {
+		fprintf(stderr, "Number of outstanding transactions must be positive\n");
+		return -EINVAL;
+	}
+
+	outstanding = malloc(num * sizeof(uint64_t));
+	rb_trans = calloc(num, sizeof(struct bench_rb_trans));
+	trans = calloc(num, sizeof(struct dnet_trans));
+	if (!outstanding || !rb_trans || !trans)
+		return -ENOMEM;
+
+	next = 1;
+	for (k = 0; k < num; ++k) {
+		rb_trans[k].trans = next++;
+		bench_rb_insert(&root, &rb_trans[k]);
+		outstanding[k] = rb_trans[k].trans;
+	}
+
+	seed = 1;
+	start = bench_now();
+	for (i = 0; i < ops; ++i) {
+		k = rand_r(&seed) % num;
+
+		rt = bench_rb_search(&root, outstanding[k]);
+		rb_erase(&rt->entry, &root);
+
+		rt->trans = next++;
+		bench_rb_insert(&root, rt);
+		outstanding[k] = rt->trans;
+	}
+	rb_time = bench_now() - start;
+
+	memset(&table, 0, sizeof(struct dnet_trans_table));
+
+	next = 1;
+	for (k = 0; k < num; ++k) {
+		trans[k].trans = next++;
+		atomic_init(&trans[k].refcnt, 1);
+		INIT_LIST_HEAD(&trans[k].trans_list_entry);
+
+		if (dnet_trans_insert_nolock(&table, &trans[k]))
+			return -ENOMEM;
+		outstanding[k] = trans[k].trans;
+	}
+
+	seed = 1;
+	start = bench_now();
+	for (i = 0; i < ops; ++i) {
+		k = rand_r(&seed) % num;
+
+		t = dnet_trans_search(&table, outstanding[k]);
+		atomic_dec(&t->refcnt);
+		dnet_trans_remove_nolock(&table, t);
+
+		t->trans = next++;
+		dnet_trans_insert_nolock(&table, t);
+		outstanding[k] = t->trans;
+	}
+	table_time = bench_now() - start;
+
+	printf("outstanding: %d: rb-tree: %.1f ns/op, hash table: %.1f ns/op, table size: %u\n",
+			num, rb_time * 1000000000.0 / ops, table_time * 1000000000.0 / ops, table.size);
+
+	dnet_trans_table_free(&table);
+	free(trans);
+	free(rb_trans);
+	free(outstanding);
+
+	return 0;
+}
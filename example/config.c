@@ -84,6 +84,8 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.check_timeout = value;
 	else if (!strcmp(key, "cache_sync_timeout"))
 		dnet_cur_cfg_data->cfg_state.cache_sync_timeout = value;
+	else if (!strcmp(key, "cache_shards"))
+		dnet_cur_cfg_data->cfg_state.cache_shards = value;
 	else if (!strcmp(key, "stall_count"))
 		dnet_cur_cfg_data->cfg_state.stall_count = value;
 	else if (!strcmp(key, "join"))
@@ -96,8 +98,30 @@ static int dnet_simple_set(struct dnet_config_backend *b __unused, char *key, ch
 		dnet_cur_cfg_data->cfg_state.io_thread_num = value;
 	else if (!strcmp(key, "nonblocking_io_thread_num"))
 		dnet_cur_cfg_data->cfg_state.nonblocking_io_thread_num = value;
+	else if (!strcmp(key, "io_thread_num_max"))
+		dnet_cur_cfg_data->cfg_state.io_thread_num_max = value;
+	else if (!strcmp(key, "nonblocking_io_thread_num_max"))
+		dnet_cur_cfg_data->cfg_state.nonblocking_io_thread_num_max = value;
 	else if (!strcmp(key, "net_thread_num"))
 		dnet_cur_cfg_data->cfg_state.net_thread_num = value;
+	else if (!strcmp(key, "net_events_batch"))
+		dnet_cur_cfg_data->net_events_batch = value;
+	else if (!strcmp(key, "io_queue_limit"))
+		dnet_cur_cfg_data->cfg_state.io_queue_limit = value;
+	else if (!strcmp(key, "io_queue_kb_limit"))
+		dnet_cur_cfg_data->cfg_state.io_queue_kb_limit = value;
+	else if (!strcmp(key, "io_queue_policy"))
+		dnet_cur_cfg_data->io_queue_policy = value;
+	else if (!strcmp(key, "net_engine"))
+		dnet_cur_cfg_data->cfg_state.net_engine = value;
+	else if (!strcmp(key, "net_conns"))
+		dnet_cur_cfg_data->cfg_state.net_conns = value;
+	else if (!strcmp(key, "net_conns_policy"))
+		dnet_cur_cfg_data->net_conns_policy = value;
+	else if (!strcmp(key, "net_large_size"))
+		dnet_cur_cfg_data->net_large_size = value;
+	else if (!strcmp(key, "net_slice_size"))
+		dnet_cur_cfg_data->cfg_state.net_slice_size = value;
 	else if (!strcmp(key, "bg_ionice_class"))
 		dnet_cur_cfg_data->cfg_state.bg_ionice_class = value;
 	else if (!strcmp(key, "bg_ionice_prio"))
@@ -336,12 +360,43 @@ static int dnet_set_cache_size(struct dnet_config_backend *b __unused, char *key
 	return 0;
 }
 
+/*
+ * Space separated list of command names which take shared oplock, 'none' makes all of them exclusive
+ */
+static int dnet_set_oplock_shared(struct dnet_config_backend *b __unused, char *key __unused, char *value)
+{
+	unsigned int mask = DNET_OPLOCK_SHARED_NONE;
+	char *token, *saveptr;
+	int cmd;
+
+	for (token = strtok_r(value, " ,", &saveptr); token; token = strtok_r(NULL, " ,", &saveptr)) {
+		if (!strcasecmp(token, "none"))
+			continue;
+
+		for (cmd = 1; cmd < DNET_CMD_UNKNOWN; ++cmd) {
+			if (!strcasecmp(token, dnet_cmd_string(cmd)))
+				break;
+		}
+
+		if (cmd == DNET_CMD_UNKNOWN) {
+			dnet_backend_log(DNET_LOG_ERROR, "cnf: unknown oplock_shared command: %s\n", token);
+			return -EINVAL;
+		}
+
+		mask |= 1U << cmd;
+	}
+
+	dnet_cur_cfg_data->cfg_state.oplock_shared = mask;
+	return 0;
+}
+
 static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"mallopt_mmap_threshold", dnet_set_malloc_options},
 	{"log_level", dnet_simple_set},
 	{"wait_timeout", dnet_simple_set},
 	{"check_timeout", dnet_simple_set},
 	{"cache_sync_timeout", dnet_simple_set},
+	{"cache_shards", dnet_simple_set},
 	{"stall_count", dnet_simple_set},
 	{"group", dnet_set_group},
 	{"addr", dnet_set_addr},
@@ -354,7 +409,18 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"history", dnet_set_history_env},
 	{"io_thread_num", dnet_simple_set},
 	{"nonblocking_io_thread_num", dnet_simple_set},
+	{"io_thread_num_max", dnet_simple_set},
+	{"nonblocking_io_thread_num_max", dnet_simple_set},
 	{"net_thread_num", dnet_simple_set},
+	{"net_events_batch", dnet_simple_set},
+	{"io_queue_limit", dnet_simple_set},
+	{"io_queue_kb_limit", dnet_simple_set},
+	{"io_queue_policy", dnet_simple_set},
+	{"net_engine", dnet_simple_set},
+	{"net_conns", dnet_simple_set},
+	{"net_conns_policy", dnet_simple_set},
+	{"net_large_size", dnet_simple_set},
+	{"net_slice_size", dnet_simple_set},
 	{"bg_ionice_class", dnet_simple_set},
 	{"bg_ionice_prio", dnet_simple_set},
 	{"removal_delay", dnet_simple_set},
@@ -364,6 +430,7 @@ static struct dnet_config_entry dnet_cfg_entries[] = {
 	{"srw_config", dnet_set_srw},
 	{"cache_size", dnet_set_cache_size},
 	{"indexes_shard_count", dnet_simple_set},
+	{"oplock_shared", dnet_set_oplock_shared},
 };
 
 static int dnet_set_backend(struct dnet_config_backend *current_backend __unused, char *key __unused, char *value)
@@ -72,6 +72,17 @@
 
 #define DNET_DEFAULT_INDEXES_SHARD_COUNT 16
 
+/*
+ * Default number of cache shards per online CPU, every shard has its own lifetime and sync thread,
+ * so default number of shards is capped
+ */
+#define DNET_DEFAULT_CACHE_SHARDS_PER_CPU 4
+#define DNET_DEFAULT_CACHE_SHARDS_MAX 16
+
+#define DNET_DEFAULT_NET_EVENTS_BATCH 64
+
+#define DNET_DEFAULT_NET_LARGE_SIZE (1024 * 1024)
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #undef offsetof
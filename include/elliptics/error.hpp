@@ -63,6 +63,13 @@ class no_such_address_error : public error
 		explicit no_such_address_error(const std::string &message) throw();
 };
 
+// Node's IO queue is full, request can be retried on another replica
+class busy_error : public error
+{
+	public:
+		explicit busy_error(const std::string &message) throw();
+};
+
 class error_info
 {
 	public:
@@ -162,6 +162,23 @@ int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 int __attribute__((weak)) dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
 		void *data, int fd, uint64_t offset, int on_exit);
 
+/*
+ * Reference counted data buffer.
+ * It is queued into send queue without copying its content, @destroy is called
+ * with @priv as parameter when the last reference is dropped.
+ *
+ * dnet_io_buf_alloc() allocates buffer together with its data.
+ */
+struct dnet_io_buf;
+
+struct dnet_io_buf * __attribute__((weak)) dnet_io_buf_create(void *data, size_t size,
+		void (* destroy)(void *priv), void *priv);
+struct dnet_io_buf * __attribute__((weak)) dnet_io_buf_alloc(size_t size);
+void * __attribute__((weak)) dnet_io_buf_data(struct dnet_io_buf *buf);
+size_t __attribute__((weak)) dnet_io_buf_size(struct dnet_io_buf *buf);
+struct dnet_io_buf * __attribute__((weak)) dnet_io_buf_get(struct dnet_io_buf *buf);
+void __attribute__((weak)) dnet_io_buf_put(struct dnet_io_buf *buf);
+
 /*
  * Reads given file from the storage. If there are multiple transformation functions,
  * they will be tried one after another.
@@ -188,6 +205,14 @@ int dnet_read_file(struct dnet_session *s, const char *file, const void *remote,
  */
 int dnet_write_object(struct dnet_session *s, struct dnet_io_control *ctl);
 
+/*
+ * Works the same way as dnet_write_object(), but @ctl->data is hosted by reference counted @buf,
+ * whose reference is queued into send queue instead of copying the data.
+ * Data must not be modified until the write is completed.
+ */
+int __attribute__((weak)) dnet_write_object_buf(struct dnet_session *s, struct dnet_io_control *ctl,
+		struct dnet_io_buf *buf);
+
 /*
  * Sends given file to the remote nodes and waits until all of them ack the write.
  *
@@ -395,8 +420,80 @@ struct dnet_config
 
 	int			cache_sync_timeout;
 
+	/*
+	 * Fields below took space of former reserved_for_future_use[11],
+	 * so offsets of preceding fields and size of the structure did not change.
+	 * Rarely tuned network and IO queue knobs are set by dnet_set_net_events_batch(),
+	 * dnet_set_net_conns_policy() and dnet_set_io_queue_policy() instead.
+	 */
+
+	/*
+	 * Maximum number of threads blocking and nonblocking IO pools can grow to
+	 * under sustained load, they are shrunk back to io_thread_num and
+	 * nonblocking_io_thread_num when idle. Zero disables autoscaling.
+	 */
+	int			io_thread_num_max;
+	int			nonblocking_io_thread_num_max;
+
+	/*
+	 * Maximum number of requests and kilobytes of their data queued to every IO pool,
+	 * zero means no limit.
+	 */
+	int			io_queue_limit;
+	int			io_queue_kb_limit;
+
+	/*
+	 * Network engine (enum dnet_net_engine) used by network threads
+	 */
+	int			net_engine;
+
+	/*
+	 * Number of connections opened to every remote node, IO requests are spread over them
+	 * according to policy set by dnet_set_net_conns_policy().
+	 */
+	int			net_conns;
+
+	/*
+	 * IO replies with more than @net_slice_size bytes of payload are sent in slices of that size
+	 * interleaved with other replies, zero disables slicing. Receivers must support DNET_FLAGS_SLICE.
+	 */
+	int			net_slice_size;
+
+	/*
+	 * Number of independently locked cache shards, zero selects DNET_DEFAULT_CACHE_SHARDS_PER_CPU
+	 * shards per online CPU, but not more than DNET_DEFAULT_CACHE_SHARDS_MAX
+	 */
+	int			cache_shards;
+
+	/*
+	 * Commands which take shared oplock on their key, bit (1U << cmd) per command,
+	 * other commands take exclusive one. Zero selects DNET_OPLOCK_SHARED_DEFAULT.
+	 */
+	int			oplock_shared;
+
 	/* so that we do not change major version frequently */
-	int			reserved_for_future_use[11];
+	int			reserved_for_future_use[2];
+};
+
+#define DNET_OPLOCK_SHARED_NONE		(1U << 0)	/* no command number, makes every command exclusive */
+#define DNET_OPLOCK_SHARED_DEFAULT	((1U << DNET_CMD_READ) | (1U << DNET_CMD_LOOKUP) | \
+					 (1U << DNET_CMD_BULK_READ) | (1U << DNET_CMD_INDEXES_FIND))
+
+enum dnet_net_conns_policy {
+	DNET_NET_CONNS_POLICY_SIZE = 0,		/* small requests use the first connection, large ones the rest */
+	DNET_NET_CONNS_POLICY_ROUND_ROBIN,	/* IO requests are spread over all connections */
+};
+
+enum dnet_net_engine {
+	DNET_NET_ENGINE_EPOLL = 0,		/* readiness notifications, nonblocking syscalls */
+	DNET_NET_ENGINE_URING,			/* receives and sends are submitted to io_uring, experimental,
+						 * slower than epoll for requests of 64K and more */
+};
+
+enum dnet_io_queue_policy {
+	DNET_IO_QUEUE_POLICY_BACKPRESSURE = 0,	/* stop reading from client connections which send new commands,
+						 * hold new commands from joined nodes */
+	DNET_IO_QUEUE_POLICY_REJECT,		/* reply -EBUSY to new commands */
 };
 
 struct dnet_node *dnet_get_node_from_state(void *state);
@@ -420,6 +517,8 @@ void dnet_session_set_user_flags(struct dnet_session *s, uint64_t user_flags);
 uint64_t dnet_session_get_user_flags(struct dnet_session *s);
 
 void dnet_session_set_timeout(struct dnet_session *s, unsigned int wait_timeout);
+/* transaction timeout in milliseconds, transactions are timed out with millisecond precision */
+void dnet_session_set_timeout_ms(struct dnet_session *s, unsigned int wait_timeout_ms);
 struct timespec *dnet_session_get_timeout(struct dnet_session *s);
 
 int dnet_session_set_ns(struct dnet_session *s, const char *ns, int nsize);
@@ -710,6 +809,13 @@ static inline int dnet_id_cmp(const struct dnet_id *id1, const struct dnet_id *i
 int __attribute__((weak)) dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more);
 int __attribute__((weak)) dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more);
 
+/*
+ * The same as dnet_send_reply(), but @odata lives in reference counted @buf,
+ * which is referenced by the send queue instead of copying.
+ */
+int __attribute__((weak)) dnet_send_reply_buf(void *state, struct dnet_cmd *cmd, struct dnet_io_buf *buf,
+		void *odata, unsigned int size, int more);
+
 
 /*
  * Request statistics from the node corresponding to given ID.
@@ -824,6 +930,11 @@ void dnet_indexes_transform_index_id(struct dnet_node *node, const struct dnet_r
 int dnet_indexes_get_shard_id(struct dnet_node *node, const struct dnet_raw_id *object_id);
 int dnet_node_get_indexes_shard_count(struct dnet_node *node);
 
+/*
+ * Copies node's statistics counters, @counters must have __DNET_CNTR_MAX entries
+ */
+void dnet_node_get_counters(struct dnet_node *node, struct dnet_stat_count *counters);
+
 int dnet_lookup_addr(struct dnet_session *s, const void *remote, int len, struct dnet_id *id, int group_id, char *dst, int dlen);
 
 struct dnet_id_param {
@@ -938,6 +1049,32 @@ int dnet_send_cmd(struct dnet_session *s,
 int dnet_flags(struct dnet_node *n);
 void dnet_set_timeouts(struct dnet_node *n, int wait_timeout, int check_timeout);
 
+/*
+ * Maximum number of ready events harvested by network thread per epoll_wait() call,
+ * zero or negative value selects DNET_DEFAULT_NET_EVENTS_BATCH.
+ */
+void dnet_set_net_events_batch(struct dnet_node *n, int batch);
+
+/*
+ * IO requests are spread over net_conns connections according to @policy (enum dnet_net_conns_policy),
+ * requests which send or are expected to receive at least @large_size bytes are large,
+ * zero @large_size selects DNET_DEFAULT_NET_LARGE_SIZE.
+ */
+void dnet_set_net_conns_policy(struct dnet_node *n, int policy, uint64_t large_size);
+
+/*
+ * What happens when IO pool queue limit is reached (enum dnet_io_queue_policy)
+ */
+void dnet_set_io_queue_policy(struct dnet_node *n, int policy);
+
+/*
+ * Change maximum number of threads blocking and nonblocking IO pools can be autoscaled to,
+ * non-positive value leaves it unchanged. Current limits and numbers of threads are returned
+ * in the same pointers. Pools are actually resized by stall-check thread.
+ */
+void dnet_update_io_threads(struct dnet_node *n, int *io_thread_max, int *nonblocking_io_thread_max,
+		int *io_thread_num, int *nonblocking_io_thread_num);
+
 #define DNET_CONF_ADDR_DELIM	':'
 int dnet_parse_addr(char *addr, int *portp, int *familyp);
 
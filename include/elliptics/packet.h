@@ -92,6 +92,41 @@ enum dnet_counters {
 	DNET_CNTR_DBR_ERROR,			/* Kyoto Cabinet DB read error */
 	DNET_CNTR_DBW_SYSTEM,			/* Kyoto Cabinet DB write error KCESYSTEM */
 	DNET_CNTR_DBW_ERROR,			/* Kyoto Cabinet DB write error */
+	DNET_CNTR_NET_WAKEUPS,			/* Number of network threads wakeups with ready events */
+	DNET_CNTR_NET_EVENTS,			/* Number of events harvested by network threads */
+	DNET_CNTR_NET_FULL_BATCHES,		/* Number of wakeups which filled the whole events batch */
+	DNET_CNTR_NET_SEND_CALLS,		/* Number of send syscalls (sendmsg/sendfile) issued by network threads */
+	DNET_CNTR_NET_SEND_BYTES,		/* Number of bytes sent by network threads */
+	DNET_CNTR_NET_SEND_REQUESTS,		/* Number of commands and replies completely sent */
+	DNET_CNTR_IO_INTERACTIVE_REQUESTS,	/* Number of interactive class requests processed by IO pools */
+	DNET_CNTR_IO_INTERACTIVE_WAIT,		/* Time interactive class requests waited in IO pool queues, usecs */
+	DNET_CNTR_IO_WRITE_REQUESTS,		/* Number of write class requests processed by IO pools */
+	DNET_CNTR_IO_WRITE_WAIT,		/* Time write class requests waited in IO pool queues, usecs */
+	DNET_CNTR_IO_BACKGROUND_REQUESTS,	/* Number of background class requests processed by IO pools */
+	DNET_CNTR_IO_BACKGROUND_WAIT,		/* Time background class requests waited in IO pool queues, usecs */
+	DNET_CNTR_IO_EXPIRED,			/* Number of commands dropped because their deadline passed in queue */
+	DNET_CNTR_IO_QUEUE_REJECTS,		/* Number of commands rejected with -EBUSY because IO queue was full */
+	DNET_CNTR_IO_QUEUE_PAUSES,		/* Number of times reading from connection was paused or command was held because IO queue was full */
+	DNET_CNTR_NET_SMALL_TRANS,		/* Number of completed small IO transactions sent by this node */
+	DNET_CNTR_NET_SMALL_TRANS_TIME,		/* Time small IO transactions took to complete, usecs */
+	DNET_CNTR_NET_LARGE_TRANS,		/* Number of completed large IO transactions sent by this node */
+	DNET_CNTR_NET_LARGE_TRANS_TIME,		/* Time large IO transactions took to complete, usecs */
+	DNET_CNTR_NET_SEND_SLICES,		/* Number of slices large replies were sent in */
+	DNET_CNTR_SLAB_ALLOCS,			/* Number of transaction and IO request allocations */
+	DNET_CNTR_SLAB_HITS,			/* Number of allocations served from object cache */
+	DNET_CNTR_SLAB_LARGE,			/* Number of allocations too large for object cache */
+	DNET_CNTR_NET_FORWARDS,			/* Number of commands forwarded to the node which owns their key */
+	DNET_CNTR_NET_REDIRECTS,		/* Number of redirect replies sent instead of forwarding commands */
+	DNET_CNTR_NET_REDIRECTED,		/* Number of commands resent to another node after redirect reply */
+	DNET_CNTR_OPLOCK_WAITS,			/* Number of times key lock had to wait for another holder */
+	DNET_CNTR_OPLOCK_WAITERS,		/* Number of commands waiting for key locks now */
+	DNET_CNTR_OPLOCK_KEY_WAITERS,		/* Largest number of commands waiting for a single key now */
+	DNET_CNTR_CACHE_SIZE,			/* Memory held by cached payloads */
+	DNET_CNTR_CACHE_OBJECTS,		/* Number of objects in cache */
+	DNET_CNTR_CACHE_SHARD_MAX_SIZE,		/* Cache size every shard may keep when the whole cache is full */
+	DNET_CNTR_CACHE_LOCK_CONTENDED,		/* Number of times cache shard lock was held by another thread */
+	DNET_CNTR_CACHE_LARGEST_SHARD_SIZE,	/* Memory held by the largest cache shard */
+	DNET_CNTR_CACHE_LARGEST_SHARD_LOCK_CONTENDED,	/* Number of times the largest cache shard lock was held by another thread */
 	DNET_CNTR_UNKNOWN,			/* This slot is allocated for statistics gathered for unknown counters */
 	__DNET_CNTR_MAX,
 };
@@ -131,6 +166,33 @@ enum dnet_counters {
 /* Currently only valid flag for LOOKUP command - when set, don't check fileinfo in cache */
 #define DNET_FLAGS_NOCACHE		(1<<6)
 
+/* Low priority request (like recovery traffic), it is queued behind client requests in IO pool */
+#define DNET_FLAGS_BACKGROUND		(1<<7)
+
+/*
+ * Command data is prefixed with struct dnet_time, which holds time client waits for reply.
+ * Node replies with -ETIMEDOUT without processing the command, if it has been queued longer than that.
+ * Must not be sent to nodes which do not support it.
+ */
+#define DNET_FLAGS_DEADLINE		(1<<8)
+
+/*
+ * Reply is sent in slices, this one is not the last. Payloads of all slices are concatenated
+ * by the receiver and processed as single reply with flags and status of the last slice.
+ * Only IO replies are sliced, the first slice starts with struct dnet_io_attr of the whole reply.
+ */
+#define DNET_FLAGS_SLICE		(1<<9)
+
+/*
+ * Command data is prefixed with struct dnet_route_version (after deadline prefix if both are set),
+ * which holds route table version of the receiving node client has synced with, zero disables redirect.
+ * Node which does not own the key and whose route table has changed since then does not forward
+ * the command, but replies with -ESTALE status and this flag. Reply data is its current route table version
+ * followed by route list entries of the owner and of states changed since client's version.
+ * Must not be sent to nodes which do not support it.
+ */
+#define DNET_FLAGS_ROUTE_VERSION	(1<<10)
+
 struct dnet_id {
 	uint8_t			id[DNET_ID_SIZE];
 	uint32_t		group_id;
@@ -239,6 +301,23 @@ static inline void dnet_convert_addr_cmd(struct dnet_addr_cmd *acmd)
 	dnet_convert_cmd(&acmd->cmd);
 }
 
+/*
+ * Route list request asks for states which have been added to the route table of the remote node
+ * since given @version, zero means all of them. The same structure is sent as the last reply
+ * and carries current version of the replying node's route table.
+ * Nodes which do not send it reply with the whole route table.
+ */
+struct dnet_route_version
+{
+	uint64_t		version;
+	uint64_t		reserved[3];
+} __attribute__ ((packed));
+
+static inline void dnet_convert_route_version(struct dnet_route_version *v)
+{
+	v->version = dnet_bswap64(v->version);
+}
+
 static inline int dnet_addr_equal(struct dnet_addr *a1, struct dnet_addr *a2)
 {
 	if (a1->family != a2->family)
@@ -351,6 +351,12 @@ class session
 		void			set_timeout(unsigned int timeout);
 		long			get_timeout() const;
 
+		/*!
+		 * Set/get transaction timeout in milliseconds
+		 */
+		void			set_timeout_ms(unsigned int timeout);
+		long			get_timeout_ms() const;
+
 		/*!
 		 * Sets/gets trace_id for all elliptics commands
 		 */
@@ -422,10 +428,26 @@ class session
 		 */
 		async_write_result write_data(const dnet_io_control &ctl);
 
+		/*!
+		 * Writes data to server by the dnet_io_control \a ctl, \a ctl.data is hosted by \a buf.
+		 *
+		 * Returns async_write_result.
+		 *
+		 * \note If \a buf is set, its reference is held until data is sent
+		 * instead of copying \a ctl.data, which must stay unmodified till then.
+		 */
+		async_write_result write_data(const dnet_io_control &ctl, dnet_io_buf *buf);
+
 		/*!
 		 * Writes data \a file to server by the dnet_io_attr \a io and
 		 *
 		 * Returns async_write_result
+		 *
+		 * \note This and other methods which write data_pointer do not copy data
+		 * owned by it (see data_pointer::is_owner()), a reference is held instead
+		 * until data is sent, so it must not be modified until the result is received.
+		 * Borrowed data (data_pointer::from_raw()) is copied and may be reused
+		 * as soon as the method returns.
 		 */
 		async_write_result write_data(const dnet_io_attr& io, const data_pointer &file);
 		/*!
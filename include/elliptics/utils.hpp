@@ -23,6 +23,7 @@
 #include <cstdlib>
 
 #include "elliptics/error.hpp"
+#include "elliptics/interface.h"
 
 namespace ioremap { namespace elliptics {
 
@@ -215,6 +216,11 @@ class data_pointer
 		size_t size() const { return m_index >= m_size ? 0 : (m_size - m_index); }
 		size_t offset() const { return m_index; }
 		bool empty() const { return m_index >= m_size; }
+		/*
+		 * Returns true if data lives as long as the pointer itself,
+		 * i.e. it is not borrowed from some external object
+		 */
+		bool is_owner() const { return m_data && m_data->is_owner(); }
 		std::string to_string() const { return std::string(reinterpret_cast<char*>(data()), size()); }
 
 	private:
@@ -225,6 +231,7 @@ class data_pointer
 				inline ~wrapper() { if (owner && data) free(data); }
 
 				inline void *get() const { return data; }
+				inline bool is_owner() const { return owner; }
 
 			private:
 				void *data;
@@ -236,6 +243,46 @@ class data_pointer
 		size_t m_size;
 };
 
+/*
+ * Reference counted buffer which shares data with given data_pointer,
+ * it allows to queue data into send queue without copying it.
+ *
+ * If pointer does not own its data, no buffer is created
+ * and data will be copied into send queue as usual.
+ */
+class io_buffer
+{
+	public:
+		io_buffer(const data_pointer &ptr) : m_buf(NULL)
+		{
+			if (ptr.empty() || !ptr.is_owner())
+				return;
+
+			data_pointer *holder = new data_pointer(ptr);
+			m_buf = dnet_io_buf_create(holder->data(), holder->size(), destroy, holder);
+			if (!m_buf)
+				delete holder;
+		}
+
+		~io_buffer()
+		{
+			dnet_io_buf_put(m_buf);
+		}
+
+		dnet_io_buf *get() const { return m_buf; }
+
+	private:
+		io_buffer(const io_buffer &);
+		io_buffer &operator =(const io_buffer &);
+
+		static void destroy(void *priv)
+		{
+			delete reinterpret_cast<data_pointer *>(priv);
+		}
+
+		dnet_io_buf *m_buf;
+};
+
 }} /* namespace ioremap::elliptics */
 
 #endif // ELLIPTICS_UTILS_HPP
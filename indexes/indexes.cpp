@@ -433,7 +433,8 @@ err_out_complete:
 				cmd.flags &= (DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
 			}
 
-			dnet_send_reply(state, &cmd, data.data(), data.size(), more);
+			io_buffer io_data(data);
+			dnet_send_reply_buf(state, &cmd, io_data.get(), data.data(), data.size(), more);
 		}
 
 		return err;
@@ -634,7 +635,8 @@ int process_internal_indexes(dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_
 		cmd->flags &= (DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
 	}
 
-	dnet_send_reply(state, cmd, reply_data.data(), reply_data.size(), err ? 1 : 0);
+	io_buffer io_data(reply_data);
+	dnet_send_reply_buf(state, cmd, io_data.get(), reply_data.data(), reply_data.size(), err ? 1 : 0);
 
 	const int64_t timer_send = timer.restart();
 
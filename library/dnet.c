@@ -324,21 +324,69 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd)
+/*
+ * Sends the last reply of the route list with current route table version, must be called under @state_lock
+ */
+static int dnet_send_route_version_nolock(struct dnet_net_state *orig, struct dnet_cmd *req)
+{
+	struct dnet_node *n = orig->n;
+	char buf[sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version)];
+	struct dnet_cmd *cmd = (struct dnet_cmd *)buf;
+	struct dnet_route_version *v = (struct dnet_route_version *)(cmd + 1);
+
+	memset(buf, 0, sizeof(buf));
+
+	memcpy(&cmd->id, &req->id, sizeof(struct dnet_id));
+	cmd->cmd = DNET_CMD_ROUTE_LIST;
+	cmd->trans = req->trans | DNET_TRANS_REPLY;
+	cmd->flags = DNET_FLAGS_NOLOCK | DNET_FLAGS_MORE;
+	cmd->size = sizeof(struct dnet_route_version);
+
+	v->version = n->route_version;
+
+	dnet_convert_route_version(v);
+	dnet_convert_cmd(cmd);
+
+	return dnet_send(orig, buf, sizeof(buf));
+}
+
+/*
+ * Requests with route table version only get states which have been added or got their addresses since then,
+ * the last reply tells the version they are now synced with. Requests without it get the whole table.
+ */
+static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_node *n = orig->n;
+	struct dnet_route_version *v = data;
 	struct dnet_net_state *st;
 	struct dnet_group *g;
 	void *buf = NULL;
 	size_t size, orig_size = 0;
+	uint64_t since = 0;
+	int versioned = 0, sent = 0, total = 0;
 	int err;
 
+	if (cmd->size >= sizeof(struct dnet_route_version)) {
+		dnet_convert_route_version(v);
+		since = v->version;
+		versioned = 1;
+	}
+
 	pthread_mutex_lock(&n->state_lock);
+
+	/* version of the previous incarnation of this node */
+	if (since > n->route_version)
+		since = 0;
+
 	list_for_each_entry(g, &n->group_list, group_entry) {
 		list_for_each_entry(st, &g->state_list, state_entry) {
 			if (dnet_addr_equal(&st->addr, &orig->addr) || !st->addrs)
 				continue;
 
+			total++;
+			if (st->idc->version <= since)
+				continue;
+
 			size = st->idc->id_num * sizeof(struct dnet_raw_id) +
 				sizeof(struct dnet_addr_cmd) + n->addr_num * sizeof(struct dnet_addr);
 
@@ -364,10 +412,18 @@ static int dnet_cmd_route_list(struct dnet_net_state *orig, struct dnet_cmd *cmd
 			err = dnet_send(orig, buf, size);
 			if (err)
 				goto err_out_unlock;
+
+			sent++;
 		}
 	}
 
 	err = 0;
+	if (versioned)
+		err = dnet_send_route_version_nolock(orig, cmd);
+
+	dnet_log(n, DNET_LOG_INFO, "%s: route list: sent %d/%d states since version %llu, current version: %llu, err: %d\n",
+			dnet_state_dump_addr(orig), sent, total,
+			(unsigned long long)since, (unsigned long long)n->route_version, err);
 
 err_out_unlock:
 	pthread_mutex_unlock(&n->state_lock);
@@ -375,6 +431,136 @@ err_out_unlock:
 	return err;
 }
 
+/*
+ * Redirect reply carries the owner of the key and states client has not seen since @since
+ */
+static inline int dnet_route_redirect_entry(struct dnet_net_state *orig, struct dnet_net_state *st,
+		struct dnet_net_state *owner, uint64_t since)
+{
+	if (dnet_addr_equal(&st->addr, &orig->addr) || !st->addrs)
+		return 0;
+
+	return (st == owner) || (st->idc->version > since);
+}
+
+static inline size_t dnet_route_entry_size(struct dnet_node *n, struct dnet_net_state *st)
+{
+	return st->idc->id_num * sizeof(struct dnet_raw_id) +
+		sizeof(struct dnet_addr_cmd) + n->addr_num * sizeof(struct dnet_addr);
+}
+
+/*
+ * Size of the redirect reply entries, must be called under @state_lock
+ */
+static size_t dnet_route_redirect_size_nolock(struct dnet_net_state *orig, struct dnet_net_state *owner, uint64_t since)
+{
+	struct dnet_node *n = orig->n;
+	struct dnet_net_state *st;
+	struct dnet_group *g;
+	size_t size = 0;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (dnet_route_redirect_entry(orig, st, owner, since))
+				size += dnet_route_entry_size(n, st);
+		}
+	}
+
+	return size;
+}
+
+/*
+ * Replies to command, whose key belongs to @owner, with -ESTALE and route table changes since @since
+ * in the same entries route list is sent in, client resends command to the owner itself.
+ *
+ * Only entries are copied under @state_lock, reply is allocated before and sent after it is dropped.
+ * If route table has changed while buffer was allocated, its size is calculated again.
+ */
+int dnet_send_route_redirect(struct dnet_net_state *orig, struct dnet_cmd *req,
+		struct dnet_net_state *owner, uint64_t since)
+{
+	struct dnet_node *n = orig->n;
+	struct dnet_route_version *v;
+	struct dnet_net_state *st;
+	struct dnet_group *g;
+	struct dnet_cmd *cmd;
+	struct dnet_id id;
+	void *buf = NULL, *pos;
+	size_t size, esize, buf_size = 0;
+	uint64_t version;
+	char owner_addr[128];
+	int err, num;
+
+	while (1) {
+		pthread_mutex_lock(&n->state_lock);
+		version = n->route_version;
+		size = sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version) +
+			dnet_route_redirect_size_nolock(orig, owner, since);
+		pthread_mutex_unlock(&n->state_lock);
+
+		if (size > buf_size) {
+			free(buf);
+			buf = malloc(size);
+			if (!buf) {
+				err = -ENOMEM;
+				goto err_out_exit;
+			}
+			buf_size = size;
+		}
+		memset(buf, 0, size);
+
+		pthread_mutex_lock(&n->state_lock);
+		if (n->route_version == version)
+			break;
+		pthread_mutex_unlock(&n->state_lock);
+	}
+
+	cmd = buf;
+	v = (struct dnet_route_version *)(cmd + 1);
+	pos = v + 1;
+	num = 0;
+	memset(&id, 0, sizeof(struct dnet_id));
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (!dnet_route_redirect_entry(orig, st, owner, since))
+				continue;
+
+			esize = dnet_route_entry_size(n, st);
+			id.group_id = g->group_id;
+			dnet_send_idc_fill(st, pos, esize, &id, 0, DNET_CMD_ROUTE_LIST, 0, 0, 0);
+
+			pos += esize;
+			num++;
+		}
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	memcpy(&cmd->id, &req->id, sizeof(struct dnet_id));
+	cmd->cmd = req->cmd;
+	cmd->status = -ESTALE;
+	cmd->trans = req->trans | DNET_TRANS_REPLY;
+	cmd->flags = DNET_FLAGS_ROUTE_VERSION;
+	cmd->size = size - sizeof(struct dnet_cmd);
+
+	v->version = version;
+	dnet_convert_route_version(v);
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: %s: %s: redirect to %s: trans: %llu, sent %d states since version %llu, "
+			"current version: %llu\n",
+			dnet_state_dump_addr(orig), dnet_dump_id(&req->id), dnet_cmd_string(req->cmd),
+			dnet_server_convert_dnet_addr_raw(dnet_state_addr(owner), owner_addr, sizeof(owner_addr)),
+			(unsigned long long)req->trans,
+			num, (unsigned long long)since, (unsigned long long)version);
+
+	dnet_convert_cmd(cmd);
+	err = dnet_send(orig, buf, size);
+
+err_out_exit:
+	free(buf);
+	return err;
+}
+
 static int dnet_cmd_exec(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
 {
 	struct dnet_node *n = st->n;
@@ -420,9 +606,29 @@ static int dnet_cmd_stat_count_single(struct dnet_net_state *orig, struct dnet_c
 	return dnet_send_reply(orig, cmd, as, sizeof(struct dnet_addr_stat) + __DNET_CMD_MAX * sizeof(struct dnet_stat_count), 1);
 }
 
+/*
+ * Keys with the most commands waiting for their oplocks, logged when statistics are requested
+ */
+static void dnet_log_hot_keys(struct dnet_node *n)
+{
+	struct dnet_locks_hot hot[8];
+	int num, i;
+
+	if (!n->log || n->log->log_level < DNET_LOG_NOTICE)
+		return;
+
+	num = dnet_locks_hot_keys(n, hot, (int)ARRAY_SIZE(hot));
+	for (i = 0; i < num; ++i) {
+		dnet_log(n, DNET_LOG_NOTICE, "%s: hot oplock key: waiters: %d, shared holders: %d\n",
+				dnet_dump_id_str(hot[i].id.id), hot[i].waiters, hot[i].shared);
+	}
+}
+
 static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_cmd *cmd,
 		struct dnet_node *n, struct dnet_addr_stat *as)
 {
+	/* counters are filled in aligned buffer, @as is packed */
+	struct dnet_stat_count counters[__DNET_CNTR_MAX];
 	struct dnet_stat st;
 	int err = 0;
 
@@ -432,7 +638,12 @@ static int dnet_cmd_stat_count_global(struct dnet_net_state *orig, struct dnet_c
 	as->num = __DNET_CNTR_MAX;
 	as->cmd_num = __DNET_CMD_MAX;
 
-	memcpy(as->count, n->counters, sizeof(struct dnet_stat_count) * __DNET_CNTR_MAX);
+	memcpy(counters, n->counters, sizeof(counters));
+	dnet_io_stat_fill(n, counters);
+	dnet_locks_stat_fill(n, counters);
+	dnet_cache_stat_fill(n, counters);
+	memcpy(as->count, counters, sizeof(counters));
+	dnet_log_hot_keys(n);
 
 	if (n->cb->storage_stat) {
 		err = n->cb->storage_stat(n->cb->command_private, &st);
@@ -936,6 +1147,14 @@ err_out_exit:
 	return err;
 }
 
+static void dnet_cmd_oplock(struct dnet_node *n, struct dnet_cmd *cmd)
+{
+	if (cmd->cmd < __DNET_CMD_MAX && (n->oplock_shared & (1U << cmd->cmd)))
+		dnet_oplock_shared(n, &cmd->id);
+	else
+		dnet_oplock(n, &cmd->id);
+}
+
 static int dnet_cmd_bulk_read(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
 {
 	int err = -1, ret;
@@ -982,7 +1201,7 @@ static int dnet_cmd_bulk_read(struct dnet_net_state *st, struct dnet_cmd *cmd, v
 	}
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(st->n, &cmd->id);
+		dnet_cmd_oplock(st->n, cmd);
 	}
 
 	return err;
@@ -1051,7 +1270,7 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 	long diff;
 
 	if (!(cmd->flags & DNET_FLAGS_NOLOCK)) {
-		dnet_oplock(n, &cmd->id);
+		dnet_cmd_oplock(n, cmd);
 	}
 
 	gettimeofday(&start, NULL);
@@ -1070,7 +1289,7 @@ int dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *
 			err = dnet_cmd_join_client(st, cmd, data);
 			break;
 		case DNET_CMD_ROUTE_LIST:
-			err = dnet_cmd_route_list(st, cmd);
+			err = dnet_cmd_route_list(st, cmd, data);
 			break;
 		case DNET_CMD_EXEC:
 			err = dnet_cmd_exec(st, cmd, data);
@@ -1369,14 +1588,16 @@ err_out_exit:
 }
 */
 
-int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
-		int fd, uint64_t offset, int on_exit)
+static int dnet_send_read_data_raw(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		struct dnet_io_buf *buf, void *data, int fd, uint64_t offset, int on_exit)
 {
 	struct dnet_net_state *st = state;
 	struct dnet_node *n = st->n;
-	struct dnet_cmd *c;
-	struct dnet_io_attr *rio;
-	int hsize = sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr);
+	/* reply header is copied into queued request, so it lives on the stack */
+	char hdr[sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr)];
+	struct dnet_cmd *c = (struct dnet_cmd *)hdr;
+	struct dnet_io_attr *rio = (struct dnet_io_attr *)(c + 1);
+	int hsize = sizeof(hdr);
 	int err;
 	long csum_time, send_time, total_time;
 	struct timeval start_tv, csum_tv, send_tv;
@@ -1392,15 +1613,7 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 
 	gettimeofday(&start_tv, NULL);
 
-	c = malloc(hsize);
-	if (!c) {
-		err = -ENOMEM;
-		goto err_out_exit;
-	}
-
-	memset(c, 0, hsize);
-
-	rio = (struct dnet_io_attr *)(c + 1);
+	memset(hdr, 0, hsize);
 
 	dnet_setup_id(&c->id, cmd->id.group_id, io->id);
 
@@ -1425,13 +1638,13 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 		}
 
 		if (err)
-			goto err_out_free;
+			goto err_out_exit;
 	}
 
 	gettimeofday(&csum_tv, NULL);
 
 	if (data)
-		err = dnet_send_data(st, c, hsize, data, rio->size);
+		err = dnet_send_data_buf(st, c, hsize, buf, data, rio->size);
 	else
 		err = dnet_send_fd(st, c, hsize, fd, offset, rio->size, on_exit);
 
@@ -1449,13 +1662,25 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 			(unsigned long long)io->offset,	(unsigned long long)io->size,
 			csum_time, send_time, total_time);
 
-
-err_out_free:
-	free(c);
 err_out_exit:
 	return err;
 }
 
+int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit)
+{
+	return dnet_send_read_data_raw(state, cmd, io, NULL, data, fd, offset, on_exit);
+}
+
+/*
+ * @data lives in reference counted @buf, it is sent without copying into send queue
+ */
+int dnet_send_read_data_buf(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		struct dnet_io_buf *buf, void *data)
+{
+	return dnet_send_read_data_raw(state, cmd, io, buf, data, -1, 0, 0);
+}
+
 static void dnet_fill_state_addr(void *state, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st = state;
@@ -117,6 +117,13 @@ int dnet_node_get_indexes_shard_count(struct dnet_node *node)
 	return node->indexes_shard_count;
 }
 
+void dnet_node_get_counters(struct dnet_node *node, struct dnet_stat_count *counters)
+{
+	dnet_lock_lock(&node->counters_lock);
+	memcpy(counters, node->counters, sizeof(node->counters));
+	dnet_lock_unlock(&node->counters_lock);
+}
+
 static char *dnet_cmd_strings[] = {
 	[DNET_CMD_LOOKUP] = "LOOKUP",
 	[DNET_CMD_REVERSE_LOOKUP] = "REVERSE_LOOKUP",
@@ -170,6 +177,41 @@ static char *dnet_counter_strings[] = {
 	[DNET_CNTR_DBR_ERROR] = "DNET_CNTR_DBR_ERROR",
 	[DNET_CNTR_DBW_SYSTEM] = "DNET_CNTR_DBW_SYSTEM",
 	[DNET_CNTR_DBW_ERROR] = "DNET_CNTR_DBW_ERROR",
+	[DNET_CNTR_NET_WAKEUPS] = "DNET_CNTR_NET_WAKEUPS",
+	[DNET_CNTR_NET_EVENTS] = "DNET_CNTR_NET_EVENTS",
+	[DNET_CNTR_NET_FULL_BATCHES] = "DNET_CNTR_NET_FULL_BATCHES",
+	[DNET_CNTR_NET_SEND_CALLS] = "DNET_CNTR_NET_SEND_CALLS",
+	[DNET_CNTR_NET_SEND_BYTES] = "DNET_CNTR_NET_SEND_BYTES",
+	[DNET_CNTR_NET_SEND_REQUESTS] = "DNET_CNTR_NET_SEND_REQUESTS",
+	[DNET_CNTR_IO_INTERACTIVE_REQUESTS] = "DNET_CNTR_IO_INTERACTIVE_REQUESTS",
+	[DNET_CNTR_IO_INTERACTIVE_WAIT] = "DNET_CNTR_IO_INTERACTIVE_WAIT",
+	[DNET_CNTR_IO_WRITE_REQUESTS] = "DNET_CNTR_IO_WRITE_REQUESTS",
+	[DNET_CNTR_IO_WRITE_WAIT] = "DNET_CNTR_IO_WRITE_WAIT",
+	[DNET_CNTR_IO_BACKGROUND_REQUESTS] = "DNET_CNTR_IO_BACKGROUND_REQUESTS",
+	[DNET_CNTR_IO_BACKGROUND_WAIT] = "DNET_CNTR_IO_BACKGROUND_WAIT",
+	[DNET_CNTR_IO_EXPIRED] = "DNET_CNTR_IO_EXPIRED",
+	[DNET_CNTR_IO_QUEUE_REJECTS] = "DNET_CNTR_IO_QUEUE_REJECTS",
+	[DNET_CNTR_IO_QUEUE_PAUSES] = "DNET_CNTR_IO_QUEUE_PAUSES",
+	[DNET_CNTR_NET_SMALL_TRANS] = "DNET_CNTR_NET_SMALL_TRANS",
+	[DNET_CNTR_NET_SMALL_TRANS_TIME] = "DNET_CNTR_NET_SMALL_TRANS_TIME",
+	[DNET_CNTR_NET_LARGE_TRANS] = "DNET_CNTR_NET_LARGE_TRANS",
+	[DNET_CNTR_NET_LARGE_TRANS_TIME] = "DNET_CNTR_NET_LARGE_TRANS_TIME",
+	[DNET_CNTR_NET_SEND_SLICES] = "DNET_CNTR_NET_SEND_SLICES",
+	[DNET_CNTR_SLAB_ALLOCS] = "DNET_CNTR_SLAB_ALLOCS",
+	[DNET_CNTR_SLAB_HITS] = "DNET_CNTR_SLAB_HITS",
+	[DNET_CNTR_SLAB_LARGE] = "DNET_CNTR_SLAB_LARGE",
+	[DNET_CNTR_NET_FORWARDS] = "DNET_CNTR_NET_FORWARDS",
+	[DNET_CNTR_NET_REDIRECTS] = "DNET_CNTR_NET_REDIRECTS",
+	[DNET_CNTR_NET_REDIRECTED] = "DNET_CNTR_NET_REDIRECTED",
+	[DNET_CNTR_OPLOCK_WAITS] = "DNET_CNTR_OPLOCK_WAITS",
+	[DNET_CNTR_OPLOCK_WAITERS] = "DNET_CNTR_OPLOCK_WAITERS",
+	[DNET_CNTR_OPLOCK_KEY_WAITERS] = "DNET_CNTR_OPLOCK_KEY_WAITERS",
+	[DNET_CNTR_CACHE_SIZE] = "DNET_CNTR_CACHE_SIZE",
+	[DNET_CNTR_CACHE_OBJECTS] = "DNET_CNTR_CACHE_OBJECTS",
+	[DNET_CNTR_CACHE_SHARD_MAX_SIZE] = "DNET_CNTR_CACHE_SHARD_MAX_SIZE",
+	[DNET_CNTR_CACHE_LOCK_CONTENDED] = "DNET_CNTR_CACHE_LOCK_CONTENDED",
+	[DNET_CNTR_CACHE_LARGEST_SHARD_SIZE] = "DNET_CNTR_CACHE_LARGEST_SHARD_SIZE",
+	[DNET_CNTR_CACHE_LARGEST_SHARD_LOCK_CONTENDED] = "DNET_CNTR_CACHE_LARGEST_SHARD_LOCK_CONTENDED",
 	[DNET_CNTR_UNKNOWN] = "UNKNOWN",
 };
 
@@ -221,6 +263,10 @@ int dnet_copy_addrs(struct dnet_net_state *nst, struct dnet_addr *addrs, int add
 	nst->addr_num = addr_num;
 	memcpy(nst->addrs, addrs, addr_num * sizeof(struct dnet_addr));
 
+	/* states without addresses are not sent in route list, it has to be sent to those who have already synced */
+	if (nst->idc)
+		nst->idc->version = ++n->route_version;
+
 	pthread_mutex_unlock(&n->state_lock);
 
 	dnet_server_convert_dnet_addr_raw(dnet_state_addr(nst), addr_str, sizeof(addr_str));
@@ -332,21 +378,116 @@ err_out_exit:
 	return err;
 }
 
-static int dnet_recv_route_list_complete(struct dnet_net_state *st, struct dnet_cmd *cmd, void *priv)
+/*
+ * Adds state from route list entry, @cmd is followed by its addresses and ids
+ */
+static int dnet_process_route_entry(struct dnet_net_state *st, struct dnet_cmd *cmd)
 {
-	struct dnet_wait *w = priv;
 	struct dnet_addr_container *cnt;
 	long size;
-	int err, num;
+	int num;
+
+	size = cmd->size + sizeof(struct dnet_cmd);
+	if (size < (signed)sizeof(struct dnet_addr_cmd))
+		return -EINVAL;
+
+	cnt = (struct dnet_addr_container *)(cmd + 1);
+	dnet_convert_addr_container(cnt);
+
+	if (cmd->size < sizeof(struct dnet_addr) * cnt->addr_num + sizeof(struct dnet_addr_container) + sizeof(struct dnet_raw_id))
+		return -EINVAL;
+
+	num = (cmd->size - sizeof(struct dnet_addr) * cnt->addr_num - sizeof(struct dnet_addr_container)) / sizeof(struct dnet_raw_id);
+	if (!num)
+		return -EINVAL;
+
+	return dnet_process_route_reply(st, cnt, cmd->id.group_id, num);
+}
+
+/*
+ * Applies route table changes from redirect reply of @st: its route table version followed by route list entries.
+ * Version synced with @st is updated only if all of them have been processed.
+ */
+int dnet_process_route_redirect(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data)
+{
+	struct dnet_route_version *v = data;
+	struct dnet_cmd *entry;
+	uint64_t size = cmd->size;
+	int err, failed = 0;
+
+	if (size < sizeof(struct dnet_route_version))
+		return -EINVAL;
+
+	dnet_convert_route_version(v);
+
+	data += sizeof(struct dnet_route_version);
+	size -= sizeof(struct dnet_route_version);
+
+	dnet_route_batch_start(st->n);
+
+	while (size) {
+		entry = data;
+		if (size < sizeof(struct dnet_cmd)) {
+			failed = -EINVAL;
+			break;
+		}
+
+		dnet_convert_cmd(entry);
+		if (entry->size > size - sizeof(struct dnet_cmd)) {
+			failed = -EINVAL;
+			break;
+		}
+
+		err = dnet_process_route_entry(st, entry);
+		if (err && err != -EEXIST)
+			failed = err;
+
+		data += sizeof(struct dnet_cmd) + entry->size;
+		size -= sizeof(struct dnet_cmd) + entry->size;
+	}
+
+	dnet_route_batch_end(st->n);
+
+	if (failed)
+		return failed;
+
+	if (v->version > st->route_version)
+		st->route_version = v->version;
+
+	return 0;
+}
+
+struct dnet_route_list_wait {
+	struct dnet_node		*n;
+	struct dnet_wait		*w;
+	uint64_t			version;
+	int				failed;
+	int				batch;
+};
+
+static int dnet_recv_route_list_complete(struct dnet_net_state *st, struct dnet_cmd *cmd, void *priv)
+{
+	struct dnet_route_list_wait *rw = priv;
+	struct dnet_wait *w = rw->w;
+	struct dnet_route_version *v;
+	int err;
 
 	if (is_trans_destroyed(st, cmd)) {
 		err = -EINVAL;
 		if (cmd)
 			err = cmd->status;
 
+		/* next request asks only for changes if every state of this one has been processed */
+		if (st && !err && !rw->failed && rw->version)
+			st->route_version = rw->version;
+
+		if (rw->batch)
+			dnet_route_batch_end(rw->n);
+
 		w->status = err;
 		dnet_wakeup(w, w->cond = 1);
 		dnet_wait_put(w);
+		free(rw);
 		goto err_out_exit;
 	}
 
@@ -355,60 +496,79 @@ static int dnet_recv_route_list_complete(struct dnet_net_state *st, struct dnet_
 	if (!cmd->size || err)
 		goto err_out_exit;
 
-	size = cmd->size + sizeof(struct dnet_cmd);
-	if (size < (signed)sizeof(struct dnet_addr_cmd)) {
-		err = -EINVAL;
-		goto err_out_exit;
-	}
+	if (cmd->size == sizeof(struct dnet_route_version)) {
+		v = (struct dnet_route_version *)(cmd + 1);
+		dnet_convert_route_version(v);
 
-	cnt = (struct dnet_addr_container *)(cmd + 1);
-	dnet_convert_addr_container(cnt);
-
-	if (cmd->size < sizeof(struct dnet_addr) * cnt->addr_num + sizeof(struct dnet_addr_container) + sizeof(struct dnet_raw_id)) {
-		err = -EINVAL;
+		rw->version = v->version;
 		goto err_out_exit;
 	}
 
-	num = (cmd->size - sizeof(struct dnet_addr) * cnt->addr_num - sizeof(struct dnet_addr_container)) / sizeof(struct dnet_raw_id);
-	if (!num) {
-		err = -EINVAL;
-		goto err_out_exit;
+	/*
+	 * States of the route list are added to the snapshot at once when transaction is destroyed,
+	 * batch starts with the first entry, so that unanswered request does not delay other updates
+	 */
+	if (!rw->batch) {
+		dnet_route_batch_start(rw->n);
+		rw->batch = 1;
 	}
 
-	err = dnet_process_route_reply(st, cnt, cmd->id.group_id, num);
+	err = dnet_process_route_entry(st, cmd);
 
 err_out_exit:
+	if (err && err != -EEXIST)
+		rw->failed = 1;
 	return err;
 }
 
+/*
+ * Asks for states added since the last route list received from @st, or for all of them the first time
+ */
 int dnet_recv_route_list(struct dnet_net_state *st)
 {
 	struct dnet_io_req req;
 	struct dnet_node *n = st->n;
+	struct dnet_route_list_wait *rw;
+	struct dnet_route_version *v;
 	struct dnet_trans *t;
 	struct dnet_cmd *cmd;
 	struct dnet_wait *w;
 	int err;
 
+	rw = malloc(sizeof(struct dnet_route_list_wait));
+	if (!rw) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+	memset(rw, 0, sizeof(struct dnet_route_list_wait));
+	rw->n = n;
+
 	w = dnet_wait_alloc(0);
 	if (!w) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_free;
 	}
+	rw->w = w;
 
-	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd));
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version));
 	if (!t) {
 		err = -ENOMEM;
 		goto err_out_wait_put;
 	}
 
 	t->complete = dnet_recv_route_list_complete;
-	t->priv = w;
+	t->priv = rw;
 
 	cmd = (struct dnet_cmd *)(t + 1);
+	v = (struct dnet_route_version *)(cmd + 1);
 
 	cmd->flags = DNET_FLAGS_NEED_ACK | DNET_FLAGS_DIRECT | DNET_FLAGS_NOLOCK;
 	cmd->status = 0;
+	cmd->size = sizeof(struct dnet_route_version);
+
+	memset(v, 0, sizeof(struct dnet_route_version));
+	v->version = st->route_version;
+	dnet_convert_route_version(v);
 
 	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
 
@@ -419,13 +579,13 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 
 	dnet_convert_cmd(cmd);
 
-	dnet_log(n, DNET_LOG_DEBUG, "%s: list route request to %s.\n", dnet_dump_id(&cmd->id),
-		dnet_server_convert_dnet_addr(&st->addr));
+	dnet_log(n, DNET_LOG_DEBUG, "%s: list route request to %s, since version: %llu.\n", dnet_dump_id(&cmd->id),
+		dnet_server_convert_dnet_addr(&st->addr), (unsigned long long)st->route_version);
 
 	memset(&req, 0, sizeof(req));
 	req.st = st;
 	req.header = cmd;
-	req.hsize = sizeof(struct dnet_cmd);
+	req.hsize = sizeof(struct dnet_cmd) + sizeof(struct dnet_route_version);
 
 	dnet_wait_get(w);
 	err = dnet_trans_send(t, &req);
@@ -438,9 +598,15 @@ int dnet_recv_route_list(struct dnet_net_state *st)
 	return 0;
 
 err_out_destroy:
+	/* completion frees @rw and drops its @w reference */
 	dnet_trans_put(t);
+	dnet_wait_put(w);
+	return err;
+
 err_out_wait_put:
 	dnet_wait_put(w);
+err_out_free:
+	free(rw);
 err_out_exit:
 	return err;
 }
@@ -697,7 +863,8 @@ err_out_exit:
 	return 0;
 }
 
-static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dnet_io_control *ctl, int *errp)
+static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dnet_io_control *ctl,
+		struct dnet_io_buf *buf, int *errp)
 {
 	struct dnet_node *n = s->node;
 	struct dnet_io_req req;
@@ -705,7 +872,9 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 	struct dnet_io_attr *io;
 	struct dnet_cmd *cmd;
 	uint64_t size = ctl->io.size;
-	uint64_t tsize = sizeof(struct dnet_io_attr) + sizeof(struct dnet_cmd);
+	size_t deadline_size = dnet_cmd_deadline_size(ctl->cflags);
+	size_t route_version_size = 0;
+	uint64_t tsize = sizeof(struct dnet_io_attr) + sizeof(struct dnet_cmd) + deadline_size;
 	int err;
 
 	if (ctl->cmd == DNET_CMD_READ)
@@ -714,35 +883,24 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 	if (ctl->fd < 0 && size < DNET_COPY_IO_SIZE)
 		tsize += size;
 
-	t = dnet_trans_alloc(n, tsize);
-	t->wait_ts = *dnet_session_get_timeout(s);
+	/* route version prefix size is known when state is selected */
+	t = dnet_trans_alloc(n, tsize + sizeof(struct dnet_route_version));
 	if (!t) {
 		err = -ENOMEM;
 		goto err_out_complete;
 	}
+	t->wait_ts = *dnet_session_get_timeout(s);
 	t->complete = ctl->complete;
 	t->priv = ctl->priv;
 
 	cmd = (struct dnet_cmd *)(t + 1);
-	io = (struct dnet_io_attr *)(cmd + 1);
-
-	if (ctl->fd < 0 && size < DNET_COPY_IO_SIZE) {
-		if (size) {
-			void *data = io + 1;
-			memcpy(data, ctl->data, size);
-		}
-	}
 
 	memcpy(&cmd->id, &ctl->id, sizeof(struct dnet_id));
-	cmd->size = sizeof(struct dnet_io_attr) + size;
 	cmd->flags = ctl->cflags;
 	cmd->status = 0;
 
 	cmd->cmd = t->command = ctl->cmd;
 
-	memcpy(io, &ctl->io, sizeof(struct dnet_io_attr));
-	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
-
 	if ((s->cflags & DNET_FLAGS_DIRECT) == 0) {
 		t->st = dnet_state_get_first(n, &cmd->id);
 	} else {
@@ -752,10 +910,40 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 	}
 
 	if (!t->st) {
+		memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
 		err = -ENXIO;
 		goto err_out_destroy;
 	}
 
+	/* only command which is completely kept in transaction can be resent after redirect */
+	if (ctl->fd < 0 && size < DNET_COPY_IO_SIZE && !(s->cflags & DNET_FLAGS_DIRECT))
+		route_version_size = dnet_cmd_route_version_size(t->st, cmd->flags);
+
+	io = (struct dnet_io_attr *)((void *)(cmd + 1) + deadline_size + route_version_size);
+
+	if (deadline_size)
+		dnet_cmd_deadline_fill((struct dnet_time *)(cmd + 1), &t->wait_ts);
+
+	if (route_version_size) {
+		tsize += route_version_size;
+
+		cmd->flags |= DNET_FLAGS_ROUTE_VERSION;
+		dnet_cmd_route_version_fill((void *)(cmd + 1) + deadline_size, t->st->route_version);
+		t->hsize = tsize;
+	}
+
+	if (ctl->fd < 0 && size < DNET_COPY_IO_SIZE) {
+		if (size) {
+			void *data = io + 1;
+			memcpy(data, ctl->data, size);
+		}
+	}
+
+	cmd->size = deadline_size + route_version_size + sizeof(struct dnet_io_attr) + size;
+
+	memcpy(io, &ctl->io, sizeof(struct dnet_io_attr));
+	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
+
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 
 	dnet_log(n, DNET_LOG_INFO, "%s: created trans: %llu, cmd: %s, cflags: 0x%llx, size: %llu, offset: %llu, "
@@ -786,6 +974,7 @@ static struct dnet_trans *dnet_io_trans_create(struct dnet_session *s, struct dn
 	} else if (size >= DNET_COPY_IO_SIZE) {
 		req.data = (void *)ctl->data;
 		req.dsize = size;
+		req.buf = buf;
 	}
 
 	err = dnet_trans_send(t, &req);
@@ -806,28 +995,38 @@ err_out_destroy:
 	return NULL;
 }
 
-int dnet_trans_create_send_all(struct dnet_session *s, struct dnet_io_control *ctl)
+static int dnet_trans_create_send_all_buf(struct dnet_session *s, struct dnet_io_control *ctl, struct dnet_io_buf *buf)
 {
 	int num = 0, i, err;
 
 	for (i=0; i<s->group_num; ++i) {
 		ctl->id.group_id = s->groups[i];
 
-		dnet_io_trans_create(s, ctl, &err);
+		dnet_io_trans_create(s, ctl, buf, &err);
 		num++;
 	}
 
 	if (!num) {
-		dnet_io_trans_create(s, ctl, &err);
+		dnet_io_trans_create(s, ctl, buf, &err);
 		num++;
 	}
 
 	return num;
 }
 
+int dnet_trans_create_send_all(struct dnet_session *s, struct dnet_io_control *ctl)
+{
+	return dnet_trans_create_send_all_buf(s, ctl, NULL);
+}
+
 int dnet_write_object(struct dnet_session *s, struct dnet_io_control *ctl)
 {
-	return dnet_trans_create_send_all(s, ctl);
+	return dnet_trans_create_send_all_buf(s, ctl, NULL);
+}
+
+int dnet_write_object_buf(struct dnet_session *s, struct dnet_io_control *ctl, struct dnet_io_buf *buf)
+{
+	return dnet_trans_create_send_all_buf(s, ctl, buf);
 }
 
 static int dnet_write_file_id_raw(struct dnet_session *s, const char *file, struct dnet_id *id,
@@ -1044,7 +1243,7 @@ int dnet_read_object(struct dnet_session *s, struct dnet_io_control *ctl)
 {
 	int err;
 
-	if (!dnet_io_trans_create(s, ctl, &err))
+	if (!dnet_io_trans_create(s, ctl, NULL, &err))
 		return err;
 
 	return 0;
@@ -1380,9 +1579,11 @@ int dnet_lookup_object(struct dnet_session *s, struct dnet_id *id,
 	struct dnet_io_req req;
 	struct dnet_trans *t;
 	struct dnet_cmd *cmd;
+	size_t deadline_size = dnet_cmd_deadline_size(dnet_session_get_cflags(s));
+	size_t route_version_size;
 	int err;
 
-	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd));
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + deadline_size + sizeof(struct dnet_route_version));
 	if (!t) {
 		err = -ENOMEM;
 		goto err_out_complete;
@@ -1407,6 +1608,18 @@ int dnet_lookup_object(struct dnet_session *s, struct dnet_id *id,
 		goto err_out_destroy;
 	}
 
+	route_version_size = dnet_cmd_route_version_size(t->st, cmd->flags);
+	cmd->size = deadline_size + route_version_size;
+
+	if (deadline_size)
+		dnet_cmd_deadline_fill((struct dnet_time *)(cmd + 1), &t->wait_ts);
+
+	if (route_version_size) {
+		cmd->flags |= DNET_FLAGS_ROUTE_VERSION;
+		dnet_cmd_route_version_fill((void *)(cmd + 1) + deadline_size, t->st->route_version);
+		t->hsize = sizeof(struct dnet_cmd) + cmd->size;
+	}
+
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 	dnet_convert_cmd(cmd);
 
@@ -1415,7 +1628,7 @@ int dnet_lookup_object(struct dnet_session *s, struct dnet_id *id,
 	memset(&req, 0, sizeof(req));
 	req.st = t->st;
 	req.header = cmd;
-	req.hsize = sizeof(struct dnet_cmd);
+	req.hsize = sizeof(struct dnet_cmd) + deadline_size + route_version_size;
 
 	err = dnet_trans_send(t, &req);
 	if (err)
@@ -1769,6 +1982,8 @@ int dnet_update_status(struct dnet_session *s, struct dnet_addr *addr, struct dn
 		goto err_out_exit;
 	}
 
+	atomic_init(&priv->refcnt, 2);
+
 	priv->w = dnet_wait_alloc(0);
 	if (!priv->w) {
 		err = -ENOMEM;
@@ -69,21 +69,61 @@ extern __thread uint32_t trace_id;
 		} while (0)
 #define dnet_log_err(n, f, a...) dnet_log(n, DNET_LOG_ERROR, f ": %s [%d].\n", ##a, strerror(errno), errno)
 
+struct dnet_recv_chunk;
+
 struct dnet_io_req {
 	struct list_head	req_entry;
 
 	struct dnet_net_state	*st;
 
+	/* receive buffer hosting this request, request is not allocated separately if set */
+	struct dnet_recv_chunk	*chunk;
+
 	void			*header;
 	size_t			hsize;
 
 	void			*data;
 	size_t			dsize;
 
+	/* data part is not copied into request, but lives in this referenced buffer */
+	struct dnet_io_buf	*buf;
+
+	/* IO pool priority class and time request was queued at */
+	int			io_class;
+	struct timeval		queue_time;
+	/* command is not processed after this time, zero if client did not set deadline */
+	struct timeval		deadline;
+	/* version of this node's route table client has synced with, zero if client has not sent it */
+	uint64_t		route_version;
+
 	int			on_exit;
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/*
+	 * Slice of large reply: @slice_src is the whole reply, it is not queued itself.
+	 * The same slice request is queued again for the next part of the reply after it has been sent.
+	 */
+	struct dnet_io_req	*slice_src;
+
+	/*
+	 * Sliced reply: number of payload bytes queued in slices, entry in state's list of replies being sliced
+	 * and requests for the same transaction queued after this reply, they are sent once it is complete.
+	 */
+	uint64_t		slice_offset;
+	struct list_head	slice_entry;
+	struct list_head	slice_pending;
+};
+
+struct dnet_io_buf {
+	atomic_t		refcnt;
+
+	void			*data;
+	size_t			size;
+
+	void			(* destroy)(void *priv);
+	void			*priv;
 };
 
 /*
@@ -97,6 +137,116 @@ struct dnet_io_req {
 /* Attached data should be discarded */
 #define DNET_IO_DROP		(1<<1)
 
+/*
+ * Per-connection receive buffer.
+ *
+ * Network thread reads as much data as socket has into this buffer and parses
+ * (possibly multiple pipelined) commands out of it. Small commands are not copied,
+ * their request descriptors are taken from @reqs array and point into @data.
+ * Every such request holds a reference to the chunk, so chunk is only reused
+ * when all requests it hosts have been processed, otherwise new chunk is allocated
+ * and unparsed tail is moved there.
+ *
+ * Commands with payload larger than DNET_RECV_CHUNK_MAX_PAYLOAD are received
+ * into dedicated allocation.
+ */
+#define DNET_RECV_CHUNK_SIZE		(64 * 1024)
+#define DNET_RECV_CHUNK_REQS		64
+#define DNET_RECV_CHUNK_MAX_PAYLOAD	(16 * 1024)
+
+struct dnet_recv_chunk {
+	atomic_t		refcnt;
+	int			req_pos;
+	size_t			size;
+	/* unparsed data lives in [start, end) */
+	size_t			start, end;
+	/* registered buffer arena chunk is returned to, NULL if it was allocated with malloc() */
+	void			*arena;
+	struct dnet_io_req	reqs[DNET_RECV_CHUNK_REQS];
+	char			data[0];
+};
+
+void dnet_recv_chunk_put(struct dnet_recv_chunk *c);
+
+struct dnet_recv_slice;
+
+struct dnet_trans;
+
+/*
+ * In-flight transactions of the state, open addressing hash table keyed by transaction number
+ */
+struct dnet_trans_table {
+	struct dnet_trans	**slots;
+	unsigned int		size;
+	unsigned int		num;
+};
+
+#define DNET_TIMER_LEVELS		4
+#define DNET_TIMER_BITS			6
+#define DNET_TIMER_SLOTS		(1 << DNET_TIMER_BITS)
+
+struct dnet_timer_wheel;
+
+struct dnet_timer {
+	struct list_head	entry;
+	uint64_t		expires;	/* monotonic time, msecs */
+	struct dnet_timer_wheel	*wheel;		/* wheel timer is linked into */
+};
+
+/*
+ * Thread which processes timers of several wheels sleeps here
+ */
+struct dnet_timer_waiter {
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	uint64_t		wakeup;		/* when sleeping thread wakes up, 0 if it does not sleep */
+	struct list_head	wheels;
+};
+
+/*
+ * Timers of one network thread, every wheel has its own lock
+ */
+struct dnet_timer_wheel {
+	pthread_mutex_t		lock;
+	struct dnet_timer_waiter	*waiter;
+	struct list_head	waiter_entry;
+	uint64_t		now;		/* the next tick to be processed */
+	int			num;
+	struct list_head	expired;
+	struct list_head	slots[DNET_TIMER_LEVELS][DNET_TIMER_SLOTS];
+};
+
+uint64_t dnet_timer_now(void);
+int dnet_timer_waiter_init(struct dnet_timer_waiter *waiter);
+void dnet_timer_waiter_destroy(struct dnet_timer_waiter *waiter);
+int dnet_timer_wheel_init(struct dnet_timer_wheel *w, struct dnet_timer_waiter *waiter);
+void dnet_timer_wheel_destroy(struct dnet_timer_wheel *w);
+void dnet_timer_add(struct dnet_timer_wheel *w, struct dnet_timer *t, uint64_t expires);
+void dnet_timer_del(struct dnet_timer *t);
+struct dnet_timer *dnet_timer_expire_nolock(struct dnet_timer_wheel *w, uint64_t now);
+uint64_t dnet_timer_next(struct dnet_timer_wheel *w);
+void dnet_timer_wait(struct dnet_timer_waiter *waiter, uint64_t limit);
+
+/*
+ * Lock-free readers and deferred reclamation, see rcu.c
+ */
+struct dnet_rcu_reader;
+
+struct dnet_rcu_head {
+	struct list_head	entry;
+	uint64_t		epoch;
+	void			(* free)(struct dnet_rcu_head *head);
+};
+
+struct dnet_rcu_reader *dnet_rcu_read_lock(void);
+void dnet_rcu_read_unlock(struct dnet_rcu_reader *r);
+void dnet_rcu_retire(struct dnet_rcu_head *head, void (* free)(struct dnet_rcu_head *head));
+void dnet_rcu_defer(struct list_head *list, struct dnet_rcu_head *head, void (* free)(struct dnet_rcu_head *head));
+void dnet_rcu_retire_list(struct list_head *list);
+int dnet_rcu_reclaim(void);
+int dnet_rcu_reclaim_wait(long timeout_ms);
+void dnet_rcu_barrier(void);
+
 #define DNET_STATE_MAX_WEIGHT		(1024 * 10)
 
 /* Iterator watermarks for sending data and sleeping */
@@ -139,11 +289,25 @@ struct dnet_net_state
 	uint64_t		rcv_end;
 	unsigned int		rcv_flags;
 	void			*rcv_data;
+	struct dnet_recv_chunk	*rcv_chunk;
+
+	/* sliced replies being reassembled and the one whose slice is being received now */
+	struct list_head	rcv_slices;
+	struct dnet_recv_slice	*rcv_slice;
+
+	/* reading is paused until IO pool queue drains, state is linked into pool's paused list */
+	int			rcv_paused;
+	struct list_head	rcv_paused_entry;
 
 	int			epoll_fd;
+	struct dnet_net_io	*nio;
+	/* io_uring engine's per-state data, NULL when epoll engine is used */
+	struct dnet_uring_state	*uring;
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
 	struct list_head	send_list;
+	/* replies which are being sent in slices */
+	struct list_head	send_slices;
 	/*
 	 * Condition variable to wait when send_queue_size reaches high
 	 * watermark
@@ -153,8 +317,9 @@ struct dnet_net_state
 	atomic_t		send_queue_size;
 
 	pthread_mutex_t		trans_lock;
-	struct rb_root		trans_root;
-	struct list_head	trans_list;
+	struct dnet_trans_table	trans_table;
+	/* transactions timed out since the last stall check */
+	int			timeouts;
 
 
 	int			la;
@@ -164,6 +329,19 @@ struct dnet_net_state
 
 	struct dnet_idc		*idc;
 
+	/* version of the remote node's route table received from it, 0 until the first complete route list */
+	uint64_t		route_version;
+
+	/*
+	 * Additional connections to the same node, only route table states have them.
+	 * Array is filled by reconnection thread after state has been created and released when it is destroyed.
+	 * Reset connections are skipped by dnet_state_conn_select() until reconnection thread replaces them,
+	 * entries are replaced under @n->state_lock and read without it inside RCU read section.
+	 */
+	struct dnet_net_state	**conns;
+	int			conn_num;
+	atomic_t		conn_pos;
+
 	struct dnet_stat_count	stat[__DNET_CMD_MAX];
 };
 
@@ -181,6 +359,8 @@ struct dnet_state_id {
 struct dnet_idc {
 	struct dnet_net_state	*st;
 	struct dnet_group	*group;
+	/* route table version when this state has been added or its addresses have been set */
+	uint64_t		version;
 	int			id_num;
 	struct dnet_state_id	ids[];
 };
@@ -211,8 +391,10 @@ int dnet_search_range(struct dnet_node *n, struct dnet_id *id,
 		struct dnet_raw_id *start, struct dnet_raw_id *next);
 
 int dnet_recv_route_list(struct dnet_net_state *st);
+int dnet_process_route_redirect(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data);
 
 void dnet_state_destroy(struct dnet_net_state *st);
+void dnet_recv_slices_free(struct dnet_net_state *st);
 
 void dnet_schedule_command(struct dnet_net_state *st);
 
@@ -297,6 +479,49 @@ int dnet_notify_remove(struct dnet_net_state *st, struct dnet_cmd *cmd);
 int dnet_notify_init(struct dnet_node *n);
 void dnet_notify_exit(struct dnet_node *n);
 
+/*
+ * Immutable copy of the route table which is read without locks.
+ * It is rebuilt and replaced under @state_lock whenever ids of any group change,
+ * and holds a reference to every state it points to until it is reclaimed.
+ */
+struct dnet_route_entry {
+	struct dnet_raw_id	id;
+	struct dnet_net_state	*st;
+};
+
+#define DNET_ROUTE_RADIX_MAX_BITS	16
+
+/*
+ * Search index of the group: leading 8 bytes of every id in the same order as @ids,
+ * and radix table which points to the first prefix with given @radix_bits leading bits.
+ * Lookup touches a radix slot and one or two cache lines of prefixes, full ids are only
+ * compared when prefixes are equal.
+ */
+struct dnet_route_group {
+	unsigned int		group_id;
+	int			id_num;
+	struct dnet_route_entry	*ids;
+
+	int			radix_bits;
+	uint32_t		*radix;
+	uint64_t		*prefix;
+};
+
+struct dnet_route_table {
+	struct dnet_rcu_head	rcu;
+
+	int			group_num;
+	struct dnet_route_group	*groups;		/* sorted by group id */
+
+	int			state_num;
+	struct dnet_net_state	**states;
+};
+
+void dnet_route_update_nolock(struct dnet_node *n, int removed);
+void dnet_route_batch_start(struct dnet_node *n);
+void dnet_route_batch_end(struct dnet_node *n);
+void dnet_route_destroy(struct dnet_node *n);
+
 struct dnet_group
 {
 	struct list_head	group_entry;
@@ -335,10 +560,43 @@ struct dnet_transform
 int dnet_crypto_init(struct dnet_node *n);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
+/*
+ * Maximum number of times network thread invokes state's ->process() callback
+ * for single ready event per wakeup. Epoll is level-triggered, so whatever is left
+ * in the socket will be reported again at the next epoll_wait() call, and busy
+ * connection does not starve other sockets harvested in the same batch.
+ */
+#define DNET_NET_EVENT_BUDGET		32
+
+/*
+ * Maximum number of iovec entries gathered from send queue into single sendmsg() call
+ */
+#define DNET_SEND_IOV_MAX		64
+
+struct dnet_uring;
+struct dnet_uring_state;
+
 struct dnet_net_io {
 	int			epoll_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+
+	struct epoll_event	*events;
+
+	/* ring of io_uring engine, NULL when epoll engine is used */
+	struct dnet_uring	*uring;
+
+	/* per-thread statistics, only updated by the thread itself */
+	uint64_t		wakeups;
+	uint64_t		events_total;
+	uint64_t		full_batches;
+	uint64_t		send_calls;
+	uint64_t		send_bytes;
+	uint64_t		send_requests;
+	uint64_t		send_slices;
+
+	/* timeouts of transactions sent over states of this thread */
+	struct dnet_timer_wheel	timers;
 };
 
 enum dnet_work_io_mode {
@@ -347,14 +605,6 @@ enum dnet_work_io_mode {
 	DNET_WORK_IO_MODE_EXEC_BLOCKING,
 };
 
-struct dnet_work_pool;
-struct dnet_work_io {
-	struct list_head	wio_entry;
-	int			thread_index;
-	pthread_t		tid;
-	struct dnet_work_pool	*pool;
-};
-
 struct list_stat {
 	uint64_t		list_size;
 	uint64_t		volume;
@@ -394,22 +644,134 @@ static inline void list_stat_reset(struct list_stat *st, struct timeval *time) {
 	st->time_base.tv_usec = time->tv_usec;
 }
 
+/*
+ * Priority classes of requests queued to IO pools.
+ * Every IO thread has a queue per class, and they are served
+ * with weighted fair queueing: while several classes are backlogged,
+ * they get shares of processed requests proportional to their weights.
+ */
+enum dnet_io_class {
+	DNET_IO_CLASS_INTERACTIVE = 0,		/* replies, client reads and lookups, service commands */
+	DNET_IO_CLASS_WRITE,			/* writes and removals */
+	DNET_IO_CLASS_BACKGROUND,		/* recovery, iteration, index rebuild and DNET_FLAGS_BACKGROUND */
+	__DNET_IO_CLASS_MAX,
+};
+
+#define DNET_IO_CLASS_INTERACTIVE_WEIGHT	8
+#define DNET_IO_CLASS_WRITE_WEIGHT		4
+#define DNET_IO_CLASS_BACKGROUND_WEIGHT		1
+
+struct dnet_work_pool;
+struct dnet_work_io {
+	int			thread_index;
+	pthread_t		tid;
+	struct dnet_work_pool	*pool;
+
+	/*
+	 * Requests bound to this thread: replies are hashed by transaction number,
+	 * commands are hashed by key. Replies are processed only by this thread,
+	 * so multiple replies of the same transaction (DNET_FLAGS_MORE sequence)
+	 * are processed in order, commands can be stolen by idle threads.
+	 */
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	struct list_head	list[__DNET_IO_CLASS_MAX];
+	struct list_stat	list_stats;
+
+	/*
+	 * Virtual time of every class queue and of the last dequeued request,
+	 * the class with the smallest one is served next.
+	 */
+	uint64_t		pass[__DNET_IO_CLASS_MAX];
+	uint64_t		vtime;
+
+	/* number of queued commands, which can be stolen */
+	int			stealable;
+
+	/* thread has no work and is about to sleep */
+	int			idle;
+	/* idle thread is asked to look for stealable work */
+	int			kick;
+
+	/* thread is asked to process its queue and exit when pool shrinks */
+	int			stop;
+	/* thread has exited, no more requests can be queued to it */
+	int			stopped;
+
+	/* time spent processing requests in microseconds */
+	uint64_t		busy_time;
+
+	/* number of requests of every class processed by this thread and time they waited in queue */
+	uint64_t		class_requests[__DNET_IO_CLASS_MAX];
+	uint64_t		class_wait_time[__DNET_IO_CLASS_MAX];
+
+	/* number of commands dropped because their deadline had passed */
+	uint64_t		expired;
+};
+
+/*
+ * IO pools are autoscaled by stall-check thread once per second.
+ * Pool grows by quarter of its size if there was queue which has not been drained
+ * during the last DNET_WORK_POOL_GROW_TICKS seconds while threads were busy
+ * at least DNET_WORK_POOL_BUSY_HIGH percents of time, and shrinks by one thread
+ * after DNET_WORK_POOL_SHRINK_TICKS seconds without queue and with threads
+ * busy less than DNET_WORK_POOL_BUSY_LOW percents of time.
+ */
+#define DNET_WORK_POOL_GROW_TICKS	2
+#define DNET_WORK_POOL_SHRINK_TICKS	10
+#define DNET_WORK_POOL_BUSY_HIGH	75
+#define DNET_WORK_POOL_BUSY_LOW		25
+
 struct dnet_work_pool {
 	struct dnet_node	*n;
 	int			mode;
-	int			num;
-	struct list_head	list;
-	struct list_stat	list_stats;
+
+	/*
+	 * @num threads are running now. First @min of them are never stopped and only they
+	 * process replies, so that transaction affinity does not change when pool is resized.
+	 * Pool can be grown up to @limit threads, which can be changed at runtime,
+	 * but not above @max threads which are allocated at startup.
+	 */
+	int			num, min, limit, max;
 	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
-	struct list_head	wio_list;
-	uint64_t		*trans;
+	struct dnet_work_io	*wio;
+	void			*(* process)(void *);
+
+	/* autoscaling state */
+	uint64_t		busy_time;
+	struct timeval		stat_time;
+	int			grow_ticks, shrink_ticks;
+
+	/*
+	 * Number of requests and bytes queued to all threads and their limits (zero means no limit).
+	 * When limit is reached, depending on @queue_policy, either new commands are rejected with -EBUSY,
+	 * or reading from the client state which has sent the command is paused, until queue drains
+	 * below DNET_WORK_POOL_QUEUE_LOW percents of the limit. Joined states also carry replies
+	 * to our own requests, so they are never paused, their new commands are parked instead.
+	 */
+	long			queued;
+	uint64_t		queued_bytes;
+	long			queue_limit;
+	uint64_t		queue_bytes_limit;
+	int			queue_policy;
+
+	pthread_mutex_t		paused_lock;
+	struct list_head	paused_list;
+	int			paused_num;
+	struct list_head	parked_list;
+	long			parked_num;
+
+	uint64_t		rejects, pauses;
 };
 
+#define DNET_WORK_POOL_QUEUE_LOW	75
+
 struct dnet_io {
 	int			need_exit;
 
 	int			net_thread_num, net_thread_pos;
+	int			net_events_batch;
+	int			net_engine;
 	struct dnet_net_io	*net;
 
 	struct dnet_work_pool	*recv_pool;
@@ -418,33 +780,89 @@ struct dnet_io {
 
 int dnet_state_accept_process(struct dnet_net_state *st, struct epoll_event *ev);
 int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev);
+int dnet_io_process_network_event(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev);
+void dnet_io_state_drop(struct dnet_net_state *st, int err);
+int dnet_send_gather_nolock(struct dnet_net_state *st, struct iovec *iov, int *more);
+void dnet_send_advance(struct dnet_net_state *st, size_t size);
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
 void dnet_io_exit(struct dnet_node *n);
+void dnet_io_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters);
+void dnet_io_autoscale(struct dnet_node *n);
 
 void dnet_io_req_free(struct dnet_io_req *r);
 
+void *dnet_slab_alloc(size_t size);
+void *dnet_slab_realloc(void *ptr, size_t size);
+void dnet_slab_free(void *ptr);
+void dnet_slab_stat_fill(struct dnet_stat_count *counters);
+int dnet_io_req_slice_next_nolock(struct dnet_net_state *st, struct dnet_io_req *r);
+
+#ifdef HAVE_IO_URING_SUPPORT
+/*
+ * io_uring network engine, see uring.c
+ */
+int dnet_uring_init(struct dnet_net_io *nio);
+void dnet_uring_destroy(struct dnet_net_io *nio);
+void *dnet_uring_process_network(void *data);
+int dnet_uring_state_init(struct dnet_net_state *st);
+void dnet_uring_state_destroy(struct dnet_net_state *st);
+int dnet_uring_schedule(struct dnet_net_state *st, int send);
+struct dnet_recv_chunk *dnet_uring_chunk_get(struct dnet_uring *u);
+void dnet_uring_chunk_put(struct dnet_uring *u, struct dnet_recv_chunk *c);
+
+int dnet_recv_buffer(struct dnet_net_state *st, void **buf, size_t *size);
+int dnet_recv_received(struct dnet_net_state *st, size_t size);
+#endif
+
+/*
+ * Oplock table is split into shards selected by key hash, every shard has its own lock,
+ * tree of used entries and pool of free ones. Entry fields are protected by the shard lock,
+ * key is held either exclusively (@locked) or by @shared holders, @refcnt counts holders
+ * and waiters, entry goes back to the pool when it drops to zero.
+ */
+#define DNET_LOCKS_SHARDS	64
+
 struct dnet_locks_entry {
 	struct rb_node		lock_tree_entry;
 	struct list_head	lock_list_entry;
-	pthread_mutex_t		lock;
 	pthread_cond_t		wait;
 	struct dnet_raw_id	id;
 	int			locked;
-	atomic_t		refcnt;
+	int			shared;
+	int			waiters;
+	int			exclusive_waiters;
+	int			refcnt;
+	int			allocated;
 };
 
-struct dnet_locks {
+struct dnet_locks_shard {
+	pthread_mutex_t		lock;
 	struct list_head	lock_list;
 	struct rb_root		lock_tree;
-	pthread_mutex_t		lock;
+	uint64_t		waits;
+} __attribute__((aligned(64)));
+
+struct dnet_locks {
+	struct dnet_locks_shard	shards[DNET_LOCKS_SHARDS];
+	struct dnet_locks_entry	*entries;
 };
 
 void dnet_locks_destroy(struct dnet_node *n);
 int dnet_locks_init(struct dnet_node *n, int num);
 void dnet_oplock(struct dnet_node *n, struct dnet_id *key);
+void dnet_oplock_shared(struct dnet_node *n, struct dnet_id *key);
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key);
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key);
 
+struct dnet_locks_hot {
+	struct dnet_raw_id	id;
+	int			waiters;
+	int			shared;
+};
+
+void dnet_locks_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters);
+int dnet_locks_hot_keys(struct dnet_node *n, struct dnet_locks_hot *hot, int num);
+
 struct dnet_config_data
 {
 	struct dnet_log backend_logger;
@@ -457,6 +875,12 @@ struct dnet_config_data
 	char *cfg_remotes;
 	int daemon_mode;
 
+	/* knobs which are not part of dnet_config, they are set on created node */
+	int net_events_batch;
+	int net_conns_policy;
+	uint64_t net_large_size;
+	int io_queue_policy;
+
 	struct dnet_config_entry *cfg_entries;
 	int cfg_size;
 	struct dnet_config_backend *cfg_current_backend;
@@ -488,6 +912,13 @@ struct dnet_node
 
 	pthread_mutex_t		state_lock;
 	struct list_head	group_list;
+	/* snapshot of @group_list routes, NULL when it is stale or could not be built */
+	struct dnet_route_table	*route;
+	/* increased on every route table change, under @state_lock */
+	uint64_t		route_version;
+	/* route table updates in progress, snapshot is rebuilt once when the last one ends */
+	int			route_batch;
+	int			route_stale;
 
 	/* hosts client states, i.e. those who didn't join network */
 	struct list_head	empty_state_list;
@@ -514,8 +945,18 @@ struct dnet_node
 
 	pthread_t		check_tid;
 	pthread_t		reconnect_tid;
+	pthread_t		reclaim_tid;
+	/* checking thread sleeps here until the next transaction timer of any network thread */
+	struct dnet_timer_waiter	trans_timers;
 	long			stall_count;
 
+	int			net_conns;
+	int			net_conns_policy;
+	uint64_t		net_large_size;
+	/* route table states without additional connections have been created, protected by @state_lock */
+	int			net_conns_pending;
+	uint64_t		net_slice_size;
+
 	pthread_t		monitor_tid;
 	int			monitor_fd;
 
@@ -544,6 +985,8 @@ struct dnet_node
 	int			client_prio;
 
 	struct dnet_locks	*locks;
+	unsigned int		oplock_shared;
+
 	/*
 	 * List of dnet_iterator.
 	 * Used for iterator management e.g. pause/continue actions.
@@ -555,6 +998,7 @@ struct dnet_node
 	pthread_mutex_t		iterator_lock;
 
 	size_t			cache_size;
+	int			cache_shards;
 	void			*cache;
 
 	struct dnet_config_data *config_data;
@@ -616,6 +1060,13 @@ static inline void dnet_counter_inc(struct dnet_node *n, int counter, int err)
 				(unsigned long long)n->counters[counter].err);
 }
 
+static inline void dnet_counter_add(struct dnet_node *n, int counter, int64_t val)
+{
+	dnet_lock_lock(&n->counters_lock);
+	n->counters[counter].count += val;
+	dnet_lock_unlock(&n->counters_lock);
+}
+
 static inline void dnet_counter_set(struct dnet_node *n, int counter, int err, int64_t val)
 {
 	if (counter >= __DNET_CNTR_MAX)
@@ -631,12 +1082,13 @@ static inline void dnet_counter_set(struct dnet_node *n, int counter, int err, i
 
 struct dnet_trans;
 int __attribute__((weak)) dnet_process_cmd_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, void *data, int recursive);
+int __attribute__((weak)) dnet_send_route_redirect(struct dnet_net_state *orig, struct dnet_cmd *cmd,
+		struct dnet_net_state *owner, uint64_t since);
 int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r);
 
 int dnet_recv(struct dnet_net_state *st, void *data, unsigned int size);
 int dnet_sendfile(struct dnet_net_state *st, int fd, uint64_t *offset, uint64_t size);
 
-int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
 
 int __attribute__((weak)) dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int recursive);
 
@@ -656,11 +1108,13 @@ int __attribute__((weak)) dnet_state_join_nolock(struct dnet_net_state *st);
 
 struct dnet_trans
 {
-	struct rb_node			trans_entry;
+	int				trans_hashed; /* transaction is in state's table */
 	struct list_head		trans_list_entry;
 
-	struct timeval			time, start;
+	struct timeval			start;
 	struct timespec			wait_ts;
+	/* armed while transaction is in state's table */
+	struct dnet_timer		timer;
 
 	struct dnet_net_state		*orig; /* only for forward */
 
@@ -671,6 +1125,11 @@ struct dnet_trans
 	atomic_t			refcnt;
 
 	int				command; /* main command this transaction carries */
+	int				size_class; /* enum dnet_trans_size_class, set when IO transaction is sent */
+
+	/* size of the whole command kept after transaction if it can be resent after redirect, 0 otherwise */
+	uint64_t			hsize;
+	int				redirects;
 
 	void				*priv;
 	int				(* complete)(struct dnet_net_state *st,
@@ -678,11 +1137,63 @@ struct dnet_trans
 						     void *priv);
 };
 
+enum dnet_trans_size_class {
+	DNET_TRANS_SIZE_NONE = 0,
+	DNET_TRANS_SIZE_SMALL,
+	DNET_TRANS_SIZE_LARGE,
+};
+
 void dnet_trans_destroy(struct dnet_trans *t);
 struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size);
 int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl);
 int dnet_trans_timer_setup(struct dnet_trans *t);
 
+/*
+ * Size of the deadline prefix of command data for given command flags
+ */
+static inline size_t dnet_cmd_deadline_size(uint64_t cflags)
+{
+	return (cflags & DNET_FLAGS_DEADLINE) ? sizeof(struct dnet_time) : 0;
+}
+
+/*
+ * Deadline is sent as relative timeout, so that node does not depend on client's clock
+ */
+static inline void dnet_cmd_deadline_fill(struct dnet_time *dt, struct timespec *wait_ts)
+{
+	dt->tsec = wait_ts->tv_sec;
+	dt->tnsec = wait_ts->tv_nsec;
+	dnet_convert_time(dt);
+}
+
+/* number of times command is redirected before it is sent to be forwarded by the node it was sent to */
+#define DNET_TRANS_REDIRECT_MAX		2
+
+/*
+ * Size of the route version prefix of command data sent to @st, it is only sent to nodes which have replied
+ * with their version to route list request, and is not needed by commands which are never forwarded
+ */
+static inline size_t dnet_cmd_route_version_size(struct dnet_net_state *st, uint64_t cflags)
+{
+	return (st->route_version && !(cflags & DNET_FLAGS_DIRECT)) ? sizeof(struct dnet_route_version) : 0;
+}
+
+static inline void dnet_cmd_route_version_fill(struct dnet_route_version *v, uint64_t version)
+{
+	memset(v, 0, sizeof(struct dnet_route_version));
+	v->version = version;
+	dnet_convert_route_version(v);
+}
+
+/*
+ * Size of the deadline and route version prefixes, which precede command's own data, for given command flags
+ */
+static inline size_t dnet_cmd_prefix_size(uint64_t cflags)
+{
+	return dnet_cmd_deadline_size(cflags) +
+		((cflags & DNET_FLAGS_ROUTE_VERSION) ? sizeof(struct dnet_route_version) : 0);
+}
+
 static inline struct dnet_trans *dnet_trans_get(struct dnet_trans *t)
 {
 	atomic_inc(&t->refcnt);
@@ -695,10 +1206,12 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 		dnet_trans_destroy(t);
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a);
+int dnet_trans_insert_nolock(struct dnet_trans_table *table, struct dnet_trans *a);
 void dnet_trans_remove(struct dnet_trans *t);
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t);
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans);
+void dnet_trans_remove_nolock(struct dnet_trans_table *table, struct dnet_trans *t);
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *table, uint64_t trans);
+int dnet_trans_table_move_nolock(struct dnet_trans_table *table, struct list_head *head);
+void dnet_trans_table_free(struct dnet_trans_table *table);
 
 void dnet_trans_clean_list(struct list_head *head);
 int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_head *head);
@@ -711,6 +1224,10 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_buf(struct dnet_net_state *st, void *header, uint64_t hsize,
+		struct dnet_io_buf *buf, void *data, uint64_t dsize);
+int dnet_send_read_data_buf(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io,
+		struct dnet_io_buf *buf, void *data);
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -732,6 +1249,7 @@ struct dnet_addr_storage
 int dnet_check_thread_start(struct dnet_node *n);
 void dnet_check_thread_stop(struct dnet_node *n);
 int dnet_try_reconnect(struct dnet_node *n);
+void dnet_state_conns_check(struct dnet_node *n, int all);
 
 void dnet_monitor_exit(struct dnet_node *n);
 int dnet_monitor_init(struct dnet_node *n, struct dnet_config *cfg);
@@ -762,6 +1280,7 @@ int dnet_cmd_exec_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, struct sp
 
 int dnet_cache_init(struct dnet_node *n);
 void dnet_cache_cleanup(struct dnet_node *n);
+void dnet_cache_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters);
 int dnet_cmd_cache_io(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data);
 int dnet_cmd_cache_indexes(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_indexes_request *request);
 int dnet_cmd_cache_lookup(struct dnet_net_state *st, struct dnet_cmd *cmd);
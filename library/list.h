@@ -264,6 +264,22 @@ static inline void list_splice_init(struct list_head *list,
 	}
 }
 
+/**
+ * list_splice_tail_init - join two lists, each list being a queue, and reinitialise the emptied list
+ * @list: the new list to add.
+ * @head: the place to add it in the first list.
+ *
+ * The list at @list is reinitialised
+ */
+static inline void list_splice_tail_init(struct list_head *list,
+					 struct list_head *head)
+{
+	if (!list_empty(list)) {
+		__list_splice(list, head->prev);
+		INIT_LIST_HEAD(list);
+	}
+}
+
 /**
  * list_entry - get the struct for this entry
  * @ptr:	the &struct list_head pointer.
@@ -23,88 +23,133 @@
 
 #include "elliptics.h"
 
+static void dnet_locks_entry_destroy(struct dnet_locks_entry *entry)
+{
+	pthread_cond_destroy(&entry->wait);
+	if (entry->allocated)
+		free(entry);
+}
+
 void dnet_locks_destroy(struct dnet_node *n)
 {
+	struct dnet_locks *locks = n->locks;
 	struct dnet_locks_entry *r, *tmp;
+	struct dnet_locks_shard *shard;
+	struct rb_node *node;
+	int i;
+
+	if (!locks)
+		return;
 
-	if (n->locks) {
+	for (i = 0; i < DNET_LOCKS_SHARDS; ++i) {
+		shard = &locks->shards[i];
 
-		list_for_each_entry_safe(r, tmp, &n->locks->lock_list, lock_list_entry) {
-			list_del(&r->lock_list_entry);
-			pthread_mutex_destroy(&r->lock);
-			pthread_cond_destroy(&r->wait);
+		while ((node = rb_first(&shard->lock_tree))) {
+			r = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
+			rb_erase(node, &shard->lock_tree);
+			dnet_locks_entry_destroy(r);
+		}
 
-			if (r->lock_tree_entry.rb_parent_color) {
-				rb_erase(&r->lock_tree_entry, &n->locks->lock_tree);
-			}
+		list_for_each_entry_safe(r, tmp, &shard->lock_list, lock_list_entry) {
+			list_del(&r->lock_list_entry);
+			dnet_locks_entry_destroy(r);
 		}
 
-		free(n->locks);
-		n->locks = NULL;
+		pthread_mutex_destroy(&shard->lock);
 	}
+
+	free(locks->entries);
+	free(locks);
+	n->locks = NULL;
 }
 
 int dnet_locks_init(struct dnet_node *n, int num)
 {
-	int err, i;
 	struct dnet_locks_entry *entry;
+	struct dnet_locks_shard *shard;
+	struct dnet_locks *locks;
+	int err, i, shards = 0;
 
-	n->locks = malloc(sizeof(struct dnet_locks) + num * sizeof(struct dnet_locks_entry));
-	if (!n->locks) {
-		err = -ENOMEM;
+	err = -posix_memalign((void **)&locks, 64, sizeof(struct dnet_locks));
+	if (err)
 		goto err_out_exit;
-	}
 
-	INIT_LIST_HEAD(&n->locks->lock_list);
-	n->locks->lock_tree = RB_ROOT;
+	memset(locks, 0, sizeof(struct dnet_locks));
 
-	err = pthread_mutex_init(&n->locks->lock, NULL);
-	if (err) {
-		err = -err;
-		dnet_log(n, DNET_LOG_ERROR, "Could not create lock: %s [%d]\n", strerror(-err), err);
-
-		goto err_out_destroy;
+	locks->entries = malloc(num * sizeof(struct dnet_locks_entry));
+	if (!locks->entries) {
+		err = -ENOMEM;
+		goto err_out_free;
 	}
 
-	entry = (struct dnet_locks_entry *) (n->locks + 1);
-
-	for (i = 0; i < num; ++i, ++entry) {
-		entry->locked = 0;
+	for (shards = 0; shards < DNET_LOCKS_SHARDS; ++shards) {
+		shard = &locks->shards[shards];
 
-		err = pthread_mutex_init(&entry->lock, NULL);
+		err = -pthread_mutex_init(&shard->lock, NULL);
 		if (err) {
-			err = -err;
-			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]\n", i, num, strerror(-err), err);
-
+			dnet_log(n, DNET_LOG_ERROR, "Could not create lock %d/%d: %s [%d]\n",
+					shards, DNET_LOCKS_SHARDS, strerror(-err), err);
 			goto err_out_destroy;
 		}
-		err = pthread_cond_init(&entry->wait, NULL);
+
+		INIT_LIST_HEAD(&shard->lock_list);
+		shard->lock_tree = RB_ROOT;
+	}
+
+	for (i = 0; i < num; ++i) {
+		entry = &locks->entries[i];
+		memset(entry, 0, sizeof(struct dnet_locks_entry));
+
+		err = -pthread_cond_init(&entry->wait, NULL);
 		if (err) {
-			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Could not create cond %d/%d: %s [%d]\n", i, num, strerror(-err), err);
-
-			pthread_mutex_destroy(&entry->lock);
 			goto err_out_destroy;
 		}
 
-		memset(&entry->lock_tree_entry, 0, sizeof(struct rb_node));
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
+		/* preallocated entries are spread evenly, shard which runs out of them allocates new ones */
+		list_add_tail(&entry->lock_list_entry, &locks->shards[i % DNET_LOCKS_SHARDS].lock_list);
 	}
 
+	n->locks = locks;
 	return 0;
 
 err_out_destroy:
-	dnet_locks_destroy(n);
+	for (i = 0; i < shards; ++i) {
+		shard = &locks->shards[i];
+
+		while (!list_empty(&shard->lock_list)) {
+			entry = list_first_entry(&shard->lock_list, struct dnet_locks_entry, lock_list_entry);
+			list_del(&entry->lock_list_entry);
+			pthread_cond_destroy(&entry->wait);
+		}
+
+		pthread_mutex_destroy(&shard->lock);
+	}
+	free(locks->entries);
+err_out_free:
+	free(locks);
 err_out_exit:
 	return err;
 }
 
-static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_node *n, struct dnet_id *id)
+/*
+ * Ids are hashes already, multiplication only guards against keys with non-random first bytes
+ */
+static inline struct dnet_locks_shard *dnet_oplock_shard(struct dnet_node *n, struct dnet_id *id)
+{
+	uint64_t h;
+
+	memcpy(&h, id->id, sizeof(h));
+	h *= 0x9e3779b97f4a7c15ULL;
+
+	return &n->locks->shards[(h >> 32) % DNET_LOCKS_SHARDS];
+}
+
+static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_locks_shard *shard, struct dnet_id *id)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node *node = root->rb_node;
-	struct dnet_locks_entry *entry = NULL;
-	int cmp = 1;
+	struct rb_node *node = shard->lock_tree.rb_node;
+	struct dnet_locks_entry *entry;
+	int cmp;
 
 	while (node) {
 		entry = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
@@ -121,10 +166,9 @@ static struct dnet_locks_entry *dnet_oplock_search_nolock(struct dnet_node *n, s
 	return NULL;
 }
 
-static int dnet_oplock_insert_nolock(struct dnet_node *n, struct dnet_locks_entry *a)
+static void dnet_oplock_insert_nolock(struct dnet_locks_shard *shard, struct dnet_locks_entry *a)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-	struct rb_node **node = &root->rb_node, *parent = NULL;
+	struct rb_node **node = &shard->lock_tree.rb_node, *parent = NULL;
 	struct dnet_locks_entry *t;
 	int cmp;
 
@@ -136,143 +180,248 @@ static int dnet_oplock_insert_nolock(struct dnet_node *n, struct dnet_locks_entr
 		cmp = memcmp(t->id.id, a->id.id, DNET_ID_SIZE);
 		if (cmp < 0)
 			node = &parent->rb_left;
-		else if (cmp > 0)
-			node = &parent->rb_right;
 		else
-			return -EEXIST;
+			node = &parent->rb_right;
 	}
 
 	rb_link_node(&a->lock_tree_entry, parent, node);
-	rb_insert_color(&a->lock_tree_entry, root);
-	return 0;
+	rb_insert_color(&a->lock_tree_entry, &shard->lock_tree);
 }
 
-static void dnet_oplock_remove_nolock(struct dnet_node *n, struct dnet_locks_entry *entry)
+static struct dnet_locks_entry *dnet_oplock_alloc_nolock(struct dnet_node *n, struct dnet_locks_shard *shard, struct dnet_id *id)
 {
-	struct rb_root *root = &n->locks->lock_tree;
-
-	if (!entry->lock_tree_entry.rb_parent_color) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: trying to remove non-existen oplock.\n",
-			dnet_dump_id_str(entry->id.id));
-		return;
-	}
+	struct dnet_locks_entry *entry;
 
-	if (entry) {
-		rb_erase(&entry->lock_tree_entry, root);
-		entry->lock_tree_entry.rb_parent_color = 0;
-	}
-}
+	if (!list_empty(&shard->lock_list)) {
+		entry = list_first_entry(&shard->lock_list, struct dnet_locks_entry, lock_list_entry);
+		list_del(&entry->lock_list_entry);
+	} else {
+		entry = malloc(sizeof(struct dnet_locks_entry));
+		if (!entry) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: could not allocate oplock.\n", dnet_dump_id(id));
+			return NULL;
+		}
+		memset(entry, 0, sizeof(struct dnet_locks_entry));
 
-static struct dnet_locks_entry *dnet_oplock_ensure(struct dnet_node *n, struct dnet_id *id)
-{
-	struct dnet_locks_entry *entry = NULL;
+		if (pthread_cond_init(&entry->wait, NULL)) {
+			dnet_log(n, DNET_LOG_ERROR, "%s: could not create oplock cond.\n", dnet_dump_id(id));
+			free(entry);
+			return NULL;
+		}
 
-	pthread_mutex_lock(&n->locks->lock);
+		entry->allocated = 1;
+	}
 
-	entry = dnet_oplock_search_nolock(n, id);
+	entry->locked = 0;
+	entry->shared = 0;
+	entry->waiters = 0;
+	entry->exclusive_waiters = 0;
+	entry->refcnt = 0;
+	memcpy(entry->id.id, id->id, sizeof(entry->id.id));
 
-	if (entry) {
-		atomic_inc(&entry->refcnt);
-	} else if (!list_empty(&n->locks->lock_list)) {
-		entry = list_first_entry(&n->locks->lock_list, struct dnet_locks_entry, lock_list_entry);
-		list_del(&entry->lock_list_entry);
+	dnet_oplock_insert_nolock(shard, entry);
+	return entry;
+}
 
-		entry->locked = 0;
-		atomic_init(&entry->refcnt, 1);
+/*
+ * Drops reference, entry goes back into the shard pool when neither holder nor waiters are left
+ */
+static void dnet_oplock_put_nolock(struct dnet_locks_shard *shard, struct dnet_locks_entry *entry)
+{
+	if (--entry->refcnt == 0) {
+		rb_erase(&entry->lock_tree_entry, &shard->lock_tree);
+		list_add(&entry->lock_list_entry, &shard->lock_list);
+	}
+}
 
-		memcpy(entry->id.id, id->id, sizeof(entry->id.id));
+static struct dnet_locks_entry *dnet_oplock_get_nolock(struct dnet_node *n, struct dnet_locks_shard *shard, struct dnet_id *id)
+{
+	struct dnet_locks_entry *entry;
 
-		dnet_oplock_insert_nolock(n, entry);
-	} else {
-		dnet_log(n, DNET_LOG_ERROR, "%s: oplock list is empty.\n", dnet_dump_id(id));
-	}
+	entry = dnet_oplock_search_nolock(shard, id);
+	if (!entry)
+		entry = dnet_oplock_alloc_nolock(n, shard, id);
 
-	pthread_mutex_unlock(&n->locks->lock);
+	if (entry)
+		entry->refcnt++;
 
 	return entry;
 }
 
-static struct dnet_locks_entry *dnet_oplock_take(struct dnet_node *n, struct dnet_id *id)
+static void dnet_oplock_wait_nolock(struct dnet_locks_shard *shard, struct dnet_locks_entry *entry)
 {
-	struct dnet_locks_entry *entry = NULL;
+	entry->waiters++;
+	shard->waits++;
 
-	pthread_mutex_lock(&n->locks->lock);
+	pthread_cond_wait(&entry->wait, &shard->lock);
 
-	entry = dnet_oplock_search_nolock(n, id);
+	entry->waiters--;
+}
 
-	if (!entry) {
-		dnet_log(n, DNET_LOG_ERROR, "%s: lock not found.\n", dnet_dump_id(id));
-		goto err_out_complete;
-	}
+void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
+{
+	struct dnet_locks_shard *shard = dnet_oplock_shard(n, key);
+	struct dnet_locks_entry *entry;
 
-	if (entry && atomic_dec_and_test(&entry->refcnt)) {
-		dnet_oplock_remove_nolock(n, entry);
-		list_add_tail(&entry->lock_list_entry, &n->locks->lock_list);
+	pthread_mutex_lock(&shard->lock);
 
-		entry = NULL;
-		goto err_out_complete;
-	}
+	entry = dnet_oplock_get_nolock(n, shard, key);
+	if (entry) {
+		/* shared holders which come later wait until all exclusive waiters are done */
+		entry->exclusive_waiters++;
+		while (entry->locked || entry->shared)
+			dnet_oplock_wait_nolock(shard, entry);
+		entry->exclusive_waiters--;
 
-err_out_complete:
-	pthread_mutex_unlock(&n->locks->lock);
+		entry->locked = 1;
+	}
 
-	return entry;
+	pthread_mutex_unlock(&shard->lock);
 }
 
-void dnet_oplock(struct dnet_node *n, struct dnet_id *key)
+void dnet_oplock_shared(struct dnet_node *n, struct dnet_id *key)
 {
-	struct dnet_locks_entry *entry = dnet_oplock_ensure(n, key);
+	struct dnet_locks_shard *shard = dnet_oplock_shard(n, key);
+	struct dnet_locks_entry *entry;
 
-	if (!entry) {
-		return;
-	}
+	pthread_mutex_lock(&shard->lock);
 
-	pthread_mutex_lock(&entry->lock);
+	entry = dnet_oplock_get_nolock(n, shard, key);
+	if (entry) {
+		while (entry->locked || entry->exclusive_waiters)
+			dnet_oplock_wait_nolock(shard, entry);
 
-	while (entry->locked) {
-		pthread_cond_wait(&entry->wait, &entry->lock);
+		entry->shared++;
 	}
 
-	entry->locked = 1;
-
-	pthread_mutex_unlock(&entry->lock);
+	pthread_mutex_unlock(&shard->lock);
 }
 
+/*
+ * Releases either exclusive or shared lock, whichever is held
+ */
 void dnet_opunlock(struct dnet_node *n, struct dnet_id *key)
 {
-	struct dnet_locks_entry *entry = dnet_oplock_take(n, key);
+	struct dnet_locks_shard *shard = dnet_oplock_shard(n, key);
+	struct dnet_locks_entry *entry;
 
-	if (!entry) {
-		return;
+	pthread_mutex_lock(&shard->lock);
+
+	entry = dnet_oplock_search_nolock(shard, key);
+	if (!entry || (!entry->locked && !entry->shared)) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: lock not found.\n", dnet_dump_id(key));
+		goto err_out_unlock;
 	}
 
-	pthread_mutex_lock(&entry->lock);
+	if (entry->locked)
+		entry->locked = 0;
+	else
+		entry->shared--;
 
-	entry->locked = 0;
+	/* waiters hold references, so the entry stays in the tree until the last of them unlocks it */
+	if (entry->waiters && !entry->shared)
+		pthread_cond_broadcast(&entry->wait);
 
-	pthread_cond_signal(&entry->wait);
+	dnet_oplock_put_nolock(shard, entry);
 
-	pthread_mutex_unlock(&entry->lock);
+err_out_unlock:
+	pthread_mutex_unlock(&shard->lock);
 }
 
 int dnet_optrylock(struct dnet_node *n, struct dnet_id *key)
 {
-	struct dnet_locks_entry *entry = dnet_oplock_ensure(n, key);
+	struct dnet_locks_shard *shard = dnet_oplock_shard(n, key);
+	struct dnet_locks_entry *entry;
 	int err = 0;
 
-	if (!entry) {
-		return -ENOENT;
-	}
+	pthread_mutex_lock(&shard->lock);
 
-	pthread_mutex_lock(&entry->lock);
+	entry = dnet_oplock_search_nolock(shard, key);
+	if (entry) {
+		if (entry->locked || entry->shared)
+			err = -EBUSY;
+		else
+			entry->refcnt++;
+	} else {
+		entry = dnet_oplock_alloc_nolock(n, shard, key);
+		if (!entry)
+			err = -ENOENT;
+		else
+			entry->refcnt++;
+	}
 
-	if (entry->locked)
-		err = -EBUSY;
-	else
+	if (!err)
 		entry->locked = 1;
 
-	pthread_mutex_unlock(&entry->lock);
+	pthread_mutex_unlock(&shard->lock);
 
 	return err;
 }
 
+void dnet_locks_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters)
+{
+	struct dnet_locks_shard *shard;
+	struct dnet_locks_entry *entry;
+	struct rb_node *node;
+	int i;
+
+	if (!n->locks)
+		return;
+
+	for (i = 0; i < DNET_LOCKS_SHARDS; ++i) {
+		shard = &n->locks->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		counters[DNET_CNTR_OPLOCK_WAITS].count += shard->waits;
+
+		for (node = rb_first(&shard->lock_tree); node; node = rb_next(node)) {
+			entry = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
+
+			counters[DNET_CNTR_OPLOCK_WAITERS].count += entry->waiters;
+			if ((uint64_t)entry->waiters > counters[DNET_CNTR_OPLOCK_KEY_WAITERS].count)
+				counters[DNET_CNTR_OPLOCK_KEY_WAITERS].count = entry->waiters;
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/*
+ * Fills up to @num keys with the largest number of waiters sorted by it, returns number of filled keys
+ */
+int dnet_locks_hot_keys(struct dnet_node *n, struct dnet_locks_hot *hot, int num)
+{
+	struct dnet_locks_shard *shard;
+	struct dnet_locks_entry *entry;
+	struct rb_node *node;
+	int i, pos, filled = 0;
+
+	if (!n->locks)
+		return 0;
+
+	for (i = 0; i < DNET_LOCKS_SHARDS; ++i) {
+		shard = &n->locks->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		for (node = rb_first(&shard->lock_tree); node; node = rb_next(node)) {
+			entry = rb_entry(node, struct dnet_locks_entry, lock_tree_entry);
+			if (!entry->waiters)
+				continue;
+
+			for (pos = filled; pos > 0 && hot[pos - 1].waiters < entry->waiters; --pos) {
+				if (pos < num)
+					hot[pos] = hot[pos - 1];
+			}
+
+			if (pos < num) {
+				hot[pos].id = entry->id;
+				hot[pos].waiters = entry->waiters;
+				hot[pos].shared = entry->shared;
+				if (filled < num)
+					filled++;
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return filled;
+}
@@ -245,46 +245,248 @@ err_out_exit:
 
 void dnet_state_clean(struct dnet_net_state *st)
 {
-	struct rb_node *rb_node;
-	struct dnet_trans *t;
-	int num = 0;
-
-	while (1) {
-		t = NULL;
+	struct dnet_trans *t, *tmp;
+	LIST_HEAD(head);
+	int moved, num = 0;
 
+	do {
 		pthread_mutex_lock(&st->trans_lock);
-		rb_node = rb_first(&st->trans_root);
-		if (rb_node) {
-			t = rb_entry(rb_node, struct dnet_trans, trans_entry);
-			dnet_trans_get(t);
-			dnet_trans_remove_nolock(&st->trans_root, t);
+		moved = dnet_trans_table_move_nolock(&st->trans_table, &head);
+		pthread_mutex_unlock(&st->trans_lock);
+
+		list_for_each_entry_safe(t, tmp, &head, trans_list_entry) {
 			list_del_init(&t->trans_list_entry);
+			dnet_trans_put(t);
 		}
-		pthread_mutex_unlock(&st->trans_lock);
 
-		if (!t)
-			break;
+		num += moved;
+	} while (moved);
 
-		dnet_trans_put(t);
-		dnet_trans_put(t);
-		num++;
+	dnet_log(st->n, DNET_LOG_NOTICE, "Cleaned state %s, transactions freed: %d\n", dnet_state_dump_addr(st), num);
+}
+
+struct dnet_io_buf *dnet_io_buf_create(void *data, size_t size, void (* destroy)(void *priv), void *priv)
+{
+	struct dnet_io_buf *buf;
+
+	buf = malloc(sizeof(struct dnet_io_buf));
+	if (!buf)
+		return NULL;
+
+	atomic_init(&buf->refcnt, 1);
+	buf->data = data;
+	buf->size = size;
+	buf->destroy = destroy;
+	buf->priv = priv;
+
+	return buf;
+}
+
+struct dnet_io_buf *dnet_io_buf_alloc(size_t size)
+{
+	struct dnet_io_buf *buf;
+
+	buf = malloc(sizeof(struct dnet_io_buf) + size);
+	if (!buf)
+		return NULL;
+
+	atomic_init(&buf->refcnt, 1);
+	buf->data = buf + 1;
+	buf->size = size;
+	buf->destroy = NULL;
+	buf->priv = NULL;
+
+	return buf;
+}
+
+void *dnet_io_buf_data(struct dnet_io_buf *buf)
+{
+	return buf->data;
+}
+
+size_t dnet_io_buf_size(struct dnet_io_buf *buf)
+{
+	return buf->size;
+}
+
+struct dnet_io_buf *dnet_io_buf_get(struct dnet_io_buf *buf)
+{
+	atomic_inc(&buf->refcnt);
+	return buf;
+}
+
+void dnet_io_buf_put(struct dnet_io_buf *buf)
+{
+	if (buf && atomic_dec_and_test(&buf->refcnt)) {
+		if (buf->destroy)
+			buf->destroy(buf->priv);
+		free(buf);
 	}
+}
 
-	dnet_log(st->n, DNET_LOG_NOTICE, "Cleaned state %s, transactions freed: %d\n", dnet_state_dump_addr(st), num);
+/*
+ * Point slice request @r to the next part of its reply
+ */
+static void dnet_io_req_slice_fill(struct dnet_io_req *r, uint64_t slice_size)
+{
+	struct dnet_io_req *src = r->slice_src;
+	struct dnet_cmd *cmd = r->header, *orig = src->header;
+	uint64_t offset = src->slice_offset;
+	uint64_t size = src->dsize + src->fsize - offset;
+	uint64_t flags;
+
+	if (size > slice_size)
+		size = slice_size;
+
+	/* only the first slice carries the rest of the original header */
+	r->hsize = offset ? sizeof(struct dnet_cmd) : src->hsize;
+
+	r->data = NULL;
+	r->dsize = 0;
+	r->fd = -1;
+	r->fsize = 0;
+
+	if (offset < src->dsize) {
+		r->data = src->data + offset;
+		r->dsize = src->dsize - offset;
+		if (r->dsize > size)
+			r->dsize = size;
+	}
+
+	if (size > r->dsize) {
+		r->fd = src->fd;
+		r->local_offset = src->local_offset + offset + r->dsize - src->dsize;
+		r->fsize = size - r->dsize;
+	}
+
+	src->slice_offset += size;
+
+	/* headers are already converted to network byte order */
+	flags = dnet_bswap64(orig->flags);
+	if (src->slice_offset != src->dsize + src->fsize)
+		flags |= DNET_FLAGS_SLICE;
+
+	cmd->flags = dnet_bswap64(flags);
+	cmd->size = dnet_bswap64(r->hsize - sizeof(struct dnet_cmd) + size);
 }
 
 /*
- * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
- * Large data blocks are being sent through sendfile anyway, so it should not be _that_ costly operation.
+ * Only IO replies are sliced: their header carries struct dnet_io_attr with the payload size,
+ * so the receiver allocates reassembly buffer once when the first slice arrives.
+ */
+static int dnet_io_req_need_slice(struct dnet_node *n, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_io_attr *io = (struct dnet_io_attr *)(cmd + 1);
+
+	if (!n->net_slice_size || r->hsize != sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr))
+		return 0;
+
+	if (!(dnet_bswap64(cmd->trans) & DNET_TRANS_REPLY))
+		return 0;
+
+	if (dnet_bswap64(io->size) != r->dsize + r->fsize)
+		return 0;
+
+	return r->dsize + r->fsize > n->net_slice_size;
+}
+
+static struct dnet_io_req *dnet_io_req_slice(struct dnet_node *n, struct dnet_io_req *src)
+{
+	struct dnet_io_req *r;
+
+	r = dnet_slab_alloc(sizeof(struct dnet_io_req) + src->hsize);
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(struct dnet_io_req));
+
+	r->header = r + 1;
+	memcpy(r->header, src->header, src->hsize);
+
+	INIT_LIST_HEAD(&src->slice_entry);
+	INIT_LIST_HEAD(&src->slice_pending);
+
+	r->slice_src = src;
+	dnet_io_req_slice_fill(r, n->net_slice_size);
+
+	return r;
+}
+
+/*
+ * Requests of the transaction whose reply is being sent in slices wait until the reply is sent.
+ * Must be called under @st->send_lock.
+ */
+static void dnet_io_req_queue_nolock(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = NULL, *scmd;
+	struct dnet_io_req *src;
+
+	/* command header is sent as data by dnet_send() */
+	if (r->hsize >= sizeof(struct dnet_cmd))
+		cmd = r->header;
+	else if (!r->hsize && r->dsize >= sizeof(struct dnet_cmd))
+		cmd = r->data;
+
+	if (cmd) {
+		list_for_each_entry(src, &st->send_slices, slice_entry) {
+			scmd = src->header;
+			if (scmd->trans == cmd->trans) {
+				list_add_tail(&r->req_entry, &src->slice_pending);
+				return;
+			}
+		}
+	}
+
+	list_add_tail(&r->req_entry, &st->send_list);
+
+	if (r->slice_src)
+		list_add_tail(&r->slice_src->slice_entry, &st->send_slices);
+}
+
+/*
+ * Slice @r has been sent: queue it again at the tail for the next part of the reply,
+ * so that requests queued meanwhile are sent first, or, if the reply has been completely sent,
+ * queue requests which waited for it. Returns 1 if @r has been queued again.
+ *
+ * Must be called under @st->send_lock.
+ */
+int dnet_io_req_slice_next_nolock(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_io_req *src = r->slice_src, *p, *tmp;
+
+	if (src->slice_offset != src->dsize + src->fsize) {
+		dnet_io_req_slice_fill(r, st->n->net_slice_size);
+		list_add_tail(&r->req_entry, &st->send_list);
+		return 1;
+	}
+
+	list_del_init(&src->slice_entry);
+
+	list_for_each_entry_safe(p, tmp, &src->slice_pending, req_entry) {
+		list_del(&p->req_entry);
+		dnet_io_req_queue_nolock(st, p);
+	}
+
+	return 0;
+}
+
+/*
+ * Header is always copied into queued request, it is small and usually lives on caller's stack.
+ * Data is copied only if it does not live in reference counted buffer, otherwise reference is grabbed.
+ * Large data blocks are being sent through sendfile anyway.
  */
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
 	void *buf;
-	struct dnet_io_req *r;
+	struct dnet_io_req *r, *src;
+	size_t copy_size = 0;
 	int offset = 0;
 	int err = 0;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+	if (!orig->buf)
+		copy_size = orig->dsize;
+
+	buf = r = dnet_slab_alloc(sizeof(struct dnet_io_req) + copy_size + orig->hsize);
 	if (!r) {
 		err = -ENOMEM;
 		goto err_out_exit;
@@ -301,11 +503,17 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 	}
 
 	if (orig->data && orig->dsize) {
-		r->data = buf + sizeof(struct dnet_io_req) + offset;
 		r->dsize = orig->dsize;
 
-		offset += r->dsize;
-		memcpy(r->data, orig->data, r->dsize);
+		if (orig->buf) {
+			r->data = orig->data;
+			r->buf = dnet_io_buf_get(orig->buf);
+		} else {
+			r->data = buf + sizeof(struct dnet_io_req) + offset;
+
+			offset += r->dsize;
+			memcpy(r->data, orig->data, r->dsize);
+		}
 	}
 
 	if (orig->fd >= 0 && orig->fsize) {
@@ -315,8 +523,19 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 		r->fsize = orig->fsize;
 	}
 
+	if (dnet_io_req_need_slice(st->n, r)) {
+		src = r;
+
+		r = dnet_io_req_slice(st->n, src);
+		if (!r) {
+			dnet_io_req_free(src);
+			err = -ENOMEM;
+			goto err_out_exit;
+		}
+	}
+
 	pthread_mutex_lock(&st->send_lock);
-	list_add_tail(&r->req_entry, &st->send_list);
+	dnet_io_req_queue_nolock(st, r);
 
 	if (!st->need_exit)
 		dnet_schedule_send(st);
@@ -328,13 +547,37 @@ err_out_exit:
 
 void dnet_io_req_free(struct dnet_io_req *r)
 {
+	struct dnet_io_req *p, *tmp;
+
+	/* slice does not own any of its parts, they belong to the whole reply */
+	if (r->slice_src) {
+		dnet_io_req_free(r->slice_src);
+		dnet_slab_free(r);
+		return;
+	}
+
+	if (r->slice_offset) {
+		list_for_each_entry_safe(p, tmp, &r->slice_pending, req_entry) {
+			list_del(&p->req_entry);
+			dnet_io_req_free(p);
+		}
+	}
+
 	if (r->fd >= 0 && r->fsize) {
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CACHE_FORGET)
 			posix_fadvise(r->fd, r->local_offset, r->fsize, POSIX_FADV_DONTNEED);
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE)
 			close(r->fd);
 	}
-	free(r);
+
+	dnet_io_buf_put(r->buf);
+
+	if (r->chunk) {
+		dnet_recv_chunk_put(r->chunk);
+		return;
+	}
+
+	dnet_slab_free(r);
 }
 
 static int dnet_wait(struct dnet_net_state *st, unsigned int events, long timeout)
@@ -431,7 +674,8 @@ ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size)
 	return dnet_io_req_queue(st, &r);
 }
 
-ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize)
+ssize_t dnet_send_data_buf(struct dnet_net_state *st, void *header, uint64_t hsize,
+		struct dnet_io_buf *buf, void *data, uint64_t dsize)
 {
 	struct dnet_io_req r;
 
@@ -440,32 +684,15 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	r.hsize = hsize;
 	r.data = data;
 	r.dsize = dsize;
+	r.buf = buf;
 	r.fd = -1;
 
 	return dnet_io_req_queue(st, &r);
 }
 
-static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
+ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize)
 {
-	ssize_t err;
-
-	while (dsize) {
-		err = dnet_sendfile(st, fd, &offset, dsize);
-		if (err < 0)
-			break;
-		if (err == 0) {
-			err = -ENODATA;
-			dnet_log_err(st->n, "Looks like truncated file: fd: %d, offset: %llu, size: %llu.\n",
-					fd, (unsigned long long)offset, (unsigned long long)dsize);
-			break;
-		}
-
-		dsize -= err;
-		st->send_offset += err;
-		err = 0;
-	}
-
-	return err;
+	return dnet_send_data_buf(st, header, hsize, NULL, data, dsize);
 }
 
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
@@ -486,14 +713,114 @@ ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 
 static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	struct timespec *wait_ts = t->wait_ts.tv_sec ? &t->wait_ts : &st->n->wait_ts;
+	struct timespec *wait_ts = (t->wait_ts.tv_sec || t->wait_ts.tv_nsec) ? &t->wait_ts : &st->n->wait_ts;
+	uint64_t expires = dnet_timer_now() + wait_ts->tv_sec * 1000 + wait_ts->tv_nsec / 1000000;
+	struct dnet_net_io *nio = st->nio ? st->nio : &st->n->io->net[0];
 
-	gettimeofday(&t->time, NULL);
+	/* transaction could be removed by dnet_state_clean() while its reply was processed */
+	if (t->trans_hashed)
+		dnet_timer_add(&nio->timers, &t->timer, expires);
+}
 
-	t->time.tv_sec += wait_ts->tv_sec;
-	t->time.tv_usec += wait_ts->tv_nsec / 1000;
+/*
+ * Only IO commands are spread over connections,
+ * control commands (join, auth, route list, statistics and so on) always use route table state
+ */
+static int dnet_trans_io_command(int command)
+{
+	switch (command) {
+	case DNET_CMD_LOOKUP:
+	case DNET_CMD_WRITE:
+	case DNET_CMD_READ:
+	case DNET_CMD_EXEC:
+	case DNET_CMD_DEL:
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_DEL_RANGE:
+	case DNET_CMD_BULK_READ:
+	case DNET_CMD_INDEXES_UPDATE:
+	case DNET_CMD_INDEXES_INTERNAL:
+	case DNET_CMD_INDEXES_FIND:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int dnet_trans_size_class(struct dnet_node *n, struct dnet_trans *t, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_io_attr *io;
+	uint64_t size;
+	size_t offset;
+
+	if (r->hsize + r->dsize + r->fsize >= n->net_large_size)
+		return DNET_TRANS_SIZE_LARGE;
+
+	switch (t->command) {
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_BULK_READ:
+		return DNET_TRANS_SIZE_LARGE;
+	case DNET_CMD_READ:
+		/* header is already converted to network byte order, zero size means the whole object */
+		offset = sizeof(struct dnet_cmd) + dnet_cmd_prefix_size(dnet_bswap64(cmd->flags));
+		if (r->hsize < offset + sizeof(struct dnet_io_attr))
+			break;
+
+		io = r->header + offset;
+		size = dnet_bswap64(io->size);
+		if (!size || size >= n->net_large_size)
+			return DNET_TRANS_SIZE_LARGE;
+		break;
+	}
 
-	list_move_tail(&t->trans_list_entry, &st->trans_list);
+	return DNET_TRANS_SIZE_SMALL;
+}
+
+/*
+ * Returns connection the transaction of @size_class should be sent over,
+ * additional connection is returned referenced, route table state @st is returned as is.
+ */
+static struct dnet_net_state *dnet_state_conn_select(struct dnet_net_state *st, int size_class)
+{
+	struct dnet_net_state *conn;
+	struct dnet_rcu_reader *r;
+	int num = st->conn_num;
+	unsigned int pos;
+	int i;
+
+	if (!num)
+		return st;
+
+	__sync_synchronize();
+
+	if (st->n->net_conns_policy == DNET_NET_CONNS_POLICY_ROUND_ROBIN) {
+		/* route table state takes the last slot */
+		pos = (unsigned int)atomic_inc(&st->conn_pos) % (num + 1);
+		if (pos == (unsigned int)num)
+			return st;
+	} else {
+		if (size_class != DNET_TRANS_SIZE_LARGE)
+			return st;
+
+		pos = (unsigned int)atomic_inc(&st->conn_pos) % num;
+	}
+
+	/* reset connection can be replaced and released by reconnection thread meanwhile */
+	r = dnet_rcu_read_lock();
+	if (!r)
+		return st;
+
+	for (i = 0; i < num; ++i) {
+		conn = __atomic_load_n(&st->conns[(pos + i) % num], __ATOMIC_ACQUIRE);
+		if (!conn->need_exit) {
+			dnet_state_get(conn);
+			dnet_rcu_read_unlock(r);
+			return conn;
+		}
+	}
+
+	dnet_rcu_read_unlock(r);
+	return st;
 }
 
 int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
@@ -501,10 +828,22 @@ int dnet_trans_send(struct dnet_trans *t, struct dnet_io_req *req)
 	struct dnet_net_state *st = req->st;
 	int err;
 
+	if (dnet_trans_io_command(t->command)) {
+		t->size_class = dnet_trans_size_class(st->n, t, req);
+
+		/* transaction is tracked by and its reply is received from selected connection */
+		st = dnet_state_conn_select(st, t->size_class);
+		if (st != req->st) {
+			dnet_state_put(t->st);
+			t->st = st;
+			req->st = st;
+		}
+	}
+
 	dnet_trans_get(t);
 
 	pthread_mutex_lock(&st->trans_lock);
-	err = dnet_trans_insert_nolock(&st->trans_root, t);
+	err = dnet_trans_insert_nolock(&st->trans_table, t);
 	if (!err)
 		dnet_trans_timestamp(st, t);
 	pthread_mutex_unlock(&st->trans_lock);
@@ -676,6 +1015,68 @@ static int dnet_trans_forward(struct dnet_trans *t, struct dnet_io_req *r,
 	return dnet_trans_send(t, r);
 }
 
+/*
+ * Node the command has been sent to does not own its key and has replied with route table changes
+ * client has missed. They are applied and command is resent to the owner. If the owner is still not known,
+ * or command has been redirected too many times, it is resent to the same node with zero version,
+ * which forwards it then.
+ */
+static int dnet_trans_redirect(struct dnet_net_state *st, struct dnet_trans *t, struct dnet_cmd *reply, void *data)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_net_state *rst, *nst = NULL;
+	struct dnet_cmd *cmd = (struct dnet_cmd *)(t + 1);
+	struct dnet_route_version *v;
+	struct dnet_io_req req;
+	char src[128], dst[128];
+	uint64_t version = 0;
+	int err;
+
+	/* reply could be received over additional connection, route table state keeps the version */
+	rst = dnet_state_search_by_addr(n, &st->addr);
+	if (!rst)
+		rst = dnet_state_get(st);
+
+	err = dnet_process_route_redirect(rst, reply, data);
+
+	if (++t->redirects <= DNET_TRANS_REDIRECT_MAX)
+		nst = dnet_state_get_first(n, &t->cmd.id);
+
+	if (nst && nst != rst && nst != n->st) {
+		version = nst->route_version;
+		dnet_state_put(rst);
+	} else {
+		dnet_state_put(nst);
+		nst = rst;
+	}
+
+	dnet_log(n, DNET_LOG_NOTICE, "%s: %s: trans: %llu redirected by %s to %s, version: %llu, redirects: %d, "
+			"route update err: %d\n",
+			dnet_dump_id(&t->cmd.id), dnet_cmd_string(t->command), (unsigned long long)t->trans,
+			dnet_server_convert_dnet_addr_raw(dnet_state_addr(st), src, sizeof(src)),
+			dnet_server_convert_dnet_addr_raw(dnet_state_addr(nst), dst, sizeof(dst)),
+			(unsigned long long)version,
+			t->redirects, err);
+
+	/* kept command has already been converted to network byte order */
+	v = (struct dnet_route_version *)((void *)(cmd + 1) + dnet_cmd_deadline_size(dnet_bswap64(cmd->flags)));
+	dnet_cmd_route_version_fill(v, version);
+
+	dnet_state_put(t->st);
+	t->st = nst;
+
+	memset(&req, 0, sizeof(req));
+	req.st = nst;
+	req.header = cmd;
+	req.hsize = t->hsize;
+
+	err = dnet_trans_send(t, &req);
+	if (!err)
+		dnet_counter_inc(n, DNET_CNTR_NET_REDIRECTED, 0);
+
+	return err;
+}
+
 int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 {
 	int err = 0;
@@ -688,10 +1089,10 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 		uint64_t tid = cmd->trans & ~DNET_TRANS_REPLY;
 
 		pthread_mutex_lock(&st->trans_lock);
-		t = dnet_trans_search(&st->trans_root, tid);
+		t = dnet_trans_search(&st->trans_table, tid);
 		if (t) {
 			if (!(cmd->flags & DNET_FLAGS_MORE)) {
-				dnet_trans_remove_nolock(&st->trans_root, t);
+				dnet_trans_remove_nolock(&st->trans_table, t);
 			} else {
 				dnet_trans_timestamp(st, t);
 			}
@@ -712,6 +1113,18 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 			goto err_out_exit;
 		}
 
+		if ((cmd->flags & DNET_FLAGS_ROUTE_VERSION) && (cmd->status == -ESTALE) && t->hsize) {
+			err = dnet_trans_redirect(st, t, cmd, r->data);
+			if (!err) {
+				dnet_trans_put(t);
+				goto out;
+			}
+
+			/* completion gets redirect as an error without its data */
+			cmd->size = 0;
+			err = 0;
+		}
+
 		if (t->complete)
 			t->complete(t->st, cmd, t->priv);
 
@@ -734,13 +1147,25 @@ int dnet_process_recv(struct dnet_net_state *st, struct dnet_io_req *r)
 #if 1
 	forward_state = dnet_state_get_first(n, &cmd->id);
 	if (!forward_state || forward_state == st || forward_state == n->st ||
-			(st->rcv_cmd.flags & DNET_FLAGS_DIRECT)) {
+			(cmd->flags & DNET_FLAGS_DIRECT)) {
 		dnet_state_put(forward_state);
 
 		err = dnet_process_cmd_raw(st, cmd, r->data, 0);
 		goto out;
 	}
 
+	/* client with stale route table is told where the key lives instead of paying for the extra hop */
+	if (r->route_version && r->route_version < n->route_version) {
+		err = dnet_send_route_redirect(st, cmd, forward_state, r->route_version);
+		if (!err) {
+			dnet_counter_inc(n, DNET_CNTR_NET_REDIRECTS, 0);
+			dnet_state_put(forward_state);
+			goto out;
+		}
+	}
+
+	dnet_counter_inc(n, DNET_CNTR_NET_FORWARDS, 0);
+
 	t = dnet_trans_new(st);
 	if (!t) {
 		err = -ENOMEM;
@@ -789,6 +1214,7 @@ static void dnet_state_remove(struct dnet_net_state *st)
 static void dnet_state_remove_and_shutdown(struct dnet_net_state *st, int error)
 {
 	int level = DNET_LOG_NOTICE;
+	int i;
 
 	if (error && (error != -EUCLEAN))
 		level = DNET_LOG_ERROR;
@@ -808,6 +1234,10 @@ static void dnet_state_remove_and_shutdown(struct dnet_net_state *st, int error)
 
 	pthread_mutex_unlock(&st->send_lock);
 
+	for (i = 0; i < st->conn_num; ++i) {
+		if (!st->conns[i]->need_exit)
+			dnet_state_remove_and_shutdown(st->conns[i], error);
+	}
 }
 
 int dnet_state_reset_nolock_noclean(struct dnet_net_state *st, int error, struct list_head *head)
@@ -846,6 +1276,13 @@ void dnet_set_sockopt(int s)
 	opt = 1;
 	setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &opt, 4);
 
+	/*
+	 * Send path coalesces queued requests itself,
+	 * so there is no need to wait for more data in the kernel.
+	 */
+	opt = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, 4);
+
 	opt = 3;
 	setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, &opt, 4);
 	opt = 10;
@@ -873,6 +1310,15 @@ int dnet_setup_control_nolock(struct dnet_net_state *st)
 		if (++io->net_thread_pos >= io->net_thread_num)
 			io->net_thread_pos = 0;
 		st->epoll_fd = io->net[pos].epoll_fd;
+		st->nio = &io->net[pos];
+
+#ifdef HAVE_IO_URING_SUPPORT
+		if (st->nio->uring) {
+			err = dnet_uring_state_init(st);
+			if (err)
+				goto err_out_unschedule;
+		}
+#endif
 
 		err = dnet_schedule_recv(st);
 		if (err)
@@ -954,9 +1400,8 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 
 	INIT_LIST_HEAD(&st->state_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
+	INIT_LIST_HEAD(&st->rcv_paused_entry);
 
-	st->trans_root = RB_ROOT;
-	INIT_LIST_HEAD(&st->trans_list);
 
 	st->epoll_fd = -1;
 
@@ -968,6 +1413,8 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	}
 
 	INIT_LIST_HEAD(&st->send_list);
+	INIT_LIST_HEAD(&st->send_slices);
+	INIT_LIST_HEAD(&st->rcv_slices);
 	err = pthread_mutex_init(&st->send_lock, NULL);
 	if (err) {
 		err = -err;
@@ -1002,6 +1449,175 @@ err_out:
 	return err;
 }
 
+/*
+ * Opens additional connections to the node of the route table state.
+ * They are not joined and are not added into route table, remote node sees them as client connections,
+ * they are authenticated if route table state is.
+ * Failure to open them is not fatal, requests will use the connections which were opened.
+ */
+static void dnet_state_conns_create(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_net_state **conns, *conn;
+	int i, s, err = 0, num = 0;
+
+	conns = calloc(n->net_conns - 1, sizeof(struct dnet_net_state *));
+	if (!conns) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	for (i = 0; i < n->net_conns - 1; ++i) {
+		s = dnet_socket_create_addr(n, &st->addr, 0);
+		if (s < 0) {
+			err = s;
+			break;
+		}
+
+		/* will close socket on error */
+		conn = dnet_state_create(n, 0, NULL, 0, &st->addr, s, &err, 0, st->idx, dnet_state_net_process);
+		if (!conn)
+			break;
+
+		/* creation reference belongs to network thread, this one is dropped when route table state is destroyed */
+		conns[num++] = dnet_state_get(conn);
+
+		if (st->__join_state == DNET_JOIN) {
+			err = dnet_auth_send(conn);
+			if (err)
+				break;
+		}
+	}
+
+	/* route table state has been reset meanwhile, nothing will reset connections it does not know about */
+	if (st->need_exit) {
+		for (i = 0; i < num; ++i) {
+			dnet_state_reset(conns[i], -EUCLEAN);
+			dnet_state_put(conns[i]);
+		}
+		num = 0;
+	}
+
+	if (!num) {
+		free(conns);
+		goto err_out_exit;
+	}
+
+	st->conns = conns;
+	__sync_synchronize();
+	st->conn_num = num;
+
+err_out_exit:
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: opened %d of %d additional connections: %s [%d]\n",
+				dnet_state_dump_addr(st), num, n->net_conns - 1, strerror(-err), err);
+	}
+}
+
+struct dnet_state_conn_retired {
+	struct dnet_rcu_head	rcu;
+	struct dnet_net_state	*st;
+};
+
+static void dnet_state_conn_free(struct dnet_rcu_head *head)
+{
+	struct dnet_state_conn_retired *old = container_of(head, struct dnet_state_conn_retired, rcu);
+
+	dnet_state_put(old->st);
+	free(old);
+}
+
+/*
+ * Reopens additional connections of route table state @st which have been reset.
+ * Reset connection is released when lockless readers which could have selected it leave RCU read section.
+ */
+static void dnet_state_conns_replace(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_state_conn_retired *old;
+	struct dnet_net_state *conn;
+	int i, s, err = 0, num = 0;
+
+	for (i = 0; i < st->conn_num; ++i) {
+		if (!st->conns[i]->need_exit)
+			continue;
+
+		old = malloc(sizeof(struct dnet_state_conn_retired));
+		if (!old) {
+			err = -ENOMEM;
+			break;
+		}
+
+		s = dnet_socket_create_addr(n, &st->addr, 0);
+		if (s < 0) {
+			err = s;
+			free(old);
+			break;
+		}
+
+		/* will close socket on error */
+		conn = dnet_state_create(n, 0, NULL, 0, &st->addr, s, &err, 0, st->idx, dnet_state_net_process);
+		if (!conn) {
+			free(old);
+			break;
+		}
+
+		/* creation reference belongs to network thread, this one is dropped when connection is replaced */
+		dnet_state_get(conn);
+
+		if (st->__join_state == DNET_JOIN) {
+			err = dnet_auth_send(conn);
+			if (err) {
+				dnet_state_reset(conn, err);
+				dnet_state_put(conn);
+				free(old);
+				break;
+			}
+		}
+
+		/* route table state reset takes the same lock, so it either sees the new connection or we see its reset */
+		pthread_mutex_lock(&n->state_lock);
+		if (st->need_exit) {
+			pthread_mutex_unlock(&n->state_lock);
+
+			dnet_state_reset(conn, -EUCLEAN);
+			dnet_state_put(conn);
+			free(old);
+			break;
+		}
+
+		old->st = st->conns[i];
+		__atomic_store_n(&st->conns[i], conn, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&n->state_lock);
+
+		dnet_rcu_retire(&old->rcu, dnet_state_conn_free);
+		num++;
+	}
+
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: reopened %d reset additional connections: %s [%d]\n",
+				dnet_state_dump_addr(st), num, strerror(-err), err);
+	} else if (num) {
+		dnet_log(n, DNET_LOG_NOTICE, "%s: reopened %d reset additional connections\n",
+				dnet_state_dump_addr(st), num);
+	}
+}
+
+/*
+ * Returns true if some of additional connections of @st have been reset, must be called under @n->state_lock
+ */
+static int dnet_state_conns_reset_nolock(struct dnet_net_state *st)
+{
+	int i;
+
+	for (i = 0; i < st->conn_num; ++i) {
+		if (st->conns[i]->need_exit)
+			return 1;
+	}
+
+	return 0;
+}
+
 struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 		int group_id, struct dnet_raw_id *ids, int id_num,
 		struct dnet_addr *addr, int s, int *errp, int join, int idx,
@@ -1101,6 +1717,13 @@ struct dnet_net_state *dnet_state_create(struct dnet_node *n,
 	if (err)
 		goto err_out_exit;
 
+	/* connecting would block the caller, connections are opened by reconnection thread */
+	if (ids && id_num && (process == dnet_state_net_process) && (n->net_conns > 1)) {
+		pthread_mutex_lock(&n->state_lock);
+		n->net_conns_pending = 1;
+		pthread_mutex_unlock(&n->state_lock);
+	}
+
 	return st;
 
 err_out_unlock:
@@ -1124,6 +1747,71 @@ err_out_exit:
 	return NULL;
 }
 
+/*
+ * Opens additional connections for route table states which do not have them yet.
+ * Only states created since the previous call are looked for unless @all is set,
+ * then states which failed to open any connection are retried and reset connections are replaced too.
+ */
+void dnet_state_conns_check(struct dnet_node *n, int all)
+{
+	struct dnet_net_state *st, **states;
+	struct dnet_group *g;
+	int i, num = 0, pos = 0;
+
+	if (n->net_conns <= 1)
+		return;
+
+	pthread_mutex_lock(&n->state_lock);
+	if (!all && !n->net_conns_pending) {
+		pthread_mutex_unlock(&n->state_lock);
+		return;
+	}
+
+	n->net_conns_pending = 0;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry)
+			num++;
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	if (!num)
+		return;
+
+	states = malloc(num * sizeof(struct dnet_net_state *));
+	if (!states) {
+		pthread_mutex_lock(&n->state_lock);
+		n->net_conns_pending = 1;
+		pthread_mutex_unlock(&n->state_lock);
+		return;
+	}
+
+	pthread_mutex_lock(&n->state_lock);
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (pos == num)
+				break;
+
+			if (st->need_exit || (st->process != dnet_state_net_process))
+				continue;
+
+			if (!st->conns || (all && dnet_state_conns_reset_nolock(st)))
+				states[pos++] = dnet_state_get(st);
+		}
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	for (i = 0; i < pos; ++i) {
+		if (states[i]->conns)
+			dnet_state_conns_replace(states[i]);
+		else
+			dnet_state_conns_create(states[i]);
+		dnet_state_put(states[i]);
+	}
+
+	free(states);
+}
+
 int dnet_state_num(struct dnet_session *s)
 {
 	struct dnet_node *n = s->node;
@@ -1153,8 +1841,17 @@ static void dnet_state_send_clean(struct dnet_net_state *st)
 
 void dnet_state_destroy(struct dnet_net_state *st)
 {
+	int i;
+
 	dnet_state_remove(st);
 
+	for (i = 0; i < st->conn_num; ++i) {
+		if (!st->conns[i]->need_exit)
+			dnet_state_reset(st->conns[i], -EUCLEAN);
+		dnet_state_put(st->conns[i]);
+	}
+	free(st->conns);
+
 	if (st->read_s >= 0) {
 		dnet_sock_close(st->read_s);
 		dnet_sock_close(st->write_s);
@@ -1164,8 +1861,17 @@ void dnet_state_destroy(struct dnet_net_state *st)
 
 	dnet_state_send_clean(st);
 
+	dnet_slab_free(st->rcv_data);
+	dnet_recv_chunk_put(st->rcv_chunk);
+	dnet_recv_slices_free(st);
+
+#ifdef HAVE_IO_URING_SUPPORT
+	dnet_uring_state_destroy(st);
+#endif
+
 	pthread_mutex_destroy(&st->send_lock);
 	pthread_mutex_destroy(&st->trans_lock);
+	dnet_trans_table_free(&st->trans_table);
 
 	dnet_log(st->n, DNET_LOG_NOTICE, "Freeing state %s, socket: %d/%d, addr-num: %d.\n",
 		dnet_server_convert_dnet_addr(&st->addr), st->read_s, st->write_s, st->addr_num);
@@ -1211,139 +1917,40 @@ int dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd,
 	return err;
 }
 
-int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more)
+int dnet_send_reply_buf(void *state, struct dnet_cmd *cmd, struct dnet_io_buf *buf,
+		void *odata, unsigned int size, int more)
 {
 	struct dnet_net_state *st = state;
-	struct dnet_cmd *c;
-	void *data;
-	int err;
+	struct dnet_cmd c;
 
 	if (st == st->n->st)
 		return 0;
 
-	c = malloc(sizeof(struct dnet_cmd) + size);
-	if (!c)
-		return -ENOMEM;
-
-	memset(c, 0, sizeof(struct dnet_cmd) + size);
-
-	data = c + 1;
-	*c = *cmd;
+	c = *cmd;
 
 	if ((cmd->flags & DNET_FLAGS_NEED_ACK) || more)
-		c->flags |= DNET_FLAGS_MORE;
+		c.flags |= DNET_FLAGS_MORE;
 
-	c->size = size;
-	c->trans |= DNET_TRANS_REPLY;
-
-	if (size)
-		memcpy(data, odata, size);
+	c.size = size;
+	c.trans |= DNET_TRANS_REPLY;
 
 	dnet_log(st->n, DNET_LOG_NOTICE, "%s: %s: reply -> %s: trans: %lld, size: %u, cflags: 0x%llx.\n",
 		dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
-		(unsigned long long)(c->trans &~ DNET_TRANS_REPLY),
-		size, (unsigned long long)c->flags);
-
-	dnet_convert_cmd(c);
-
-	err = dnet_send(st, c, sizeof(struct dnet_cmd) + size);
-	free(c);
-
-	return err;
-}
-
-int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
-{
-	int cork;
-	int err = 0;
-	size_t offset = st->send_offset;
-	size_t total_size = r->dsize + r->hsize + r->fsize;
-
-	if (total_size > sizeof(struct dnet_cmd)) {
-		/* Use TCP_CORK to send headers and packet body in one piece */
-		cork = 1;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-	}
-
-	if (1) {
-		struct dnet_cmd *cmd = r->header;
-		if (!cmd)
-			cmd = r->data;
-		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: sending -> %s: trans: %lld, size: %llu, cflags: 0x%llx, start-sent: %zd/%zd.\n",
-			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
-			(unsigned long long)(cmd->trans &~ DNET_TRANS_REPLY),
-			(unsigned long long)cmd->size, (unsigned long long)cmd->flags,
-			st->send_offset, r->dsize + r->hsize + r->fsize);
-	}
-
-	if (r->hsize && r->header && st->send_offset < r->hsize) {
-		err = dnet_send_nolock(st, r->header + offset, r->hsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
+		(unsigned long long)(c.trans &~ DNET_TRANS_REPLY),
+		size, (unsigned long long)c.flags);
 
-	if (r->dsize && r->data && st->send_offset < (r->dsize + r->hsize)) {
-		offset = st->send_offset - r->hsize;
-		err = dnet_send_nolock(st, r->data + offset, r->dsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
-
-	if (r->fd >= 0 && r->fsize && st->send_offset < (r->dsize + r->hsize + r->fsize)) {
-		offset = st->send_offset - r->dsize - r->hsize;
-		err = dnet_send_fd_nolock(st, r->fd, r->local_offset + offset, r->fsize - offset);
-		if (err)
-			goto err_out_exit;
-	}
-
-	if (r->hsize > sizeof(struct dnet_cmd)) {
-		struct dnet_cmd *cmd = r->header;
-		int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
-
-		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: SENT %s cmd: %s: cmd-size: %llu, nonblocking: %d\n",
-			dnet_state_dump_addr(st), dnet_dump_id(r->header),
-			nonblocking ? "nonblocking" : "blocking",
-			dnet_cmd_string(cmd->cmd),
-			(unsigned long long)cmd->size, nonblocking);
-	}
-
-err_out_exit:
-
-	if (1) {
-		struct dnet_cmd *cmd = r->header;
-		if (!cmd)
-			cmd = r->data;
-		dnet_log(st->n, DNET_LOG_DEBUG, "%s: %s: sending -> %s: trans: %lld, size: %llu, cflags: 0x%llx, finish-sent: %zd/%zd.\n",
-			dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd), dnet_server_convert_dnet_addr(&st->addr),
-			(unsigned long long)(cmd->trans &~ DNET_TRANS_REPLY),
-			(unsigned long long)cmd->size, (unsigned long long)cmd->flags,
-			st->send_offset, r->dsize + r->hsize + r->fsize);
-	}
-
-	if (err && err != -EAGAIN) {
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: setting send need_exit to %d\n", dnet_state_dump_addr(st), err);
-		st->need_exit = err;
-	}
-
-	if (total_size > sizeof(struct dnet_cmd)) {
-		cork = 0;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-	}
+	dnet_convert_cmd(&c);
 
 	/*
-	 * Flush TCP output pipeline if we've sent whole request.
-	 *
-	 * We do not destroy request here, it is postponed to caller.
-	 * Function can be called without lock - default call path from network processing thread and dnet_process_send_single()
-	 * or under st->send_lock, if queue was empty and dnet_send*() caller directly invoked this function from dnet_io_req_queue()
-	 * instead of queueing.
+	 * Header and data are queued as single request,
+	 * data is copied only if it does not live in reference counted buffer.
 	 */
-	if (st->send_offset == r->dsize + r->hsize + r->fsize) {
-		int nodelay = 1;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
-	}
+	return dnet_send_data_buf(st, &c, sizeof(struct dnet_cmd), buf, odata, size);
+}
 
-	return err;
+int dnet_send_reply(void *state, struct dnet_cmd *cmd, void *odata, unsigned int size, int more)
+{
+	return dnet_send_reply_buf(state, cmd, NULL, odata, size, more);
 }
 
 int dnet_parse_addr(char *addr, int *portp, int *familyp)
@@ -166,12 +166,69 @@ static void dnet_idc_remove_ids(struct dnet_net_state *st, struct dnet_group *g)
 		}
 	}
 
+	/* compaction keeps ids sorted */
 	g->id_num = pos;
-
-	qsort(g->ids,  g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
 	st->idc = NULL;
 }
 
+/*
+ * Id is not added into the group if it is already there or repeats previous id of the state
+ */
+static inline int dnet_idc_id_dup(struct dnet_idc *idc, int pos)
+{
+	return pos > 0 && !dnet_idc_compare(&idc->ids[pos - 1], &idc->ids[pos]);
+}
+
+/*
+ * Merge sorted ids of the new state into sorted group ids, returns number of added ids.
+ * Only the new ids are sorted, group ids are moved once.
+ */
+static int dnet_idc_merge_ids(struct dnet_group *g, struct dnet_idc *idc, int id_num)
+{
+	struct dnet_state_id *ids;
+	int i, j, pos, num = 0, cmp;
+
+	qsort(idc->ids, id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
+
+	for (j = 0; j < id_num; ++j) {
+		if (dnet_idc_id_dup(idc, j))
+			continue;
+		if (bsearch(&idc->ids[j], g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare))
+			continue;
+
+		num++;
+	}
+
+	if (!num)
+		return -EEXIST;
+
+	ids = realloc(g->ids, (g->id_num + num) * sizeof(struct dnet_state_id));
+	if (!ids)
+		return -ENOMEM;
+	g->ids = ids;
+
+	/* from the end, so that not yet merged group ids are never overwritten */
+	i = g->id_num - 1;
+	pos = g->id_num + num - 1;
+	for (j = id_num - 1; j >= 0; ) {
+		cmp = -1;
+		if (i >= 0)
+			cmp = dnet_idc_compare(&g->ids[i], &idc->ids[j]);
+
+		if (cmp > 0) {
+			g->ids[pos--] = g->ids[i--];
+			continue;
+		}
+
+		if (cmp < 0 && !dnet_idc_id_dup(idc, j))
+			g->ids[pos--] = idc->ids[j];
+		j--;
+	}
+
+	g->id_num += num;
+	return num;
+}
+
 int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id *ids, int id_num)
 {
 	struct dnet_node *n = st->n;
@@ -206,28 +263,12 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 		list_add_tail(&g->group_entry, &n->group_list);
 	}
 
-	g->ids = realloc(g->ids, (g->id_num + id_num) * sizeof(struct dnet_state_id));
-	if (!g->ids) {
-		g->id_num = 0;
+	num = dnet_idc_merge_ids(g, idc, id_num);
+	if (num < 0) {
+		err = num;
 		goto err_out_unlock_put;
 	}
 
-	num = 0;
-	for (i=0; i<id_num; ++i) {
-		if (!bsearch(&idc->ids[i], g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare)) {
-			memcpy(&g->ids[g->id_num + num], &idc->ids[i], sizeof(struct dnet_state_id));
-			num++;
-		}
-	}
-
-	if (!num) {
-		err = -EEXIST;
-		goto err_out_unlock_put;
-	}
-
-	g->id_num += num;
-	qsort(g->ids, g->id_num, sizeof(struct dnet_state_id), dnet_idc_compare);
-
 	list_add_tail(&st->state_entry, &g->state_list);
 	list_add_tail(&st->storage_state_entry, &n->storage_state_list);
 
@@ -249,6 +290,8 @@ int dnet_idc_create(struct dnet_net_state *st, int group_id, struct dnet_raw_id
 	if (err)
 		goto err_out_remove_nolock;
 
+	dnet_route_update_nolock(n, 0);
+	idc->version = n->route_version;
 	pthread_mutex_unlock(&n->state_lock);
 
 	gettimeofday(&end, NULL);
@@ -304,6 +347,7 @@ void dnet_idc_destroy_nolock(struct dnet_net_state *st)
 
 	g = idc->group;
 	dnet_idc_remove_ids(st, g);
+	dnet_route_update_nolock(st->n, 1);
 	dnet_group_put(g);
 	free(idc);
 }
@@ -443,21 +487,316 @@ err_out_exit:
 	return found;
 }
 
-struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id)
+static void dnet_route_table_free(struct dnet_rcu_head *head)
 {
+	struct dnet_route_table *table = container_of(head, struct dnet_route_table, rcu);
+	int i;
+
+	for (i = 0; i < table->state_num; ++i)
+		dnet_state_put(table->states[i]);
+
+	free(table);
+}
+
+static int dnet_route_group_compare(const void *k1, const void *k2)
+{
+	const struct dnet_route_group *g1 = k1;
+	const struct dnet_route_group *g2 = k2;
+
+	if (g1->group_id < g2->group_id)
+		return -1;
+	if (g1->group_id > g2->group_id)
+		return 1;
+	return 0;
+}
+
+/*
+ * States are referenced by snapshot since they are added into group until they are removed from it,
+ * so unreferenced state found here is being destroyed and waits for @state_lock to remove itself.
+ * This only happens when previous snapshot could not be built.
+ */
+static inline int dnet_route_state_dying(struct dnet_net_state *st)
+{
+	return atomic_read(&st->refcnt) == 0;
+}
+
+static inline uint64_t dnet_route_prefix(const unsigned char *id)
+{
+	uint64_t prefix = 0;
+	int i;
+
+	for (i = 0; i < 8; ++i)
+		prefix = (prefix << 8) | id[i];
+
+	return prefix;
+}
+
+/*
+ * About one id per radix slot
+ */
+static int dnet_route_radix_bits(int id_num)
+{
+	int bits = 1;
+
+	while (bits < DNET_ROUTE_RADIX_MAX_BITS && (1 << bits) < id_num)
+		bits++;
+
+	return bits;
+}
+
+static void dnet_route_group_index(struct dnet_route_group *g)
+{
+	int shift = 64 - g->radix_bits;
+	uint64_t slot;
+	int i;
+
+	for (i = 0; i < g->id_num; ++i)
+		g->prefix[i] = dnet_route_prefix(g->ids[i].id.id);
+
+	for (slot = 0, i = 0; slot <= (1ULL << g->radix_bits); ++slot) {
+		while (i < g->id_num && (g->prefix[i] >> shift) < slot)
+			i++;
+
+		g->radix[slot] = i;
+	}
+}
+
+static struct dnet_route_table *dnet_route_table_create_nolock(struct dnet_node *n)
+{
+	struct dnet_route_table *table;
+	struct dnet_route_group *rg;
+	struct dnet_route_entry *e;
+	struct dnet_net_state *st;
+	struct dnet_group *g;
+	int group_num = 0, id_num = 0, state_num = 0, radix_num = 0;
+	uint32_t *radix;
+	uint64_t *prefix;
+	int i;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (!g->id_num)
+			continue;
+
+		group_num++;
+		id_num += g->id_num;
+		radix_num += (1 << dnet_route_radix_bits(g->id_num)) + 1;
+		list_for_each_entry(st, &g->state_list, state_entry)
+			state_num++;
+	}
+
+	table = malloc(sizeof(struct dnet_route_table) +
+			id_num * (sizeof(struct dnet_route_entry) + sizeof(uint64_t)) +
+			group_num * sizeof(struct dnet_route_group) +
+			state_num * sizeof(struct dnet_net_state *) +
+			radix_num * sizeof(uint32_t));
+	if (!table)
+		return NULL;
+
+	e = (struct dnet_route_entry *)(table + 1);
+	prefix = (uint64_t *)(e + id_num);
+	table->groups = (struct dnet_route_group *)(prefix + id_num);
+	table->states = (struct dnet_net_state **)(table->groups + group_num);
+	radix = (uint32_t *)(table->states + state_num);
+	table->group_num = 0;
+	table->state_num = 0;
+
+	list_for_each_entry(g, &n->group_list, group_entry) {
+		if (!g->id_num)
+			continue;
+
+		rg = &table->groups[table->group_num];
+		rg->group_id = g->group_id;
+		rg->id_num = 0;
+		rg->ids = e;
+
+		for (i = 0; i < g->id_num; ++i) {
+			st = g->ids[i].idc->st;
+			if (dnet_route_state_dying(st))
+				continue;
+
+			memcpy(&e->id, &g->ids[i].raw, sizeof(struct dnet_raw_id));
+			e->st = st;
+			e++;
+			rg->id_num++;
+		}
+
+		if (!rg->id_num)
+			continue;
+
+		/* sized by group ids, some of them could have been skipped */
+		rg->radix_bits = dnet_route_radix_bits(g->id_num);
+		rg->radix = radix;
+		rg->prefix = prefix;
+		radix += (1 << rg->radix_bits) + 1;
+		prefix += rg->id_num;
+
+		dnet_route_group_index(rg);
+
+		table->group_num++;
+
+		list_for_each_entry(st, &g->state_list, state_entry) {
+			if (!dnet_route_state_dying(st))
+				table->states[table->state_num++] = dnet_state_get(st);
+		}
+	}
+
+	qsort(table->groups, table->group_num, sizeof(struct dnet_route_group), dnet_route_group_compare);
+
+	return table;
+}
+
+static void dnet_route_publish_nolock(struct dnet_node *n, struct dnet_route_table *table)
+{
+	struct dnet_route_table *old;
+
+	old = n->route;
+	__atomic_store_n(&n->route, table, __ATOMIC_RELEASE);
+
+	if (old)
+		dnet_rcu_retire(&old->rcu, dnet_route_table_free);
+}
+
+static void dnet_route_rebuild_nolock(struct dnet_node *n)
+{
+	struct dnet_route_table *table;
+
+	table = dnet_route_table_create_nolock(n);
+	if (!table)
+		dnet_log(n, DNET_LOG_ERROR, "Failed to allocate route table snapshot, falling back to locked lookup.\n");
+
+	dnet_route_publish_nolock(n, table);
+	n->route_stale = 0;
+}
+
+/*
+ * Must be called under @state_lock after group ids have been changed, @removed is set when state has left its group.
+ * New snapshot is published right away unless route table update is in progress, it is rebuilt when the update ends then.
+ * Until that lookups keep using the old snapshot if states have only been added, and take the lock if any has been removed,
+ * so that removed states are never returned.
+ * Old snapshot is freed when lock-free readers are done with it.
+ */
+void dnet_route_update_nolock(struct dnet_node *n, int removed)
+{
+	n->route_version++;
+
+	if (!n->route_batch) {
+		dnet_route_rebuild_nolock(n);
+		return;
+	}
+
+	n->route_stale = 1;
+	if (removed)
+		dnet_route_publish_nolock(n, NULL);
+}
+
+/*
+ * Route table update consisting of many state additions or removals, like received route list
+ */
+void dnet_route_batch_start(struct dnet_node *n)
+{
+	pthread_mutex_lock(&n->state_lock);
+	n->route_batch++;
+	pthread_mutex_unlock(&n->state_lock);
+}
+
+void dnet_route_batch_end(struct dnet_node *n)
+{
+	pthread_mutex_lock(&n->state_lock);
+	if (--n->route_batch == 0 && n->route_stale)
+		dnet_route_rebuild_nolock(n);
+	pthread_mutex_unlock(&n->state_lock);
+}
+
+/*
+ * Called when all states have been reset and no lookups are possible
+ */
+void dnet_route_destroy(struct dnet_node *n)
+{
+	pthread_mutex_lock(&n->state_lock);
+	if (n->route) {
+		dnet_rcu_retire(&n->route->rcu, dnet_route_table_free);
+		n->route = NULL;
+	}
+	pthread_mutex_unlock(&n->state_lock);
+
+	dnet_rcu_barrier();
+}
+
+/*
+ * The same as dnet_state_search_nolock() on snapshot, returned state is not referenced
+ */
+static struct dnet_net_state *dnet_route_table_search(struct dnet_route_table *table, struct dnet_id *id)
+{
+	struct dnet_route_group *g, key;
+	uint64_t prefix, slot;
+	int low, high, i;
+
+	key.group_id = id->group_id;
+	g = bsearch(&key, table->groups, table->group_num, sizeof(struct dnet_route_group), dnet_route_group_compare);
+	if (!g)
+		return NULL;
+
+	prefix = dnet_route_prefix(id->id);
+	slot = prefix >> (64 - g->radix_bits);
+
+	/* the first id whose prefix is greater than the key's one, it can only be in the key's radix slot or right after it */
+	for (low = g->radix[slot], high = g->radix[slot + 1]; low < high; ) {
+		i = low + (high - low) / 2;
+
+		if (g->prefix[i] <= prefix)
+			low = i + 1;
+		else
+			high = i;
+	}
+
+	/* ids with the same prefix are greater than the key unless their full ids say otherwise */
+	while (low > 0 && g->prefix[low - 1] == prefix && dnet_id_cmp_str(g->ids[low - 1].id.id, id->id) > 0)
+		low--;
+
+	if (low == 0)
+		low = g->id_num;
+
+	return g->ids[low - 1].st;
+}
+
+static struct dnet_net_state *dnet_route_search(struct dnet_node *n, struct dnet_id *id, int skip_self)
+{
+	struct dnet_route_table *table;
 	struct dnet_net_state *found;
+	struct dnet_rcu_reader *r;
+
+	r = dnet_rcu_read_lock();
+	if (r) {
+		table = __atomic_load_n(&n->route, __ATOMIC_ACQUIRE);
+		if (table) {
+			found = dnet_route_table_search(table, id);
+			if (found && !(skip_self && found == n->st))
+				dnet_state_get(found);
+			else
+				found = NULL;
+
+			dnet_rcu_read_unlock(r);
+			return found;
+		}
+
+		dnet_rcu_read_unlock(r);
+	}
 
 	pthread_mutex_lock(&n->state_lock);
 	found = dnet_state_search_nolock(n, id);
-	if (found == n->st) {
+	if (skip_self && found == n->st) {
 		dnet_state_put(found);
 		found = NULL;
 	}
-
 	pthread_mutex_unlock(&n->state_lock);
 
 	return found;
 }
+
+struct dnet_net_state *dnet_state_get_first(struct dnet_node *n, struct dnet_id *id)
+{
+	return dnet_route_search(n, id, 1);
+}
 void dnet_state_put(struct dnet_net_state *st)
 {
 	/*
@@ -473,13 +812,7 @@ void dnet_state_put(struct dnet_net_state *st)
  */
 struct dnet_net_state *dnet_node_state(struct dnet_node *n)
 {
-	struct dnet_net_state *found;
-
-	pthread_mutex_lock(&n->state_lock);
-	found = dnet_state_search_nolock(n, &n->id);
-	pthread_mutex_unlock(&n->state_lock);
-
-	return found;
+	return dnet_route_search(n, &n->id, 0);
 }
 
 struct dnet_node *dnet_node_create(struct dnet_config *cfg)
@@ -547,13 +880,18 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	n->notify_hash_size = cfg->hash_size;
 	n->check_timeout = cfg->check_timeout;
 	n->stall_count = cfg->stall_count;
+	n->net_conns = cfg->net_conns;
+	n->net_large_size = DNET_DEFAULT_NET_LARGE_SIZE;
+	n->net_slice_size = cfg->net_slice_size > 0 ? cfg->net_slice_size : 0;
 	n->id.group_id = cfg->group_id;
 	n->bg_ionice_class = cfg->bg_ionice_class;
 	n->bg_ionice_prio = cfg->bg_ionice_prio;
 	n->removal_delay = cfg->removal_delay;
 	n->flags = cfg->flags;
 	n->cache_size = cfg->cache_size;
+	n->cache_shards = cfg->cache_shards;
 	n->indexes_shard_count = cfg->indexes_shard_count;
+	n->oplock_shared = cfg->oplock_shared ? (unsigned int)cfg->oplock_shared : DNET_OPLOCK_SHARED_DEFAULT;
 
 	if (!n->log)
 		dnet_log_init(n, cfg->log);
@@ -578,12 +916,26 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 				n->cache_sync_timeout);
 	}
 
+	if (n->cache_shards <= 0) {
+		n->cache_shards = DNET_DEFAULT_CACHE_SHARDS_PER_CPU * sysconf(_SC_NPROCESSORS_ONLN);
+		if (n->cache_shards <= 0)
+			n->cache_shards = DNET_DEFAULT_CACHE_SHARDS_PER_CPU;
+		if (n->cache_shards > DNET_DEFAULT_CACHE_SHARDS_MAX)
+			n->cache_shards = DNET_DEFAULT_CACHE_SHARDS_MAX;
+	}
+
 	if (!n->stall_count) {
 		n->stall_count = DNET_DEFAULT_STALL_TRANSACTIONS;
 		dnet_log(n, DNET_LOG_NOTICE, "Using default stall count (%ld transactions).\n",
 				n->stall_count);
 	}
 
+	if (n->net_conns <= 0)
+		n->net_conns = 1;
+
+	if (n->net_conns > 1)
+		dnet_log(n, DNET_LOG_INFO, "Using %d connections per node.\n", n->net_conns);
+
 	n->client_prio = cfg->client_prio;
 	n->server_prio = cfg->server_prio;
 
@@ -597,10 +949,14 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	if (err)
 		goto err_out_free;
 
-	err = dnet_io_init(n, cfg);
+	err = dnet_timer_waiter_init(&n->trans_timers);
 	if (err)
 		goto err_out_crypto_cleanup;
 
+	err = dnet_io_init(n, cfg);
+	if (err)
+		goto err_out_timers_destroy;
+
 	err = dnet_check_thread_start(n);
 	if (err)
 		goto err_out_io_exit;
@@ -611,6 +967,8 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 
 err_out_io_exit:
 	dnet_io_exit(n);
+err_out_timers_destroy:
+	dnet_timer_waiter_destroy(&n->trans_timers);
 err_out_crypto_cleanup:
 	dnet_crypto_cleanup(n);
 err_out_free:
@@ -645,6 +1003,7 @@ void dnet_node_cleanup_common_resources(struct dnet_node *n)
 	dnet_check_thread_stop(n);
 
 	dnet_io_exit(n);
+	dnet_timer_waiter_destroy(&n->trans_timers);
 
 	pthread_attr_destroy(&n->attr);
 
@@ -818,11 +1177,18 @@ uint64_t dnet_session_get_user_flags(struct dnet_session *s)
 void dnet_session_set_timeout(struct dnet_session *s, unsigned int wait_timeout)
 {
 	s->wait_ts.tv_sec = wait_timeout;
+	s->wait_ts.tv_nsec = 0;
+}
+
+void dnet_session_set_timeout_ms(struct dnet_session *s, unsigned int wait_timeout_ms)
+{
+	s->wait_ts.tv_sec = wait_timeout_ms / 1000;
+	s->wait_ts.tv_nsec = (wait_timeout_ms % 1000) * 1000000;
 }
 
 struct timespec *dnet_session_get_timeout(struct dnet_session *s)
 {
-	return s->wait_ts.tv_sec ? &s->wait_ts : &s->node->wait_ts;
+	return (s->wait_ts.tv_sec || s->wait_ts.tv_nsec) ? &s->wait_ts : &s->node->wait_ts;
 }
 
 void dnet_set_timeouts(struct dnet_node *n, int wait_timeout, int check_timeout)
@@ -831,6 +1197,23 @@ void dnet_set_timeouts(struct dnet_node *n, int wait_timeout, int check_timeout)
 	n->check_timeout = check_timeout;
 }
 
+void dnet_set_net_events_batch(struct dnet_node *n, int batch)
+{
+	/* network threads resize their event arrays when they notice the change */
+	n->io->net_events_batch = batch > 0 ? batch : DNET_DEFAULT_NET_EVENTS_BATCH;
+}
+
+void dnet_set_net_conns_policy(struct dnet_node *n, int policy, uint64_t large_size)
+{
+	n->net_conns_policy = policy;
+	n->net_large_size = large_size ? large_size : DNET_DEFAULT_NET_LARGE_SIZE;
+}
+
+void dnet_set_io_queue_policy(struct dnet_node *n, int policy)
+{
+	n->io->recv_pool->queue_policy = n->io->recv_pool_nb->queue_policy = policy;
+}
+
 struct dnet_node *dnet_session_get_node(struct dnet_session *s)
 {
 	return s->node;
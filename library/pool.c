@@ -29,6 +29,21 @@ static char *dnet_work_io_mode_string[] = {
 	[DNET_WORK_IO_MODE_NONBLOCKING] = "NONBLOCKING",
 };
 
+static char *dnet_io_class_string[] = {
+	[DNET_IO_CLASS_INTERACTIVE] = "INTERACTIVE",
+	[DNET_IO_CLASS_WRITE] = "WRITE",
+	[DNET_IO_CLASS_BACKGROUND] = "BACKGROUND",
+};
+
+/* virtual time request of given class takes, inversely proportional to class weight */
+#define DNET_IO_CLASS_STRIDE	(1 << 20)
+
+static const uint64_t dnet_io_class_stride[] = {
+	[DNET_IO_CLASS_INTERACTIVE] = DNET_IO_CLASS_STRIDE / DNET_IO_CLASS_INTERACTIVE_WEIGHT,
+	[DNET_IO_CLASS_WRITE] = DNET_IO_CLASS_STRIDE / DNET_IO_CLASS_WRITE_WEIGHT,
+	[DNET_IO_CLASS_BACKGROUND] = DNET_IO_CLASS_STRIDE / DNET_IO_CLASS_BACKGROUND_WEIGHT,
+};
+
 __thread uint32_t trace_id = 0;
 
 static char *dnet_work_io_mode_str(int mode)
@@ -42,82 +57,140 @@ static char *dnet_work_io_mode_str(int mode)
 static void dnet_work_pool_cleanup(struct dnet_work_pool *pool)
 {
 	struct dnet_io_req *r, *tmp;
-	struct dnet_work_io *wio, *wio_tmp;
+	struct dnet_net_state *st, *st_tmp;
+	struct dnet_work_io *wio;
+	int i, c;
 
-	list_for_each_entry_safe(wio, wio_tmp, &pool->wio_list, wio_entry) {
-		pthread_join(wio->tid, NULL);
-		list_del(&wio->wio_entry);
-		free(wio);
-	}
+	for (i = 0; i < pool->num; ++i)
+		pthread_join(pool->wio[i].tid, NULL);
 
+	list_for_each_entry_safe(st, st_tmp, &pool->paused_list, rcv_paused_entry) {
+		list_del_init(&st->rcv_paused_entry);
+		st->rcv_paused = 0;
+		dnet_state_put(st);
+	}
 
-	list_for_each_entry_safe(r, tmp, &pool->list, req_entry) {
+	list_for_each_entry_safe(r, tmp, &pool->parked_list, req_entry) {
 		list_del(&r->req_entry);
 		dnet_io_req_free(r);
 	}
 
-	pthread_cond_destroy(&pool->wait);
+	for (i = 0; i < pool->max; ++i) {
+		wio = &pool->wio[i];
+
+		for (c = 0; c < __DNET_IO_CLASS_MAX; ++c) {
+			list_for_each_entry_safe(r, tmp, &wio->list[c], req_entry) {
+				list_del(&r->req_entry);
+				dnet_io_req_free(r);
+			}
+		}
+
+		pthread_cond_destroy(&wio->wait);
+		pthread_mutex_destroy(&wio->lock);
+	}
+
+	pthread_mutex_destroy(&pool->paused_lock);
 	pthread_mutex_destroy(&pool->lock);
-	free(pool->trans);
+	free(pool->wio);
 	free(pool);
 }
 
-static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
+/*
+ * Must be called under @pool->lock
+ */
+static int dnet_work_pool_grow_nolock(struct dnet_node *n, struct dnet_work_pool *pool, int num)
 {
 	int i, err;
-	struct dnet_work_io *wio, *tmp;
-
-	pthread_mutex_lock(&pool->lock);
+	struct dnet_work_io *wio;
 
-	pool->trans = realloc(pool->trans, sizeof(uint64_t) * (pool->num + num));
+	if (pool->num + num > pool->max)
+		return -E2BIG;
 
 	for (i = 0; i < num; ++i) {
-		wio = malloc(sizeof(struct dnet_work_io));
-		if (!wio) {
-			err = -ENOMEM;
-			goto err_out_io_threads;
-		}
-
-		wio->thread_index = i;
-		wio->pool = pool;
+		wio = &pool->wio[pool->num];
 
-		pool->trans[pool->num + i] = ~0ULL;
-
-		err = pthread_create(&wio->tid, NULL, process, wio);
+		/*
+		 * Slot could be used by previously stopped thread,
+		 * its lock can still be taken by request dispatcher
+		 */
+		pthread_mutex_lock(&wio->lock);
+		wio->idle = 0;
+		wio->kick = 0;
+		wio->stop = 0;
+		wio->stopped = 0;
+		pthread_mutex_unlock(&wio->lock);
+
+		err = pthread_create(&wio->tid, NULL, pool->process, wio);
 		if (err) {
-			free(wio);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create IO thread: %d\n", err);
-			goto err_out_io_threads;
+			return err;
 		}
 
-		list_add_tail(&wio->wio_entry, &pool->wio_list);
+		/*
+		 * Thread becomes visible for dispatching only after it has been fully initialized
+		 */
+		__sync_synchronize();
+		pool->num++;
 	}
 
 	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads\n",
-			dnet_work_io_mode_str(pool->mode), pool->num, pool->num + num);
-
-	pool->num += num;
-	pthread_mutex_unlock(&pool->lock);
+			dnet_work_io_mode_str(pool->mode), pool->num - num, pool->num);
 
 	return 0;
+}
+
+/*
+ * Must be called under @pool->lock, returns number of stopped threads,
+ * they occupy slots starting from new @pool->num and have to be joined
+ * by dnet_work_pool_join() after lock is dropped.
+ *
+ * Stopped thread processes requests already queued to it before exit,
+ * and dispatcher redirects requests which race with stop to permanent threads.
+ */
+static int dnet_work_pool_shrink_nolock(struct dnet_node *n, struct dnet_work_pool *pool, int num)
+{
+	struct dnet_work_io *wio;
+	int i;
+
+	if (pool->num - num < pool->min)
+		num = pool->num - pool->min;
 
-err_out_io_threads:
-	list_for_each_entry_safe(wio, tmp, &pool->wio_list, wio_entry) {
-		pthread_join(wio->tid, NULL);
-		list_del(&wio->wio_entry);
-		free(wio);
+	for (i = 0; i < num; ++i) {
+		wio = &pool->wio[pool->num - 1];
+
+		pool->num--;
+		__sync_synchronize();
+
+		pthread_mutex_lock(&wio->lock);
+		wio->stop = 1;
+		pthread_cond_signal(&wio->wait);
+		pthread_mutex_unlock(&wio->lock);
 	}
 
-	pthread_mutex_unlock(&pool->lock);
+	if (num > 0)
+		dnet_log(n, DNET_LOG_INFO, "Shrunk %s pool by: %d -> %d IO threads\n",
+				dnet_work_io_mode_str(pool->mode), pool->num + num, pool->num);
 
-	return err;
+	return num > 0 ? num : 0;
+}
+
+/*
+ * Slots are not reused until threads are joined, since pool is resized only by stall-check thread
+ */
+static void dnet_work_pool_join(struct dnet_work_pool *pool, int start, int num)
+{
+	int i;
+
+	for (i = start; i < start + num; ++i)
+		pthread_join(pool->wio[i].tid, NULL);
 }
 
-static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int mode, void *(* process)(void *))
+static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num, int max, int mode, void *(* process)(void *))
 {
 	struct dnet_work_pool *pool;
-	int err;
+	struct dnet_work_io *wio;
+	int err, i, c;
 
 	pool = malloc(sizeof(struct dnet_work_pool));
 	if (!pool) {
@@ -127,63 +200,409 @@ static struct dnet_work_pool *dnet_work_pool_alloc(struct dnet_node *n, int num,
 
 	memset(pool, 0, sizeof(struct dnet_work_pool));
 
+	if (max < num)
+		max = num;
+
 	pool->num = 0;
+	pool->min = num;
+	pool->limit = max;
+	pool->max = max;
 	pool->mode = mode;
 	pool->n = n;
-	INIT_LIST_HEAD(&pool->list);
-	list_stat_init(&pool->list_stats);
-	INIT_LIST_HEAD(&pool->wio_list);
+	pool->process = process;
+	gettimeofday(&pool->stat_time, NULL);
+
+	pool->wio = malloc(sizeof(struct dnet_work_io) * pool->max);
+	if (!pool->wio) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	memset(pool->wio, 0, sizeof(struct dnet_work_io) * pool->max);
 
 	err = pthread_mutex_init(&pool->lock, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_free;
+		goto err_out_free_wio;
 	}
 
-	err = pthread_cond_init(&pool->wait, NULL);
+	err = pthread_mutex_init(&pool->paused_lock, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_mutex_destroy;
+		goto err_out_destroy_lock;
 	}
 
-	err = dnet_work_pool_grow(n, pool, num, process);
+	INIT_LIST_HEAD(&pool->paused_list);
+	INIT_LIST_HEAD(&pool->parked_list);
+
+	for (i = 0; i < pool->max; ++i) {
+		wio = &pool->wio[i];
+
+		wio->thread_index = i;
+		wio->pool = pool;
+		for (c = 0; c < __DNET_IO_CLASS_MAX; ++c)
+			INIT_LIST_HEAD(&wio->list[c]);
+		list_stat_init(&wio->list_stats);
+
+		err = pthread_mutex_init(&wio->lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_destroy_wio;
+		}
+
+		err = pthread_cond_init(&wio->wait, NULL);
+		if (err) {
+			err = -err;
+			pthread_mutex_destroy(&wio->lock);
+			goto err_out_destroy_wio;
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	err = dnet_work_pool_grow_nolock(n, pool, num);
+	pthread_mutex_unlock(&pool->lock);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_cleanup;
 
 	return pool;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&pool->wait);
-err_out_mutex_destroy:
+err_out_cleanup:
+	n->need_exit = 1;
+	dnet_work_pool_cleanup(pool);
+	goto err_out_exit;
+err_out_destroy_wio:
+	while (--i >= 0) {
+		pthread_cond_destroy(&pool->wio[i].wait);
+		pthread_mutex_destroy(&pool->wio[i].lock);
+	}
+	pthread_mutex_destroy(&pool->paused_lock);
+err_out_destroy_lock:
 	pthread_mutex_destroy(&pool->lock);
+err_out_free_wio:
+	free(pool->wio);
 err_out_free:
 	free(pool);
 err_out_exit:
 	return NULL;
 }
 
-/* As an example (with hardcoded loglevel and one second interval) */
-static inline void list_stat_log(struct list_stat *st, struct dnet_node *node, const char *list_name) {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
+/*
+ * Replies are bound to IO thread by transaction number, so that all replies of the same
+ * transaction are queued to the same thread and processed in order.
+ * Only permanent threads process replies, so this binding does not change when pool is resized.
+ * Commands are bound to IO thread by key.
+ */
+static struct dnet_work_io *dnet_work_pool_select(struct dnet_work_pool *pool, struct dnet_cmd *cmd)
+{
+	uint64_t hash;
+	int num;
+
+	if (cmd->trans & DNET_TRANS_REPLY) {
+		hash = cmd->trans & ~DNET_TRANS_REPLY;
+		num = pool->min;
+	} else {
+		memcpy(&hash, cmd->id.id, sizeof(hash));
+		num = pool->num;
+	}
+
+	hash *= 0x9e3779b97f4a7c15ULL;
+
+	return &pool->wio[(hash >> 32) % num];
+}
+
+/*
+ * Wake up idle thread to steal just queued command from the busy one.
+ * Idle flag is set before idle thread checks other queues for the last time,
+ * so either it finds the command there or it is found here.
+ */
+static void dnet_work_pool_kick_idle(struct dnet_work_pool *pool, struct dnet_work_io *busy)
+{
+	struct dnet_work_io *wio;
+	int i, found = 0;
+
+	for (i = 1; i < pool->num && !found; ++i) {
+		wio = &pool->wio[(busy->thread_index + i) % pool->num];
+		if (!wio->idle)
+			continue;
+
+		pthread_mutex_lock(&wio->lock);
+		if (wio->idle) {
+			wio->kick = 1;
+			pthread_cond_signal(&wio->wait);
+			found = 1;
+		}
+		pthread_mutex_unlock(&wio->lock);
+	}
+}
+
+/*
+ * Replies are always interactive, so that all replies of the same transaction
+ * are queued to the same queue and processed in order.
+ */
+static int dnet_io_class(struct dnet_cmd *cmd)
+{
+	if (cmd->trans & DNET_TRANS_REPLY)
+		return DNET_IO_CLASS_INTERACTIVE;
+
+	if (cmd->flags & DNET_FLAGS_BACKGROUND)
+		return DNET_IO_CLASS_BACKGROUND;
+
+	switch (cmd->cmd) {
+	case DNET_CMD_WRITE:
+	case DNET_CMD_DEL:
+	case DNET_CMD_INDEXES_UPDATE:
+		return DNET_IO_CLASS_WRITE;
+	case DNET_CMD_BULK_READ:
+	case DNET_CMD_READ_RANGE:
+	case DNET_CMD_DEL_RANGE:
+	case DNET_CMD_DEFRAG:
+	case DNET_CMD_ITERATOR:
+	case DNET_CMD_INDEXES_INTERNAL:
+		return DNET_IO_CLASS_BACKGROUND;
+	default:
+		return DNET_IO_CLASS_INTERACTIVE;
+	}
+}
+
+static int dnet_work_io_empty(struct dnet_work_io *wio)
+{
+	int c;
+
+	for (c = 0; c < __DNET_IO_CLASS_MAX; ++c) {
+		if (!list_empty(&wio->list[c]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Strip deadline prefix off the command data and calculate deadline.
+ * Header is moved over the prefix, so that data still follows it.
+ * Deadline is not forwarded if command is forwarded to another node.
+ */
+static void dnet_io_req_deadline(struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_time timeout;
+
+	if (!(cmd->flags & DNET_FLAGS_DEADLINE) || (cmd->trans & DNET_TRANS_REPLY))
+		return;
+
+	cmd->flags &= ~DNET_FLAGS_DEADLINE;
+
+	if (cmd->size < sizeof(struct dnet_time))
+		return;
+
+	memcpy(&timeout, cmd + 1, sizeof(struct dnet_time));
+	dnet_convert_time(&timeout);
 
-	if ((tv.tv_sec - st->time_base.tv_sec) >= 1) {
-		double elapsed_seconds = (double)(tv.tv_sec - st->time_base.tv_sec) * 1000000 + (tv.tv_usec - st->time_base.tv_usec);
-		elapsed_seconds /= 1000000;
-		dnet_log(node, DNET_LOG_INFO, "%s report: elapsed: %.3f s, current size: %ld, min: %ld, max: %ld, volume: %ld\n",
-			list_name, elapsed_seconds, st->list_size, st->min_list_size, st->max_list_size, st->volume);
+	r->header += sizeof(struct dnet_time);
+	memmove(r->header, cmd, sizeof(struct dnet_cmd));
 
-		list_stat_reset(st, &tv);
+	cmd = r->header;
+	cmd->size -= sizeof(struct dnet_time);
+
+	r->data = cmd->size ? cmd + 1 : NULL;
+	r->dsize = cmd->size;
+
+	if (!timeout.tsec && !timeout.tnsec)
+		return;
+
+	r->deadline.tv_sec = r->queue_time.tv_sec + timeout.tsec;
+	r->deadline.tv_usec = r->queue_time.tv_usec + timeout.tnsec / 1000;
+	if (r->deadline.tv_usec >= 1000000) {
+		r->deadline.tv_sec += r->deadline.tv_usec / 1000000;
+		r->deadline.tv_usec %= 1000000;
+	}
+}
+
+/*
+ * Strip route version prefix, which follows deadline, off the command data the same way
+ */
+static void dnet_io_req_route_version(struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+	struct dnet_route_version v;
+
+	if (!(cmd->flags & DNET_FLAGS_ROUTE_VERSION) || (cmd->trans & DNET_TRANS_REPLY))
+		return;
+
+	cmd->flags &= ~DNET_FLAGS_ROUTE_VERSION;
+
+	if (cmd->size < sizeof(struct dnet_route_version))
+		return;
+
+	memcpy(&v, cmd + 1, sizeof(struct dnet_route_version));
+	dnet_convert_route_version(&v);
+
+	r->header += sizeof(struct dnet_route_version);
+	memmove(r->header, cmd, sizeof(struct dnet_cmd));
+
+	cmd = r->header;
+	cmd->size -= sizeof(struct dnet_route_version);
+
+	r->data = cmd->size ? cmd + 1 : NULL;
+	r->dsize = cmd->size;
+
+	r->route_version = v.version;
+}
+
+/*
+ * Returns true if number of queued requests or bytes is not less than @percent of the pool's limit
+ */
+static int dnet_work_pool_queue_full(struct dnet_work_pool *pool, int percent)
+{
+	if (pool->queue_limit && pool->queued * 100 >= pool->queue_limit * percent)
+		return 1;
+	if (pool->queue_bytes_limit && pool->queued_bytes * 100 >= pool->queue_bytes_limit * percent)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Queue @r to the thread which handles its transaction
+ */
+static void dnet_work_pool_queue(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	struct dnet_work_io *wio;
+	struct dnet_cmd *cmd = r->header;
+	int reply = !!(cmd->trans & DNET_TRANS_REPLY);
+
+	__sync_add_and_fetch(&pool->queued, 1);
+	__sync_add_and_fetch(&pool->queued_bytes, r->hsize + r->dsize);
+
+	wio = dnet_work_pool_select(pool, cmd);
+
+	pthread_mutex_lock(&wio->lock);
+	if (wio->stopped) {
+		/* pool has been shrunk after thread was selected */
+		pthread_mutex_unlock(&wio->lock);
+
+		wio = &pool->wio[wio->thread_index % pool->min];
+		pthread_mutex_lock(&wio->lock);
+	}
+	/* class which has been idle does not get credit for the time it had nothing to do */
+	if (list_empty(&wio->list[r->io_class]) && wio->pass[r->io_class] < wio->vtime)
+		wio->pass[r->io_class] = wio->vtime;
+
+	list_add_tail(&r->req_entry, &wio->list[r->io_class]);
+	list_stat_size_increase(&wio->list_stats, 1);
+	if (!reply)
+		wio->stealable++;
+	pthread_cond_signal(&wio->wait);
+	pthread_mutex_unlock(&wio->lock);
+
+	if (!reply && !wio->idle)
+		dnet_work_pool_kick_idle(pool, wio);
+}
+
+/*
+ * Hold new command @r from joined state until pool's queue drains.
+ * Replies to our own requests are received from the same socket, so it is not paused.
+ * Returns 0 if command has been parked, it is queued by dnet_work_pool_resume() then.
+ * Commands which arrive while others are parked are parked too, so that their order is kept.
+ */
+static int dnet_work_pool_park(struct dnet_work_pool *pool, struct dnet_io_req *r)
+{
+	int parked = 0;
+
+	pthread_mutex_lock(&pool->paused_lock);
+	if (pool->parked_num || dnet_work_pool_queue_full(pool, 100)) {
+		/* logged before parking, command can be queued and freed by another thread right after that */
+		dnet_log(pool->n, DNET_LOG_DEBUG, "%s: %s: %s pool queue is full: requests: %ld, bytes: %llu, parked: %ld, "
+				"holding command: %s\n",
+				dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_work_io_mode_str(pool->mode),
+				pool->queued, (unsigned long long)pool->queued_bytes, pool->parked_num,
+				dnet_cmd_string(((struct dnet_cmd *)r->header)->cmd));
+
+		list_add_tail(&r->req_entry, &pool->parked_list);
+		pool->parked_num++;
+		pool->pauses++;
+		parked = 1;
+	}
+	pthread_mutex_unlock(&pool->paused_lock);
+
+	return parked ? 0 : -EAGAIN;
+}
+
+/*
+ * Stop reading from client state @st until pool's queue drains.
+ * State is removed from epoll under @pool->paused_lock, so that it can not race with resume.
+ */
+static void dnet_work_pool_pause(struct dnet_work_pool *pool, struct dnet_net_state *st)
+{
+	pthread_mutex_lock(&pool->paused_lock);
+	if (!st->rcv_paused) {
+		st->rcv_paused = 1;
+		list_add_tail(&st->rcv_paused_entry, &pool->paused_list);
+		pool->paused_num++;
+		pool->pauses++;
+
+		dnet_state_get(st);
+		dnet_unschedule_recv(st);
+
+		dnet_log(pool->n, DNET_LOG_NOTICE, "%s: %s pool queue is full: requests: %ld, bytes: %llu, pausing receive\n",
+				dnet_state_dump_addr(st), dnet_work_io_mode_str(pool->mode),
+				pool->queued, (unsigned long long)pool->queued_bytes);
 	}
+	pthread_mutex_unlock(&pool->paused_lock);
 }
 
+/*
+ * Queue parked commands and resume reading from all paused states
+ * if pool's queue has drained below low watermark.
+ * Parked commands go first, they have been received before anything paused states would send.
+ */
+static void dnet_work_pool_resume(struct dnet_work_pool *pool)
+{
+	struct dnet_net_state *st;
+	struct dnet_io_req *r;
+
+	while (pool->parked_num && !dnet_work_pool_queue_full(pool, DNET_WORK_POOL_QUEUE_LOW)) {
+		pthread_mutex_lock(&pool->paused_lock);
+		if (list_empty(&pool->parked_list)) {
+			pthread_mutex_unlock(&pool->paused_lock);
+			break;
+		}
+
+		r = list_first_entry(&pool->parked_list, struct dnet_io_req, req_entry);
+		list_del(&r->req_entry);
+		pool->parked_num--;
+
+		/* queued under the lock, so that command parked after this one can not overtake it */
+		dnet_work_pool_queue(pool, r);
+		pthread_mutex_unlock(&pool->paused_lock);
+	}
+
+	while (pool->paused_num && !pool->parked_num && !dnet_work_pool_queue_full(pool, DNET_WORK_POOL_QUEUE_LOW)) {
+		pthread_mutex_lock(&pool->paused_lock);
+		if (list_empty(&pool->paused_list)) {
+			pthread_mutex_unlock(&pool->paused_lock);
+			break;
+		}
+
+		st = list_first_entry(&pool->paused_list, struct dnet_net_state, rcv_paused_entry);
+		list_del_init(&st->rcv_paused_entry);
+		pool->paused_num--;
+
+		st->rcv_paused = 0;
+		dnet_schedule_recv(st);
+		pthread_mutex_unlock(&pool->paused_lock);
+
+		dnet_state_put(st);
+	}
+}
 
 static void *dnet_io_process(void *data_);
 static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 {
 	struct dnet_io *io = n->io;
 	struct dnet_work_pool *pool = io->recv_pool;
+	struct dnet_net_state *st;
 	struct dnet_cmd *cmd = r->header;
+	int reply = !!(cmd->trans & DNET_TRANS_REPLY);
 	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
 
 	if (cmd->size > 0) {
@@ -195,7 +614,6 @@ static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 			dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_cmd_string(cmd->cmd), nonblocking);
 	} else {
 		unsigned long long tid = cmd->trans & ~DNET_TRANS_REPLY;
-		int reply = !!(cmd->trans & DNET_TRANS_REPLY);
 
 		dnet_log(r->st->n, DNET_LOG_DEBUG, "%s: %s: RECV: %s: nonblocking: %d, cmd-size: %llu, cflags: 0x%llx, trans: %lld, reply: %d\n",
 			dnet_state_dump_addr(r->st), dnet_dump_id(r->header), dnet_cmd_string(cmd->cmd), nonblocking,
@@ -205,12 +623,52 @@ static void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 	if (nonblocking)
 		pool = io->recv_pool_nb;
 
-	pthread_mutex_lock(&pool->lock);
-	list_add_tail(&r->req_entry, &pool->list);
-	list_stat_size_increase(&pool->list_stats, 1);
-	list_stat_log(&pool->list_stats, r->st->n, "input io queue");
-	pthread_cond_signal(&pool->wait);
-	pthread_mutex_unlock(&pool->lock);
+	gettimeofday(&r->queue_time, NULL);
+	dnet_io_req_deadline(r);
+	dnet_io_req_route_version(r);
+
+	cmd = r->header;
+	r->io_class = dnet_io_class(cmd);
+	st = r->st;
+
+	/*
+	 * Replies are never rejected or held, requests waiting for them could never complete otherwise.
+	 * Joined states carry both our replies and commands of other nodes, so they are never paused either.
+	 */
+	if (!reply && pool->queue_policy == DNET_IO_QUEUE_POLICY_REJECT && dnet_work_pool_queue_full(pool, 100)) {
+		dnet_log(n, DNET_LOG_NOTICE, "%s: %s: rejecting command: %s, trans: %llu, %s pool queue is full: "
+				"requests: %ld, bytes: %llu\n",
+				dnet_state_dump_addr(st), dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
+				(unsigned long long)cmd->trans, dnet_work_io_mode_str(pool->mode),
+				pool->queued, (unsigned long long)pool->queued_bytes);
+
+		__sync_add_and_fetch(&pool->rejects, 1);
+		dnet_send_ack(st, cmd, -EBUSY, 0);
+
+		dnet_io_req_free(r);
+		dnet_state_put(st);
+		return;
+	}
+
+	if (!reply && pool->queue_policy == DNET_IO_QUEUE_POLICY_BACKPRESSURE && st->__join_state == DNET_JOIN) {
+		if (!dnet_work_pool_park(pool, r)) {
+			/* queue could have been drained by IO threads before command was parked */
+			dnet_work_pool_resume(pool);
+			return;
+		}
+
+		dnet_work_pool_queue(pool, r);
+		return;
+	}
+
+	dnet_work_pool_queue(pool, r);
+
+	if (!reply && pool->queue_policy == DNET_IO_QUEUE_POLICY_BACKPRESSURE && dnet_work_pool_queue_full(pool, 100)) {
+		dnet_work_pool_pause(pool, st);
+
+		/* queue could have been drained by IO threads before state was paused */
+		dnet_work_pool_resume(pool);
+	}
 }
 
 
@@ -225,116 +683,559 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		dnet_log(st->n, DNET_LOG_DEBUG, "freed: size: %llu, trans: %llu, reply: %d, ptr: %p.\n",
 						(unsigned long long)c->size, tid, tid != c->trans, st->rcv_data);
 #endif
-		free(st->rcv_data);
+		dnet_slab_free(st->rcv_data);
 		st->rcv_data = NULL;
 	}
 
 	st->rcv_end = sizeof(struct dnet_cmd);
 	st->rcv_offset = 0;
+	st->rcv_slice = NULL;
 }
 
-static int dnet_process_recv_single(struct dnet_net_state *st)
+/*
+ * Sliced reply being reassembled into @r sized for the whole reply, @size bytes of @total have been
+ * received so far. @r is NULL while its slice is being received into @st->rcv_data
+ */
+struct dnet_recv_slice {
+	struct list_head	entry;
+	uint64_t		trans;
+	uint64_t		size;
+	uint64_t		total;
+	struct dnet_io_req	*r;
+};
+
+void dnet_recv_slices_free(struct dnet_net_state *st)
 {
-	struct dnet_node *n = st->n;
-	struct dnet_io_req *r;
-	void *data;
-	uint64_t size;
-	int err;
+	struct dnet_recv_slice *s, *tmp;
+
+	list_for_each_entry_safe(s, tmp, &st->rcv_slices, entry) {
+		list_del(&s->entry);
+		dnet_slab_free(s->r);
+		free(s);
+	}
+}
+
+static struct dnet_recv_chunk *dnet_recv_chunk_alloc(struct dnet_net_state *st)
+{
+	struct dnet_recv_chunk *c = NULL;
+	void *arena = NULL;
+
+#ifdef HAVE_IO_URING_SUPPORT
+	/* chunk from registered arena is received into without pinning pages on every call */
+	if (st->nio && st->nio->uring) {
+		c = dnet_uring_chunk_get(st->nio->uring);
+		if (c)
+			arena = st->nio->uring;
+	}
+#else
+	(void) st;
+#endif
+
+	if (!c) {
+		c = malloc(sizeof(struct dnet_recv_chunk) + DNET_RECV_CHUNK_SIZE);
+		if (!c)
+			return NULL;
+	}
+
+	memset(c, 0, sizeof(struct dnet_recv_chunk));
+	c->arena = arena;
+
+	atomic_init(&c->refcnt, 1);
+	c->size = DNET_RECV_CHUNK_SIZE;
+
+	return c;
+}
+
+void dnet_recv_chunk_put(struct dnet_recv_chunk *c)
+{
+	if (c && atomic_dec_and_test(&c->refcnt)) {
+#ifdef HAVE_IO_URING_SUPPORT
+		if (c->arena) {
+			dnet_uring_chunk_put(c->arena, c);
+			return;
+		}
+#endif
+		free(c);
+	}
+}
+
+/*
+ * Make sure there is enough space at the tail of the receive chunk to host
+ * the largest command which is not received into dedicated allocation,
+ * and there are free request descriptors.
+ *
+ * If nobody but the state references current chunk, unparsed data is moved
+ * to its beginning, otherwise new chunk is allocated.
+ */
+static int dnet_recv_chunk_prepare(struct dnet_net_state *st)
+{
+	struct dnet_recv_chunk *c = st->rcv_chunk, *nc;
+	size_t left;
+
+	if (c && (c->req_pos < DNET_RECV_CHUNK_REQS) &&
+			(c->size - c->start >= sizeof(struct dnet_cmd) + DNET_RECV_CHUNK_MAX_PAYLOAD))
+		return 0;
+
+	if (!c) {
+		st->rcv_chunk = dnet_recv_chunk_alloc(st);
+		if (!st->rcv_chunk)
+			return -ENOMEM;
+
+		return 0;
+	}
+
+	left = c->end - c->start;
 
-again:
 	/*
-	 * Reading command first.
+	 * Only network thread grabs references to the chunk,
+	 * so if we are the only user, nobody else can get it.
+	 * Fence orders the last reads of IO threads, which dropped their references, before we overwrite the data.
 	 */
-	if (st->rcv_flags & DNET_IO_CMD)
-		data = &st->rcv_cmd;
-	else
-		data = st->rcv_data;
-	data += st->rcv_offset;
-	size = st->rcv_end - st->rcv_offset;
+	if (atomic_read(&c->refcnt) == 1) {
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		memmove(c->data, c->data + c->start, left);
+		c->start = 0;
+		c->end = left;
+		c->req_pos = 0;
+		return 0;
+	}
+
+	nc = dnet_recv_chunk_alloc(st);
+	if (!nc)
+		return -ENOMEM;
+
+	memcpy(nc->data, c->data + c->start, left);
+	nc->end = left;
+
+	st->rcv_chunk = nc;
+	dnet_recv_chunk_put(c);
+
+	return 0;
+}
+
+/*
+ * Read as much data as socket has into receive chunk.
+ * Returns zero if something has been read.
+ */
+static int dnet_recv_chunk_fill(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_recv_chunk *c;
+	int err;
+
+	err = dnet_recv_chunk_prepare(st);
+	if (err)
+		return err;
+
+	c = st->rcv_chunk;
+
+	err = recv(st->read_s, c->data + c->end, c->size - c->end, 0);
+	if (err < 0) {
+		err = -EAGAIN;
+		if (errno != EAGAIN && errno != EINTR) {
+			err = -errno;
+			dnet_log_err(n, "failed to receive data, socket: %d", st->read_s);
+		}
+
+		return err;
+	}
+
+	if (err == 0) {
+		dnet_log(n, DNET_LOG_ERROR, "Peer %s has disconnected.\n",
+			dnet_server_convert_dnet_addr(&st->addr));
+		return -ECONNRESET;
+	}
+
+	c->end += err;
+	return 0;
+}
+
+static void dnet_recv_schedule(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	r->st = dnet_state_get(st);
+
+	dnet_schedule_io(st->n, r);
+}
+
+/*
+ * Start receiving slice of sliced reply, payloads of all slices are received into single allocation
+ * one after another. It is sized once from IO attribute at the head of the first slice.
+ * Returns 1 if command is not a part of sliced reply.
+ */
+static int dnet_recv_slice_start(struct dnet_net_state *st, struct dnet_recv_chunk *c, size_t avail)
+{
+	struct dnet_cmd *cmd = &st->rcv_cmd;
+	struct dnet_recv_slice *s;
+	struct dnet_io_attr io;
+	size_t offset, size;
+	int found = 0;
+
+	list_for_each_entry(s, &st->rcv_slices, entry) {
+		if (s->trans == cmd->trans) {
+			found = 1;
+			break;
+		}
+	}
+
+	if (!found) {
+		if (!(cmd->flags & DNET_FLAGS_SLICE))
+			return 1;
+
+		if (cmd->size < sizeof(struct dnet_io_attr))
+			return -EPROTO;
 
-	if (size) {
-		err = recv(st->read_s, data, size, 0);
+		if (avail < sizeof(struct dnet_cmd) + sizeof(struct dnet_io_attr))
+			return -EAGAIN;
+
+		memcpy(&io, c->data + c->start + sizeof(struct dnet_cmd), sizeof(struct dnet_io_attr));
+		dnet_convert_io_attr(&io);
+
+		s = malloc(sizeof(struct dnet_recv_slice));
+		if (!s)
+			return -ENOMEM;
+		memset(s, 0, sizeof(struct dnet_recv_slice));
+
+		s->trans = cmd->trans;
+		s->total = sizeof(struct dnet_io_attr) + io.size;
+
+		s->r = dnet_slab_alloc(sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + s->total);
+		if (!s->r) {
+			free(s);
+			return -ENOMEM;
+		}
+
+		list_add_tail(&s->entry, &st->rcv_slices);
+	}
+
+	if (s->size + cmd->size > s->total)
+		return -EPROTO;
+
+	offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + s->size;
+
+	size = avail - sizeof(struct dnet_cmd);
+	if (size > cmd->size)
+		size = cmd->size;
+
+	memcpy((void *)s->r + offset, c->data + c->start + sizeof(struct dnet_cmd), size);
+	c->start += sizeof(struct dnet_cmd) + size;
+
+	st->rcv_slice = s;
+	st->rcv_data = s->r;
+	s->r = NULL;
+	st->rcv_offset = offset + size;
+	st->rcv_end = offset + cmd->size;
+	st->rcv_flags &= ~DNET_IO_CMD;
+
+	return 0;
+}
+
+/*
+ * Slice has been received into @r. Returns reassembled reply if it was the last slice.
+ */
+static struct dnet_io_req *dnet_recv_slice_complete(struct dnet_net_state *st, struct dnet_io_req *r)
+{
+	struct dnet_recv_slice *s = st->rcv_slice;
+	struct dnet_cmd *cmd = &st->rcv_cmd;
+
+	s->size += cmd->size;
+
+	if (cmd->flags & DNET_FLAGS_SLICE) {
+		s->r = r;
+		return NULL;
+	}
+
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->header = r + 1;
+	r->hsize = sizeof(struct dnet_cmd);
+
+	cmd->size = s->size;
+	memcpy(r->header, cmd, sizeof(struct dnet_cmd));
+
+	r->data = r->header + sizeof(struct dnet_cmd);
+	r->dsize = cmd->size;
+
+	list_del(&s->entry);
+	free(s);
+
+	return r;
+}
+
+/*
+ * Schedule large command once its payload has been completely received
+ */
+static int dnet_recv_large_complete(struct dnet_net_state *st)
+{
+	struct dnet_io_req *r;
+
+	if (st->rcv_offset != st->rcv_end)
+		return -EAGAIN;
+
+	r = st->rcv_data;
+	st->rcv_data = NULL;
+
+	if (st->rcv_slice)
+		r = dnet_recv_slice_complete(st, r);
+
+	dnet_schedule_command(st);
+
+	if (r)
+		dnet_recv_schedule(st, r);
+	return 0;
+}
+
+/*
+ * Receive the rest of the large command directly into its dedicated allocation
+ */
+static int dnet_recv_large(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	int err;
+
+	while (st->rcv_offset != st->rcv_end) {
+		err = recv(st->read_s, st->rcv_data + st->rcv_offset, st->rcv_end - st->rcv_offset, 0);
 		if (err < 0) {
 			err = -EAGAIN;
 			if (errno != EAGAIN && errno != EINTR) {
 				err = -errno;
 				dnet_log_err(n, "failed to receive data, socket: %d", st->read_s);
-				goto out;
 			}
 
-			goto out;
+			return err;
 		}
 
 		if (err == 0) {
 			dnet_log(n, DNET_LOG_ERROR, "Peer %s has disconnected.\n",
 				dnet_server_convert_dnet_addr(&st->addr));
-			err = -ECONNRESET;
-			goto out;
+			return -ECONNRESET;
 		}
 
 		st->rcv_offset += err;
 	}
 
-	if (st->rcv_offset != st->rcv_end)
-		goto again;
+	return dnet_recv_large_complete(st);
+}
 
-	if (st->rcv_flags & DNET_IO_CMD) {
-		unsigned long long tid;
-		struct dnet_cmd *c = &st->rcv_cmd;
+/*
+ * Parse single command out of receive chunk.
+ * Returns -EAGAIN if there is not enough data buffered.
+ */
+static int dnet_recv_chunk_parse(struct dnet_net_state *st)
+{
+	struct dnet_node *n = st->n;
+	struct dnet_recv_chunk *c = st->rcv_chunk;
+	struct dnet_cmd *cmd = &st->rcv_cmd;
+	struct dnet_io_req *r;
+	unsigned long long tid;
+	size_t avail, size;
+	int err;
 
-		dnet_convert_cmd(c);
+	if (!c)
+		return -EAGAIN;
 
-		tid = c->trans & ~DNET_TRANS_REPLY;
+	/* all request descriptors are used, move unparsed data into fresh chunk */
+	if (c->req_pos == DNET_RECV_CHUNK_REQS) {
+		err = dnet_recv_chunk_prepare(st);
+		if (err)
+			return err;
 
-		dnet_log(n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
-				"reply: %d, size: %llu, flags: 0x%llx, status: %d.\n",
-				dnet_dump_id(&c->id), tid, (unsigned long long)c->trans,
-				!!(c->trans & DNET_TRANS_REPLY),
-				(unsigned long long)c->size, (unsigned long long)c->flags, c->status);
+		c = st->rcv_chunk;
+	}
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
-		if (!r) {
-			err = -ENOMEM;
-			goto out;
-		}
+	avail = c->end - c->start;
+	if (avail < sizeof(struct dnet_cmd))
+		return -EAGAIN;
+
+	memcpy(cmd, c->data + c->start, sizeof(struct dnet_cmd));
+	dnet_convert_cmd(cmd);
+
+	if ((cmd->flags & DNET_FLAGS_SLICE) || !list_empty(&st->rcv_slices)) {
+		err = dnet_recv_slice_start(st, c, avail);
+		if (err <= 0)
+			return err;
+	}
+
+	if (cmd->size > DNET_RECV_CHUNK_MAX_PAYLOAD) {
+		tid = cmd->trans & ~DNET_TRANS_REPLY;
+
+		dnet_log(n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
+				"reply: %d, size: %llu, flags: 0x%llx, status: %d, dedicated buffer.\n",
+				dnet_dump_id(&cmd->id), tid, (unsigned long long)cmd->trans,
+				!!(cmd->trans & DNET_TRANS_REPLY),
+				(unsigned long long)cmd->size, (unsigned long long)cmd->flags, cmd->status);
+
+		r = dnet_slab_alloc(cmd->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		if (!r)
+			return -ENOMEM;
 		memset(r, 0, sizeof(struct dnet_io_req));
 
 		r->header = r + 1;
 		r->hsize = sizeof(struct dnet_cmd);
-		memcpy(r->header, &st->rcv_cmd, sizeof(struct dnet_cmd));
+		memcpy(r->header, cmd, sizeof(struct dnet_cmd));
+
+		r->data = r->header + sizeof(struct dnet_cmd);
+		r->dsize = cmd->size;
+
+		/* move already received part of the payload */
+		size = avail - sizeof(struct dnet_cmd);
+		if (size > cmd->size)
+			size = cmd->size;
+
+		memcpy(r->data, c->data + c->start + sizeof(struct dnet_cmd), size);
+		c->start += sizeof(struct dnet_cmd) + size;
 
 		st->rcv_data = r;
-		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd);
-		st->rcv_end = st->rcv_offset + c->size;
+		st->rcv_offset = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + size;
+		st->rcv_end = sizeof(struct dnet_io_req) + sizeof(struct dnet_cmd) + cmd->size;
 		st->rcv_flags &= ~DNET_IO_CMD;
 
-		if (c->size) {
-			r->data = r->header + sizeof(struct dnet_cmd);
-			r->dsize = c->size;
+		/* the rest of the payload is received by the caller */
+		return 0;
+	}
 
-			/*
-			 * We read the command header, now get the data.
-			 */
-			goto again;
-		}
+	if (avail < sizeof(struct dnet_cmd) + cmd->size)
+		return -EAGAIN;
+
+	tid = cmd->trans & ~DNET_TRANS_REPLY;
+
+	dnet_log(n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
+			"reply: %d, size: %llu, flags: 0x%llx, status: %d.\n",
+			dnet_dump_id(&cmd->id), tid, (unsigned long long)cmd->trans,
+			!!(cmd->trans & DNET_TRANS_REPLY),
+			(unsigned long long)cmd->size, (unsigned long long)cmd->flags, cmd->status);
+
+	r = &c->reqs[c->req_pos++];
+	memset(r, 0, sizeof(struct dnet_io_req));
+
+	r->chunk = c;
+	atomic_inc(&c->refcnt);
+
+	r->header = c->data + c->start;
+	r->hsize = sizeof(struct dnet_cmd);
+	memcpy(r->header, cmd, sizeof(struct dnet_cmd));
+
+	if (cmd->size) {
+		r->data = r->header + sizeof(struct dnet_cmd);
+		r->dsize = cmd->size;
 	}
 
-	r = st->rcv_data;
-	st->rcv_data = NULL;
+	c->start += sizeof(struct dnet_cmd) + cmd->size;
+
+	dnet_recv_schedule(st, r);
+	return 0;
+}
+
+/*
+ * Drop unparsed data, but do not touch chunk's content,
+ * it can still be used by requests being processed
+ */
+static void dnet_recv_drop(struct dnet_net_state *st)
+{
+	if (st->rcv_chunk)
+		st->rcv_chunk->start = st->rcv_chunk->end;
 
 	dnet_schedule_command(st);
+}
 
-	r->st = dnet_state_get(st);
+/*
+ * Schedule every command buffered in the receive chunk and read socket
+ * at most once. Epoll is level-triggered, so it will not wake us up for
+ * the data which has been already read, thus chunk never contains whole
+ * command when we return.
+ */
+static int dnet_process_recv_single(struct dnet_net_state *st)
+{
+	int err, filled = 0, scheduled = 0;
+
+	while (1) {
+		if (st->rcv_flags & DNET_IO_CMD)
+			err = dnet_recv_chunk_parse(st);
+		else
+			err = dnet_recv_large(st);
+
+		if (!err) {
+			scheduled = 1;
+			continue;
+		}
+
+		if (err != -EAGAIN)
+			break;
+
+		/*
+		 * Large command is received directly from the socket,
+		 * and we do not read into chunk more than once per call,
+		 * or at all if IO pool has paused receiving from this state.
+		 */
+		if (!(st->rcv_flags & DNET_IO_CMD) || filled || st->rcv_paused)
+			break;
+
+		err = dnet_recv_chunk_fill(st);
+		if (err)
+			break;
+
+		filled = 1;
+	}
+
+	if (err == -EAGAIN && (scheduled || filled))
+		err = 0;
+
+	if (err && err != -EAGAIN && err != -EINTR)
+		dnet_recv_drop(st);
+
+	return err;
+}
+
+#ifdef HAVE_IO_URING_SUPPORT
+/*
+ * Buffer the next portion of data should be received into,
+ * used by engines which submit receives themselves.
+ */
+int dnet_recv_buffer(struct dnet_net_state *st, void **buf, size_t *size)
+{
+	struct dnet_recv_chunk *c;
+	int err;
+
+	if (!(st->rcv_flags & DNET_IO_CMD)) {
+		*buf = st->rcv_data + st->rcv_offset;
+		*size = st->rcv_end - st->rcv_offset;
+		return 0;
+	}
 
-	dnet_schedule_io(n, r);
+	err = dnet_recv_chunk_prepare(st);
+	if (err)
+		return err;
+
+	c = st->rcv_chunk;
+	*buf = c->data + c->end;
+	*size = c->size - c->end;
 	return 0;
+}
+
+/*
+ * Account @size bytes received into dnet_recv_buffer() and schedule every complete command
+ */
+int dnet_recv_received(struct dnet_net_state *st, size_t size)
+{
+	int err;
+
+	if (st->rcv_flags & DNET_IO_CMD)
+		st->rcv_chunk->end += size;
+	else
+		st->rcv_offset += size;
 
-out:
-	if (err != -EAGAIN && err != -EINTR)
-		dnet_schedule_command(st);
+	do {
+		if (st->rcv_flags & DNET_IO_CMD)
+			err = dnet_recv_chunk_parse(st);
+		else
+			err = dnet_recv_large_complete(st);
+	} while (!err);
 
+	if (err == -EAGAIN)
+		return 0;
+
+	dnet_recv_drop(st);
 	return err;
 }
+#endif
 
 int dnet_socket_local_addr(int s, struct dnet_addr *addr)
 {
@@ -424,36 +1325,149 @@ int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *e
 			dnet_server_convert_dnet_addr_raw(&addr, client_addr, sizeof(client_addr)), cs,
 			dnet_server_convert_dnet_addr_raw(&saddr, server_addr, sizeof(server_addr)), idx);
 
-	return 0;
+	return 0;
+
+err_out_exit:
+	return err;
+}
+
+void dnet_unschedule_send(struct dnet_net_state *st)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLOUT;
+	ev.data.ptr = st;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->write_s, &ev);
+}
+
+void dnet_unschedule_recv(struct dnet_net_state *st)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = st;
+
+	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
+}
+
+/*
+ * Gather header and data parts of the queued requests into @iov, starting from the first one,
+ * @st->send_offset bytes of which have been already sent.
+ *
+ * Gathering stops at the first request with file part, it is sent via sendfile() after its
+ * header is sent, @more is set in this case to ask TCP to put them into the same segment.
+ *
+ * Must be called under @st->send_lock.
+ */
+int dnet_send_gather_nolock(struct dnet_net_state *st, struct iovec *iov, int *more)
+{
+	struct dnet_io_req *r;
+	size_t offset = st->send_offset;
+	int num = 0;
+
+	*more = 0;
+
+	list_for_each_entry(r, &st->send_list, req_entry) {
+		if (num + 2 > DNET_SEND_IOV_MAX)
+			break;
+
+		if (r->hsize) {
+			if (offset < r->hsize) {
+				iov[num].iov_base = r->header + offset;
+				iov[num].iov_len = r->hsize - offset;
+				num++;
+
+				offset = 0;
+			} else {
+				offset -= r->hsize;
+			}
+		}
+
+		if (r->dsize) {
+			if (offset < r->dsize) {
+				iov[num].iov_base = r->data + offset;
+				iov[num].iov_len = r->dsize - offset;
+				num++;
+
+				offset = 0;
+			} else {
+				offset -= r->dsize;
+			}
+		}
+
+		if (r->fd >= 0 && r->fsize) {
+			*more = !!num;
+			break;
+		}
+	}
 
-err_out_exit:
-	return err;
+	return num;
 }
 
-void dnet_unschedule_send(struct dnet_net_state *st)
+/*
+ * Move send offset @size bytes forward, destroy requests which have been completely sent.
+ * Only network thread removes requests from the send queue, so the first request
+ * can not go away while it is being sent without lock.
+ */
+void dnet_send_advance(struct dnet_net_state *st, size_t size)
 {
-	struct epoll_event ev;
+	struct dnet_io_req *r;
+	size_t total;
+	int requeued;
 
-	ev.events = EPOLLOUT;
-	ev.data.ptr = st;
+	while (size) {
+		pthread_mutex_lock(&st->send_lock);
+		r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+		pthread_mutex_unlock(&st->send_lock);
 
-	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->write_s, &ev);
-}
+		total = r->hsize + r->dsize + r->fsize;
 
-void dnet_unschedule_recv(struct dnet_net_state *st)
-{
-	struct epoll_event ev;
+		if (st->send_offset + size < total) {
+			st->send_offset += size;
+			break;
+		}
 
-	ev.events = EPOLLIN;
-	ev.data.ptr = st;
+		size -= total - st->send_offset;
+		st->send_offset = 0;
 
-	epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, &ev);
+		pthread_mutex_lock(&st->send_lock);
+		list_del(&r->req_entry);
+		requeued = r->slice_src && dnet_io_req_slice_next_nolock(st, r);
+		pthread_mutex_unlock(&st->send_lock);
+
+		if (r->slice_src)
+			st->nio->send_slices++;
+		if (requeued)
+			continue;
+
+		if (atomic_read(&st->send_queue_size) > 0)
+			if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
+				dnet_log(st->n, DNET_LOG_DEBUG,
+						"State low_watermark reached: %s: %d, waking up\n",
+						dnet_server_convert_dnet_addr(&st->addr),
+						atomic_read(&st->send_queue_size));
+				pthread_cond_broadcast(&st->send_wait);
+			}
+
+		dnet_io_req_free(r);
+		st->nio->send_requests++;
+	}
 }
 
+/*
+ * Send queued requests issuing single syscall per iteration: memory parts of as many
+ * requests as fit into iovec are sent with sendmsg(), file part of the first request
+ * in the queue is sent with sendfile().
+ */
 static int dnet_process_send_single(struct dnet_net_state *st)
 {
-	struct dnet_io_req *r = NULL;
-	int err;
+	struct iovec iov[DNET_SEND_IOV_MAX];
+	struct msghdr msg;
+	struct dnet_io_req *r;
+	uint64_t offset, size;
+	ssize_t err;
+	int num, more;
 
 	while (1) {
 		r = NULL;
@@ -461,6 +1475,7 @@ static int dnet_process_send_single(struct dnet_net_state *st)
 		pthread_mutex_lock(&st->send_lock);
 		if (!list_empty(&st->send_list)) {
 			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+			num = dnet_send_gather_nolock(st, iov, &more);
 		} else {
 			dnet_unschedule_send(st);
 		}
@@ -471,27 +1486,48 @@ static int dnet_process_send_single(struct dnet_net_state *st)
 			goto err_out_exit;
 		}
 
-		err = dnet_send_request(st, r);
-		if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-			pthread_mutex_lock(&st->send_lock);
-			list_del(&r->req_entry);
-			pthread_mutex_unlock(&st->send_lock);
-
-			if (atomic_read(&st->send_queue_size) > 0)
-				if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
-					dnet_log(st->n, DNET_LOG_DEBUG,
-							"State low_watermark reached: %s: %d, waking up\n",
-							dnet_server_convert_dnet_addr(&st->addr),
-							atomic_read(&st->send_queue_size));
-					pthread_cond_broadcast(&st->send_wait);
-				}
+		if (num) {
+			memset(&msg, 0, sizeof(struct msghdr));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = num;
 
-			dnet_io_req_free(r);
-			st->send_offset = 0;
+			err = sendmsg(st->write_s, &msg, more ? MSG_MORE : 0);
+			if (err < 0)
+				err = -errno;
+			else if (err == 0) {
+				dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+						dnet_state_dump_addr(st), st->write_s);
+				err = -ECONNRESET;
+			}
+		} else {
+			/* header and data of the first request have been sent, only file part is left */
+			size = r->fsize - (st->send_offset - r->hsize - r->dsize);
+			offset = r->local_offset + r->fsize - size;
+
+			err = dnet_sendfile(st, r->fd, &offset, size);
+			if (err == 0) {
+				dnet_log(st->n, DNET_LOG_ERROR, "Looks like truncated file: fd: %d, offset: %llu, size: %llu.\n",
+						r->fd, (unsigned long long)offset, (unsigned long long)size);
+				err = -ENODATA;
+			}
 		}
 
-		if (err)
+		st->nio->send_calls++;
+
+		if (err < 0) {
+			if (err == -EINTR)
+				continue;
+			if (err != -EAGAIN) {
+				dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to send data: %zd, setting send need_exit\n",
+						dnet_state_dump_addr(st), err);
+				st->need_exit = err;
+			}
+
 			goto err_out_exit;
+		}
+
+		st->nio->send_bytes += err;
+		dnet_send_advance(st, err);
 	}
 
 err_out_exit:
@@ -515,6 +1551,11 @@ static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
 	if (st->need_exit)
 		return -ENOEXEC;
 
+#ifdef HAVE_IO_URING_SUPPORT
+	if (st->uring)
+		return dnet_uring_schedule(st, send);
+#endif
+
 	err = epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
 	if (err < 0) {
 		err = -errno;
@@ -562,22 +1603,93 @@ err_out_exit:
 	return err;
 }
 
+/*
+ * Reset state after network error and drop the reference network thread holds
+ */
+void dnet_io_state_drop(struct dnet_net_state *st, int err)
+{
+	dnet_state_reset(st, err);
+
+	pthread_mutex_lock(&st->send_lock);
+	dnet_unschedule_send(st);
+	dnet_unschedule_recv(st);
+	pthread_mutex_unlock(&st->send_lock);
+
+	dnet_add_reconnect_state(st->n, &st->addr, st->__join_state);
+
+	// state still contains a fair number of transactions in its queue
+	// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
+	// while every transaction holds a reference
+	//
+	// IO thread could remove transaction, it is the only place allowed to do it.
+	// transactions may live in the tree and be accessed without locks in IO thread,
+	// IO thread is kind of 'owner' of the transaction processing
+	dnet_state_put(st);
+}
+
+/*
+ * Process single ready event.
+ * Returns zero if state is still alive or negative error if it was reset and dropped.
+ */
+int dnet_io_process_network_event(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev)
+{
+	int err = 0, i;
+
+	st->epoll_fd = nio->epoll_fd;
+	st->nio = nio;
+
+	for (i = 0; i < DNET_NET_EVENT_BUDGET; ++i) {
+		err = st->process(st, ev);
+		if (err == 0)
+			continue;
+
+		if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
+			return 0;
+
+		if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+			if (!err)
+				err = -ETIMEDOUT;
+
+			dnet_io_state_drop(st, err);
+			return err;
+		}
+	}
+
+	/*
+	 * Budget is exhausted, but there is still some work to do for this state.
+	 * Epoll is level-triggered, so we will get it back at the next wakeup.
+	 */
+	return 0;
+}
+
 static void *dnet_io_process_network(void *data_)
 {
 	struct dnet_net_io *nio = data_;
 	struct dnet_node *n = nio->n;
 	struct dnet_net_state *st;
-	struct epoll_event ev;
-	int err = 0;
+	int batch = n->io->net_events_batch;
+	int err = 0, num, i, j;
 
 	dnet_set_name("net_pool");
 
 	while (!n->need_exit) {
-		err = epoll_wait(nio->epoll_fd, &ev, 1, 1000);
-		if (err == 0)
+		/* batch size is changed by dnet_set_net_events_batch() */
+		num = n->io->net_events_batch;
+		if (num != batch) {
+			struct epoll_event *events;
+
+			events = realloc(nio->events, sizeof(struct epoll_event) * num);
+			if (events) {
+				nio->events = events;
+				batch = num;
+			}
+		}
+
+		num = epoll_wait(nio->epoll_fd, nio->events, batch, 1000);
+		if (num == 0)
 			continue;
 
-		if (err < 0) {
+		if (num < 0) {
 			err = -errno;
 
 			if (err == -EAGAIN || err == -EINTR)
@@ -588,50 +1700,87 @@ static void *dnet_io_process_network(void *data_)
 			break;
 		}
 
-		st = ev.data.ptr;
-		st->epoll_fd = nio->epoll_fd;
+		nio->wakeups++;
+		nio->events_total += num;
+		if (num == batch)
+			nio->full_batches++;
 
-		while (1) {
-			err = st->process(st, &ev);
-			if (err == 0)
+		for (i = 0; i < num; ++i) {
+			st = nio->events[i].data.ptr;
+			if (!st)
 				continue;
 
-			if (err == -EAGAIN && st->stall < DNET_DEFAULT_STALL_TRANSACTIONS)
-				break;
+			err = dnet_io_process_network_event(nio, st, &nio->events[i]);
+			if (err) {
+				/*
+				 * State has been reset and its reference dropped,
+				 * read and write sockets of the same state can be reported
+				 * in the same batch, do not touch it again.
+				 */
+				for (j = i + 1; j < num; ++j) {
+					if (nio->events[j].data.ptr == st)
+						nio->events[j].data.ptr = NULL;
+				}
+			}
+		}
+	}
+
+	return &n->need_exit;
+}
+
+static void dnet_work_pool_stat_fill(struct dnet_work_pool *pool, struct dnet_stat_count *counters)
+{
+	struct dnet_work_io *wio;
+	int i;
+
+	for (i = 0; i < pool->max; ++i) {
+		wio = &pool->wio[i];
 
-			if (err < 0 || st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
-				if (!err)
-					err = -ETIMEDOUT;
+		counters[DNET_CNTR_IO_INTERACTIVE_REQUESTS].count += wio->class_requests[DNET_IO_CLASS_INTERACTIVE];
+		counters[DNET_CNTR_IO_INTERACTIVE_WAIT].count += wio->class_wait_time[DNET_IO_CLASS_INTERACTIVE];
+		counters[DNET_CNTR_IO_WRITE_REQUESTS].count += wio->class_requests[DNET_IO_CLASS_WRITE];
+		counters[DNET_CNTR_IO_WRITE_WAIT].count += wio->class_wait_time[DNET_IO_CLASS_WRITE];
+		counters[DNET_CNTR_IO_BACKGROUND_REQUESTS].count += wio->class_requests[DNET_IO_CLASS_BACKGROUND];
+		counters[DNET_CNTR_IO_BACKGROUND_WAIT].count += wio->class_wait_time[DNET_IO_CLASS_BACKGROUND];
+		counters[DNET_CNTR_IO_EXPIRED].count += wio->expired;
+	}
 
-				dnet_state_reset(st, err);
+	counters[DNET_CNTR_IO_QUEUE_REJECTS].count += pool->rejects;
+	counters[DNET_CNTR_IO_QUEUE_PAUSES].count += pool->pauses;
+}
 
-				pthread_mutex_lock(&st->send_lock);
-				dnet_unschedule_send(st);
-				dnet_unschedule_recv(st);
-				pthread_mutex_unlock(&st->send_lock);
+void dnet_io_stat_fill(struct dnet_node *n, struct dnet_stat_count *counters)
+{
+	struct dnet_io *io = n->io;
+	int i;
 
-				dnet_add_reconnect_state(st->n, &st->addr, st->__join_state);
+	if (!io)
+		return;
 
-				// state still contains a fair number of transactions in its queue
-				// they will not be cleaned up here - dnet_state_put() will only drop refctn by 1,
-				// while every transaction holds a reference
-				//
-				// IO thread could remove transaction, it is the only place allowed to do it.
-				// transactions may live in the tree and be accessed without locks in IO thread,
-				// IO thread is kind of 'owner' of the transaction processing
-				dnet_state_put(st);
-				break;
-			}
-		}
+	for (i = 0; i < io->net_thread_num; ++i) {
+		struct dnet_net_io *nio = &io->net[i];
+
+		counters[DNET_CNTR_NET_WAKEUPS].count += nio->wakeups;
+		counters[DNET_CNTR_NET_EVENTS].count += nio->events_total;
+		counters[DNET_CNTR_NET_FULL_BATCHES].count += nio->full_batches;
+		counters[DNET_CNTR_NET_SEND_CALLS].count += nio->send_calls;
+		counters[DNET_CNTR_NET_SEND_BYTES].count += nio->send_bytes;
+		counters[DNET_CNTR_NET_SEND_REQUESTS].count += nio->send_requests;
+		counters[DNET_CNTR_NET_SEND_SLICES].count += nio->send_slices;
 	}
 
-	return &n->need_exit;
+	dnet_work_pool_stat_fill(io->recv_pool, counters);
+	dnet_work_pool_stat_fill(io->recv_pool_nb, counters);
+
+	dnet_slab_stat_fill(counters);
 }
 
 static void dnet_io_cleanup_states(struct dnet_node *n)
 {
 	struct dnet_net_state *st, *tmp;
 
+	dnet_route_batch_start(n);
+
 	list_for_each_entry_safe(st, tmp, &n->storage_state_list, storage_state_entry) {
 		dnet_unschedule_send(st);
 		dnet_unschedule_recv(st);
@@ -641,6 +1790,11 @@ static void dnet_io_cleanup_states(struct dnet_node *n)
 		dnet_state_clean(st);
 		dnet_state_put(st);
 	}
+
+	dnet_route_batch_end(n);
+
+	/* route snapshots hold the last references to the states */
+	dnet_route_destroy(n);
 }
 
 struct dnet_io_process_data {
@@ -648,118 +1802,328 @@ struct dnet_io_process_data {
 	int thread_number;
 };
 
-static struct dnet_io_req *take_request(struct dnet_work_pool *pool, int thread_index)
+/*
+ * Must be called under @wio->lock
+ */
+static void dnet_work_io_dequeue_nolock(struct dnet_work_io *wio, struct dnet_io_req *r)
+{
+	struct dnet_cmd *cmd = r->header;
+
+	list_del_init(&r->req_entry);
+	list_stat_size_decrease(&wio->list_stats, 1);
+
+	__sync_sub_and_fetch(&wio->pool->queued, 1);
+	__sync_sub_and_fetch(&wio->pool->queued_bytes, r->hsize + r->dsize);
+
+	if (!(cmd->trans & DNET_TRANS_REPLY))
+		wio->stealable--;
+}
+
+/*
+ * Take request from non-empty class queue with the smallest virtual time
+ */
+static struct dnet_io_req *dnet_work_io_take(struct dnet_work_io *wio)
+{
+	struct dnet_io_req *r = NULL;
+	int c, best = -1;
+
+	pthread_mutex_lock(&wio->lock);
+	for (c = 0; c < __DNET_IO_CLASS_MAX; ++c) {
+		if (list_empty(&wio->list[c]))
+			continue;
+
+		if (best < 0 || wio->pass[c] < wio->pass[best])
+			best = c;
+	}
+
+	if (best >= 0) {
+		r = list_first_entry(&wio->list[best], struct dnet_io_req, req_entry);
+		dnet_work_io_dequeue_nolock(wio, r);
+
+		wio->vtime = wio->pass[best];
+		wio->pass[best] += dnet_io_class_stride[best];
+	}
+	pthread_mutex_unlock(&wio->lock);
+
+	return r;
+}
+
+/*
+ * Steal the first queued command of the highest priority class from other thread of the same pool.
+ * Replies are never stolen to preserve their order.
+ */
+static struct dnet_io_req *dnet_work_io_steal(struct dnet_work_io *wio)
 {
-	struct dnet_io_req *it = NULL;
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_io *victim;
+	struct dnet_io_req *r;
 	struct dnet_cmd *cmd;
-	uint64_t tid;
-	int i;
-	int ok;
+	int i, c;
 
-	list_for_each_entry(it, &pool->list, req_entry) {
-		cmd = it->header;
-		tid = cmd->trans & ~DNET_TRANS_REPLY;
-		ok = 1;
-
-		/* This is not a transaction reply, process it right now */
-		if (!(cmd->trans & DNET_TRANS_REPLY))
-			return it;
-
-		for (i = 0; i < pool->num; ++i) {
-			 /* Someone claimed transaction @tid */
-			if (pool->trans[i] == tid) {
-				 /* Its our transaction, let's handle it */
-				if (i == thread_index) {
-					/* its the last transaction in given set, clear 'claim' flag for current thread */
-					if (!(cmd->flags & DNET_FLAGS_MORE))
-						pool->trans[thread_index] = ~0ULL;
-
-					return it;
-				}
+	for (i = 1; i < pool->num; ++i) {
+		victim = &pool->wio[(wio->thread_index + i) % pool->num];
+		if (!victim->stealable)
+			continue;
 
-				/* we should not touch it */
-				ok = 0;
-				break;
-			}
-		}
+		pthread_mutex_lock(&victim->lock);
+		for (c = 0; c < __DNET_IO_CLASS_MAX; ++c) {
+			list_for_each_entry(r, &victim->list[c], req_entry) {
+				cmd = r->header;
 
-		/*
-		 * 'ok' here means no one claimed given transaction, we can process it,
-		 * but only if 'we' do not wait for another transaction already.
-		 */
-		if (ok) {
-			if (pool->trans[thread_index] == ~0ULL) {
-				/* only claim this transaction if there will be others */
-				if (cmd->flags & DNET_FLAGS_MORE)
-					pool->trans[thread_index] = tid;
-				return it;
+				if (!(cmd->trans & DNET_TRANS_REPLY)) {
+					dnet_work_io_dequeue_nolock(victim, r);
+					pthread_mutex_unlock(&victim->lock);
+					return r;
+				}
 			}
 		}
+		pthread_mutex_unlock(&victim->lock);
 	}
 
 	return NULL;
 }
 
-static void *dnet_io_process(void *data_)
+/*
+ * Get the next request for given thread: its own queue is checked first,
+ * then stealable commands of other threads, and thread sleeps if there is nothing.
+ */
+static struct dnet_io_req *dnet_work_io_get(struct dnet_work_io *wio)
 {
-	struct dnet_work_io *wio = data_;
-	struct dnet_work_pool *pool = wio->pool;
-	struct dnet_node *n = pool->n;
-	struct dnet_net_state *st;
+	struct dnet_io_req *r;
 	struct timespec ts;
 	struct timeval tv;
-	struct dnet_io_req *r;
-	int err;
-	struct dnet_cmd *cmd;
 
-	dnet_set_name("io_pool");
+	r = dnet_work_io_take(wio);
+	if (r)
+		return r;
 
-	while (!n->need_exit) {
-		r = NULL;
-		err = 0;
+	pthread_mutex_lock(&wio->lock);
+	if (wio->stop && dnet_work_io_empty(wio)) {
+		wio->stopped = 1;
+		pthread_mutex_unlock(&wio->lock);
+		return NULL;
+	}
+	wio->idle = 1;
+	pthread_mutex_unlock(&wio->lock);
 
+	r = dnet_work_io_steal(wio);
+	if (!r) {
 		gettimeofday(&tv, NULL);
 		ts.tv_sec = tv.tv_sec + 1;
 		ts.tv_nsec = tv.tv_usec * 1000;
 
-		pthread_mutex_lock(&pool->lock);
+		pthread_mutex_lock(&wio->lock);
+		if (dnet_work_io_empty(wio) && !wio->kick && !wio->stop)
+			pthread_cond_timedwait(&wio->wait, &wio->lock, &ts);
+		pthread_mutex_unlock(&wio->lock);
+	}
 
-		pool->trans[wio->thread_index] = -1;
+	pthread_mutex_lock(&wio->lock);
+	wio->idle = 0;
+	wio->kick = 0;
+	pthread_mutex_unlock(&wio->lock);
 
-		if (!(r = take_request(pool, wio->thread_index))) {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if ((r = take_request(pool, wio->thread_index)))
-				err = 0;
-		}
+	return r;
+}
 
-		if (r) {
-			list_del_init(&r->req_entry);
-			list_stat_size_decrease(&pool->list_stats, 1);
-		}
-		pthread_mutex_unlock(&pool->lock);
+static void *dnet_io_process(void *data_)
+{
+	struct dnet_work_io *wio = data_;
+	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_node *n = pool->n;
+	struct dnet_net_state *st;
+	struct dnet_io_req *r;
+	struct dnet_cmd *cmd;
+	struct timeval start, end;
 
-		if (!r || err)
+	dnet_set_name("io_pool");
+
+	while (!n->need_exit && !wio->stopped) {
+		r = dnet_work_io_get(wio);
+		if (!r)
 			continue;
 
+		gettimeofday(&start, NULL);
+
 		st = r->st;
 		cmd = r->header;
 		trace_id = cmd->id.trace_id;
 
-		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s\n",
-			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode));
+		wio->class_requests[r->io_class]++;
+		wio->class_wait_time[r->io_class] += (start.tv_sec - r->queue_time.tv_sec) * 1000000 +
+			start.tv_usec - r->queue_time.tv_usec;
+
+		if (r->deadline.tv_sec && timercmp(&start, &r->deadline, >)) {
+			/* client has already given up waiting for the reply */
+			dnet_log(n, DNET_LOG_NOTICE, "%s: %s: dropping expired command: %s, trans: %llu, "
+					"queued for: %ld usecs\n",
+					dnet_state_dump_addr(st), dnet_dump_id(&cmd->id), dnet_cmd_string(cmd->cmd),
+					(unsigned long long)cmd->trans,
+					(start.tv_sec - r->queue_time.tv_sec) * 1000000 + start.tv_usec - r->queue_time.tv_usec);
+
+			wio->expired++;
+			dnet_send_ack(st, cmd, -ETIMEDOUT, 0);
+		} else {
+			dnet_log(n, DNET_LOG_DEBUG, "%s: %s: got IO event: %p: hsize: %zu, dsize: %zu, mode: %s, class: %s\n",
+				dnet_state_dump_addr(st), dnet_dump_id(r->header), r, r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode),
+				dnet_io_class_string[r->io_class]);
+
+			dnet_process_recv(st, r);
+		}
 
-		err = dnet_process_recv(st, r);
 		trace_id = 0;
 
 		dnet_io_req_free(r);
 		dnet_state_put(st);
+
+		dnet_work_pool_resume(pool);
+
+		gettimeofday(&end, NULL);
+		wio->busy_time += (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
 	}
 
 	return NULL;
 }
 
+/*
+ * Called once per second from stall-check thread.
+ * Queue statistics of all threads is collected and reset here,
+ * so that dispatching does not need to check time.
+ */
+static void dnet_work_pool_autoscale(struct dnet_work_pool *pool)
+{
+	struct dnet_node *n = pool->n;
+	struct dnet_work_io *wio;
+	struct list_stat st;
+	struct timeval tv;
+	uint64_t busy_time = 0, busy = 0, queue = 0;
+	long elapsed;
+	int i, num, stopped = 0;
+
+	gettimeofday(&tv, NULL);
+
+	list_stat_init(&st);
+
+	/* paused states are resumed by IO threads, this is a fallback if pool has drained in between */
+	dnet_work_pool_resume(pool);
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (i = 0; i < pool->max; ++i)
+		busy_time += pool->wio[i].busy_time;
+
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio[i];
+
+		pthread_mutex_lock(&wio->lock);
+		/* requests which were waiting in the queue during whole interval */
+		if (wio->list_stats.min_list_size != ~0ULL)
+			queue += wio->list_stats.min_list_size;
+		else
+			queue += wio->list_stats.list_size;
+
+		st.list_size += wio->list_stats.list_size;
+		st.volume += wio->list_stats.volume;
+		if (wio->list_stats.max_list_size > st.max_list_size)
+			st.max_list_size = wio->list_stats.max_list_size;
+
+		list_stat_reset(&wio->list_stats, &tv);
+		pthread_mutex_unlock(&wio->lock);
+	}
+
+	elapsed = (tv.tv_sec - pool->stat_time.tv_sec) * 1000000 + tv.tv_usec - pool->stat_time.tv_usec;
+	if (elapsed > 0)
+		busy = (busy_time - pool->busy_time) * 100 / (elapsed * pool->num);
+
+	pool->busy_time = busy_time;
+	pool->stat_time = tv;
+
+	dnet_log(n, DNET_LOG_INFO, "%s pool report: elapsed: %.3f s, threads: %d [%d, %d], busy: %llu%%, "
+			"current size: %llu, waiting: %llu, max: %llu, volume: %llu\n",
+			dnet_work_io_mode_str(pool->mode), (double)elapsed / 1000000, pool->num, pool->min, pool->limit,
+			(unsigned long long)busy, (unsigned long long)st.list_size, (unsigned long long)queue,
+			(unsigned long long)st.max_list_size, (unsigned long long)st.volume);
+
+	if (pool->num > pool->limit) {
+		stopped = dnet_work_pool_shrink_nolock(n, pool, pool->num - pool->limit);
+		pool->grow_ticks = pool->shrink_ticks = 0;
+	} else if (queue && busy >= DNET_WORK_POOL_BUSY_HIGH && pool->num < pool->limit) {
+		pool->shrink_ticks = 0;
+
+		if (++pool->grow_ticks >= DNET_WORK_POOL_GROW_TICKS) {
+			num = pool->num / 4;
+			if (num < 1)
+				num = 1;
+			if (num > pool->limit - pool->num)
+				num = pool->limit - pool->num;
+
+			dnet_work_pool_grow_nolock(n, pool, num);
+			pool->grow_ticks = 0;
+		}
+	} else if (!queue && busy < DNET_WORK_POOL_BUSY_LOW && pool->num > pool->min) {
+		pool->grow_ticks = 0;
+
+		if (++pool->shrink_ticks >= DNET_WORK_POOL_SHRINK_TICKS) {
+			stopped = dnet_work_pool_shrink_nolock(n, pool, 1);
+			pool->shrink_ticks = 0;
+		}
+	} else {
+		pool->grow_ticks = pool->shrink_ticks = 0;
+	}
+
+	num = pool->num;
+	pthread_mutex_unlock(&pool->lock);
+
+	/* stopped threads drain their queues first, do not hold pool lock meanwhile */
+	dnet_work_pool_join(pool, num, stopped);
+}
+
+void dnet_io_autoscale(struct dnet_node *n)
+{
+	struct dnet_io *io = n->io;
+
+	if (!io)
+		return;
+
+	dnet_work_pool_autoscale(io->recv_pool);
+	dnet_work_pool_autoscale(io->recv_pool_nb);
+}
+
+static void dnet_work_pool_status(struct dnet_work_pool *pool, int *limit_ptr, int *num)
+{
+	int limit = *limit_ptr;
+
+	pthread_mutex_lock(&pool->lock);
+	if (limit > 0) {
+		if (limit < pool->min)
+			limit = pool->min;
+		if (limit > pool->max)
+			limit = pool->max;
+
+		if (limit != pool->limit)
+			dnet_log(pool->n, DNET_LOG_INFO, "%s pool: changing maximum number of IO threads: %d -> %d\n",
+					dnet_work_io_mode_str(pool->mode), pool->limit, limit);
+
+		pool->limit = limit;
+	}
+
+	*limit_ptr = pool->limit;
+	*num = pool->num;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void dnet_update_io_threads(struct dnet_node *n, int *io_thread_max, int *nonblocking_io_thread_max,
+		int *io_thread_num, int *nonblocking_io_thread_num)
+{
+	struct dnet_io *io = n->io;
+
+	dnet_work_pool_status(io->recv_pool, io_thread_max, io_thread_num);
+	dnet_work_pool_status(io->recv_pool_nb, nonblocking_io_thread_max, nonblocking_io_thread_num);
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
+	void *(* process_network)(void *) = dnet_io_process_network;
 	int err, i;
 	int io_size = sizeof(struct dnet_io) + sizeof(struct dnet_net_io) * cfg->net_thread_num;
 
@@ -773,38 +2137,86 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 	n->io->net_thread_num = cfg->net_thread_num;
 	n->io->net_thread_pos = 0;
+	n->io->net_events_batch = DNET_DEFAULT_NET_EVENTS_BATCH;
+	n->io->net_engine = cfg->net_engine;
 	n->io->net = (struct dnet_net_io *)(n->io + 1);
 
-	n->io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
+#ifndef HAVE_IO_URING_SUPPORT
+	if (n->io->net_engine == DNET_NET_ENGINE_URING) {
+		dnet_log(n, DNET_LOG_ERROR, "io_uring network engine is not supported by this build, using epoll\n");
+		n->io->net_engine = DNET_NET_ENGINE_EPOLL;
+	}
+#endif
+
+	n->io->recv_pool = dnet_work_pool_alloc(n, cfg->io_thread_num, cfg->io_thread_num_max,
+			DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
 	if (!n->io->recv_pool) {
 		err = -ENOMEM;
 		goto err_out_free;
 	}
 
-	n->io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, DNET_WORK_IO_MODE_NONBLOCKING, dnet_io_process);
+	n->io->recv_pool_nb = dnet_work_pool_alloc(n, cfg->nonblocking_io_thread_num, cfg->nonblocking_io_thread_num_max,
+			DNET_WORK_IO_MODE_NONBLOCKING, dnet_io_process);
 	if (!n->io->recv_pool_nb) {
 		err = -ENOMEM;
 		goto err_out_free_recv_pool;
 	}
 
+	n->io->recv_pool->queue_limit = n->io->recv_pool_nb->queue_limit = cfg->io_queue_limit;
+	n->io->recv_pool->queue_bytes_limit = n->io->recv_pool_nb->queue_bytes_limit = (uint64_t)cfg->io_queue_kb_limit * 1024;
+
+	for (i = 0; i < n->io->net_thread_num; ++i) {
+		err = dnet_timer_wheel_init(&n->io->net[i].timers, &n->trans_timers);
+		if (err)
+			goto err_out_timers_destroy;
+	}
+
 	for (i=0; i<n->io->net_thread_num; ++i) {
 		struct dnet_net_io *nio = &n->io->net[i];
 
 		nio->n = n;
 
+		nio->events = malloc(sizeof(struct epoll_event) * n->io->net_events_batch);
+		if (!nio->events) {
+			err = -ENOMEM;
+			goto err_out_net_destroy;
+		}
+
 		nio->epoll_fd = epoll_create(10000);
 		if (nio->epoll_fd < 0) {
 			err = -errno;
 			dnet_log_err(n, "Failed to create epoll fd");
+			free(nio->events);
 			goto err_out_net_destroy;
 		}
 
 		fcntl(nio->epoll_fd, F_SETFD, FD_CLOEXEC);
 		fcntl(nio->epoll_fd, F_SETFL, O_NONBLOCK);
 
-		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
+#ifdef HAVE_IO_URING_SUPPORT
+		/* epoll descriptor is still created to bind states to threads, but nothing waits on it */
+		if (n->io->net_engine == DNET_NET_ENGINE_URING) {
+			err = dnet_uring_init(nio);
+			if (err == -ENOSYS && i == 0) {
+				dnet_log(n, DNET_LOG_ERROR, "io_uring network engine is not supported by the kernel, using epoll\n");
+				n->io->net_engine = DNET_NET_ENGINE_EPOLL;
+			} else if (err) {
+				close(nio->epoll_fd);
+				free(nio->events);
+				goto err_out_net_destroy;
+			} else {
+				process_network = dnet_uring_process_network;
+			}
+		}
+#endif
+
+		err = pthread_create(&nio->tid, NULL, process_network, nio);
 		if (err) {
+#ifdef HAVE_IO_URING_SUPPORT
+			dnet_uring_destroy(nio);
+#endif
 			close(nio->epoll_fd);
+			free(nio->events);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d\n", err);
 			goto err_out_net_destroy;
@@ -816,9 +2228,18 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 err_out_net_destroy:
 	while (--i >= 0) {
 		pthread_join(n->io->net[i].tid, NULL);
+#ifdef HAVE_IO_URING_SUPPORT
+		dnet_uring_destroy(&n->io->net[i]);
+#endif
 		close(n->io->net[i].epoll_fd);
+		free(n->io->net[i].events);
 	}
 
+	i = n->io->net_thread_num;
+err_out_timers_destroy:
+	while (--i >= 0)
+		dnet_timer_wheel_destroy(&n->io->net[i].timers);
+
 	dnet_work_pool_cleanup(n->io->recv_pool_nb);
 err_out_free_recv_pool:
 	dnet_work_pool_cleanup(n->io->recv_pool);
@@ -839,6 +2260,7 @@ void dnet_io_exit(struct dnet_node *n)
 	for (i=0; i<io->net_thread_num; ++i) {
 		pthread_join(io->net[i].tid, NULL);
 		close(io->net[i].epoll_fd);
+		free(io->net[i].events);
 	}
 
 	dnet_work_pool_cleanup(io->recv_pool_nb);
@@ -846,5 +2268,14 @@ void dnet_io_exit(struct dnet_node *n)
 
 	dnet_io_cleanup_states(n);
 
+#ifdef HAVE_IO_URING_SUPPORT
+	/* rings are destroyed last, requests and states still reference chunks of their arenas */
+	for (i = 0; i < io->net_thread_num; ++i)
+		dnet_uring_destroy(&io->net[i]);
+#endif
+
+	for (i = 0; i < io->net_thread_num; ++i)
+		dnet_timer_wheel_destroy(&io->net[i].timers);
+
 	free(io);
 }
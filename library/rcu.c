@@ -0,0 +1,264 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Epoch based reclamation of objects which are read without locks.
+ *
+ * Writer replaces shared pointer and retires old object, retirement advances global epoch.
+ * Every reading thread publishes epoch it has observed when entering read section,
+ * and 0 when it leaves it. Retired object is freed when no reader is left in read section
+ * entered before that object has been retired.
+ *
+ * Readers never wait, they only write into their own thread record.
+ * Retired objects are freed by dnet_rcu_reclaim_wait() from reclamation thread of every node,
+ * which is woken up by retirement, and by dnet_rcu_barrier() which waits for all of them.
+ */
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elliptics.h"
+
+struct dnet_rcu_reader {
+	struct list_head		entry;
+	volatile uint64_t		epoch;
+	int				nest;
+};
+
+static uint64_t dnet_rcu_epoch = 1;
+
+static pthread_once_t dnet_rcu_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dnet_rcu_key;
+static __thread struct dnet_rcu_reader *dnet_rcu_local;
+
+static pthread_mutex_t dnet_rcu_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(dnet_rcu_readers);
+
+/* retired objects in order of their epochs */
+static pthread_mutex_t dnet_rcu_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(dnet_rcu_retired);
+static pthread_cond_t dnet_rcu_retired_wait = PTHREAD_COND_INITIALIZER;
+
+static void dnet_rcu_reader_destroy(void *data)
+{
+	struct dnet_rcu_reader *r = data;
+
+	pthread_mutex_lock(&dnet_rcu_readers_lock);
+	list_del(&r->entry);
+	pthread_mutex_unlock(&dnet_rcu_readers_lock);
+
+	if (dnet_rcu_local == r)
+		dnet_rcu_local = NULL;
+	free(r);
+}
+
+static void dnet_rcu_init(void)
+{
+	pthread_key_create(&dnet_rcu_key, dnet_rcu_reader_destroy);
+}
+
+static struct dnet_rcu_reader *dnet_rcu_reader_get(void)
+{
+	struct dnet_rcu_reader *r = dnet_rcu_local;
+
+	if (r)
+		return r;
+
+	pthread_once(&dnet_rcu_once, dnet_rcu_init);
+
+	r = malloc(sizeof(struct dnet_rcu_reader));
+	if (!r)
+		return NULL;
+	memset(r, 0, sizeof(struct dnet_rcu_reader));
+
+	pthread_mutex_lock(&dnet_rcu_readers_lock);
+	list_add_tail(&r->entry, &dnet_rcu_readers);
+	pthread_mutex_unlock(&dnet_rcu_readers_lock);
+
+	pthread_setspecific(dnet_rcu_key, r);
+	dnet_rcu_local = r;
+
+	return r;
+}
+
+/*
+ * Returns NULL if thread record can not be allocated, caller has to fall back to locked access then
+ */
+struct dnet_rcu_reader *dnet_rcu_read_lock(void)
+{
+	struct dnet_rcu_reader *r = dnet_rcu_reader_get();
+
+	if (r && r->nest++ == 0) {
+		r->epoch = __atomic_load_n(&dnet_rcu_epoch, __ATOMIC_RELAXED);
+
+		/* epoch has to be visible to writers before shared pointers are read */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	return r;
+}
+
+void dnet_rcu_read_unlock(struct dnet_rcu_reader *r)
+{
+	if (--r->nest == 0)
+		__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Must be called after @head object has been unlinked from shared pointer,
+ * @free is called when there are no readers who could have seen it
+ */
+void dnet_rcu_retire(struct dnet_rcu_head *head, void (* free)(struct dnet_rcu_head *head))
+{
+	head->free = free;
+
+	pthread_mutex_lock(&dnet_rcu_retired_lock);
+	head->epoch = __atomic_add_fetch(&dnet_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+	list_add_tail(&head->entry, &dnet_rcu_retired);
+	pthread_cond_broadcast(&dnet_rcu_retired_wait);
+	pthread_mutex_unlock(&dnet_rcu_retired_lock);
+}
+
+/*
+ * Queues @head into @list, which is retired by dnet_rcu_retire_list() later, caller protects @list.
+ * Objects unlinked under a lock are retired after it is dropped, so that holders of different locks
+ * do not serialize on the global retired list and epoch.
+ */
+void dnet_rcu_defer(struct list_head *list, struct dnet_rcu_head *head, void (* free)(struct dnet_rcu_head *head))
+{
+	head->free = free;
+	list_add_tail(&head->entry, list);
+}
+
+/*
+ * Retires all objects queued into @list by dnet_rcu_defer() at once, @list is empty on return
+ */
+void dnet_rcu_retire_list(struct list_head *list)
+{
+	struct dnet_rcu_head *head;
+	uint64_t epoch;
+
+	if (list_empty(list))
+		return;
+
+	pthread_mutex_lock(&dnet_rcu_retired_lock);
+	epoch = __atomic_add_fetch(&dnet_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+	list_for_each_entry(head, list, entry)
+		head->epoch = epoch;
+	list_splice_tail_init(list, &dnet_rcu_retired);
+	pthread_cond_broadcast(&dnet_rcu_retired_wait);
+	pthread_mutex_unlock(&dnet_rcu_retired_lock);
+}
+
+/*
+ * Oldest epoch any reader is in, or current epoch if there are no readers
+ */
+static uint64_t dnet_rcu_min_epoch(void)
+{
+	struct dnet_rcu_reader *r;
+	uint64_t min, epoch;
+
+	min = __atomic_load_n(&dnet_rcu_epoch, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&dnet_rcu_readers_lock);
+	list_for_each_entry(r, &dnet_rcu_readers, entry) {
+		epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+		if (epoch && epoch < min)
+			min = epoch;
+	}
+	pthread_mutex_unlock(&dnet_rcu_readers_lock);
+
+	return min;
+}
+
+/*
+ * Free retired objects which are not visible to readers anymore, returns number of objects left
+ */
+int dnet_rcu_reclaim(void)
+{
+	struct dnet_rcu_head *head, *tmp;
+	LIST_HEAD(list);
+	uint64_t min;
+	int left = 0;
+
+	pthread_mutex_lock(&dnet_rcu_retired_lock);
+	if (list_empty(&dnet_rcu_retired)) {
+		pthread_mutex_unlock(&dnet_rcu_retired_lock);
+		return 0;
+	}
+
+	min = dnet_rcu_min_epoch();
+
+	list_for_each_entry_safe(head, tmp, &dnet_rcu_retired, entry) {
+		if (head->epoch > min) {
+			left++;
+			continue;
+		}
+
+		list_move_tail(&head->entry, &list);
+	}
+	pthread_mutex_unlock(&dnet_rcu_retired_lock);
+
+	/* free callbacks may drop references and take other locks */
+	list_for_each_entry_safe(head, tmp, &list, entry) {
+		list_del(&head->entry);
+		head->free(head);
+	}
+
+	return left;
+}
+
+/*
+ * Wait up to @timeout_ms milliseconds for retired objects and free those which are not visible
+ * to readers anymore, returns number of objects left.
+ *
+ * Reclamation can not be done in dnet_rcu_retire(), since it is called under locks
+ * free callbacks may need.
+ */
+int dnet_rcu_reclaim_wait(long timeout_ms)
+{
+	struct timespec ts;
+	struct timeval tv;
+	int err = 0;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + timeout_ms / 1000;
+	ts.tv_nsec = tv.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&dnet_rcu_retired_lock);
+	while (list_empty(&dnet_rcu_retired) && err != ETIMEDOUT)
+		err = pthread_cond_timedwait(&dnet_rcu_retired_wait, &dnet_rcu_retired_lock, &ts);
+	pthread_mutex_unlock(&dnet_rcu_retired_lock);
+
+	return dnet_rcu_reclaim();
+}
+
+/*
+ * Wait until all objects retired so far are freed, must not be called from read section
+ */
+void dnet_rcu_barrier(void)
+{
+	while (dnet_rcu_reclaim())
+		sched_yield();
+}
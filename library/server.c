@@ -214,6 +214,12 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data, str
 
 	n->config_data = cfg_data;
 
+	if (cfg_data) {
+		dnet_set_net_events_batch(n, cfg_data->net_events_batch);
+		dnet_set_net_conns_policy(n, cfg_data->net_conns_policy, cfg_data->net_large_size);
+		dnet_set_io_queue_policy(n, cfg_data->io_queue_policy);
+	}
+
 	err = dnet_node_check_stack(n);
 	if (err)
 		goto err_out_node_destroy;
@@ -0,0 +1,326 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Size-classed object cache for small short-lived allocations: transactions and queued IO requests.
+ *
+ * Every thread keeps a few free objects of every class, so allocation and free usually
+ * do not touch shared state. Objects are frequently freed by another thread than the one
+ * which has allocated them (network thread frees requests queued by IO threads),
+ * so thread caches exchange objects with global per-class depot in batches.
+ *
+ * Allocations larger than the biggest class go directly to malloc().
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elliptics.h"
+
+#define DNET_SLAB_MIN_SIZE		128
+#define DNET_SLAB_CLASSES		7		/* 128 .. 8192 bytes */
+#define DNET_SLAB_LARGE			DNET_SLAB_CLASSES
+
+#define DNET_SLAB_CACHE_MAX		64		/* objects of every class cached by single thread */
+#define DNET_SLAB_BATCH			32		/* objects moved between thread cache and depot at once */
+#define DNET_SLAB_DEPOT_MAX		4096		/* objects of every class kept in global depot */
+
+/*
+ * Object header, @next links free objects, allocated object only uses @class
+ */
+struct dnet_slab_obj {
+	union {
+		struct dnet_slab_obj	*next;
+		uint64_t		pad;
+	};
+	uint64_t			class;
+};
+
+struct dnet_slab_cache {
+	struct list_head		entry;
+
+	struct dnet_slab_obj		*free[DNET_SLAB_CLASSES];
+	int				num[DNET_SLAB_CLASSES];
+
+	uint64_t			allocs;
+	uint64_t			hits;
+	uint64_t			large;
+};
+
+struct dnet_slab_depot {
+	pthread_mutex_t			lock;
+	struct dnet_slab_obj		*free;
+	int				num;
+};
+
+static struct dnet_slab_depot dnet_slab_depots[DNET_SLAB_CLASSES];
+
+static pthread_once_t dnet_slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t dnet_slab_key;
+static __thread struct dnet_slab_cache *dnet_slab_local;
+
+/* thread caches for statistics, and counters of already exited threads */
+static pthread_mutex_t dnet_slab_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(dnet_slab_caches);
+static uint64_t dnet_slab_exited_allocs, dnet_slab_exited_hits, dnet_slab_exited_large;
+
+static inline size_t dnet_slab_class_size(int class)
+{
+	return DNET_SLAB_MIN_SIZE << class;
+}
+
+static inline int dnet_slab_class(size_t size)
+{
+	int class = 0;
+
+	while (class < DNET_SLAB_CLASSES && dnet_slab_class_size(class) < size)
+		class++;
+
+	return class;
+}
+
+/*
+ * Put up to @num objects from the head of thread cache list into depot, free them if depot is full
+ */
+static void dnet_slab_flush(struct dnet_slab_cache *c, int class, int num)
+{
+	struct dnet_slab_depot *d = &dnet_slab_depots[class];
+	struct dnet_slab_obj *head, *tail, *o;
+	int i;
+
+	head = tail = c->free[class];
+	if (!head)
+		return;
+
+	for (i = 1; i < num && tail->next; ++i)
+		tail = tail->next;
+
+	c->free[class] = tail->next;
+	c->num[class] -= i;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->num < DNET_SLAB_DEPOT_MAX) {
+		tail->next = d->free;
+		d->free = head;
+		d->num += i;
+		pthread_mutex_unlock(&d->lock);
+		return;
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	tail->next = NULL;
+	while (head) {
+		o = head;
+		head = head->next;
+		free(o);
+	}
+}
+
+static void dnet_slab_refill(struct dnet_slab_cache *c, int class)
+{
+	struct dnet_slab_depot *d = &dnet_slab_depots[class];
+	struct dnet_slab_obj *head, *tail;
+	int i;
+
+	pthread_mutex_lock(&d->lock);
+	head = tail = d->free;
+	if (head) {
+		for (i = 1; i < DNET_SLAB_BATCH && tail->next; ++i)
+			tail = tail->next;
+
+		d->free = tail->next;
+		d->num -= i;
+
+		tail->next = c->free[class];
+		c->free[class] = head;
+		c->num[class] += i;
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void dnet_slab_cache_destroy(void *data)
+{
+	struct dnet_slab_cache *c = data;
+	int class;
+
+	for (class = 0; class < DNET_SLAB_CLASSES; ++class) {
+		while (c->free[class])
+			dnet_slab_flush(c, class, DNET_SLAB_BATCH);
+	}
+
+	pthread_mutex_lock(&dnet_slab_caches_lock);
+	list_del(&c->entry);
+	dnet_slab_exited_allocs += c->allocs;
+	dnet_slab_exited_hits += c->hits;
+	dnet_slab_exited_large += c->large;
+	pthread_mutex_unlock(&dnet_slab_caches_lock);
+
+	if (dnet_slab_local == c)
+		dnet_slab_local = NULL;
+	free(c);
+}
+
+static void dnet_slab_init(void)
+{
+	int class;
+
+	for (class = 0; class < DNET_SLAB_CLASSES; ++class)
+		pthread_mutex_init(&dnet_slab_depots[class].lock, NULL);
+
+	pthread_key_create(&dnet_slab_key, dnet_slab_cache_destroy);
+}
+
+static struct dnet_slab_cache *dnet_slab_cache_get(void)
+{
+	struct dnet_slab_cache *c = dnet_slab_local;
+
+	if (c)
+		return c;
+
+	pthread_once(&dnet_slab_once, dnet_slab_init);
+
+	c = malloc(sizeof(struct dnet_slab_cache));
+	if (!c)
+		return NULL;
+	memset(c, 0, sizeof(struct dnet_slab_cache));
+
+	pthread_mutex_lock(&dnet_slab_caches_lock);
+	list_add_tail(&c->entry, &dnet_slab_caches);
+	pthread_mutex_unlock(&dnet_slab_caches_lock);
+
+	pthread_setspecific(dnet_slab_key, c);
+	dnet_slab_local = c;
+
+	return c;
+}
+
+void *dnet_slab_alloc(size_t size)
+{
+	struct dnet_slab_cache *c = dnet_slab_cache_get();
+	int class = dnet_slab_class(size);
+	struct dnet_slab_obj *o;
+
+	if (c) {
+		c->allocs++;
+		if (class == DNET_SLAB_LARGE)
+			c->large++;
+	}
+
+	/* objects allocated without thread cache are not pooled, whatever their size is */
+	if (!c || class == DNET_SLAB_LARGE) {
+		o = malloc(sizeof(struct dnet_slab_obj) + size);
+		if (!o)
+			return NULL;
+
+		o->class = DNET_SLAB_LARGE;
+		return o + 1;
+	}
+
+	if (!c->free[class])
+		dnet_slab_refill(c, class);
+
+	o = c->free[class];
+	if (o) {
+		c->free[class] = o->next;
+		c->num[class]--;
+		c->hits++;
+	} else {
+		o = malloc(sizeof(struct dnet_slab_obj) + dnet_slab_class_size(class));
+		if (!o)
+			return NULL;
+	}
+
+	o->class = class;
+	return o + 1;
+}
+
+void dnet_slab_free(void *ptr)
+{
+	struct dnet_slab_obj *o;
+	struct dnet_slab_cache *c;
+	int class;
+
+	if (!ptr)
+		return;
+
+	o = (struct dnet_slab_obj *)ptr - 1;
+	class = o->class;
+
+	c = NULL;
+	if (class != DNET_SLAB_LARGE)
+		c = dnet_slab_cache_get();
+
+	if (!c) {
+		free(o);
+		return;
+	}
+
+	o->next = c->free[class];
+	c->free[class] = o;
+
+	if (++c->num[class] > DNET_SLAB_CACHE_MAX)
+		dnet_slab_flush(c, class, DNET_SLAB_BATCH);
+}
+
+void *dnet_slab_realloc(void *ptr, size_t size)
+{
+	struct dnet_slab_obj *o;
+	void *n;
+
+	if (!ptr)
+		return dnet_slab_alloc(size);
+
+	o = (struct dnet_slab_obj *)ptr - 1;
+	if (o->class == DNET_SLAB_LARGE) {
+		o = realloc(o, sizeof(struct dnet_slab_obj) + size);
+		if (!o)
+			return NULL;
+
+		return o + 1;
+	}
+
+	if (size <= dnet_slab_class_size(o->class))
+		return ptr;
+
+	n = dnet_slab_alloc(size);
+	if (!n)
+		return NULL;
+
+	memcpy(n, ptr, dnet_slab_class_size(o->class));
+	dnet_slab_free(ptr);
+
+	return n;
+}
+
+/*
+ * Counters are process-wide, thread caches are shared by all nodes
+ */
+void dnet_slab_stat_fill(struct dnet_stat_count *counters)
+{
+	struct dnet_slab_cache *c;
+
+	pthread_mutex_lock(&dnet_slab_caches_lock);
+	counters[DNET_CNTR_SLAB_ALLOCS].count += dnet_slab_exited_allocs;
+	counters[DNET_CNTR_SLAB_HITS].count += dnet_slab_exited_hits;
+	counters[DNET_CNTR_SLAB_LARGE].count += dnet_slab_exited_large;
+
+	list_for_each_entry(c, &dnet_slab_caches, entry) {
+		counters[DNET_CNTR_SLAB_ALLOCS].count += c->allocs;
+		counters[DNET_CNTR_SLAB_HITS].count += c->hits;
+		counters[DNET_CNTR_SLAB_LARGE].count += c->large;
+	}
+	pthread_mutex_unlock(&dnet_slab_caches_lock);
+}
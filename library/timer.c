@@ -0,0 +1,321 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Hierarchical timer wheel with millisecond ticks.
+ *
+ * Level 0 has a slot for every tick of the next 64 milliseconds, every slot of the next level
+ * covers the whole previous level. When level 0 wraps around, the next slot of level 1
+ * is cascaded, i.e. its timers are redistributed into level 0, and so on up the levels.
+ * Every timer is moved at most DNET_TIMER_LEVELS times, adding and removing it is O(1).
+ *
+ * Timers which are farther than the wheel covers (about 4.6 hours) are put into the farthest slot
+ * and are redistributed again when it is cascaded.
+ *
+ * Every network thread has its own wheel, so arming timers of different threads does not contend.
+ * Thread which processes timers sleeps until the first tick when something happens in any of its wheels.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "elliptics.h"
+
+#define DNET_TIMER_MASK		(DNET_TIMER_SLOTS - 1)
+#define DNET_TIMER_RANGE	(1ULL << (DNET_TIMER_BITS * DNET_TIMER_LEVELS))
+
+uint64_t dnet_timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int dnet_timer_waiter_init(struct dnet_timer_waiter *waiter)
+{
+	pthread_condattr_t attr;
+	int err;
+
+	INIT_LIST_HEAD(&waiter->wheels);
+	waiter->wakeup = 0;
+
+	err = -pthread_mutex_init(&waiter->lock, NULL);
+	if (err)
+		goto err_out_exit;
+
+	err = -pthread_condattr_init(&attr);
+	if (err)
+		goto err_out_lock_destroy;
+
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	err = -pthread_cond_init(&waiter->wait, &attr);
+	pthread_condattr_destroy(&attr);
+	if (err)
+		goto err_out_lock_destroy;
+
+	return 0;
+
+err_out_lock_destroy:
+	pthread_mutex_destroy(&waiter->lock);
+err_out_exit:
+	return err;
+}
+
+void dnet_timer_waiter_destroy(struct dnet_timer_waiter *waiter)
+{
+	pthread_cond_destroy(&waiter->wait);
+	pthread_mutex_destroy(&waiter->lock);
+}
+
+int dnet_timer_wheel_init(struct dnet_timer_wheel *w, struct dnet_timer_waiter *waiter)
+{
+	int err, i, j;
+
+	for (i = 0; i < DNET_TIMER_LEVELS; ++i) {
+		for (j = 0; j < DNET_TIMER_SLOTS; ++j)
+			INIT_LIST_HEAD(&w->slots[i][j]);
+	}
+	INIT_LIST_HEAD(&w->expired);
+
+	w->now = dnet_timer_now();
+	w->num = 0;
+	w->waiter = waiter;
+
+	err = -pthread_mutex_init(&w->lock, NULL);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&waiter->lock);
+	list_add_tail(&w->waiter_entry, &waiter->wheels);
+	pthread_mutex_unlock(&waiter->lock);
+
+	return 0;
+}
+
+void dnet_timer_wheel_destroy(struct dnet_timer_wheel *w)
+{
+	pthread_mutex_lock(&w->waiter->lock);
+	list_del(&w->waiter_entry);
+	pthread_mutex_unlock(&w->waiter->lock);
+
+	pthread_mutex_destroy(&w->lock);
+}
+
+static void dnet_timer_link(struct dnet_timer_wheel *w, struct dnet_timer *t)
+{
+	uint64_t expires = t->expires;
+	uint64_t delta;
+	int level = 0;
+
+	if (expires < w->now)
+		expires = w->now;
+
+	delta = expires - w->now;
+	if (delta >= DNET_TIMER_RANGE) {
+		delta = DNET_TIMER_RANGE - 1;
+		expires = w->now + delta;
+	}
+
+	while (delta >= (1ULL << (DNET_TIMER_BITS * (level + 1))))
+		level++;
+
+	list_add_tail(&t->entry, &w->slots[level][(expires >> (DNET_TIMER_BITS * level)) & DNET_TIMER_MASK]);
+}
+
+/*
+ * Timer is (re)armed in @w, it is removed from the wheel it was linked into before if that was another one
+ */
+void dnet_timer_add(struct dnet_timer_wheel *w, struct dnet_timer *t, uint64_t expires)
+{
+	struct dnet_timer_waiter *waiter = w->waiter;
+
+	if (t->wheel && t->wheel != w)
+		dnet_timer_del(t);
+
+	pthread_mutex_lock(&w->lock);
+	if (!list_empty(&t->entry))
+		list_del(&t->entry);
+	else
+		w->num++;
+
+	t->wheel = w;
+	t->expires = expires;
+	dnet_timer_link(w, t);
+	pthread_mutex_unlock(&w->lock);
+
+	/*
+	 * Waiter sets @wakeup before it looks at wheels, so it either has seen this timer
+	 * or we see that it is going to sleep longer than this timer has to wait
+	 */
+	if (expires < *(volatile uint64_t *)&waiter->wakeup) {
+		pthread_mutex_lock(&waiter->lock);
+		if (expires < waiter->wakeup) {
+			waiter->wakeup = expires;
+			pthread_cond_signal(&waiter->wait);
+		}
+		pthread_mutex_unlock(&waiter->lock);
+	}
+}
+
+void dnet_timer_del(struct dnet_timer *t)
+{
+	struct dnet_timer_wheel *w = t->wheel;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	if (!list_empty(&t->entry)) {
+		list_del_init(&t->entry);
+		w->num--;
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void dnet_timer_cascade(struct dnet_timer_wheel *w, int level, int idx)
+{
+	struct dnet_timer *t, *tmp;
+	LIST_HEAD(head);
+
+	list_splice_init(&w->slots[level][idx], &head);
+
+	list_for_each_entry_safe(t, tmp, &head, entry) {
+		list_del(&t->entry);
+		dnet_timer_link(w, t);
+	}
+}
+
+/*
+ * Move timers which expire not later than @now into expired list, returns first of them or NULL.
+ * Returned timer is unlinked and the caller is responsible for it.
+ */
+struct dnet_timer *dnet_timer_expire_nolock(struct dnet_timer_wheel *w, uint64_t now)
+{
+	struct dnet_timer *t;
+	int level, idx;
+
+	while (list_empty(&w->expired) && w->now <= now) {
+		idx = w->now & DNET_TIMER_MASK;
+
+		for (level = 1; level < DNET_TIMER_LEVELS && !idx; ++level) {
+			idx = (w->now >> (DNET_TIMER_BITS * level)) & DNET_TIMER_MASK;
+			dnet_timer_cascade(w, level, idx);
+		}
+
+		list_splice_init(&w->slots[0][w->now & DNET_TIMER_MASK], &w->expired);
+		w->now++;
+	}
+
+	if (list_empty(&w->expired))
+		return NULL;
+
+	t = list_first_entry(&w->expired, struct dnet_timer, entry);
+	list_del_init(&t->entry);
+	w->num--;
+
+	return t;
+}
+
+/*
+ * The first tick when anything happens in the wheel: level 0 slot expires or upper level slot is cascaded.
+ * Slot of level @level is cascaded at the first tick which is a multiple of its range and maps to this slot,
+ * current slot of the level has already been cascaded unless @now is such a tick.
+ * Returns -1 when wheel is empty.
+ */
+static uint64_t dnet_timer_next_nolock(struct dnet_timer_wheel *w)
+{
+	uint64_t next = -1, base, tick;
+	int level, shift, first, last, i;
+
+	if (!list_empty(&w->expired))
+		return w->now;
+
+	if (!w->num)
+		return next;
+
+	for (i = 0; i < DNET_TIMER_SLOTS; ++i) {
+		tick = w->now + i;
+		if (!list_empty(&w->slots[0][tick & DNET_TIMER_MASK])) {
+			next = tick;
+			break;
+		}
+	}
+
+	for (level = 1; level < DNET_TIMER_LEVELS; ++level) {
+		shift = DNET_TIMER_BITS * level;
+		base = w->now >> shift;
+
+		first = (w->now & ((1ULL << shift) - 1)) ? 1 : 0;
+		last = first + DNET_TIMER_SLOTS - 1;
+
+		for (i = first; i <= last; ++i) {
+			tick = (base + i) << shift;
+			if (tick >= next)
+				break;
+
+			if (!list_empty(&w->slots[level][(base + i) & DNET_TIMER_MASK])) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+uint64_t dnet_timer_next(struct dnet_timer_wheel *w)
+{
+	uint64_t next;
+
+	pthread_mutex_lock(&w->lock);
+	next = dnet_timer_next_nolock(w);
+	pthread_mutex_unlock(&w->lock);
+
+	return next;
+}
+
+/*
+ * Sleep until the next timer of any wheel of the waiter expires, or until @limit,
+ * or until earlier timer is added
+ */
+void dnet_timer_wait(struct dnet_timer_waiter *waiter, uint64_t limit)
+{
+	struct dnet_timer_wheel *w;
+	struct timespec ts;
+	uint64_t next;
+
+	pthread_mutex_lock(&waiter->lock);
+	waiter->wakeup = limit;
+
+	list_for_each_entry(w, &waiter->wheels, waiter_entry) {
+		next = dnet_timer_next(w);
+		if (next < waiter->wakeup)
+			waiter->wakeup = next;
+	}
+
+	next = waiter->wakeup;
+	if (next > dnet_timer_now()) {
+		ts.tv_sec = next / 1000;
+		ts.tv_nsec = (next % 1000) * 1000000;
+		pthread_cond_timedwait(&waiter->wait, &waiter->lock, &ts);
+	}
+
+	waiter->wakeup = 0;
+	pthread_mutex_unlock(&waiter->lock);
+}
@@ -26,53 +26,91 @@
 #include "elliptics/packet.h"
 #include "elliptics/interface.h"
 
-static inline int dnet_trans_cmp(uint64_t old, uint64_t new)
+/*
+ * Transactions are kept in open addressing hash table with linear probing.
+ * Transaction numbers are sequential, they are scattered with multiplicative hash,
+ * otherwise every new transaction would be inserted right after the previous one
+ * and would have to probe through the whole cluster of older ones.
+ *
+ * Removal shifts following entries of the probe sequence back into the freed slot,
+ * thus there are no tombstones and lookup stops at the first empty slot.
+ * Table is kept at most half full and is allocated when the first transaction is inserted.
+ */
+#define DNET_TRANS_TABLE_MIN_SIZE	64
+
+static inline unsigned int dnet_trans_hash(uint64_t trans, unsigned int size)
 {
-	if (old > new)
-		return 1;
-	if (old < new)
-		return -1;
+	return (trans * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctz(size));
+}
+
+static int dnet_trans_table_resize(struct dnet_trans_table *table, unsigned int size)
+{
+	struct dnet_trans **slots, *t;
+	unsigned int i, pos;
+
+	slots = calloc(size, sizeof(struct dnet_trans *));
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; i < table->size; ++i) {
+		t = table->slots[i];
+		if (!t)
+			continue;
+
+		pos = dnet_trans_hash(t->trans, size);
+		while (slots[pos])
+			pos = (pos + 1) & (size - 1);
+
+		slots[pos] = t;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->size = size;
+
 	return 0;
 }
 
-struct dnet_trans *dnet_trans_search(struct rb_root *root, uint64_t trans)
+void dnet_trans_table_free(struct dnet_trans_table *table)
 {
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
-
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, trans_entry);
-
-		cmp = dnet_trans_cmp(t->trans, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
+	free(table->slots);
+	table->slots = NULL;
+	table->size = 0;
+	table->num = 0;
+}
+
+struct dnet_trans *dnet_trans_search(struct dnet_trans_table *table, uint64_t trans)
+{
+	unsigned int mask = table->size - 1;
+	unsigned int pos;
+	struct dnet_trans *t;
+
+	if (!table->num)
+		return NULL;
+
+	for (pos = dnet_trans_hash(trans, table->size); (t = table->slots[pos]); pos = (pos + 1) & mask) {
+		if (t->trans == trans)
 			return dnet_trans_get(t);
 	}
 
 	return NULL;
 }
 
-int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
+int dnet_trans_insert_nolock(struct dnet_trans_table *table, struct dnet_trans *a)
 {
-	struct rb_node **n = &root->rb_node, *parent = NULL;
+	unsigned int mask, pos;
 	struct dnet_trans *t;
-	int cmp;
-
-	while (*n) {
-		parent = *n;
+	int err;
 
-		t = rb_entry(parent, struct dnet_trans, trans_entry);
+	if ((table->num + 1) * 2 > table->size) {
+		err = dnet_trans_table_resize(table, table->size ? table->size * 2 : DNET_TRANS_TABLE_MIN_SIZE);
+		if (err)
+			return err;
+	}
 
-		cmp = dnet_trans_cmp(t->trans, a->trans);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
+	mask = table->size - 1;
+	for (pos = dnet_trans_hash(a->trans, table->size); (t = table->slots[pos]); pos = (pos + 1) & mask) {
+		if (t->trans == a->trans)
 			return -EEXIST;
 	}
 
@@ -81,24 +119,75 @@ int dnet_trans_insert_nolock(struct rb_root *root, struct dnet_trans *a)
 			dnet_dump_id(&a->cmd.id), (unsigned long long)a->trans,
 			dnet_server_convert_dnet_addr(&a->st->addr));
 
-	rb_link_node(&a->trans_entry, parent, n);
-	rb_insert_color(&a->trans_entry, root);
+	table->slots[pos] = a;
+	table->num++;
+	a->trans_hashed = 1;
 	return 0;
 }
 
-void dnet_trans_remove_nolock(struct rb_root *root, struct dnet_trans *t)
+void dnet_trans_remove_nolock(struct dnet_trans_table *table, struct dnet_trans *t)
 {
-	if (!t->trans_entry.rb_parent_color) {
+	unsigned int mask = table->size - 1;
+	unsigned int pos, next, home;
+	struct dnet_trans *e;
+
+	if (!t->trans_hashed) {
 		if (t->st && t->st->n)
 			dnet_log(t->st->n, DNET_LOG_ERROR, "%s: trying to remove standalone transaction %llu.\n",
 				dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans);
 		return;
 	}
 
-	if (t) {
-		rb_erase(&t->trans_entry, root);
-		t->trans_entry.rb_parent_color = 0;
+	for (pos = dnet_trans_hash(t->trans, table->size); table->slots[pos] != t; pos = (pos + 1) & mask)
+		;
+
+	table->slots[pos] = NULL;
+
+	/* move back every following entry whose home slot is not between the hole and the entry */
+	for (next = (pos + 1) & mask; (e = table->slots[next]); next = (next + 1) & mask) {
+		home = dnet_trans_hash(e->trans, table->size);
+
+		if (((next - home) & mask) >= ((next - pos) & mask)) {
+			table->slots[pos] = e;
+			table->slots[next] = NULL;
+			pos = next;
+		}
+	}
+
+	table->num--;
+	t->trans_hashed = 0;
+
+	dnet_timer_del(&t->timer);
+
+	if (table->size > DNET_TRANS_TABLE_MIN_SIZE && table->num * 8 < table->size)
+		dnet_trans_table_resize(table, table->size / 2);
+}
+
+/*
+ * Remove all transactions from the table and move them to @head, they are used through
+ * their ->trans_list_entry. Returns number of moved transactions.
+ */
+int dnet_trans_table_move_nolock(struct dnet_trans_table *table, struct list_head *head)
+{
+	struct dnet_trans *t;
+	unsigned int i;
+	int num = 0;
+
+	for (i = 0; i < table->size; ++i) {
+		t = table->slots[i];
+		if (!t)
+			continue;
+
+		table->slots[i] = NULL;
+		t->trans_hashed = 0;
+		list_move_tail(&t->trans_list_entry, head);
+
+		dnet_timer_del(&t->timer);
+		num++;
 	}
+
+	table->num = 0;
+	return num;
 }
 
 void dnet_trans_remove(struct dnet_trans *t)
@@ -106,7 +195,7 @@ void dnet_trans_remove(struct dnet_trans *t)
 	struct dnet_net_state *st = t->st;
 
 	pthread_mutex_lock(&st->trans_lock);
-	dnet_trans_remove_nolock(&st->trans_root, t);
+	dnet_trans_remove_nolock(&st->trans_table, t);
 	list_del_init(&t->trans_list_entry);
 	pthread_mutex_unlock(&st->trans_lock);
 }
@@ -115,7 +204,7 @@ struct dnet_trans *dnet_trans_alloc(struct dnet_node *n __unused, uint64_t size)
 {
 	struct dnet_trans *t;
 
-	t = malloc(sizeof(struct dnet_trans) + size);
+	t = dnet_slab_alloc(sizeof(struct dnet_trans) + size);
 	if (!t)
 		goto err_out_exit;
 
@@ -123,6 +212,7 @@ struct dnet_trans *dnet_trans_alloc(struct dnet_node *n __unused, uint64_t size)
 
 	atomic_init(&t->refcnt, 1);
 	INIT_LIST_HEAD(&t->trans_list_entry);
+	INIT_LIST_HEAD(&t->timer.entry);
 
 	gettimeofday(&t->start, NULL);
 
@@ -151,7 +241,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		list_del_init(&t->trans_list_entry);
 		pthread_mutex_unlock(&st->trans_lock);
 
-		if (t->trans_entry.rb_parent_color)
+		if (t->trans_hashed)
 			dnet_trans_remove(t);
 	} else if (!list_empty(&t->trans_list_entry)) {
 		assert(0);
@@ -173,6 +263,16 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		st->median_read_time = (st->median_read_time + diff) / 2;
 	}
 
+	if (st && t->size_class) {
+		if (t->size_class == DNET_TRANS_SIZE_LARGE) {
+			dnet_counter_add(st->n, DNET_CNTR_NET_LARGE_TRANS, 1);
+			dnet_counter_add(st->n, DNET_CNTR_NET_LARGE_TRANS_TIME, diff);
+		} else {
+			dnet_counter_add(st->n, DNET_CNTR_NET_SMALL_TRANS, 1);
+			dnet_counter_add(st->n, DNET_CNTR_NET_SMALL_TRANS_TIME, diff);
+		}
+	}
+
 	if (st && st->n && t->command != 0) {
 		char str[64];
 		struct tm tm;
@@ -196,7 +296,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 	dnet_state_put(t->st);
 	dnet_state_put(t->orig);
 
-	free(t);
+	dnet_slab_free(t);
 }
 
 int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *st, struct dnet_trans_control *ctl)
@@ -205,9 +305,12 @@ int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *s
 	struct dnet_node *n = st->n;
 	struct dnet_cmd *cmd;
 	struct dnet_trans *t;
+	size_t deadline_size = dnet_cmd_deadline_size(ctl->cflags);
+	size_t route_version_size = dnet_cmd_route_version_size(st, ctl->cflags);
+	size_t prefix_size = deadline_size + route_version_size;
 	int err;
 
-	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + ctl->size);
+	t = dnet_trans_alloc(n, sizeof(struct dnet_cmd) + prefix_size + ctl->size);
 	if (!t) {
 		err = -ENOMEM;
 		if (ctl->complete)
@@ -227,14 +330,23 @@ int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *s
 
 	memcpy(&cmd->id, &ctl->id, sizeof(struct dnet_id));
 	cmd->flags = ctl->cflags;
-	cmd->size = ctl->size;	
+	cmd->size = prefix_size + ctl->size;
 	cmd->cmd = t->command = ctl->cmd;
 	cmd->trans = t->rcv_trans = t->trans = atomic_inc(&n->trans);
 
+	if (route_version_size) {
+		cmd->flags |= DNET_FLAGS_ROUTE_VERSION;
+		dnet_cmd_route_version_fill((void *)(cmd + 1) + deadline_size, st->route_version);
+		t->hsize = sizeof(struct dnet_cmd) + prefix_size + ctl->size;
+	}
+
 	memcpy(&t->cmd, cmd, sizeof(struct dnet_cmd));
 
+	if (deadline_size)
+		dnet_cmd_deadline_fill((struct dnet_time *)(cmd + 1), &t->wait_ts);
+
 	if (ctl->size && ctl->data)
-		memcpy(cmd + 1, ctl->data, ctl->size);
+		memcpy((void *)(cmd + 1) + prefix_size, ctl->data, ctl->size);
 
 	dnet_convert_cmd(cmd);
 
@@ -243,7 +355,7 @@ int dnet_trans_alloc_send_state(struct dnet_session *s, struct dnet_net_state *s
 	memset(&req, 0, sizeof(req));
 	req.st = st;
 	req.header = cmd;
-	req.hsize = sizeof(struct dnet_cmd) + ctl->size;
+	req.hsize = sizeof(struct dnet_cmd) + prefix_size + ctl->size;
 
 	dnet_log(n, DNET_LOG_INFO, "%s: alloc/send %s trans: %llu -> %s %f.\n",
 			dnet_dump_id(&cmd->id),
@@ -302,53 +414,112 @@ void dnet_trans_clean_list(struct list_head *head)
 	}
 }
 
+/*
+ * Remove all transactions of the state and move them to @head
+ */
 int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_head *head)
 {
-	struct dnet_trans *t, *tmp;
-	struct timeval tv;
-	int trans_moved = 0;
+	int trans_moved;
+
+	pthread_mutex_lock(&st->trans_lock);
+	trans_moved = dnet_trans_table_move_nolock(&st->trans_table, head);
+	pthread_mutex_unlock(&st->trans_lock);
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "state: %s, st: %p, transactions-moved: %d\n", dnet_state_dump_addr(st), st, trans_moved);
+
+	return trans_moved;
+}
+
+/*
+ * Timer of the transaction has expired, move it to @head unless it has been completed
+ * or its timer has been armed again while we were waiting for the lock
+ */
+static void dnet_trans_timeout(struct dnet_trans *t, struct list_head *head)
+{
+	struct dnet_net_state *st = t->st;
 	char str[64];
 	struct tm tm;
 
-	gettimeofday(&tv, NULL);
-
 	pthread_mutex_lock(&st->trans_lock);
-	list_for_each_entry_safe(t, tmp, &st->trans_list, trans_list_entry) {
-		if ((t->time.tv_sec >= tv.tv_sec) && !st->need_exit)
-			break;
+	if (!t->trans_hashed || !list_empty(&t->timer.entry))
+		goto err_out_unlock;
+
+	localtime_r((time_t *)&t->start.tv_sec, &tm);
+	strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT: wait-ts: %ld.%03ld, cmd: %s [%d], started: %s.%06lu\n",
+			dnet_state_dump_addr(st), (unsigned long long)t->trans,
+			(unsigned long)t->wait_ts.tv_sec, t->wait_ts.tv_nsec / 1000000,
+			dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
+			str, t->start.tv_usec);
+
+	/*
+	 * Remove transaction from the table, so it could not be found while we deal with it.
+	 * In particular, we will call ->complete() callback, which must ensure that no other thread calls it.
+	 *
+	 * Memory allocation for every transaction is handled by reference counters, but callbacks must ensure,
+	 * that no calls are made after 'final' callback has been invoked. 'Final' means is_trans_destroyed() returns true.
+	 */
+	dnet_trans_remove_nolock(&st->trans_table, t);
+	list_move_tail(&t->trans_list_entry, head);
+	st->timeouts++;
+
+err_out_unlock:
+	pthread_mutex_unlock(&st->trans_lock);
+}
 
-		localtime_r((time_t *)&t->start.tv_sec, &tm);
-		strftime(str, sizeof(str), "%F %R:%S", &tm);
+/*
+ * Complete transactions whose timers have expired.
+ * Transaction is referenced under wheel lock, where it is still in the state's table and thus alive.
+ */
+static void dnet_trans_timers_run_wheel(struct dnet_timer_wheel *w, uint64_t now, struct list_head *head)
+{
+	struct dnet_timer *timer;
+	struct dnet_trans *t;
+
+	while (1) {
+		t = NULL;
+
+		pthread_mutex_lock(&w->lock);
+		timer = dnet_timer_expire_nolock(w, now);
+		if (timer) {
+			t = container_of(timer, struct dnet_trans, timer);
+			dnet_trans_get(t);
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (!t)
+			break;
 
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: trans: %llu TIMEOUT/need-exit: stall-check wait-ts: %ld, need-exit: %d, cmd: %s [%d], started: %s.%06lu\n",
-				dnet_state_dump_addr(st), (unsigned long long)t->trans,
-				(unsigned long)t->wait_ts.tv_sec,
-				st->need_exit,
-				dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
-				str, t->start.tv_usec);
-
-		trans_moved++;
-
-		/*
-		 * Remove transaction from every tree/list, so it could not be accessed and found while we deal with it.
-		 * In particular, we will call ->complete() callback, which must ensure that no other thread calls it.
-		 *
-		 * Memory allocation for every transaction is handled by reference counters, but callbacks must ensure,
-		 * that no calls are made after 'final' callback has been invoked. 'Final' means is_trans_destroyed() returns true.
-		 */
-		dnet_trans_remove_nolock(&st->trans_root, t);
-		list_move(&t->trans_list_entry, head);
+		dnet_trans_timeout(t, head);
+		dnet_trans_put(t);
 	}
-	pthread_mutex_unlock(&st->trans_lock);
+}
 
-	dnet_log(st->n, DNET_LOG_DEBUG, "stall check: state: %s, st: %p, transactions-moved: %d\n", dnet_state_dump_addr(st), st, trans_moved);
+static void dnet_trans_timers_run(struct dnet_node *n)
+{
+	uint64_t now = dnet_timer_now();
+	LIST_HEAD(head);
+	int i;
 
-	return trans_moved;
+	for (i = 0; i < n->io->net_thread_num; ++i)
+		dnet_trans_timers_run_wheel(&n->io->net[i].timers, now, &head);
+
+	dnet_trans_clean_list(&head);
 }
 
 static void dnet_trans_check_stall(struct dnet_net_state *st, struct list_head *head)
 {
-	int trans_timeout = dnet_trans_iterate_move_transaction(st, head);
+	int trans_timeout;
+
+	pthread_mutex_lock(&st->trans_lock);
+	trans_timeout = st->timeouts;
+	st->timeouts = 0;
+	pthread_mutex_unlock(&st->trans_lock);
+
+	/* reset state will not receive replies anymore */
+	if (st->need_exit)
+		trans_timeout += dnet_trans_iterate_move_transaction(st, head);
 
 	if (trans_timeout) {
 		st->stall++;
@@ -380,10 +551,15 @@ static void dnet_check_all_states(struct dnet_node *n)
 	struct dnet_net_state *st, *tmp;
 	struct dnet_group *g, *gtmp;
 	LIST_HEAD(head);
+	int i;
 
 	pthread_mutex_lock(&n->state_lock);
 	list_for_each_entry_safe(g, gtmp, &n->group_list, group_entry) {
 		list_for_each_entry_safe(st, tmp, &g->state_list, state_entry) {
+			/* additional connections are not in route table, their transactions are checked here */
+			for (i = 0; i < st->conn_num; ++i)
+				dnet_trans_check_stall(st->conns[i], &head);
+
 			dnet_trans_check_stall(st, &head);
 		}
 	}
@@ -453,6 +629,7 @@ static void *dnet_reconnect_process(void *data)
 		}
 
 		dnet_discovery(n);
+		dnet_state_conns_check(n, 1);
 		gettimeofday(&tv2, NULL);
 
 		timeout = n->check_timeout - (tv2.tv_sec - tv1.tv_sec);
@@ -462,6 +639,7 @@ static void *dnet_reconnect_process(void *data)
 				break;
 
 			sleep(1);
+			dnet_state_conns_check(n, 0);
 		}
 	}
 
@@ -472,12 +650,39 @@ static void *dnet_reconnect_process(void *data)
 static void *dnet_check_process(void *data)
 {
 	struct dnet_node *n = data;
+	uint64_t now, check = 0;
 
 	dnet_set_name("stall-check");
 
 	while (!n->need_exit) {
-		dnet_check_all_states(n);
-		sleep(1);
+		dnet_trans_timers_run(n);
+
+		now = dnet_timer_now();
+		if (now >= check) {
+			dnet_check_all_states(n);
+			dnet_io_autoscale(n);
+			check = now + 1000;
+		}
+
+		dnet_timer_wait(&n->trans_timers, check);
+	}
+
+	return NULL;
+}
+
+/*
+ * Frees retired route snapshots as soon as readers have left them, retirement wakes us up
+ */
+static void *dnet_reclaim_process(void *data)
+{
+	struct dnet_node *n = data;
+
+	dnet_set_name("reclaim");
+
+	while (!n->need_exit) {
+		/* objects are still read, give readers some time to leave */
+		if (dnet_rcu_reclaim_wait(1000))
+			usleep(1000);
 	}
 
 	return NULL;
@@ -503,8 +708,19 @@ int dnet_check_thread_start(struct dnet_node *n)
 		goto err_out_stop_check_thread;
 	}
 
+	err = pthread_create(&n->reclaim_tid, NULL, dnet_reclaim_process, n);
+	if (err) {
+		err = -err;
+		dnet_log(n, DNET_LOG_ERROR, "Failed to start reclamation thread: err: %d.\n",
+				err);
+		goto err_out_stop_reconnect_thread;
+	}
+
 	return 0;
 
+err_out_stop_reconnect_thread:
+	n->need_exit = 1;
+	pthread_join(n->reconnect_tid, NULL);
 err_out_stop_check_thread:
 	n->need_exit = 1;
 	pthread_join(n->check_tid, NULL);
@@ -514,6 +730,7 @@ err_out_exit:
 
 void dnet_check_thread_stop(struct dnet_node *n)
 {
+	pthread_join(n->reclaim_tid, NULL);
 	pthread_join(n->reconnect_tid, NULL);
 	pthread_join(n->check_tid, NULL);
 	dnet_log(n, DNET_LOG_NOTICE, "Checking thread stopped.\n");
@@ -0,0 +1,1045 @@
+/*
+ * 2014+ Copyright (c) Evgeniy Polyakov <zbr@ioremap.net>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * io_uring network engine.
+ *
+ * Every network thread owns a ring. Receives into state's chunk and sends of its queued
+ * requests are submitted as SQEs, and the same receive/send state machine as in epoll engine
+ * is driven from completions. Every state has at most one receive and one send in flight,
+ * each of them holds a state reference.
+ *
+ * Other threads never touch the ring, they link state into thread's pending list
+ * and wake it up via eventfd, which always has a read in flight.
+ *
+ * Receive chunks are allocated from per-thread arena registered with the kernel,
+ * so pages are not pinned and unpinned for every receive.
+ * File parts of the requests are spliced into per-state pipe and then into socket.
+ *
+ * Listening sockets are polled with POLL_ADD and processed by their ->process() callback.
+ */
+
+#ifdef HAVE_IO_URING_SUPPORT
+
+/* pipe2() and splice flags */
+#define _GNU_SOURCE
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elliptics.h"
+#include "elliptics/interface.h"
+
+/* number of submission queue entries, completion queue is four times larger */
+#define DNET_URING_ENTRIES		1024
+
+/* number of receive chunks in registered arena of every network thread */
+#define DNET_URING_CHUNKS		32
+
+/* maximum number of bytes spliced from file into state's pipe at once */
+#define DNET_URING_SPLICE_SIZE		(64 * 1024)
+
+enum dnet_uring_op_type {
+	DNET_URING_OP_WAKEUP = 1,
+	DNET_URING_OP_RECV,
+	DNET_URING_OP_SEND,
+};
+
+enum dnet_uring_send_step {
+	DNET_URING_SEND_MSG = 0,		/* memory parts are sent with sendmsg */
+	DNET_URING_SEND_SPLICE_IN,		/* file part is spliced into pipe */
+	DNET_URING_SEND_SPLICE_OUT,		/* pipe is spliced into socket */
+};
+
+#define DNET_URING_PENDING_RECV		(1<<0)
+#define DNET_URING_PENDING_SEND		(1<<1)
+
+struct dnet_uring_op {
+	int			type;
+	/* SQE is in flight */
+	int			busy;
+	/* in-flight SQE is POLL_ADD waiting for readiness, operation is resubmitted when it completes */
+	int			poll;
+	struct dnet_net_state	*st;
+};
+
+struct dnet_uring_state {
+	struct dnet_uring_op	recv, send;
+
+	/* protected by ring's lock */
+	int			pending;
+	struct list_head	pending_entry;
+
+	/* network thread has dropped its reference after error */
+	int			dropped;
+
+	int			send_step;
+	struct msghdr		msg;
+	struct iovec		iov[DNET_SEND_IOV_MAX];
+
+	int			pipe[2];
+	/* bytes spliced into pipe and not yet sent to socket */
+	size_t			pipe_size;
+};
+
+struct dnet_uring {
+	int			fd;
+	struct dnet_net_io	*nio;
+
+	unsigned		*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned		sq_entries, sq_local_tail, to_submit;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ring, *cq_ring;
+	size_t			sq_ring_size, cq_ring_size, sqes_size;
+
+	/* number of submitted operations which have not completed yet */
+	unsigned		inflight;
+
+	int			efd;
+	uint64_t		efd_value;
+	struct dnet_uring_op	wakeup;
+
+	pthread_mutex_t		lock;
+	struct list_head	pending;
+
+	/* registered receive chunks, free ones are linked through their first bytes */
+	void			*arena;
+	size_t			arena_size, chunk_size;
+	pthread_mutex_t		arena_lock;
+	void			*arena_free;
+};
+
+static int dnet_uring_enter(struct dnet_uring *u, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	int err;
+
+	err = syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete, flags, arg, argsz);
+	if (err < 0)
+		return -errno;
+
+	return err;
+}
+
+/*
+ * Submit queued SQEs and wait for at least one completion for up to @timeout_ms milliseconds if @wait is set
+ */
+static int dnet_uring_submit(struct dnet_uring *u, int wait, long timeout_ms)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	unsigned flags = 0;
+	int err;
+
+	memset(&arg, 0, sizeof(arg));
+
+	if (wait) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+		arg.ts = (unsigned long)&ts;
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	}
+
+	err = dnet_uring_enter(u, u->to_submit, wait, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+	if (err >= 0) {
+		u->to_submit -= err;
+		err = 0;
+	}
+
+	return err;
+}
+
+static struct io_uring_sqe *dnet_uring_get_sqe(struct dnet_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		dnet_uring_submit(u, 0, 0);
+
+		if (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+			return NULL;
+	}
+
+	idx = u->sq_local_tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	u->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void dnet_uring_queue_sqe(struct dnet_uring *u, struct dnet_uring_op *op)
+{
+	struct io_uring_sqe *sqe = &u->sqes[u->sq_local_tail & *u->sq_mask];
+
+	sqe->user_data = (unsigned long)op;
+
+	op->busy = 1;
+	if (op->st)
+		dnet_state_get(op->st);
+
+	u->inflight++;
+	u->sq_local_tail++;
+	u->to_submit++;
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static int dnet_uring_wakeup_submit(struct dnet_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe(u);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = u->efd;
+	sqe->addr = (unsigned long)&u->efd_value;
+	sqe->len = sizeof(u->efd_value);
+
+	dnet_uring_queue_sqe(u, &u->wakeup);
+	return 0;
+}
+
+/*
+ * Queue cancellation of all operations in flight, its own completion has zero user data
+ */
+static int dnet_uring_cancel_any_queue(struct dnet_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe(u);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+	sqe->user_data = 0;
+
+	u->sq_local_tail++;
+	u->to_submit++;
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * Ring is drained on exit with IORING_ASYNC_CANCEL_ANY which appeared in Linux 5.19,
+ * older kernels reject cancel flags with -EINVAL. Nothing is in flight yet,
+ * so kernel which supports it completes request with -ENOENT.
+ */
+static int dnet_uring_check_cancel_any(struct dnet_uring *u)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int err;
+
+	err = dnet_uring_cancel_any_queue(u);
+	if (err)
+		return err;
+
+	err = dnet_uring_submit(u, 1, 1000);
+	if (err)
+		return err;
+
+	head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return -ETIME;
+
+	cqe = &u->cqes[head & *u->cq_mask];
+	err = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	if (err == -EINVAL)
+		return -ENOSYS;
+	return 0;
+}
+
+static int dnet_uring_poll_submit(struct dnet_uring *u, struct dnet_uring_op *op, int fd, int events)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = dnet_uring_get_sqe(u);
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+
+	op->poll = 1;
+	dnet_uring_queue_sqe(u, op);
+	return 0;
+}
+
+/*
+ * Drop network thread's reference to the state after error, only once
+ */
+static void dnet_uring_state_drop(struct dnet_net_state *st, int err)
+{
+	struct dnet_uring_state *us = st->uring;
+
+	if (us->dropped)
+		return;
+
+	us->dropped = 1;
+	dnet_io_state_drop(st, err);
+}
+
+static void dnet_uring_recv_submit(struct dnet_uring *u, struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct io_uring_sqe *sqe;
+	size_t size;
+	void *buf;
+	int err;
+
+	if (us->recv.busy || us->dropped || st->need_exit || st->rcv_paused)
+		return;
+
+	/* listening sockets are processed by ->process() when they become readable */
+	if (st->process != dnet_state_net_process) {
+		err = dnet_uring_poll_submit(u, &us->recv, st->read_s, POLLIN);
+		goto err_out_check;
+	}
+
+	err = dnet_recv_buffer(st, &buf, &size);
+	if (err)
+		goto err_out_check;
+
+	sqe = dnet_uring_get_sqe(u);
+	if (!sqe) {
+		err = -EBUSY;
+		goto err_out_check;
+	}
+
+	if (size > INT_MAX)
+		size = INT_MAX;
+
+	if ((st->rcv_flags & DNET_IO_CMD) && st->rcv_chunk->arena) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = 0;
+		sqe->off = -1;
+	} else {
+		/* large command's payload is received as a whole without returning partial completions */
+		sqe->opcode = IORING_OP_RECV;
+		if (!(st->rcv_flags & DNET_IO_CMD))
+			sqe->msg_flags = MSG_WAITALL;
+	}
+
+	sqe->fd = st->read_s;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = size;
+
+	dnet_uring_queue_sqe(u, &us->recv);
+	return;
+
+err_out_check:
+	if (err) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to submit receive: %s [%d]\n",
+				dnet_state_dump_addr(st), strerror(-err), err);
+		dnet_uring_state_drop(st, err);
+	}
+}
+
+static void dnet_uring_recv_complete(struct dnet_uring *u, struct dnet_net_state *st, int res)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct epoll_event ev;
+	int err = 0;
+
+	if (us->dropped)
+		return;
+
+	if (us->recv.poll) {
+		us->recv.poll = 0;
+
+		if (res < 0) {
+			err = res;
+			goto err_out_drop;
+		}
+
+		if (st->process != dnet_state_net_process) {
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = st;
+
+			if (dnet_io_process_network_event(u->nio, st, &ev)) {
+				/* state has been reset and its reference dropped */
+				us->dropped = 1;
+				return;
+			}
+		}
+
+		dnet_uring_recv_submit(u, st);
+		return;
+	}
+
+	if (res == -EAGAIN) {
+		err = dnet_uring_poll_submit(u, &us->recv, st->read_s, POLLIN);
+		if (err)
+			goto err_out_drop;
+		return;
+	}
+
+	if (res == -EINTR) {
+		dnet_uring_recv_submit(u, st);
+		return;
+	}
+
+	if (res < 0) {
+		err = res;
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to receive data, socket: %d: %s [%d]\n",
+				dnet_state_dump_addr(st), st->read_s, strerror(-err), err);
+		goto err_out_drop;
+	}
+
+	if (res == 0) {
+		dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has disconnected.\n",
+			dnet_server_convert_dnet_addr(&st->addr));
+		err = -ECONNRESET;
+		goto err_out_drop;
+	}
+
+	err = dnet_recv_received(st, res);
+	if (err)
+		goto err_out_drop;
+
+	if (st->stall >= DNET_DEFAULT_STALL_TRANSACTIONS) {
+		err = -ETIMEDOUT;
+		goto err_out_drop;
+	}
+
+	dnet_uring_recv_submit(u, st);
+	return;
+
+err_out_drop:
+	dnet_uring_state_drop(st, err);
+}
+
+static int dnet_uring_pipe(struct dnet_uring_state *us)
+{
+	int err;
+
+	if (us->pipe[0] >= 0)
+		return 0;
+
+	err = pipe2(us->pipe, O_CLOEXEC);
+	if (err < 0) {
+		us->pipe[0] = us->pipe[1] = -1;
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void dnet_uring_send_submit(struct dnet_uring *u, struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct io_uring_sqe *sqe;
+	struct dnet_io_req *r = NULL;
+	uint64_t offset, size;
+	int num = 0, more = 0, err;
+
+	if (us->send.busy || us->dropped)
+		return;
+
+	if (!us->pipe_size) {
+		pthread_mutex_lock(&st->send_lock);
+		if (!list_empty(&st->send_list)) {
+			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+			num = dnet_send_gather_nolock(st, us->iov, &more);
+		}
+		pthread_mutex_unlock(&st->send_lock);
+
+		if (!r)
+			return;
+	}
+
+	sqe = dnet_uring_get_sqe(u);
+	if (!sqe) {
+		err = -EBUSY;
+		goto err_out_drop;
+	}
+
+	if (us->pipe_size) {
+		sqe->opcode = IORING_OP_SPLICE;
+		sqe->splice_fd_in = us->pipe[0];
+		sqe->splice_off_in = -1;
+		sqe->fd = st->write_s;
+		sqe->off = -1;
+		sqe->len = us->pipe_size;
+
+		us->send_step = DNET_URING_SEND_SPLICE_OUT;
+	} else if (num) {
+		memset(&us->msg, 0, sizeof(struct msghdr));
+		us->msg.msg_iov = us->iov;
+		us->msg.msg_iovlen = num;
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = st->write_s;
+		sqe->addr = (unsigned long)&us->msg;
+		sqe->msg_flags = more ? MSG_MORE : 0;
+
+		us->send_step = DNET_URING_SEND_MSG;
+	} else {
+		/* header and data of the first request have been sent, only file part is left */
+		err = dnet_uring_pipe(us);
+		if (err)
+			goto err_out_drop;
+
+		size = r->fsize - (st->send_offset - r->hsize - r->dsize);
+		offset = r->local_offset + r->fsize - size;
+		if (size > DNET_URING_SPLICE_SIZE)
+			size = DNET_URING_SPLICE_SIZE;
+
+		sqe->opcode = IORING_OP_SPLICE;
+		sqe->splice_fd_in = r->fd;
+		sqe->splice_off_in = offset;
+		sqe->fd = us->pipe[1];
+		sqe->off = -1;
+		sqe->len = size;
+
+		us->send_step = DNET_URING_SEND_SPLICE_IN;
+	}
+
+	dnet_uring_queue_sqe(u, &us->send);
+	return;
+
+err_out_drop:
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to submit send: %s [%d]\n",
+			dnet_state_dump_addr(st), strerror(-err), err);
+	st->need_exit = err;
+	dnet_uring_state_drop(st, err);
+}
+
+static void dnet_uring_send_complete(struct dnet_uring *u, struct dnet_net_state *st, int res)
+{
+	struct dnet_uring_state *us = st->uring;
+	struct dnet_net_io *nio = u->nio;
+	int err;
+
+	if (us->dropped)
+		return;
+
+	if (us->send.poll) {
+		us->send.poll = 0;
+
+		if (res < 0) {
+			err = res;
+			goto err_out_drop;
+		}
+
+		dnet_uring_send_submit(u, st);
+		return;
+	}
+
+	if (res == -EAGAIN) {
+		err = dnet_uring_poll_submit(u, &us->send, st->write_s, POLLOUT);
+		if (err)
+			goto err_out_drop;
+		return;
+	}
+
+	if (res == -EINTR) {
+		dnet_uring_send_submit(u, st);
+		return;
+	}
+
+	if (res < 0) {
+		err = res;
+		goto err_out_drop;
+	}
+
+	if (res == 0) {
+		if (us->send_step == DNET_URING_SEND_SPLICE_IN) {
+			dnet_log(st->n, DNET_LOG_ERROR, "%s: looks like truncated file\n", dnet_state_dump_addr(st));
+			err = -ENODATA;
+		} else {
+			dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.\n",
+					dnet_state_dump_addr(st), st->write_s);
+			err = -ECONNRESET;
+		}
+
+		goto err_out_drop;
+	}
+
+	nio->send_calls++;
+
+	if (us->send_step == DNET_URING_SEND_SPLICE_IN) {
+		us->pipe_size = res;
+	} else {
+		if (us->send_step == DNET_URING_SEND_SPLICE_OUT)
+			us->pipe_size -= res;
+
+		nio->send_bytes += res;
+		dnet_send_advance(st, res);
+	}
+
+	dnet_uring_send_submit(u, st);
+	return;
+
+err_out_drop:
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: failed to send data: %d, setting send need_exit\n",
+			dnet_state_dump_addr(st), err);
+	st->need_exit = err;
+	dnet_uring_state_drop(st, err);
+}
+
+/*
+ * Submit operations for states other threads have asked for
+ */
+static void dnet_uring_process_pending(struct dnet_uring *u)
+{
+	struct dnet_uring_state *us;
+	struct dnet_net_state *st;
+	int pending;
+
+	while (1) {
+		pthread_mutex_lock(&u->lock);
+		if (list_empty(&u->pending)) {
+			pthread_mutex_unlock(&u->lock);
+			break;
+		}
+
+		us = list_first_entry(&u->pending, struct dnet_uring_state, pending_entry);
+		list_del_init(&us->pending_entry);
+
+		pending = us->pending;
+		us->pending = 0;
+		pthread_mutex_unlock(&u->lock);
+
+		st = us->recv.st;
+
+		if (pending & DNET_URING_PENDING_RECV)
+			dnet_uring_recv_submit(u, st);
+		if (pending & DNET_URING_PENDING_SEND)
+			dnet_uring_send_submit(u, st);
+
+		dnet_state_put(st);
+	}
+}
+
+static void dnet_uring_complete(struct dnet_uring *u, struct dnet_uring_op *op, int res)
+{
+	struct dnet_net_state *st = op->st;
+
+	op->busy = 0;
+	u->inflight--;
+
+	switch (op->type) {
+	case DNET_URING_OP_WAKEUP:
+		dnet_uring_process_pending(u);
+
+		if (dnet_uring_wakeup_submit(u)) {
+			dnet_log(u->nio->n, DNET_LOG_ERROR, "Failed to resubmit network thread wakeup\n");
+			u->nio->n->need_exit = -EBUSY;
+		}
+		return;
+	case DNET_URING_OP_RECV:
+		dnet_uring_recv_complete(u, st, res);
+		break;
+	case DNET_URING_OP_SEND:
+		dnet_uring_send_complete(u, st, res);
+		break;
+	}
+
+	/* reference grabbed when operation was submitted */
+	dnet_state_put(st);
+}
+
+void *dnet_uring_process_network(void *data)
+{
+	struct dnet_net_io *nio = data;
+	struct dnet_uring *u = nio->uring;
+	struct dnet_node *n = nio->n;
+	struct io_uring_cqe *cqe;
+	struct dnet_uring_op *op;
+	unsigned head;
+	int err, res, num;
+
+	dnet_set_name("net_pool");
+
+	err = dnet_uring_wakeup_submit(u);
+	if (err) {
+		n->need_exit = err;
+		return &n->need_exit;
+	}
+
+	while (!n->need_exit) {
+		err = dnet_uring_submit(u, 1, 1000);
+		if (err && err != -ETIME && err != -EINTR && err != -EBUSY && err != -EAGAIN) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to wait for io_uring completions: %s [%d]\n",
+					strerror(-err), err);
+			n->need_exit = err;
+			break;
+		}
+
+		num = 0;
+		head = *u->cq_head;
+		while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &u->cqes[head & *u->cq_mask];
+			op = (struct dnet_uring_op *)(unsigned long)cqe->user_data;
+			res = cqe->res;
+
+			__atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+
+			dnet_uring_complete(u, op, res);
+			num++;
+		}
+
+		if (num) {
+			nio->wakeups++;
+			nio->events_total += num;
+		}
+	}
+
+	return &n->need_exit;
+}
+
+int dnet_uring_schedule(struct dnet_net_state *st, int send)
+{
+	struct dnet_uring *u = st->nio->uring;
+	struct dnet_uring_state *us = st->uring;
+	uint64_t one = 1;
+	int wakeup = 0;
+
+	pthread_mutex_lock(&u->lock);
+	if (!us->pending) {
+		/* thread drains the whole list once woken up, so only the first state has to wake it */
+		wakeup = list_empty(&u->pending);
+
+		list_add_tail(&us->pending_entry, &u->pending);
+		dnet_state_get(st);
+	}
+	us->pending |= send ? DNET_URING_PENDING_SEND : DNET_URING_PENDING_RECV;
+	pthread_mutex_unlock(&u->lock);
+
+	if (wakeup && write(u->efd, &one, sizeof(one)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int dnet_uring_state_init(struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us;
+
+	us = malloc(sizeof(struct dnet_uring_state));
+	if (!us)
+		return -ENOMEM;
+
+	memset(us, 0, sizeof(struct dnet_uring_state));
+
+	us->recv.type = DNET_URING_OP_RECV;
+	us->recv.st = st;
+	us->send.type = DNET_URING_OP_SEND;
+	us->send.st = st;
+
+	INIT_LIST_HEAD(&us->pending_entry);
+	us->pipe[0] = us->pipe[1] = -1;
+
+	st->uring = us;
+	return 0;
+}
+
+void dnet_uring_state_destroy(struct dnet_net_state *st)
+{
+	struct dnet_uring_state *us = st->uring;
+
+	if (!us)
+		return;
+
+	if (us->pipe[0] >= 0) {
+		close(us->pipe[0]);
+		close(us->pipe[1]);
+	}
+
+	free(us);
+	st->uring = NULL;
+}
+
+struct dnet_recv_chunk *dnet_uring_chunk_get(struct dnet_uring *u)
+{
+	void *c;
+
+	pthread_mutex_lock(&u->arena_lock);
+	c = u->arena_free;
+	if (c)
+		u->arena_free = *(void **)c;
+	pthread_mutex_unlock(&u->arena_lock);
+
+	return c;
+}
+
+void dnet_uring_chunk_put(struct dnet_uring *u, struct dnet_recv_chunk *c)
+{
+	pthread_mutex_lock(&u->arena_lock);
+	*(void **)c = u->arena_free;
+	u->arena_free = c;
+	pthread_mutex_unlock(&u->arena_lock);
+}
+
+/*
+ * Allocate receive chunks and register them with the ring,
+ * if registration fails (for example because of RLIMIT_MEMLOCK) chunks are allocated with malloc()
+ */
+static void dnet_uring_arena_init(struct dnet_uring *u)
+{
+	struct dnet_node *n = u->nio->n;
+	struct iovec iov;
+	void *c;
+	int err, i;
+
+	u->chunk_size = ALIGN(sizeof(struct dnet_recv_chunk) + DNET_RECV_CHUNK_SIZE, 4096);
+	u->arena_size = u->chunk_size * DNET_URING_CHUNKS;
+
+	u->arena = mmap(NULL, u->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->arena == MAP_FAILED) {
+		u->arena = NULL;
+		return;
+	}
+
+	iov.iov_base = u->arena;
+	iov.iov_len = u->arena_size;
+
+	err = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+	if (err < 0) {
+		dnet_log(n, DNET_LOG_NOTICE, "Failed to register %zu bytes of receive buffers: %s [%d], "
+				"receive chunks will not be registered\n",
+				u->arena_size, strerror(errno), -errno);
+		munmap(u->arena, u->arena_size);
+		u->arena = NULL;
+		return;
+	}
+
+	for (i = DNET_URING_CHUNKS - 1; i >= 0; --i) {
+		c = u->arena + i * u->chunk_size;
+		*(void **)c = u->arena_free;
+		u->arena_free = c;
+	}
+}
+
+int dnet_uring_init(struct dnet_net_io *nio)
+{
+	struct dnet_node *n = nio->n;
+	struct io_uring_params p;
+	struct dnet_uring *u;
+	int err;
+
+	u = malloc(sizeof(struct dnet_uring));
+	if (!u) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(u, 0, sizeof(struct dnet_uring));
+	u->nio = nio;
+	u->wakeup.type = DNET_URING_OP_WAKEUP;
+	INIT_LIST_HEAD(&u->pending);
+
+	/*
+	 * Only network thread submits to the ring and it enters the kernel right after
+	 * processing completions, so there is no need to interrupt it to run completion work
+	 */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+	p.cq_entries = DNET_URING_ENTRIES * 4;
+
+	u->fd = syscall(__NR_io_uring_setup, DNET_URING_ENTRIES, &p);
+	if (u->fd < 0) {
+		err = -errno;
+		/* kernels older than 5.19 do not know setup flags */
+		if (err == -EPERM || err == -EINVAL)
+			err = -ENOSYS;
+		dnet_log(n, DNET_LOG_ERROR, "Failed to setup io_uring: %s [%d]\n", strerror(-err), err);
+		goto err_out_free;
+	}
+
+	/* completions are waited for with timeout, so that thread notices node exit */
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+		err = -ENOSYS;
+		dnet_log(n, DNET_LOG_ERROR, "io_uring does not support required features: 0x%x\n", p.features);
+		goto err_out_close;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED) {
+		err = -errno;
+		goto err_out_unmap_sq;
+	}
+
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		err = -errno;
+		goto err_out_unmap_cq;
+	}
+
+	u->sq_head = u->sq_ring + p.sq_off.head;
+	u->sq_tail = u->sq_ring + p.sq_off.tail;
+	u->sq_mask = u->sq_ring + p.sq_off.ring_mask;
+	u->sq_array = u->sq_ring + p.sq_off.array;
+	u->sq_entries = p.sq_entries;
+	u->sq_local_tail = *u->sq_tail;
+
+	u->cq_head = u->cq_ring + p.cq_off.head;
+	u->cq_tail = u->cq_ring + p.cq_off.tail;
+	u->cq_mask = u->cq_ring + p.cq_off.ring_mask;
+	u->cqes = u->cq_ring + p.cq_off.cqes;
+
+	err = dnet_uring_check_cancel_any(u);
+	if (err) {
+		dnet_log(n, DNET_LOG_ERROR, "io_uring does not support cancellation of all requests: %s [%d]\n",
+				strerror(-err), err);
+		goto err_out_unmap_sqes;
+	}
+
+	u->efd = eventfd(0, EFD_CLOEXEC);
+	if (u->efd < 0) {
+		err = -errno;
+		goto err_out_unmap_sqes;
+	}
+
+	err = pthread_mutex_init(&u->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_close_efd;
+	}
+
+	err = pthread_mutex_init(&u->arena_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_lock;
+	}
+
+	nio->uring = u;
+	dnet_uring_arena_init(u);
+
+	return 0;
+
+err_out_destroy_lock:
+	pthread_mutex_destroy(&u->lock);
+err_out_close_efd:
+	close(u->efd);
+err_out_unmap_sqes:
+	munmap(u->sqes, u->sqes_size);
+err_out_unmap_cq:
+	munmap(u->cq_ring, u->cq_ring_size);
+err_out_unmap_sq:
+	munmap(u->sq_ring, u->sq_ring_size);
+err_out_close:
+	close(u->fd);
+err_out_free:
+	free(u);
+err_out_exit:
+	return err;
+}
+
+/*
+ * Cancel operations which are still in flight after network thread has exited and drop
+ * state references they and pending list hold. States have been already reset by this time,
+ * so their sockets are shut down and their operations complete.
+ */
+static void dnet_uring_drain(struct dnet_uring *u)
+{
+	struct dnet_uring_state *us;
+	struct io_uring_cqe *cqe;
+	struct dnet_uring_op *op;
+	unsigned head;
+	int i;
+
+	while (!list_empty(&u->pending)) {
+		us = list_first_entry(&u->pending, struct dnet_uring_state, pending_entry);
+		list_del_init(&us->pending_entry);
+		us->pending = 0;
+
+		dnet_state_put(us->recv.st);
+	}
+
+	/* support has been checked when ring was set up */
+	dnet_uring_cancel_any_queue(u);
+
+	for (i = 0; i < 10 && u->inflight; ++i) {
+		dnet_uring_submit(u, 1, 100);
+
+		head = *u->cq_head;
+		while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &u->cqes[head & *u->cq_mask];
+			op = (struct dnet_uring_op *)(unsigned long)cqe->user_data;
+
+			__atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+
+			if (!op)
+				continue;
+
+			op->busy = 0;
+			u->inflight--;
+
+			if (op->st)
+				dnet_state_put(op->st);
+		}
+	}
+}
+
+void dnet_uring_destroy(struct dnet_net_io *nio)
+{
+	struct dnet_uring *u = nio->uring;
+
+	if (!u)
+		return;
+
+	dnet_uring_drain(u);
+
+	munmap(u->sqes, u->sqes_size);
+	munmap(u->cq_ring, u->cq_ring_size);
+	munmap(u->sq_ring, u->sq_ring_size);
+	close(u->fd);
+	close(u->efd);
+
+	if (u->arena)
+		munmap(u->arena, u->arena_size);
+
+	pthread_mutex_destroy(&u->arena_lock);
+	pthread_mutex_destroy(&u->lock);
+	free(u);
+
+	nio->uring = NULL;
+}
+
+#endif
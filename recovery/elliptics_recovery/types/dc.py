@@ -128,6 +128,7 @@ def recover((address, )):
     log.debug("Creating direct session: {0}".format(ctx.address))
     local_session = elliptics_create_session(node=local_node,
                                              group=ctx.group_id,
+                                             cflags=ctx.cflags,
                                              )
     local_session.set_direct_id(*ctx.address)
 
@@ -140,6 +141,7 @@ def recover((address, )):
     log.debug("Creating direct session: {0}".format(diff.address))
     remote_session = elliptics_create_session(node=remote_node,
                                               group=diff.address.group_id,
+                                              cflags=ctx.cflags,
                                               )
     remote_session.set_direct_id(*diff.address)
 
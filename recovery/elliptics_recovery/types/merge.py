@@ -148,6 +148,7 @@ def recover(ctx, diff, group, stats):
     log.debug("Creating direct remote session: {0}".format(diff.address))
     remote_session = elliptics_create_session(node=remote_node,
                                               group=group,
+                                              cflags=ctx.cflags,
                                              )
     remote_session.set_direct_id(*diff.address)
 
@@ -156,6 +157,7 @@ def recover(ctx, diff, group, stats):
     log.debug("Creating direct local session: {0}".format(g_ctx.address))
     local_session = elliptics_create_session(node=local_node,
                                              group=group,
+                                             cflags=ctx.cflags,
                                             )
     local_session.set_direct_id(*g_ctx.address)
 